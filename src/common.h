@@ -36,9 +36,12 @@
 #include <murphy/common/list.h>
 #include <murphy/common/mainloop.h>
 #include <murphy/common/hashtbl.h>
+#include <murphy/common/flat-hashtbl.h>
+#include <murphy/common/concurrent-hashtbl.h>
 #include <murphy/common/utils.h>
 #include <murphy/common/file-utils.h>
 #include <murphy/common/msg.h>
 #include <murphy/common/transport.h>
+#include <murphy/common/work.h>
 
 #endif
@@ -0,0 +1,618 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "murphy/common/mm.h"
+#include "murphy/common/list.h"
+#include "murphy/common/hashtbl.h"
+#include "murphy/common/utils.h"
+#include "murphy/common/concurrent-hashtbl.h"
+
+#define MIN_NBUCKET   8
+#define MAX_LOAD      2                 /* grow beyond this load */
+
+/*
+ * Notes:
+ *     Buckets and tables are never modified once published. Writers
+ *     publish modified copies and retire the originals to a list of
+ *     retired items, tagging them with the current epoch. Then they
+ *     bump the epoch. Readers record the epoch in effect when entering
+ *     a read-side section. A retired item can be released once every
+ *     reader is either outside a read-side section, or has entered it
+ *     after the item was retired (thus has a recorded epoch greater than
+ *     the tag of the item). The full memory barriers in between the
+ *     reader recording its epoch and looking at the table, and in
+ *     between the writer publishing and checking the readers, make sure
+ *     that either the writer sees the reader in its read-side section,
+ *     or the reader sees the published copy.
+ */
+
+typedef struct retired_s retired_t;
+
+struct retired_s {                      /* a retired table or bucket */
+    retired_t *next;                    /* next retired item */
+    uint64_t   epoch;                   /* epoch at retirement */
+    int        table;                   /* whether this is a table */
+};
+
+typedef struct {                        /* a hash table entry */
+    void     *key;                      /* key for this entry */
+    void     *obj;                      /* object for this entry */
+    uint32_t  hash;                     /* hash of key */
+} entry_t;
+
+typedef struct {                        /* a hash bucket */
+    retired_t  r;                       /* retirement info */
+    int        kill;                    /* entry to free on release, or -1 */
+    size_t     nentry;                  /* number of entries */
+    entry_t    entries[];               /* the entries */
+} bucket_t;
+
+typedef struct {                        /* a table of buckets */
+    retired_t  r;                       /* retirement info */
+    size_t     nbucket;                 /* number of buckets */
+    bucket_t  *buckets[];               /* the buckets */
+} table_t;
+
+typedef struct {                        /* per-thread reader state */
+    mrp_chtbl_t     *ht;                /* table we're reading */
+    mrp_list_hook_t  hook;              /* to list of readers */
+    uint64_t         epoch;             /* epoch at entry, 0 if not reading */
+    int              nest;              /* read-side section nesting */
+} reader_t;
+
+struct mrp_chtbl_s {
+    table_t            *tbl;            /* current table */
+    size_t              nentry;         /* number of entries */
+    uint64_t            epoch;          /* current epoch */
+    retired_t          *retired;        /* retired items, latest first */
+    pthread_mutex_t     lock;           /* writer lock */
+    pthread_key_t       key;            /* key for per-thread readers */
+    mrp_list_hook_t     readers;        /* per-thread readers */
+    mrp_htbl_comp_fn_t  comp;           /* key comparison function */
+    mrp_htbl_hash_fn_t  hash;           /* key hash function */
+    mrp_htbl_free_fn_t  free;           /* function to free an entry */
+};
+
+
+static table_t *table_alloc(size_t nbucket)
+{
+    table_t *t;
+
+    if ((t = mrp_allocz(sizeof(*t) + nbucket * sizeof(t->buckets[0]))) != NULL)
+        t->nbucket = nbucket;
+
+    return t;
+}
+
+
+static bucket_t *bucket_alloc(size_t nentry)
+{
+    bucket_t *b;
+
+    b = mrp_allocz(sizeof(*b) + nentry * sizeof(b->entries[0]));
+
+    if (b != NULL) {
+        b->nentry = nentry;
+        b->kill   = -1;
+    }
+
+    return b;
+}
+
+
+static void release(mrp_chtbl_t *ht, retired_t *r)
+{
+    bucket_t *b;
+    entry_t  *e;
+
+    if (!r->table) {
+        b = (bucket_t *)r;
+
+        if (b->kill >= 0 && ht->free != NULL) {
+            e = b->entries + b->kill;
+            ht->free(e->key, e->obj);
+        }
+    }
+
+    mrp_free(r);
+}
+
+
+/*
+ * readers
+ */
+
+static void reader_release(void *data)
+{
+    reader_t    *r  = data;
+    mrp_chtbl_t *ht = r->ht;
+
+    pthread_mutex_lock(&ht->lock);
+    mrp_list_delete(&r->hook);
+    pthread_mutex_unlock(&ht->lock);
+
+    mrp_free(r);
+}
+
+
+static reader_t *reader_get(mrp_chtbl_t *ht)
+{
+    reader_t *r;
+
+    if (MRP_LIKELY((r = pthread_getspecific(ht->key)) != NULL))
+        return r;
+
+    if ((r = mrp_allocz(sizeof(*r))) == NULL)
+        return NULL;
+
+    r->ht = ht;
+    mrp_list_init(&r->hook);
+
+    if (pthread_setspecific(ht->key, r) != 0) {
+        mrp_free(r);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&ht->lock);
+    mrp_list_append(&ht->readers, &r->hook);
+    pthread_mutex_unlock(&ht->lock);
+
+    return r;
+}
+
+
+int mrp_chtbl_read_lock(mrp_chtbl_t *ht)
+{
+    reader_t *r;
+    uint64_t  epoch;
+
+    if ((r = reader_get(ht)) == NULL)
+        return FALSE;
+
+    if (r->nest++ == 0) {
+        epoch = __atomic_load_n(&ht->epoch, __ATOMIC_RELAXED);
+        __atomic_store_n(&r->epoch, epoch, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    return TRUE;
+}
+
+
+void mrp_chtbl_read_unlock(mrp_chtbl_t *ht)
+{
+    reader_t *r = pthread_getspecific(ht->key);
+
+    if (r == NULL || r->nest <= 0)
+        return;
+
+    if (--r->nest == 0)
+        __atomic_store_n(&r->epoch, 0, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * writers
+ */
+
+static void retire(mrp_chtbl_t *ht, retired_t *r, int table)
+{
+    r->epoch    = ht->epoch;
+    r->table    = table;
+    r->next     = ht->retired;
+    ht->retired = r;
+}
+
+
+static void reclaim(mrp_chtbl_t *ht)
+{
+    mrp_list_hook_t *p, *n;
+    reader_t        *reader;
+    retired_t       *r, **rp;
+    uint64_t         min, epoch;
+
+    /* start a new epoch, then find the oldest one still being read */
+    __atomic_add_fetch(&ht->epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    min = UINT64_MAX;
+    mrp_list_foreach(&ht->readers, p, n) {
+        reader = mrp_list_entry(p, typeof(*reader), hook);
+        epoch  = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+
+        if (epoch != 0 && epoch < min)
+            min = epoch;
+    }
+
+    /* release everything retired before that, the list is latest first */
+    for (rp = &ht->retired; *rp != NULL; rp = &(*rp)->next)
+        if ((*rp)->epoch < min)
+            break;
+
+    r   = *rp;
+    *rp = NULL;
+
+    while (r != NULL) {
+        retired_t *next = r->next;
+        release(ht, r);
+        r = next;
+    }
+}
+
+
+static void publish(void **ptr, void *value)
+{
+    __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+}
+
+
+static int grow(mrp_chtbl_t *ht)
+{
+    table_t  *old = ht->tbl, *t;
+    bucket_t *b, *nb;
+    size_t   *cnt, i, j, idx;
+
+    if ((t = table_alloc(2 * old->nbucket)) == NULL)
+        return FALSE;
+
+    if ((cnt = mrp_allocz(t->nbucket * sizeof(*cnt))) == NULL)
+        goto fail;
+
+    for (i = 0; i < old->nbucket; i++)
+        if ((b = old->buckets[i]) != NULL)
+            for (j = 0; j < b->nentry; j++)
+                cnt[b->entries[j].hash & (t->nbucket - 1)]++;
+
+    for (i = 0; i < t->nbucket; i++) {
+        if (cnt[i] && (t->buckets[i] = bucket_alloc(cnt[i])) == NULL)
+            goto fail;
+        cnt[i] = 0;
+    }
+
+    for (i = 0; i < old->nbucket; i++) {
+        if ((b = old->buckets[i]) == NULL)
+            continue;
+
+        for (j = 0; j < b->nentry; j++) {
+            idx = b->entries[j].hash & (t->nbucket - 1);
+            nb  = t->buckets[idx];
+            nb->entries[cnt[idx]++] = b->entries[j];
+        }
+    }
+
+    mrp_free(cnt);
+
+    publish((void **)&ht->tbl, t);
+
+    for (i = 0; i < old->nbucket; i++)
+        if ((b = old->buckets[i]) != NULL)
+            retire(ht, &b->r, FALSE);
+
+    retire(ht, &old->r, TRUE);
+
+    return TRUE;
+
+ fail:
+    for (i = 0; i < t->nbucket; i++)
+        mrp_free(t->buckets[i]);
+    mrp_free(t);
+    mrp_free(cnt);
+
+    return FALSE;
+}
+
+
+int mrp_chtbl_insert(mrp_chtbl_t *ht, void *key, void *object)
+{
+    uint32_t   hash = ht->hash(key);
+    table_t   *t;
+    bucket_t  *b, *nb;
+    entry_t   *e;
+    size_t     idx, n;
+
+    pthread_mutex_lock(&ht->lock);
+
+    /* if we can't grow, just keep on using the current table */
+    if (ht->nentry >= MAX_LOAD * ht->tbl->nbucket)
+        grow(ht);
+
+    t   = ht->tbl;
+    idx = hash & (t->nbucket - 1);
+    b   = t->buckets[idx];
+    n   = b ? b->nentry : 0;
+
+    if ((nb = bucket_alloc(n + 1)) == NULL) {
+        pthread_mutex_unlock(&ht->lock);
+        return FALSE;
+    }
+
+    if (n > 0)
+        memcpy(nb->entries, b->entries, n * sizeof(b->entries[0]));
+
+    e = nb->entries + n;
+    e->key  = key;
+    e->obj  = object;
+    e->hash = hash;
+
+    publish((void **)&t->buckets[idx], nb);
+    ht->nentry++;
+
+    if (b != NULL)
+        retire(ht, &b->r, FALSE);
+
+    reclaim(ht);
+
+    pthread_mutex_unlock(&ht->lock);
+
+    return TRUE;
+}
+
+
+static void *remove_entry(mrp_chtbl_t *ht, void *key, void *object, int free)
+{
+    uint32_t   hash = ht->hash(key);
+    table_t   *t;
+    bucket_t  *b, *nb;
+    entry_t   *e;
+    size_t     idx, i;
+    void      *obj;
+
+    /*
+     * Remove the first entry matching @key, and if @object is given,
+     * also matching @object. Copy all other entries of the bucket to
+     * a new one (or drop the bucket altogether if it becomes empty).
+     */
+
+    pthread_mutex_lock(&ht->lock);
+
+    t   = ht->tbl;
+    idx = hash & (t->nbucket - 1);
+    b   = t->buckets[idx];
+    obj = NULL;
+
+    if (b == NULL)
+        goto out;
+
+    for (i = 0, e = b->entries; i < b->nentry; i++, e++)
+        if (e->hash == hash && !ht->comp(e->key, key) &&
+            (object == NULL || e->obj == object))
+            break;
+
+    if (i >= b->nentry)
+        goto out;
+
+    if (b->nentry > 1) {
+        if ((nb = bucket_alloc(b->nentry - 1)) == NULL)
+            goto out;
+
+        memcpy(nb->entries, b->entries, i * sizeof(b->entries[0]));
+        memcpy(nb->entries + i, b->entries + i + 1,
+               (b->nentry - i - 1) * sizeof(b->entries[0]));
+    }
+    else
+        nb = NULL;
+
+    publish((void **)&t->buckets[idx], nb);
+    ht->nentry--;
+
+    obj = e->obj;
+
+    /* the removed entry is freed once nobody sees the bucket any more */
+    if (free)
+        b->kill = i;
+
+    retire(ht, &b->r, FALSE);
+    reclaim(ht);
+
+ out:
+    pthread_mutex_unlock(&ht->lock);
+
+    return obj;
+}
+
+
+void *mrp_chtbl_remove(mrp_chtbl_t *ht, void *key, int free)
+{
+    return remove_entry(ht, key, NULL, free);
+}
+
+
+/*
+ * lookup and iteration
+ */
+
+void *mrp_chtbl_lookup(mrp_chtbl_t *ht, void *key)
+{
+    uint32_t  hash = ht->hash(key);
+    table_t  *t;
+    bucket_t *b;
+    entry_t  *e;
+    void     *obj;
+    size_t    i;
+
+    if (!mrp_chtbl_read_lock(ht))
+        return NULL;
+
+    t   = __atomic_load_n(&ht->tbl, __ATOMIC_ACQUIRE);
+    b   = __atomic_load_n(&t->buckets[hash & (t->nbucket - 1)],
+                          __ATOMIC_ACQUIRE);
+    obj = NULL;
+
+    if (b != NULL) {
+        for (i = 0, e = b->entries; i < b->nentry; i++, e++) {
+            if (e->hash == hash && !ht->comp(e->key, key)) {
+                obj = e->obj;
+                break;
+            }
+        }
+    }
+
+    mrp_chtbl_read_unlock(ht);
+
+    return obj;
+}
+
+
+int mrp_chtbl_foreach(mrp_chtbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
+{
+    table_t  *t;
+    bucket_t *b;
+    entry_t  *e;
+    size_t    i, j;
+    int       verdict;
+
+    if (!mrp_chtbl_read_lock(ht))
+        return FALSE;
+
+    t = __atomic_load_n(&ht->tbl, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < t->nbucket; i++) {
+        if ((b = __atomic_load_n(&t->buckets[i], __ATOMIC_ACQUIRE)) == NULL)
+            continue;
+
+        for (j = 0, e = b->entries; j < b->nentry; j++, e++) {
+            verdict = cb(e->key, e->obj, user_data);
+
+            if (verdict & MRP_HTBL_ITER_UNHASH)
+                remove_entry(ht, e->key, e->obj,
+                             (verdict & MRP_HTBL_ITER_DELETE) ==
+                             MRP_HTBL_ITER_DELETE);
+
+            if (!(verdict & MRP_HTBL_ITER_MORE))
+                goto out;
+        }
+    }
+
+ out:
+    mrp_chtbl_read_unlock(ht);
+
+    return TRUE;
+}
+
+
+/*
+ * creation and destruction
+ */
+
+mrp_chtbl_t *mrp_chtbl_create(mrp_htbl_config_t *cfg)
+{
+    mrp_chtbl_t        *ht;
+    mrp_htbl_hash_fn_t  hash;
+    size_t              nbucket, n;
+
+    hash = mrp_htbl_config_hash(cfg);
+
+    if (!cfg->comp || !hash)
+        return NULL;
+
+    if ((ht = mrp_allocz(sizeof(*ht))) == NULL)
+        return NULL;
+
+    if (cfg->nbucket != 0)
+        nbucket = cfg->nbucket;
+    else
+        nbucket = cfg->nentry / MAX_LOAD;
+
+    for (n = MIN_NBUCKET; n < nbucket; n <<= 1)
+        ;
+
+    if ((ht->tbl = table_alloc(n)) == NULL)
+        goto fail;
+
+    if (pthread_key_create(&ht->key, reader_release) != 0)
+        goto fail;
+
+    pthread_mutex_init(&ht->lock, NULL);
+    mrp_list_init(&ht->readers);
+
+    ht->epoch = 1;
+    ht->comp  = cfg->comp;
+    ht->hash  = hash;
+    ht->free  = cfg->free;
+
+    return ht;
+
+ fail:
+    mrp_free(ht->tbl);
+    mrp_free(ht);
+
+    return NULL;
+}
+
+
+void mrp_chtbl_destroy(mrp_chtbl_t *ht, int free)
+{
+    mrp_list_hook_t *p, *n;
+    reader_t        *reader;
+    retired_t       *r, *next;
+    bucket_t        *b;
+    size_t           i, j;
+
+    if (ht == NULL)
+        return;
+
+    /*
+     * Notes:
+     *     We assume that nobody is using the table any more while it
+     *     is being destroyed, so we can release everything right away.
+     */
+
+    pthread_key_delete(ht->key);
+
+    mrp_list_foreach(&ht->readers, p, n) {
+        reader = mrp_list_entry(p, typeof(*reader), hook);
+        mrp_list_delete(&reader->hook);
+        mrp_free(reader);
+    }
+
+    for (r = ht->retired; r != NULL; r = next) {
+        next = r->next;
+        release(ht, r);
+    }
+
+    for (i = 0; i < ht->tbl->nbucket; i++) {
+        if ((b = ht->tbl->buckets[i]) == NULL)
+            continue;
+
+        if (free && ht->free != NULL)
+            for (j = 0; j < b->nentry; j++)
+                ht->free(b->entries[j].key, b->entries[j].obj);
+
+        mrp_free(b);
+    }
+
+    mrp_free(ht->tbl);
+
+    pthread_mutex_destroy(&ht->lock);
+    mrp_free(ht);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_CONCURRENT_HASHTBL_H__
+#define __MURPHY_CONCURRENT_HASHTBL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/hashtbl.h>
+
+MRP_CDECL_BEGIN
+
+/*
+ * read-mostly concurrent hash tables
+ *
+ * Concurrent hash tables can be looked up from any number of threads
+ * without locking, while being modified from other threads. Writers
+ * are serialized using a lock. Instead of modifying a hash bucket in
+ * place, writers publish a modified copy of it, and keep the original
+ * around until every reader that might still be looking at it is done.
+ * Removed entries are freed likewise, once no reader can see them any
+ * more.
+ *
+ * Readers are tracked using epochs. A lookup marks the calling thread
+ * as reading for its duration. To keep using the object found by a
+ * lookup, or to look up several entries consistently, enclose the
+ * lookups and the use of the objects in mrp_chtbl_read_lock() and
+ * mrp_chtbl_read_unlock(). Read-side sections nest and must be short.
+ * They may modify the table, but must not block waiting for another
+ * thread which modifies it.
+ *
+ * Concurrent hash tables take the same configuration and callbacks as
+ * mrp_htbl_t. Iteration takes a snapshot of the table, so callbacks can
+ * freely modify the table while being iterated over.
+ */
+
+typedef struct mrp_chtbl_s mrp_chtbl_t;
+
+/** Create a new concurrent hash table with the given configuration. */
+mrp_chtbl_t *mrp_chtbl_create(mrp_htbl_config_t *cfg);
+
+/** Destroy a table, free all entries unless @free is FALSE. No readers. */
+void mrp_chtbl_destroy(mrp_chtbl_t *ht, int free);
+
+/** Insert the given @key/@object pair to the hash table. */
+int mrp_chtbl_insert(mrp_chtbl_t *ht, void *key, void *object);
+
+/** Remove and return the object for @key, also free unless @free is FALSE. */
+void *mrp_chtbl_remove(mrp_chtbl_t *ht, void *key, int free);
+
+/** Look up the object corresponding to @key. */
+void *mrp_chtbl_lookup(mrp_chtbl_t *ht, void *key);
+
+/** Iterate over a snapshot of all entries of a concurrent hash table. */
+int mrp_chtbl_foreach(mrp_chtbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data);
+
+/** Enter a read-side section, keeping looked up objects alive. */
+int mrp_chtbl_read_lock(mrp_chtbl_t *ht);
+
+/** Leave a read-side section. */
+void mrp_chtbl_read_unlock(mrp_chtbl_t *ht);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_CONCURRENT_HASHTBL_H__ */
@@ -910,6 +910,9 @@ static DBusMessage *msg_encode(const char *sender_id, mrp_msg_t *msg)
     uint16_t         u16;
     int16_t          s16;
 
+    if (!mrp_msg_materialize(msg))
+        return NULL;
+
     m = dbus_message_new(DBUS_MESSAGE_TYPE_METHOD_CALL);
 
     if (m == NULL)
@@ -60,6 +60,10 @@ typedef struct {
     void           *ibuf;                /* input buffer */
     size_t          isize;               /* input buffer size */
     size_t          idata;               /* amount of input data */
+    mrp_io_req_t   *ireq;                /* pending recvmsg, if native I/O */
+    struct msghdr   imsg;                /* message header for ireq */
+    struct iovec    iiov;                /* I/O vector for ireq */
+    mrp_sockaddr_t  iaddr;               /* peer address for ireq */
 } dgrm_t;
 
 
@@ -67,6 +71,7 @@ static void dgrm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
                         mrp_io_event_t events, void *user_data);
 static int dgrm_disconnect(mrp_transport_t *mu);
 static int open_socket(dgrm_t *u, int family);
+static int watch_socket(dgrm_t *u);
 
 
 /*
@@ -261,7 +266,6 @@ static int dgrm_createfrom(mrp_transport_t *mu, void *conn)
 {
     dgrm_t         *u = (dgrm_t *)mu;
     int             on;
-    mrp_io_event_t  events;
 
     u->sock = *(int *)conn;
 
@@ -275,10 +279,7 @@ static int dgrm_createfrom(mrp_transport_t *mu, void *conn)
             fcntl(u->sock, F_SETFL, O_NONBLOCK, on);
         }
 
-        events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
-        u->iow = mrp_add_io_watch(u->ml, u->sock, events, dgrm_recv_cb, u);
-
-        if (u->iow != NULL)
+        if (watch_socket(u))
             return TRUE;
     }
 
@@ -316,8 +317,15 @@ static void dgrm_close(mrp_transport_t *mu)
 
     mrp_del_io_watch(u->iow);
     u->iow = NULL;
+    mrp_io_cancel(u->ireq);
+    u->ireq = NULL;
 
-    mrp_free(u->ibuf);
+    if (mu->rxbuf != NULL) {             /* closed while passing on input */
+        mrp_msg_buffer_unref(mu->rxbuf);
+        mu->rxbuf = NULL;
+    }
+    else
+        mrp_free(u->ibuf);
     u->ibuf  = NULL;
     u->isize = 0;
     u->idata = 0;
@@ -329,6 +337,31 @@ static void dgrm_close(mrp_transport_t *mu)
 }
 
 
+static int reclaim_input(dgrm_t *u)
+{
+    mrp_transport_t  *mu    = (mrp_transport_t *)u;
+    mrp_msg_buffer_t *rxbuf = mu->rxbuf;
+
+    /*
+     * Take back our input buffer after passing on a message in view mode.
+     * If the message is still alive, it owns the buffer now and we switch
+     * to a new one.
+     */
+
+    mu->rxbuf = NULL;
+
+    if (mrp_msg_buffer_reclaim(rxbuf))
+        return TRUE;
+
+    if ((u->ibuf = mrp_allocz(u->isize)) == NULL) {
+        u->isize = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
 static void dgrm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
                          mrp_io_event_t events, void *user_data)
 {
@@ -339,82 +372,249 @@ static void dgrm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
     uint32_t         size;
     ssize_t          n;
     void            *data;
-    int              old, error;
+    unsigned int     budget, cnt;
+    int              old, error, flags;
 
     MRP_UNUSED(ml);
-    MRP_UNUSED(w);
+
+    /*
+     * Notes: We keep receiving datagrams until we run out of them or
+     *     the budget of the watch is used up. Only the first receive is
+     *     allowed to block (if the socket is in blocking mode), since
+     *     that is the one we were notified about.
+     */
+
+    budget = mrp_get_io_watch_budget(w);
 
     if (events & MRP_IO_EVENT_IN) {
-        if (u->idata == u->isize) {
-            if (u->isize != 0) {
-                old      = u->isize;
-                u->isize *= 2;
-            }
-            else {
-                old      = 0;
-                u->isize = DEFAULT_SIZE;
+        for (cnt = 0, flags = 0; budget == 0 || cnt < budget;
+             cnt++, flags = MSG_DONTWAIT) {
+            if (u->idata == u->isize) {
+                if (u->isize != 0) {
+                    old      = u->isize;
+                    u->isize *= 2;
+                }
+                else {
+                    old      = 0;
+                    u->isize = DEFAULT_SIZE;
+                }
+                if (!mrp_reallocz(u->ibuf, old, u->isize)) {
+                    error = ENOMEM;
+                    goto fatal_error;
+                }
             }
-            if (!mrp_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
-            fatal_error:
-            closed:
-                dgrm_disconnect(mu);
 
-                if (u->evt.closed != NULL)
-                    MRP_TRANSPORT_BUSY(mu, {
-                            mu->evt.closed(mu, error, mu->user_data);
-                        });
+            n = recv(fd, &size, sizeof(size), MSG_PEEK | flags);
+            u->nread++;
 
-                u->check_destroy(mu);
-                return;
+            if (n < 0 && cnt > 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            if (n != sizeof(size)) {
+                error = EIO;
+                goto fatal_error;
             }
-        }
 
-        if (recv(fd, &size, sizeof(size), MSG_PEEK) != sizeof(size)) {
-            error = EIO;
-            goto fatal_error;
-        }
+            size = ntohl(size);
 
-        size = ntohl(size);
+            if (u->isize < size + sizeof(size)) {
+                old      = u->isize;
+                u->isize = size + sizeof(size);
+
+                if (!mrp_reallocz(u->ibuf, old, u->isize)) {
+                    error = ENOMEM;
+                    goto fatal_error;
+                }
+            }
 
-        if (u->isize < size + sizeof(size)) {
-            old      = u->isize;
-            u->isize = size + sizeof(size);
+            addrlen = sizeof(addr);
+            n = recvfrom(fd, u->ibuf, size + sizeof(size), flags,
+                         &addr.any, &addrlen);
+            u->nread++;
 
-            if (!mrp_reallocz(u->ibuf, old, u->isize)) {
-                error = ENOMEM;
+            if (n != (ssize_t)(size + sizeof(size))) {
+                error = n < 0 ? EIO : EPROTO;
                 goto fatal_error;
             }
-        }
 
-        addrlen = sizeof(addr);
-        n = recvfrom(fd, u->ibuf, size + sizeof(size), 0, &addr.any, &addrlen);
+            if (MRP_TRANSPORT_ZEROCOPY_MSG(mu))
+                mu->rxbuf = mrp_msg_buffer_create(u->ibuf);
 
-        if (n != (ssize_t)(size + sizeof(size))) {
-            error = n < 0 ? EIO : EPROTO;
-            goto fatal_error;
-        }
+            data  = u->ibuf + sizeof(size);
+            error = mu->recv_data(mu, data, size, &addr, addrlen);
 
-        data  = u->ibuf + sizeof(size);
-        error = mu->recv_data(mu, data, size, &addr, addrlen);
+            if (mu->rxbuf != NULL && !reclaim_input(u))
+                error = ENOMEM;
 
-        if (error)
-            goto fatal_error;
+            if (error)
+                goto fatal_error;
+
+            if (u->check_destroy(mu))
+                return;
 
-        if (u->check_destroy(mu))
-            return;
+            if (u->iow != w)                     /* closed by the callback */
+                return;
+        }
     }
 
     if (events & MRP_IO_EVENT_HUP) {
         error = 0;
         goto closed;
     }
+
+    return;
+
+ fatal_error:
+ closed:
+    dgrm_disconnect(mu);
+
+    if (u->evt.closed != NULL)
+        MRP_TRANSPORT_BUSY(mu, {
+                mu->evt.closed(mu, error, mu->user_data);
+            });
+
+    u->check_destroy(mu);
 }
 
 
-static int open_socket(dgrm_t *u, int family)
+static void dgrm_recv_done(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                           ssize_t result, void *user_data);
+
+static int dgrm_recv_start(dgrm_t *u)
+{
+    if (u->isize == 0) {
+        if ((u->ibuf = mrp_allocz(DEFAULT_SIZE)) == NULL)
+            return FALSE;
+
+        u->isize = DEFAULT_SIZE;
+    }
+
+    mrp_clear(&u->imsg);
+    u->iiov.iov_base     = u->ibuf;
+    u->iiov.iov_len      = u->isize;
+    u->imsg.msg_name     = &u->iaddr;
+    u->imsg.msg_namelen  = sizeof(u->iaddr);
+    u->imsg.msg_iov      = &u->iiov;
+    u->imsg.msg_iovlen   = 1;
+
+    u->ireq = mrp_io_recvmsg(u->ml, u->sock, &u->imsg, MSG_TRUNC,
+                             dgrm_recv_done, u);
+
+    return u->ireq != NULL;
+}
+
+
+static void dgrm_recv_done(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                           ssize_t result, void *user_data)
+{
+    dgrm_t          *u  = (dgrm_t *)user_data;
+    mrp_transport_t *mu = (mrp_transport_t *)u;
+    uint32_t         size;
+    void            *data;
+    int              old, error;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(req);
+
+    u->ireq = NULL;
+
+    if (result < 0) {
+        if (result == -EAGAIN || result == -EINTR)
+            goto restart;
+
+        error = EIO;
+        goto fatal_error;
+    }
+
+    /*
+     * Notes: With MSG_TRUNC we get the real size of the datagram. We
+     *        have no means to peek at the size before receiving, so if
+     *        the datagram did not fit, it is lost. We log an error and
+     *        grow the buffer so that we won't drop the next one.
+     */
+
+    if ((size_t)result > u->isize) {
+        mrp_log_error("Dropped truncated datagram of %zd bytes.", result);
+
+        old      = u->isize;
+        u->isize = result;
+
+        if (!mrp_reallocz(u->ibuf, old, u->isize)) {
+            u->isize = 0;
+            error    = ENOMEM;
+            goto fatal_error;
+        }
+
+        goto restart;
+    }
+
+    if (result < (ssize_t)sizeof(size)) {
+        error = EPROTO;
+        goto fatal_error;
+    }
+
+    size = ntohl(*(uint32_t *)u->ibuf);
+
+    if (result != (ssize_t)(size + sizeof(size))) {
+        error = EPROTO;
+        goto fatal_error;
+    }
+
+    if (MRP_TRANSPORT_ZEROCOPY_MSG(mu))
+        mu->rxbuf = mrp_msg_buffer_create(u->ibuf);
+
+    data  = u->ibuf + sizeof(size);
+    error = mu->recv_data(mu, data, size, &u->iaddr, u->imsg.msg_namelen);
+
+    if (mu->rxbuf != NULL && !reclaim_input(u))
+        error = ENOMEM;
+
+    if (error)
+        goto fatal_error;
+
+    if (u->check_destroy(mu))
+        return;
+
+ restart:
+    if (u->sock >= 0 && dgrm_recv_start(u))
+        return;
+
+    error = ENOMEM;
+
+ fatal_error:
+    dgrm_disconnect(mu);
+
+    if (u->evt.closed != NULL)
+        MRP_TRANSPORT_BUSY(mu, {
+                mu->evt.closed(mu, error, mu->user_data);
+            });
+
+    u->check_destroy(mu);
+}
+
+
+static int watch_socket(dgrm_t *u)
 {
     mrp_io_event_t events;
+
+    /*
+     * Notes: With native completion-based I/O (io_uring) we keep a
+     *        recvmsg request pending on the socket instead of watching
+     *        it for readiness, peeking at the size and then receiving.
+     */
+
+    if (mrp_io_req_native(u->ml))
+        return dgrm_recv_start(u);
+
+    events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
+    u->iow = mrp_add_io_watch(u->ml, u->sock, events, dgrm_recv_cb, u);
+
+    return u->iow != NULL;
+}
+
+
+static int open_socket(dgrm_t *u, int family)
+{
     int            on;
     long           nb;
 
@@ -434,10 +634,7 @@ static int open_socket(dgrm_t *u, int family)
             fcntl(u->sock, F_SETFL, O_CLOEXEC, on);
         }
 
-        events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
-        u->iow = mrp_add_io_watch(u->ml, u->sock, events, dgrm_recv_cb, u);
-
-        if (u->iow != NULL)
+        if (watch_socket(u))
             return TRUE;
         else {
             close(u->sock);
@@ -512,6 +709,7 @@ static int dgrm_send(mrp_transport_t *mu, mrp_msg_t *msg)
             iov[1].iov_len  = size;
 
             n = writev(u->sock, iov, 2);
+            u->nwrite++;
             mrp_free(buf);
 
             if (n == (ssize_t)(size + sizeof(len)))
@@ -564,6 +762,7 @@ static int dgrm_sendto(mrp_transport_t *mu, mrp_msg_t *msg,
         hdr.msg_flags      = 0;
 
         n = sendmsg(u->sock, &hdr, 0);
+        u->nwrite++;
         mrp_free(buf);
 
         if (n == (ssize_t)(size + sizeof(len)))
@@ -587,6 +786,7 @@ static int dgrm_sendraw(mrp_transport_t *mu, void *data, size_t size)
 
     if (u->connected) {
         n = write(u->sock, data, size);
+        u->nwrite++;
 
         if (n == (ssize_t)size)
             return TRUE;
@@ -615,6 +815,7 @@ static int dgrm_sendrawto(mrp_transport_t *mu, void *data, size_t size,
     }
 
     n = sendto(u->sock, data, size, 0, &addr->any, addrlen);
+    u->nwrite++;
 
     if (n == (ssize_t)size)
         return TRUE;
@@ -662,6 +863,7 @@ static int senddatato(mrp_transport_t *mu, void *data, uint16_t tag,
                 n = send(u->sock, buf, len + sizeof(*lenp), 0);
             else
                 n = sendto(u->sock, buf, len + sizeof(*lenp), 0, &addr->any, addrlen);
+            u->nwrite++;
 
             mrp_free(buf);
 
@@ -0,0 +1,509 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/types.h>
+#ifdef __SSE2__
+#    include <emmintrin.h>
+#endif
+
+#include "murphy/common/mm.h"
+#include "murphy/common/hashtbl.h"
+#include "murphy/common/utils.h"
+#include "murphy/common/flat-hashtbl.h"
+
+#define GROUP_SIZE   16                 /* slots per probed group */
+#define MIN_NSLOT    GROUP_SIZE         /* minimum number of slots */
+#define MAX_LOAD(n)  ((n) - (n) / 8)    /* max. entries for n slots */
+
+#define CTRL_EMPTY   ((int8_t)0x80)     /* empty slot */
+#define CTRL_DELETED ((int8_t)0xfe)     /* deleted slot (tombstone) */
+
+typedef struct {                        /* a hash table slot */
+    void     *key;                      /* key for this entry */
+    void     *obj;                      /* object for this entry */
+    uint32_t  hash;                     /* (mixed) hash of key */
+} slot_t;
+
+typedef struct {                        /* iterator state */
+    size_t idx;                         /* slot being iterated */
+    int    verdict;                     /* remove-from-cb verdict */
+} iter_t;
+
+struct mrp_fhtbl_s {
+    int8_t             *ctrl;           /* slot control bytes */
+    slot_t             *slots;          /* hash table slots */
+    size_t              nslot;          /* this many of them */
+    size_t              nentry;         /* number of entries */
+    size_t              ngrowth;        /* empty slots we can still fill */
+    mrp_htbl_comp_fn_t  comp;           /* key comparison function */
+    mrp_htbl_hash_fn_t  hash;           /* key hash function */
+    mrp_htbl_free_fn_t  free;           /* function to free an entry */
+    iter_t             *iter;           /* active iterator state */
+};
+
+
+/*
+ * control bytes
+ *
+ * A control byte of a slot in use holds the 7 most significant bits of
+ * the hash of the key (thus has its MSB clear). Empty and deleted slots
+ * have control bytes with the MSB set. We match a group of 16 control
+ * bytes at a time, getting a 16-bit mask of the matching slots.
+ */
+
+static inline int8_t ctrl_hash(uint32_t hash)
+{
+    return (int8_t)(hash >> 25);
+}
+
+
+#ifdef __SSE2__
+
+static inline uint32_t group_match(const int8_t *ctrl, int8_t c)
+{
+    __m128i grp = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(grp, _mm_set1_epi8(c)));
+}
+
+
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+    __m128i grp = _mm_loadu_si128((const __m128i *)ctrl);
+
+    return _mm_movemask_epi8(grp);
+}
+
+#else /* !__SSE2__ */
+
+static inline uint32_t group_match(const int8_t *ctrl, int8_t c)
+{
+    uint32_t mask;
+    int      i;
+
+    for (i = 0, mask = 0; i < GROUP_SIZE; i++)
+        if (ctrl[i] == c)
+            mask |= (1 << i);
+
+    return mask;
+}
+
+
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+    uint32_t mask;
+    int      i;
+
+    for (i = 0, mask = 0; i < GROUP_SIZE; i++)
+        if (ctrl[i] < 0)
+            mask |= (1 << i);
+
+    return mask;
+}
+
+#endif /* !__SSE2__ */
+
+
+static inline uint32_t group_match_empty(const int8_t *ctrl)
+{
+    return group_match(ctrl, CTRL_EMPTY);
+}
+
+
+/*
+ * hashing and probing
+ *
+ * We can't trust user-supplied hash functions to spread their bits
+ * evenly, so we mix the hashes we get. We use the least significant
+ * bits of the mixed hash to pick the first group to probe, the most
+ * significant ones to put into control bytes. We probe groups using
+ * triangular numbers, which visits every group of the table.
+ */
+
+static inline uint32_t mix_hash(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+
+    return h;
+}
+
+
+static ssize_t find_slot(mrp_fhtbl_t *ht, void *key, uint32_t hash)
+{
+    size_t    mask = ht->nslot / GROUP_SIZE - 1;
+    size_t    grp  = hash & mask;
+    size_t    step, idx;
+    int8_t   *ctrl;
+    slot_t   *slot;
+    uint32_t  m;
+
+    for (step = 0; step <= mask; grp = (grp + ++step) & mask) {
+        ctrl = ht->ctrl + grp * GROUP_SIZE;
+
+        for (m = group_match(ctrl, ctrl_hash(hash)); m != 0; m &= m - 1) {
+            idx  = grp * GROUP_SIZE + ffs(m) - 1;
+            slot = ht->slots + idx;
+
+            if (slot->hash == hash && !ht->comp(slot->key, key))
+                return idx;
+        }
+
+        if (group_match_empty(ctrl))
+            break;
+    }
+
+    return -1;
+}
+
+
+static size_t find_free(int8_t *ctrls, size_t nslot, uint32_t hash)
+{
+    size_t    mask = nslot / GROUP_SIZE - 1;
+    size_t    grp  = hash & mask;
+    size_t    step;
+    uint32_t  m;
+
+    /* the caller must make sure that there is a free slot */
+    for (step = 0; ; grp = (grp + ++step) & mask)
+        if ((m = group_match_free(ctrls + grp * GROUP_SIZE)) != 0)
+            return grp * GROUP_SIZE + ffs(m) - 1;
+}
+
+
+static void erase_slot(mrp_fhtbl_t *ht, size_t idx)
+{
+    int8_t *ctrl = ht->ctrl + (idx & ~(size_t)(GROUP_SIZE - 1));
+
+    /*
+     * Lookups stop probing at the first group with an empty slot. If
+     * this group already has one, no probe can ever go past it and we
+     * can mark our slot empty. Otherwise we need to leave a tombstone.
+     */
+
+    if (group_match_empty(ctrl)) {
+        ht->ctrl[idx] = CTRL_EMPTY;
+        ht->ngrowth++;
+    }
+    else
+        ht->ctrl[idx] = CTRL_DELETED;
+
+    ht->nentry--;
+}
+
+
+static int resize(mrp_fhtbl_t *ht, size_t nslot)
+{
+    int8_t *ctrl;
+    slot_t *slots;
+    size_t  i, idx;
+
+    if ((ctrl = mrp_alloc(nslot)) == NULL)
+        return FALSE;
+
+    if ((slots = mrp_alloc(nslot * sizeof(*slots))) == NULL) {
+        mrp_free(ctrl);
+        return FALSE;
+    }
+
+    memset(ctrl, CTRL_EMPTY, nslot);
+
+    for (i = 0; i < ht->nslot; i++) {
+        if (ht->ctrl[i] < 0)
+            continue;
+
+        idx = find_free(ctrl, nslot, ht->slots[i].hash);
+
+        ctrl[idx]  = ht->ctrl[i];
+        slots[idx] = ht->slots[i];
+    }
+
+    mrp_free(ht->ctrl);
+    mrp_free(ht->slots);
+
+    ht->ctrl    = ctrl;
+    ht->slots   = slots;
+    ht->nslot   = nslot;
+    ht->ngrowth = MAX_LOAD(nslot) - ht->nentry;
+
+    return TRUE;
+}
+
+
+static int make_room(mrp_fhtbl_t *ht)
+{
+    /*
+     * We have run out of empty slots to fill. If the table is mostly
+     * full, we double its size. Otherwise it is mostly tombstones and
+     * we just rehash it at the same size to get rid of them. We can't
+     * move entries around while being iterated. In that case we fill
+     * up the remaining free slots, and only fail if there are none.
+     */
+
+    if (ht->iter == NULL) {
+        if (ht->nentry >= MAX_LOAD(ht->nslot) / 2) {
+            if (resize(ht, 2 * ht->nslot))
+                return TRUE;
+        }
+        else {
+            if (resize(ht, ht->nslot))
+                return TRUE;
+        }
+    }
+
+    return ht->nentry < ht->nslot;
+}
+
+
+/*
+ * public interface
+ */
+
+mrp_fhtbl_t *mrp_fhtbl_create(mrp_htbl_config_t *cfg)
+{
+    mrp_fhtbl_t        *ht;
+    mrp_htbl_hash_fn_t  hash;
+    size_t              nentry, nslot;
+
+    hash = mrp_htbl_config_hash(cfg);
+
+    if (!cfg->comp || !hash)
+        return NULL;
+
+    if ((ht = mrp_allocz(sizeof(*ht))) == NULL)
+        return NULL;
+
+    if (cfg->nentry != 0)
+        nentry = cfg->nentry;
+    else {
+        if (cfg->nbucket != 0)
+            nentry = 4 * cfg->nbucket;
+        else
+            nentry = 32;
+    }
+
+    for (nslot = MIN_NSLOT; MAX_LOAD(nslot) < nentry; nslot <<= 1)
+        ;
+
+    ht->comp = cfg->comp;
+    ht->hash = hash;
+    ht->free = cfg->free;
+
+    if (!resize(ht, nslot)) {
+        mrp_free(ht);
+        return NULL;
+    }
+
+    return ht;
+}
+
+
+void mrp_fhtbl_destroy(mrp_fhtbl_t *ht, int free)
+{
+    if (ht != NULL) {
+        if (free)
+            mrp_fhtbl_reset(ht, free);
+
+        mrp_free(ht->ctrl);
+        mrp_free(ht->slots);
+        mrp_free(ht);
+    }
+}
+
+
+void mrp_fhtbl_reset(mrp_fhtbl_t *ht, int free)
+{
+    size_t i;
+
+    if (free && ht->free) {
+        for (i = 0; i < ht->nslot; i++)
+            if (ht->ctrl[i] >= 0)
+                ht->free(ht->slots[i].key, ht->slots[i].obj);
+    }
+
+    memset(ht->ctrl, CTRL_EMPTY, ht->nslot);
+
+    ht->nentry  = 0;
+    ht->ngrowth = MAX_LOAD(ht->nslot);
+}
+
+
+int mrp_fhtbl_insert(mrp_fhtbl_t *ht, void *key, void *object)
+{
+    uint32_t  hash = mix_hash(ht->hash(key));
+    size_t    idx;
+    slot_t   *slot;
+
+    if (ht->ngrowth == 0 && !make_room(ht))
+        return FALSE;
+
+    idx = find_free(ht->ctrl, ht->nslot, hash);
+
+    if (ht->ctrl[idx] == CTRL_EMPTY && ht->ngrowth > 0)
+        ht->ngrowth--;
+
+    ht->ctrl[idx] = ctrl_hash(hash);
+    ht->nentry++;
+
+    slot = ht->slots + idx;
+    slot->key  = key;
+    slot->obj  = object;
+    slot->hash = hash;
+
+    return TRUE;
+}
+
+
+void *mrp_fhtbl_remove(mrp_fhtbl_t *ht, void *key, int free)
+{
+    ssize_t  idx;
+    void    *object;
+
+    if ((idx = find_slot(ht, key, mix_hash(ht->hash(key)))) < 0)
+        return NULL;
+
+    key    = ht->slots[idx].key;
+    object = ht->slots[idx].obj;
+
+    erase_slot(ht, idx);
+
+    /* if the entry is being iterated over, let the iterator free it */
+    if (ht->iter != NULL && ht->iter->idx == (size_t)idx)
+        ht->iter->verdict = free ? MRP_HTBL_ITER_DELETE : MRP_HTBL_ITER_UNHASH;
+    else {
+        if (free && ht->free)
+            ht->free(key, object);
+    }
+
+    return object;
+}
+
+
+void *mrp_fhtbl_lookup(mrp_fhtbl_t *ht, void *key)
+{
+    ssize_t idx;
+
+    if ((idx = find_slot(ht, key, mix_hash(ht->hash(key)))) < 0)
+        return NULL;
+    else
+        return ht->slots[idx].obj;
+}
+
+
+int mrp_fhtbl_foreach(mrp_fhtbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
+{
+    iter_t iter;
+    slot_t slot;
+    int    cb_verdict;
+
+    /*
+     * We can only handle a single callback-based iterator. If there
+     * is already one we're busy so just bail out. Since nothing gets
+     * moved around while we're iterating, we can simply walk through
+     * the slots in order.
+     */
+    if (ht->iter != NULL)
+        return FALSE;
+
+    mrp_clear(&iter);
+    ht->iter = &iter;
+
+    for (iter.idx = 0; iter.idx < ht->nslot; iter.idx++) {
+        if (ht->ctrl[iter.idx] < 0)
+            continue;
+
+        slot         = ht->slots[iter.idx];
+        iter.verdict = 0;
+        cb_verdict   = cb(slot.key, slot.obj, user_data);
+
+        /* entry was removed from cb, free it if we were asked to */
+        if (iter.verdict) {
+            if (iter.verdict == MRP_HTBL_ITER_DELETE && ht->free)
+                ht->free(slot.key, slot.obj);
+        }
+        else {
+            if (cb_verdict & MRP_HTBL_ITER_UNHASH) {
+                erase_slot(ht, iter.idx);
+
+                if ((cb_verdict & MRP_HTBL_ITER_DELETE) ==
+                    MRP_HTBL_ITER_DELETE && ht->free)
+                    ht->free(slot.key, slot.obj);
+            }
+        }
+
+        if (!(cb_verdict & MRP_HTBL_ITER_MORE))
+            break;
+    }
+
+    ht->iter = NULL;
+
+    return TRUE;
+}
+
+
+void *mrp_fhtbl_find(mrp_fhtbl_t *ht, mrp_htbl_find_cb_t cb, void *user_data)
+{
+    iter_t  iter;
+    slot_t *slot;
+    void   *found;
+    size_t  i;
+
+    /*
+     * Bail out if there is also an iterator active... We register
+     * ourselves as one only to keep the table from being resized
+     * under us. No entry is marked as being iterated over.
+     */
+    if (ht->iter != NULL)
+        return NULL;
+
+    iter.idx     = (size_t)-1;
+    iter.verdict = 0;
+    ht->iter     = &iter;
+    found        = NULL;
+
+    for (i = 0, slot = ht->slots; i < ht->nslot; i++, slot++) {
+        if (ht->ctrl[i] < 0)
+            continue;
+
+        if (cb(slot->key, slot->obj, user_data)) {
+            found = slot->obj;
+            break;
+        }
+    }
+
+    ht->iter = NULL;
+
+    return found;
+}
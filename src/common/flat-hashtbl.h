@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_FLAT_HASHTBL_H__
+#define __MURPHY_FLAT_HASHTBL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/hashtbl.h>
+
+MRP_CDECL_BEGIN
+
+/*
+ * flat (open addressing) hash tables
+ *
+ * A flat hash table stores its entries inline in a single array of
+ * slots, along with a parallel array of one control byte per slot. A
+ * control byte tells whether a slot is empty, deleted or in use, and for
+ * slots in use it also holds 7 bits of the hash of the key. Lookups scan
+ * the control bytes of a group of 16 slots at a time (using SSE2 where
+ * available), and only compare the keys of slots with matching hash
+ * bits. Unlike mrp_htbl_t, insertions do not allocate memory unless the
+ * table needs to grow.
+ *
+ * Flat hash tables take the same configuration, callbacks and iterator
+ * verdicts as mrp_htbl_t. Like mrp_htbl_t, they do not check for
+ * duplicate keys on insertion. Entries can be removed while iterating
+ * over the table. Entries inserted while iterating may or may not be
+ * iterated over.
+ */
+
+typedef struct mrp_fhtbl_s mrp_fhtbl_t;
+
+/** Create a new flat hash table with the given configuration. */
+mrp_fhtbl_t *mrp_fhtbl_create(mrp_htbl_config_t *cfg);
+
+/** Destroy a flat hash table, free all entries unless @free is FALSE. */
+void mrp_fhtbl_destroy(mrp_fhtbl_t *ht, int free);
+
+/** Reset a flat hash table, also free all entries unless @free is FALSE. */
+void mrp_fhtbl_reset(mrp_fhtbl_t *ht, int free);
+
+/** Insert the given @key/@object pair to the hash table. */
+int mrp_fhtbl_insert(mrp_fhtbl_t *ht, void *key, void *object);
+
+/** Remove and return the object for @key, also free unless @free is FALSE. */
+void *mrp_fhtbl_remove(mrp_fhtbl_t *ht, void *key, int free);
+
+/** Look up the object corresponding to @key. */
+void *mrp_fhtbl_lookup(mrp_fhtbl_t *ht, void *key);
+
+/** Find the first matching entry in a flat hash table. */
+void *mrp_fhtbl_find(mrp_fhtbl_t *ht, mrp_htbl_find_cb_t cb, void *user_data);
+
+/** Iterate over all entries of a flat hash table. */
+int mrp_fhtbl_foreach(mrp_fhtbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_FLAT_HASHTBL_H__ */
@@ -32,10 +32,27 @@
 #include "murphy/common/mm.h"
 #include "murphy/common/list.h"
 #include "murphy/common/hashtbl.h"
+#include "murphy/common/utils.h"
 
 #define MIN_NBUCKET   8
 #define MAX_NBUCKET 128
 
+/*
+ * resizing
+ *
+ * Tables are grown (doubled) once they have more than MAX_LOAD entries
+ * per bucket and shrunk (halved) once they have less than one entry per
+ * MIN_LOAD buckets, never going below the initial size. Entries are not
+ * moved to the new buckets all at once. Instead every insert, remove or
+ * lookup moves the entries of REHASH_STEP old buckets, so no single
+ * operation pays for rehashing the whole table. While an iterator is
+ * active, no resizing or rehashing is done.
+ */
+
+#define MAX_LOAD      2
+#define MIN_LOAD      8
+#define REHASH_STEP   4
+
 typedef struct {                        /* a hash bucket */
     mrp_list_hook_t entries;            /* hook to hash table entries */
     mrp_list_hook_t used;               /* hook to list of buckets in use */
@@ -45,6 +62,7 @@ typedef struct {                        /* a hash table entry */
     mrp_list_hook_t  hook;              /* hook to bucket chain */
     void            *key;               /* key for this entry */
     void            *obj;               /* object for this entry */
+    uint32_t         hash;              /* cached hash of key */
 } entry_t;
 
 typedef struct {                        /* iterator state */
@@ -57,6 +75,11 @@ typedef struct {                        /* iterator state */
 struct mrp_htbl_s {
     bucket_t           *buckets;        /* hash table buckets */
     size_t              nbucket;        /* this many of them */
+    bucket_t           *old;            /* buckets being rehashed, if any */
+    size_t              nold;           /* this many of them */
+    size_t              rehash;         /* next old bucket to rehash */
+    size_t              nentry;         /* number of entries */
+    size_t              minbucket;      /* never shrink below this */
     mrp_list_hook_t     used;           /* buckets in use */
     mrp_htbl_comp_fn_t  comp;           /* key comparison function */
     mrp_htbl_hash_fn_t  hash;           /* key hash function */
@@ -81,12 +104,31 @@ static size_t calc_buckets(size_t nbucket)
 }
 
 
+static bucket_t *alloc_buckets(size_t nbucket)
+{
+    bucket_t *buckets;
+    size_t    i;
+
+    if ((buckets = mrp_allocz(sizeof(*buckets) * nbucket)) != NULL) {
+        for (i = 0; i < nbucket; i++) {
+            mrp_list_init(&buckets[i].entries);
+            mrp_list_init(&buckets[i].used);
+        }
+    }
+
+    return buckets;
+}
+
+
 mrp_htbl_t *mrp_htbl_create(mrp_htbl_config_t *cfg)
 {
-    mrp_htbl_t *ht;
-    size_t     i, nbucket;
+    mrp_htbl_t         *ht;
+    mrp_htbl_hash_fn_t  hash;
+    size_t              nbucket;
+
+    hash = mrp_htbl_config_hash(cfg);
 
-    if (cfg->comp && cfg->hash) {
+    if (cfg->comp && hash) {
         if ((ht = mrp_allocz(sizeof(*ht))) != NULL) {
             if (cfg->nbucket != 0)
                 nbucket = cfg->nbucket;
@@ -97,22 +139,17 @@ mrp_htbl_t *mrp_htbl_create(mrp_htbl_config_t *cfg)
                     nbucket = 4 * MIN_NBUCKET;
             }
 
-            ht->nbucket = calc_buckets(nbucket);
-            ht->comp    = cfg->comp;
-            ht->hash    = cfg->hash;
-            ht->free    = cfg->free;
+            ht->nbucket   = calc_buckets(nbucket);
+            ht->minbucket = ht->nbucket;
+            ht->comp      = cfg->comp;
+            ht->hash      = hash;
+            ht->free      = cfg->free;
 
             mrp_list_init(&ht->used);
 
-            ht->buckets = mrp_allocz(sizeof(*ht->buckets) * ht->nbucket);
-            if (ht->buckets != NULL) {
-                for (i = 0; i < ht->nbucket; i++) {
-                    mrp_list_init(&ht->buckets[i].entries);
-                    mrp_list_init(&ht->buckets[i].used);
-                }
-
+            ht->buckets = alloc_buckets(ht->nbucket);
+            if (ht->buckets != NULL)
                 return ht;
-            }
             else {
                 mrp_free(ht);
                 ht = NULL;
@@ -130,6 +167,7 @@ void mrp_htbl_destroy(mrp_htbl_t *ht, int free)
         if (free)
             mrp_htbl_reset(ht, free);
 
+        mrp_free(ht->old);
         mrp_free(ht->buckets);
         mrp_free(ht);
     }
@@ -161,22 +199,126 @@ void mrp_htbl_reset(mrp_htbl_t *ht, int free)
 
         mrp_list_delete(&bucket->used);
     }
+
+    ht->nentry = 0;
+
+    if (ht->old != NULL && ht->iter == NULL) {
+        mrp_free(ht->old);
+        ht->old  = NULL;
+        ht->nold = 0;
+    }
+}
+
+
+static inline bucket_t *hash_bucket(bucket_t *buckets, size_t nbucket,
+                                    uint32_t hash)
+{
+    return buckets + (hash & (nbucket - 1));
+}
+
+
+static void unlink_bucket(mrp_htbl_t *ht, bucket_t *bucket)
+{
+    /*
+     * If there is an iterator active and this bucket would
+     * have been the next one to iterate over, we need to
+     * update the iterator to skip to the next bucket instead
+     * as this one just became empty and will be removed from
+     * the used bucket list. Failing to update the iterator
+     * could drive mrp_htbl_foreach into an infinite loop
+     * because of the unexpected hop from the used bucket list
+     * (to a single empty bucket).
+     */
+
+    if (ht->iter != NULL && ht->iter->bn == &bucket->used)
+        ht->iter->bn = bucket->used.next;
+
+    mrp_list_delete(&bucket->used);
+}
+
+
+static void link_entry(mrp_htbl_t *ht, bucket_t *bucket, entry_t *entry)
+{
+    mrp_list_append(&bucket->entries, &entry->hook);
+
+    if (mrp_list_empty(&bucket->used))
+        mrp_list_append(&ht->used, &bucket->used);
+}
+
+
+static void rehash_step(mrp_htbl_t *ht, int nstep)
+{
+    mrp_list_hook_t *p, *n;
+    bucket_t        *bucket;
+    entry_t         *entry;
+
+    if (ht->old == NULL || ht->iter != NULL)
+        return;
+
+    while (nstep-- > 0 && ht->rehash < ht->nold) {
+        bucket = ht->old + ht->rehash++;
+
+        mrp_list_foreach(&bucket->entries, p, n) {
+            entry = mrp_list_entry(p, entry_t, hook);
+            mrp_list_delete(p);
+            link_entry(ht, hash_bucket(ht->buckets, ht->nbucket, entry->hash),
+                       entry);
+        }
+
+        unlink_bucket(ht, bucket);
+    }
+
+    if (ht->rehash >= ht->nold) {
+        mrp_free(ht->old);
+        ht->old  = NULL;
+        ht->nold = 0;
+    }
+}
+
+
+static void check_load(mrp_htbl_t *ht)
+{
+    bucket_t *buckets;
+    size_t    nbucket;
+
+    if (ht->old != NULL || ht->iter != NULL)
+        return;
+
+    nbucket = ht->nbucket;
+
+    if (ht->nentry > MAX_LOAD * nbucket)
+        nbucket *= 2;
+    else if (nbucket > ht->minbucket && ht->nentry < nbucket / MIN_LOAD)
+        nbucket /= 2;
+    else
+        return;
+
+    /* if we can't allocate, just keep on using the current buckets */
+    if ((buckets = alloc_buckets(nbucket)) == NULL)
+        return;
+
+    ht->old     = ht->buckets;
+    ht->nold    = ht->nbucket;
+    ht->rehash  = 0;
+    ht->buckets = buckets;
+    ht->nbucket = nbucket;
 }
 
 
 int mrp_htbl_insert(mrp_htbl_t *ht, void *key, void *object)
 {
-    uint32_t  idx    = ht->hash(key) & (ht->nbucket - 1);
-    bucket_t *bucket = ht->buckets + idx;
-    int       first  = mrp_list_empty(&bucket->entries);
+    uint32_t  hash = ht->hash(key);
     entry_t  *entry;
 
     if ((entry = mrp_allocz(sizeof(*entry))) != NULL) {
-        entry->key = key;
-        entry->obj = object;
-        mrp_list_append(&bucket->entries, &entry->hook);
-        if (first)
-            mrp_list_append(&ht->used, &bucket->used);
+        entry->key  = key;
+        entry->obj  = object;
+        entry->hash = hash;
+        link_entry(ht, hash_bucket(ht->buckets, ht->nbucket, hash), entry);
+        ht->nentry++;
+
+        check_load(ht);
+        rehash_step(ht, REHASH_STEP);
 
         return TRUE;
     }
@@ -185,31 +327,56 @@ int mrp_htbl_insert(mrp_htbl_t *ht, void *key, void *object)
 }
 
 
-static inline entry_t *lookup(mrp_htbl_t *ht, void *key, bucket_t **bucketp)
+static inline entry_t *lookup_bucket(mrp_htbl_t *ht, bucket_t *bucket,
+                                     void *key, uint32_t hash)
 {
-    uint32_t        idx    = ht->hash(key) & (ht->nbucket - 1);
-    bucket_t       *bucket = ht->buckets + idx;
     mrp_list_hook_t *p, *n;
-    entry_t        *entry;
+    entry_t         *entry;
 
     mrp_list_foreach(&bucket->entries, p, n) {
         entry = mrp_list_entry(p, entry_t, hook);
 
-        if (!ht->comp(entry->key, key)) {
-            if (bucketp != NULL)
-                *bucketp = bucket;
+        if (entry->hash == hash && !ht->comp(entry->key, key))
             return entry;
-        }
     }
 
     return NULL;
 }
 
 
+static inline entry_t *lookup(mrp_htbl_t *ht, void *key, bucket_t **bucketp)
+{
+    uint32_t  hash = ht->hash(key);
+    bucket_t *bucket;
+    entry_t  *entry;
+
+    /* entries of old buckets not rehashed yet are still in the old table */
+    if (ht->old != NULL) {
+        bucket = hash_bucket(ht->old, ht->nold, hash);
+
+        if ((entry = lookup_bucket(ht, bucket, key, hash)) != NULL)
+            goto found;
+    }
+
+    bucket = hash_bucket(ht->buckets, ht->nbucket, hash);
+
+    if ((entry = lookup_bucket(ht, bucket, key, hash)) == NULL)
+        return NULL;
+
+ found:
+    if (bucketp != NULL)
+        *bucketp = bucket;
+
+    return entry;
+}
+
+
 void *mrp_htbl_lookup(mrp_htbl_t *ht, void *key)
 {
     entry_t *entry;
 
+    rehash_step(ht, REHASH_STEP);
+
     entry = lookup(ht, key, NULL);
     if (entry != NULL)
         return entry->obj;
@@ -236,25 +403,10 @@ static void delete_from_bucket(mrp_htbl_t *ht, bucket_t *bucket, entry_t *entry)
         ht->iter->en = eh->next;
 
     mrp_list_delete(eh);
+    ht->nentry--;
 
-
-    /*
-     * If there is an iterator active and this bucket would
-     * have been the next one to iterate over, we need to
-     * update the iterator to skip to the next bucket instead
-     * as this one just became empty and will be removed from
-     * the used bucket list. Failing to update the iterator
-     * could drive mrp_htbl_foreach into an infinite loop
-     * because of the unexpected hop from the used bucket list
-     * (to a single empty bucket).
-     */
-
-    if (ht->iter != NULL && mrp_list_empty(&bucket->entries)) {
-        if (ht->iter->bn == &bucket->used)
-            ht->iter->bn = bucket->used.next;
-
-        mrp_list_delete(&bucket->used);
-    }
+    if (mrp_list_empty(&bucket->entries))
+        unlink_bucket(ht, bucket);
 }
 
 
@@ -281,6 +433,9 @@ void *mrp_htbl_remove(mrp_htbl_t *ht, void *key, int free)
         else {
             free_entry(ht, entry, free);
         }
+
+        check_load(ht);
+        rehash_step(ht, REHASH_STEP);
     }
     else
         object = NULL;
@@ -319,9 +474,10 @@ int mrp_htbl_foreach(mrp_htbl_t *ht, mrp_htbl_iter_cb_t cb, void *user_data)
                 free_entry(ht, entry, TRUE);
             }
             else {
-                /* cb wants us to unhash (safe even if unhashed in remove) */
-                if (cb_verdict & MRP_HTBL_ITER_UNHASH)
-                    mrp_list_delete(iter.ep);
+                /* cb wants us to unhash (unless already unhashed in remove) */
+                if ((cb_verdict & MRP_HTBL_ITER_UNHASH) &&
+                    !mrp_list_empty(iter.ep))
+                    delete_from_bucket(ht, bucket, entry);
                 /* cb want us to free entry (and remove was not called) */
                 if (cb_verdict & MRP_HTBL_ITER_DELETE)
                     free_entry(ht, entry, TRUE);
@@ -30,6 +30,12 @@
 #ifndef __MURPHY_HASHTBL_H__
 #define __MURPHY_HASHTBL_H__
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/utils.h>
+
 
 MRP_CDECL_BEGIN
 
@@ -47,16 +53,29 @@ typedef void (*mrp_htbl_free_fn_t)(void *key, void *object);
 
 /*
  * hash table configuration
+ *
+ * For tables with string keys (comp is mrp_string_comp), hash can be
+ * left NULL, in which case mrp_string_hash is used.
  */
 typedef struct {
     size_t             nentry;                   /* estimated entries */
     mrp_htbl_comp_fn_t comp;                     /* comparison function */
-    mrp_htbl_hash_fn_t hash;                     /* hash function */
+    mrp_htbl_hash_fn_t hash;                     /* hash function, or NULL */
     mrp_htbl_free_fn_t free;                     /* freeing function */
     size_t             nbucket;                  /* number of buckets, or 0 */
 } mrp_htbl_config_t;
 
 
+/** Get the hash function to use for @cfg, defaulting for string keys. */
+static inline mrp_htbl_hash_fn_t mrp_htbl_config_hash(mrp_htbl_config_t *cfg)
+{
+    if (cfg->hash == NULL && cfg->comp == mrp_string_comp)
+        return mrp_string_hash;
+    else
+        return cfg->hash;
+}
+
+
 /** Create a new hash table with the given configuration. */
 mrp_htbl_t *mrp_htbl_create(mrp_htbl_config_t *cfg);
 
@@ -128,6 +128,22 @@ static inline void mrp_list_delete(mrp_list_hook_t *item)
     }
 }
 
+/** Move all items of list to the (empty) list new_list. */
+static inline void mrp_list_move(mrp_list_hook_t *new_list,
+                                 mrp_list_hook_t *list)
+{
+    if (mrp_list_empty(list))
+        mrp_list_init(new_list);
+    else {
+        new_list->next = list->next;
+        new_list->prev = list->prev;
+        new_list->next->prev = new_list;
+        new_list->prev->next = new_list;
+
+        mrp_list_init(list);
+    }
+}
+
 /** Macro to iterate through a list (current item safe to remove). */
 #define mrp_list_foreach(list, p, n)                                      \
     if ((list)->next != NULL)                                             \
@@ -27,13 +27,35 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#define _GNU_SOURCE                      /* we want dladdr */
+
+#include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <execinfo.h>
 #include <signal.h>
 #include <limits.h>
 #include <sys/epoll.h>
 #include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+
+#include <murphy/config.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#    include <sys/mman.h>
+#    include <sys/syscall.h>
+#    include <linux/io_uring.h>
+#    ifdef IORING_ENTER_EXT_ARG
+#        define URING_ENABLED
+#    endif
+#endif
 
 #include <murphy/common/macros.h>
 #include <murphy/common/mm.h>
@@ -41,6 +63,7 @@
 #include <murphy/common/list.h>
 #include <murphy/common/hashtbl.h>
 #include <murphy/common/mainloop.h>
+#include <murphy/common/work.h>
 
 #define USECS_PER_SEC  (1000 * 1000)
 #define USECS_PER_MSEC (1000)
@@ -56,10 +79,14 @@ struct mrp_io_watch_s {
     mrp_mainloop_t    *ml;                       /* mainloop */
     int                fd;                       /* file descriptor to watch */
     mrp_io_event_t     events;                   /* events of interest */
+    mrp_io_event_t     trigger;                  /* trigger mode */
+    int                armed;                    /* one-shot watch armed */
     mrp_io_watch_cb_t  cb;                       /* user callback */
     void              *user_data;                /* opaque user data */
     struct pollfd     *pollfd;                   /* associated pollfd */
     mrp_list_hook_t    slave;                    /* watches with the same fd */
+    unsigned int       budget;                   /* max. work per wakeup */
+    mrp_priority_t     prio;                     /* dispatch priority */
 };
 
 #define is_master(w) !mrp_list_empty(&(w)->hook)
@@ -71,15 +98,21 @@ struct mrp_io_watch_s {
  */
 
 struct mrp_timer_s {
-    mrp_list_hook_t  hook;                       /* to list of timers */
+    mrp_list_hook_t  hook;                       /* to expired/deleted list */
     int            (*free)(void *ptr);           /* cb to free memory */
     mrp_mainloop_t  *ml;                         /* mainloop */
-    unsigned int     msecs;                      /* timer interval */
+    uint64_t         usecs;                      /* timer interval */
     uint64_t         expire;                     /* next expiration time */
+    uint64_t         slack;                      /* allowed delay (usecs) */
+    uint64_t         deadline;                   /* expire + slack */
+    int              heapidx;                    /* index in heap, or -1 */
+    mrp_priority_t   prio;                       /* dispatch priority */
     mrp_timer_cb_t   cb;                         /* user callback */
     void            *user_data;                  /* opaque user data */
 };
 
+#define TIMER_HEAP_MIN 16                        /* min. timer heap size */
+
 
 /*
  * deferred callbacks
@@ -91,6 +124,7 @@ struct mrp_deferred_s {
     mrp_mainloop_t    *ml;                       /* mainloop */
     mrp_deferred_cb_t  cb;                       /* user callback */
     void              *user_data;                /* opaque user data */
+    mrp_priority_t     prio;                     /* dispatch priority */
     int                inactive : 1;
 };
 
@@ -109,6 +143,161 @@ struct mrp_sighandler_s {
 };
 
 
+/*
+ * completion-based I/O requests
+ */
+
+typedef enum {
+    IO_REQ_READ = 0,
+    IO_REQ_WRITE,
+    IO_REQ_RECVMSG,
+    IO_REQ_SENDMSG,
+} io_req_type_t;
+
+struct mrp_io_req_s {
+    mrp_list_hook_t   hook;                      /* to pending/done list */
+    int             (*free)(void *ptr);          /* cb to free memory */
+    mrp_mainloop_t   *ml;                        /* mainloop */
+    io_req_type_t     type;                      /* request type */
+    int               fd;                        /* file descriptor */
+    void             *buf;                       /* buffer for read/write */
+    size_t            size;                      /* buffer size */
+    struct msghdr    *msg;                       /* message for recv/sendmsg */
+    int               flags;                     /* recv/sendmsg flags */
+    mrp_io_watch_t   *w;                         /* I/O watch, if emulated */
+    int               inflight;                  /* submitted to io_uring */
+    int               polled;                    /* has a linked poll */
+    ssize_t           result;                    /* result of the request */
+    mrp_io_req_cb_t   cb;                        /* user callback */
+    void             *user_data;                 /* opaque user data */
+};
+
+
+/*
+ * io_uring backend
+ */
+
+#ifdef URING_ENABLED
+
+#define URING_ENTRIES    256                     /* submission queue size */
+#define URING_EPOLL_TAG  ((uint64_t)1)           /* user_data for epollfd */
+#define URING_CANCEL_TAG ((uint64_t)2)           /* user_data for cancels */
+#define URING_POLL_BIT   ((uint64_t)1)           /* tag of linked polls */
+
+typedef struct {
+    int                  fd;                     /* io_uring fd */
+    unsigned int         entries;                /* submission queue size */
+    unsigned int        *sq_head;                /* submission queue head */
+    unsigned int        *sq_tail;                /* submission queue tail */
+    unsigned int        *sq_mask;                /* submission queue mask */
+    unsigned int        *sq_array;               /* submission queue array */
+    struct io_uring_sqe *sqes;                   /* submission queue entries */
+    unsigned int        *cq_head;                /* completion queue head */
+    unsigned int        *cq_tail;                /* completion queue tail */
+    unsigned int        *cq_mask;                /* completion queue mask */
+    struct io_uring_cqe *cqes;                   /* completion queue entries */
+    void                *sq_ring;                /* mapped submission ring */
+    void                *cq_ring;                /* mapped completion ring */
+    size_t               sq_size;                /* submission ring size */
+    size_t               cq_size;                /* completion ring size */
+    size_t               sqes_size;              /* submission entries size */
+    unsigned int         nsqe;                   /* unsubmitted entries */
+    int                  ninflight;              /* requests in flight */
+    int                  epoll_armed;            /* epollfd poll pending */
+    int                  epoll_ready;            /* epollfd has events */
+    mrp_io_stats_t      *stats;                  /* mainloop I/O stats */
+} uring_t;
+
+#else
+
+typedef struct {
+    int ninflight;
+} uring_t;
+
+#endif
+
+
+/*
+ * callback latency profiling
+ */
+
+#define PROFILE_NBUCKET 20                       /* log2(usecs) buckets */
+
+typedef enum {
+    PROFILE_IO = 0,                              /* I/O watch */
+    PROFILE_TIMER,                               /* timer */
+    PROFILE_DEFERRED,                            /* deferred callback */
+    PROFILE_SUBLOOP,                             /* subloop dispatch */
+    PROFILE_IOREQ,                               /* I/O request completion */
+    PROFILE_LOOP,                                /* loop iteration */
+    PROFILE_POLL,                                /* poll wait */
+} profile_type_t;
+
+typedef struct {
+    void           *cb;                          /* callback address */
+    profile_type_t  type;                        /* callback type */
+    uint64_t        count;                       /* number of calls */
+    uint64_t        total;                       /* total time (nsecs) */
+    uint64_t        max;                         /* longest call (nsecs) */
+    uint64_t        hist[PROFILE_NBUCKET];       /* latency histogram */
+} profile_entry_t;
+
+typedef struct {
+    mrp_htbl_t      *entries;                    /* entries by callback */
+    int              nentry;                     /* number of entries */
+    profile_entry_t  loop;                       /* loop iteration times */
+    profile_entry_t  poll;                       /* poll wait times */
+    uint64_t         loop_start;                 /* current iteration start */
+    uint64_t         since;                      /* profiling started/reset */
+} profile_t;
+
+
+/*
+ * stall watchdog
+ */
+
+#define WATCHDOG_SIGNAL (SIGRTMIN + 7)           /* for main thread stacks */
+#define WATCHDOG_FRAMES 64                       /* max. backtrace depth */
+
+typedef struct {
+    mrp_mainloop_t  *ml;                         /* mainloop we watch */
+    pthread_t        thread;                     /* watchdog thread */
+    pthread_t        main;                       /* mainloop thread */
+    pthread_mutex_t  lock;                       /* lock for stopping */
+    pthread_cond_t   cond;                       /* signalled for stopping */
+    int              stop;                       /* whether to stop */
+    uint64_t         budget;                     /* callback budget (nsecs) */
+    void            *cb;                         /* current callback */
+    uint64_t         start;                      /* current callback start */
+    uint32_t         seq;                        /* current callback sequence */
+    uint32_t         reported;                   /* last reported sequence */
+} watchdog_t;
+
+typedef struct {
+    void     *cb;                                /* callback being called */
+    uint64_t  start;                             /* profiling start time */
+    void     *wd_cb;                             /* outer watchdog callback */
+    uint64_t  wd_start;                          /* outer watchdog start */
+    uint32_t  wd_seq;                            /* our watchdog sequence */
+} instrument_t;
+
+#define INSTRUMENT_PROFILE  0x1                  /* profiling enabled */
+#define INSTRUMENT_WATCHDOG 0x2                  /* watchdog enabled */
+
+
+/*
+ * callbacks posted from other threads
+ */
+
+typedef struct posted_s posted_t;
+
+struct posted_s {
+    posted_t      *next;                         /* next posted item */
+    mrp_post_cb_t  cb;                           /* user callback */
+    void          *user_data;                    /* opaque user data */
+};
+
+
 #define mark_deleted(o) ((o)->cb = NULL)
 #define is_deleted(o)   ((o)->cb == NULL)
 
@@ -135,6 +324,15 @@ typedef struct {
  * external mainloops
  */
 
+typedef struct {
+    uint32_t             events;                 /* registered epoll events */
+    uint32_t             want;                   /* events wanted this round */
+    uint32_t             revents;                /* events reported by epoll */
+    uint32_t             seen;                   /* last round seen in */
+    uint32_t             done;                   /* last round updated in */
+    int                  registered;             /* whether added to epoll */
+} subloop_fd_t;
+
 struct mrp_subloop_s {
     mrp_list_hook_t      hook;                   /* to list of subloops */
     int                (*free)(void *ptr);       /* cb to free memory */
@@ -146,6 +344,13 @@ struct mrp_subloop_s {
     mrp_io_watch_t      *w;                      /* watch for epollfd */
     struct pollfd       *pollfds;                /* pollfds for this subloop */
     int                  npollfd;                /* number of pollfds */
+    int                  npollslot;              /* size of pollfds */
+    struct pollfd       *qfds;                   /* buffer for querying */
+    int                  nqslot;                 /* size of qfds */
+    subloop_fd_t        *fdtab;                  /* registrations by fd */
+    int                  nfdtab;                 /* size of fdtab */
+    uint32_t             round;                  /* pollfd update round */
+    mrp_subloop_stats_t  stats;                  /* epoll usage statistics */
     int                  pending;                /* pending events */
     int                  poll;                   /* need to poll for events */
 };
@@ -171,23 +376,55 @@ struct mrp_mainloop_s {
 
     mrp_list_hook_t      iowatches;              /* list of I/O watches */
     int                  niowatch;               /* number of I/O watches */
+    int                  nprio_io;               /* non-default prio watches */
 
-    mrp_list_hook_t      timers;                 /* list of timers */
-    mrp_timer_t         *next_timer;             /* next expiring timer */
+    mrp_timer_t        **timers;                 /* timer heap */
+    int                  ntimer;                 /* number of armed timers */
+    int                  ntimerslot;             /* size of timer heap */
+    mrp_list_hook_t      expired[MRP_PRIORITY_MAX]; /* timers to dispatch */
+    int                  timerfd;                /* hires timer fd, or -1 */
+    mrp_io_watch_t      *timerwatch;             /* timerfd I/O watch */
+    uint64_t             timerfd_expire;         /* timerfd expiration time */
 
-    mrp_list_hook_t      deferred;               /* list of deferred cbs */
+    mrp_list_hook_t      deferred[MRP_PRIORITY_MAX]; /* active deferred cbs */
     mrp_list_hook_t      inactive_deferred;      /* inactive defferred cbs */
 
     int                  poll_timeout;           /* next poll timeout */
     int                  poll_result;            /* return value from poll */
+    int                  poll_next;              /* next event to dispatch */
+    int                  poll_end;               /* dispatch limit for now */
+    int                  poll_band[MRP_PRIORITY_MAX]; /* ends of prio bands */
+    uint64_t             poll_deadline;          /* I/O dispatch deadline */
+    struct epoll_event  *sorted;                 /* buffer for sorting events */
+    int                  max_events;             /* max. events per iteration */
+    uint64_t             max_usecs;              /* max. I/O dispatch time */
+    unsigned int         io_budget;              /* default I/O watch budget */
 
     int                  sigfd;                  /* signal polling fd */
     sigset_t             sigmask;                /* signal mask */
     mrp_io_watch_t      *sigwatch;               /* sigfd I/O watch */
     mrp_list_hook_t      sighandlers;            /* signal handlers */
 
+    int                  wakefd;                 /* eventfd for wakeups */
+    mrp_io_watch_t      *wakewatch;              /* wakefd I/O watch */
+    posted_t            *posted;                 /* posted callbacks */
+
+    mrp_workpool_t      *workpool;               /* default worker pool */
+
+    uring_t             *uring;                  /* io_uring, if enabled */
+    mrp_io_stats_t       io_stats;               /* I/O syscall counters */
+    mrp_list_hook_t      io_pending;             /* pending I/O requests */
+    mrp_list_hook_t      io_done;                /* completed I/O requests */
+
     mrp_list_hook_t      subloops;               /* external main loops */
 
+    int                  instrument;             /* INSTRUMENT_* flags */
+    profile_t           *profile;                /* profiling, if enabled */
+    watchdog_t          *watchdog;               /* watchdog, if enabled */
+
+    mrp_objpool_t       *pools[MRP_MAINLOOP_POOL_MAX]; /* object pools */
+    mrp_list_hook_t      trims;                  /* object pools we trim */
+
     mrp_list_hook_t      deleted;                /* unfreed deleted items */
     int                  quit;                   /* TRUE if _quit called */
     int                  exit_code;              /* returned from _run */
@@ -202,6 +439,113 @@ struct mrp_mainloop_s {
 
 
 static void dump_pollfds(const char *prefix, struct pollfd *fds, int nfd);
+static void purge_trims(mrp_mainloop_t *ml);
+
+
+/*
+ * object pools
+ *
+ * Notes: I/O watches, timers, deferred callbacks and signal handlers
+ *     are allocated from per-mainloop object pools. These are only ever
+ *     touched from the mainloop thread, so we don't need any locking.
+ */
+
+static const struct {
+    const char *name;                            /* pool name */
+    size_t      size;                            /* object size */
+} pool_types[MRP_MAINLOOP_POOL_MAX] = {
+    [MRP_MAINLOOP_POOL_IO_WATCH]   = { "I/O watches"      ,
+                                       sizeof(mrp_io_watch_t)   },
+    [MRP_MAINLOOP_POOL_TIMER]      = { "timers"           ,
+                                       sizeof(mrp_timer_t)      },
+    [MRP_MAINLOOP_POOL_DEFERRED]   = { "deferred callbacks",
+                                       sizeof(mrp_deferred_t)   },
+    [MRP_MAINLOOP_POOL_SIGHANDLER] = { "signal handlers"  ,
+                                       sizeof(mrp_sighandler_t) },
+};
+
+
+static void *pool_alloc(mrp_mainloop_t *ml, mrp_mainloop_pool_t type)
+{
+    void *obj;
+
+    if ((obj = mrp_objpool_alloc(ml->pools[type])) != NULL)
+        memset(obj, 0, pool_types[type].size);
+
+    return obj;
+}
+
+
+static inline void pool_free(void *obj)
+{
+    mrp_objpool_free(obj);
+}
+
+
+static int free_pooled(void *ptr)
+{
+    pool_free(ptr);
+
+    return TRUE;
+}
+
+
+static void destroy_pools(mrp_mainloop_t *ml)
+{
+    int i;
+
+    for (i = 0; i < MRP_MAINLOOP_POOL_MAX; i++) {
+        mrp_objpool_destroy(ml->pools[i]);
+        ml->pools[i] = NULL;
+    }
+}
+
+
+static int create_pools(mrp_mainloop_t *ml)
+{
+    mrp_objpool_config_t cfg;
+    char                 name[64];
+    int                  i;
+
+    for (i = 0; i < MRP_MAINLOOP_POOL_MAX; i++) {
+        snprintf(name, sizeof(name), "mainloop %s", pool_types[i].name);
+
+        mrp_clear(&cfg);
+        cfg.name    = name;
+        cfg.objsize = pool_types[i].size;
+
+        if ((ml->pools[i] = mrp_objpool_create(&cfg)) == NULL) {
+            destroy_pools(ml);
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+static uint64_t profile_account(mrp_mainloop_t *ml, profile_type_t type,
+                                void *cb, uint64_t start);
+static uint64_t profile_now(void);
+static void instrument_enter(mrp_mainloop_t *ml, void *cb, instrument_t *i);
+static void instrument_leave(mrp_mainloop_t *ml, profile_type_t type,
+                             instrument_t *i);
+
+
+/*
+ * Invoke a callback, profiling it and/or letting the watchdog monitor it
+ * if enabled. Otherwise the overhead is a single (predicted) branch.
+ */
+
+#define INSTRUMENTED_CALL(_ml, _type, _cb, _call) do {                    \
+        if (MRP_UNLIKELY((_ml)->instrument != 0)) {                       \
+            instrument_t _i;                                              \
+                                                                          \
+            instrument_enter((_ml), (void *)(_cb), &_i);                  \
+            _call;                                                        \
+            instrument_leave((_ml), (_type), &_i);                        \
+        }                                                                 \
+        else                                                              \
+            _call;                                                        \
+    } while (0)
 
 
 /*
@@ -216,11 +560,18 @@ static int add_slave_io_watch(mrp_io_watch_t *w)
     mrp_io_watch_t     *master, *slave;
     mrp_list_hook_t    *p, *n, *sp, *sn;
 
+    /* edge-triggered and one-shot watches can't share their fd */
+    if (w->trigger != MRP_IO_TRIGGER_LEVEL)
+        return FALSE;
+
     mrp_list_foreach(&ml->iowatches, p, n) {
         master = mrp_list_entry(p, typeof(*master), hook);
         if (master->fd != w->fd)
             continue;
 
+        if (master->trigger != MRP_IO_TRIGGER_LEVEL)
+            break;
+
         evt.events   = master->events;
         evt.data.ptr = master;
 
@@ -277,7 +628,7 @@ static int free_io_watch(void *ptr)
                 return FALSE;
     }
 
-    mrp_free(w);
+    pool_free(w);
 
     return TRUE;
 }
@@ -293,17 +644,21 @@ mrp_io_watch_t *mrp_add_io_watch(mrp_mainloop_t *ml, int fd,
     if (fd < 0 || cb == NULL)
         return NULL;
 
-    if ((w = mrp_allocz(sizeof(*w))) != NULL) {
+    if ((w = pool_alloc(ml, MRP_MAINLOOP_POOL_IO_WATCH)) != NULL) {
         mrp_list_init(&w->hook);
         mrp_list_init(&w->slave);
         w->ml        = ml;
         w->fd        = fd;
         w->events    = events & MRP_IO_EVENT_ALL;
+        w->trigger   = events & MRP_IO_TRIGGER_MASK;
+        w->armed     = TRUE;
         w->cb        = cb;
         w->user_data = user_data;
         w->free      = free_io_watch;
+        w->budget    = ml->io_budget;
+        w->prio      = MRP_PRIORITY_NORMAL;
 
-        evt.events   = w->events;
+        evt.events   = w->events | w->trigger;
         evt.data.ptr = w;
 
         if (epoll_ctl(ml->epollfd, EPOLL_CTL_ADD, w->fd, &evt) == 0) {
@@ -312,7 +667,7 @@ mrp_io_watch_t *mrp_add_io_watch(mrp_mainloop_t *ml, int fd,
         }
         else {
             if (errno != EEXIST || !add_slave_io_watch(w)) {
-                mrp_free(w);
+                pool_free(w);
                 w = NULL;
             }
         }
@@ -336,6 +691,73 @@ void mrp_del_io_watch(mrp_io_watch_t *w)
 }
 
 
+int mrp_rearm_io_watch(mrp_io_watch_t *w)
+{
+    struct epoll_event evt;
+
+    /*
+     * Notes: Epoll disables a one-shot watch once it has reported an
+     *        event for it. The watch then stays silent until rearmed,
+     *        letting its owner process the fd at its own pace.
+     */
+
+    if (w == NULL || is_deleted(w) || !(w->trigger & MRP_IO_TRIGGER_ONESHOT))
+        return FALSE;
+
+    if (w->armed)
+        return TRUE;
+
+    evt.events   = w->events | w->trigger;
+    evt.data.ptr = w;
+
+    if (epoll_ctl(w->ml->epollfd, EPOLL_CTL_MOD, w->fd, &evt) != 0)
+        return FALSE;
+
+    w->armed = TRUE;
+
+    return TRUE;
+}
+
+
+void mrp_set_io_watch_budget(mrp_io_watch_t *w, unsigned int max_work)
+{
+    if (w != NULL)
+        w->budget = max_work;
+}
+
+
+unsigned int mrp_get_io_watch_budget(mrp_io_watch_t *w)
+{
+    return w != NULL ? w->budget : 0;
+}
+
+
+int mrp_set_io_watch_priority(mrp_io_watch_t *w, mrp_priority_t prio)
+{
+    mrp_mainloop_t *ml;
+
+    if (w == NULL || is_deleted(w) || prio < 0 || prio >= MRP_PRIORITY_MAX)
+        return FALSE;
+
+    ml = w->ml;
+
+    if (w->prio == MRP_PRIORITY_NORMAL && prio != MRP_PRIORITY_NORMAL)
+        ml->nprio_io++;
+    else if (w->prio != MRP_PRIORITY_NORMAL && prio == MRP_PRIORITY_NORMAL)
+        ml->nprio_io--;
+
+    w->prio = prio;
+
+    return TRUE;
+}
+
+
+mrp_priority_t mrp_get_io_watch_priority(mrp_io_watch_t *w)
+{
+    return w != NULL ? w->prio : MRP_PRIORITY_NORMAL;
+}
+
+
 static void delete_io_watch(mrp_io_watch_t *w)
 {
     mrp_mainloop_t     *ml = w->ml;
@@ -346,9 +768,13 @@ static void delete_io_watch(mrp_io_watch_t *w)
     was_master = is_master(w);
     mrp_list_delete(&w->hook);
 
+    if (w->prio != MRP_PRIORITY_NORMAL)
+        ml->nprio_io--;
+
     if (was_master) {
         if (mrp_list_empty(&w->slave)) {
             op = EPOLL_CTL_DEL;
+            mrp_list_append(&ml->deleted, &w->hook);
         }
         else {
             /* relink first slave as new master to mainloop */
@@ -413,189 +839,480 @@ static inline int usecs_to_msecs(uint64_t usecs)
 }
 
 
-static void insert_timer(mrp_timer_t *t)
-{
-    mrp_mainloop_t  *ml = t->ml;
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t1;
-    int              inserted;
+/*
+ * Notes:
+ *
+ *     Armed timers are kept in a binary min-heap ordered by deadline,
+ *     the latest time a timer is allowed to fire (its expiration time
+ *     plus its slack). The heap is stored in an array and every timer
+ *     keeps track of its own index within the heap. This gives us O(1)
+ *     access to the next expiring timer and O(log n) insertion, removal
+ *     and rearming, which keeps things cheap even with a large number of
+ *     simultaneous timers (per-client and per-resource timeouts, for
+ *     instance).
+ *
+ *     We wake up at the earliest deadline and then fire every timer at
+ *     the top of the heap which has already expired. This way timers
+ *     with overlapping slack windows get coalesced into a single wakeup.
+ */
 
-    /*
-     * Notes:
-     *     If there is ever a need to run a large number of
-     *     simultaneous timers, we need to change this to a
-     *     self-balancing data structure, eg. an red-black tree.
-     */
+static inline void heap_set(mrp_mainloop_t *ml, int idx, mrp_timer_t *t)
+{
+    ml->timers[idx] = t;
+    t->heapidx      = idx;
+}
 
-    inserted = FALSE;
-    mrp_list_foreach(&ml->timers, p, n) {
-        t1 = mrp_list_entry(p, mrp_timer_t, hook);
 
-        if (!is_deleted(t1) && t->expire <= t1->expire) {
-            mrp_list_prepend(p->prev, &t->hook);
-            inserted = TRUE;
-            break;
-        }
-    }
+static void heap_up(mrp_mainloop_t *ml, int idx)
+{
+    mrp_timer_t *t = ml->timers[idx];
+    int          parent;
 
-    if (!inserted)
-        mrp_list_append(&ml->timers, &t->hook);
+    while (idx > 0) {
+        parent = (idx - 1) / 2;
 
-    if (ml->next_timer == NULL || t->expire < ml->next_timer->expire)
-        ml->next_timer = t;
-}
+        if (ml->timers[parent]->deadline <= t->deadline)
+            break;
 
+        heap_set(ml, idx, ml->timers[parent]);
+        idx = parent;
+    }
 
-static inline void rearm_timer(mrp_timer_t *t)
-{
-    mrp_list_delete(&t->hook);
-    t->expire = time_now() + t->msecs * USECS_PER_MSEC;
-    insert_timer(t);
+    heap_set(ml, idx, t);
 }
 
 
-static mrp_timer_t *find_next_timer(mrp_mainloop_t *ml)
+static void heap_down(mrp_mainloop_t *ml, int idx)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t = NULL;
+    mrp_timer_t *t = ml->timers[idx];
+    int          child;
 
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
+    while ((child = 2 * idx + 1) < ml->ntimer) {
+        if (child + 1 < ml->ntimer &&
+            ml->timers[child + 1]->deadline < ml->timers[child]->deadline)
+            child++;
 
-        if (!is_deleted(t))
+        if (t->deadline <= ml->timers[child]->deadline)
             break;
-        else
-            t = NULL;
+
+        heap_set(ml, idx, ml->timers[child]);
+        idx = child;
     }
 
-    ml->next_timer = t;
-    return t;
+    heap_set(ml, idx, t);
 }
 
 
-mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
-                           mrp_timer_cb_t cb, void *user_data)
+static int insert_timer(mrp_timer_t *t)
 {
-    mrp_timer_t *t;
+    mrp_mainloop_t *ml = t->ml;
+    int             nslot;
 
-    if (cb == NULL)
-        return NULL;
+    if (ml->ntimer >= ml->ntimerslot) {
+        nslot = ml->ntimerslot ? 2 * ml->ntimerslot : TIMER_HEAP_MIN;
 
-    if ((t = mrp_allocz(sizeof(*t))) != NULL) {
-        mrp_list_init(&t->hook);
-        t->ml        = ml;
-        t->expire    = time_now() + msecs * USECS_PER_MSEC;
-        t->msecs     = msecs;
-        t->cb        = cb;
-        t->user_data = user_data;
+        if (mrp_reallocz(ml->timers, ml->ntimerslot, nslot) == NULL)
+            return FALSE;
 
-        insert_timer(t);
+        ml->ntimerslot = nslot;
     }
 
-    return t;
+    heap_set(ml, ml->ntimer++, t);
+    heap_up(ml, t->heapidx);
+
+    return TRUE;
 }
 
 
-void mrp_del_timer(mrp_timer_t *t)
+static void remove_timer(mrp_timer_t *t)
 {
-    /*
-     * Notes: It is not safe to simply free this entry here as we might
-     *        be dispatching with this entry being the next to process.
-     *        We check for this and if it is not the case we relink this
-     *        to the list of deleted items which will be then processed
-     *        at end of the mainloop iteration. Otherwise we only mark the
-     *        this entry for deletion and the rest will be taken care of in
-     *        dispatch_timers().
-     */
+    mrp_mainloop_t *ml = t->ml;
+    mrp_timer_t    *last;
+    int             idx;
 
-    if (t != NULL) {
-        mark_deleted(t);
+    if ((idx = t->heapidx) < 0)
+        return;
+
+    t->heapidx = -1;
+    last       = ml->timers[--ml->ntimer];
+    ml->timers[ml->ntimer] = NULL;
 
-        if (t->ml->next_timer == t)
-            find_next_timer(t->ml);
+    if (last != t) {
+        heap_set(ml, idx, last);
+
+        if (idx > 0 && ml->timers[(idx - 1) / 2]->deadline > last->deadline)
+            heap_up(ml, idx);
+        else
+            heap_down(ml, idx);
     }
 }
 
 
-static inline void delete_timer(mrp_timer_t *t)
+static inline void update_timer(mrp_timer_t *t)
 {
-    mrp_list_delete(&t->hook);
-    mrp_list_append(&t->ml->deleted, &t->hook);
+    mrp_mainloop_t *ml  = t->ml;
+    int             idx = t->heapidx;
+
+    if (idx > 0 && ml->timers[(idx - 1) / 2]->deadline > t->deadline)
+        heap_up(ml, idx);
+    else
+        heap_down(ml, idx);
 }
 
 
-/*
- * deferred/idle callbacks
- */
+static inline mrp_timer_t *next_timer(mrp_mainloop_t *ml)
+{
+    return ml->ntimer > 0 ? ml->timers[0] : NULL;
+}
 
-mrp_deferred_t *mrp_add_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
-                                 void *user_data)
+
+static inline int rearm_timer(mrp_timer_t *t)
 {
-    mrp_deferred_t *d;
+    t->expire   = time_now() + t->usecs;
+    t->deadline = t->expire + t->slack;
+
+    if (t->heapidx >= 0) {
+        update_timer(t);
+        return TRUE;
+    }
+    else
+        return insert_timer(t);
+}
+
+
+mrp_timer_t *mrp_add_timer_usec(mrp_mainloop_t *ml, uint64_t usecs,
+                                mrp_timer_cb_t cb, void *user_data)
+{
+    mrp_timer_t *t;
 
     if (cb == NULL)
         return NULL;
 
-    if ((d = mrp_allocz(sizeof(*d))) != NULL) {
-        mrp_list_init(&d->hook);
-        d->ml        = ml;
-        d->cb        = cb;
-        d->user_data = user_data;
+    if ((t = pool_alloc(ml, MRP_MAINLOOP_POOL_TIMER)) != NULL) {
+        mrp_list_init(&t->hook);
+        t->free      = free_pooled;
+        t->ml        = ml;
+        t->expire    = time_now() + usecs;
+        t->deadline  = t->expire;
+        t->usecs     = usecs;
+        t->heapidx   = -1;
+        t->prio      = MRP_PRIORITY_NORMAL;
+        t->cb        = cb;
+        t->user_data = user_data;
 
-        mrp_list_append(&ml->deferred, &d->hook);
+        if (!insert_timer(t)) {
+            pool_free(t);
+            t = NULL;
+        }
     }
 
-    return d;
+    return t;
 }
 
 
-void mrp_del_deferred(mrp_deferred_t *d)
+mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
+                           mrp_timer_cb_t cb, void *user_data)
+{
+    return mrp_add_timer_usec(ml, (uint64_t)msecs * USECS_PER_MSEC,
+                              cb, user_data);
+}
+
+
+void mrp_mod_timer_usec(mrp_timer_t *t, uint64_t usecs)
 {
     /*
-     * Notes: It is not safe to simply free this entry here as we might
-     *        be dispatching with this entry being the next to process.
-     *        We just mark this here deleted and take care of the rest
-     *        in the dispatching loop.
+     * Notes: If the timer is being dispatched (it has expired during
+     *        this iteration but its callback has not been invoked yet),
+     *        we take it off the list of expired timers. Otherwise we
+     *        simply update its position in the heap.
      */
 
-    if (d != NULL)
-        mark_deleted(d);
-}
+    if (t != NULL && !is_deleted(t)) {
+        if (usecs != MRP_TIMER_RESTART_USEC)
+            t->usecs = usecs;
 
+        if (t->heapidx < 0)
+            mrp_list_delete(&t->hook);
 
-static inline void delete_deferred(mrp_deferred_t *d)
-{
-    mrp_list_delete(&d->hook);
-    mrp_list_append(&d->ml->deleted, &d->hook);
+        if (!rearm_timer(t))
+            mrp_log_error("Failed to rearm timer %p.", t);
+    }
 }
 
 
-void mrp_disable_deferred(mrp_deferred_t *d)
+void mrp_mod_timer(mrp_timer_t *t, unsigned int msecs)
 {
-    if (d != NULL)
-        d->inactive = TRUE;
+    if (msecs != MRP_TIMER_RESTART)
+        mrp_mod_timer_usec(t, (uint64_t)msecs * USECS_PER_MSEC);
+    else
+        mrp_mod_timer_usec(t, MRP_TIMER_RESTART_USEC);
 }
 
 
-static inline void disable_deferred(mrp_deferred_t *d)
+void mrp_set_timer_slack_usec(mrp_timer_t *t, uint64_t usecs)
 {
-    if (MRP_LIKELY(d->inactive)) {
+    if (t != NULL && !is_deleted(t)) {
+        t->slack    = usecs;
+        t->deadline = t->expire + t->slack;
+
+        if (t->heapidx >= 0)
+            update_timer(t);
+    }
+}
+
+
+void mrp_set_timer_slack(mrp_timer_t *t, unsigned int msecs)
+{
+    mrp_set_timer_slack_usec(t, (uint64_t)msecs * USECS_PER_MSEC);
+}
+
+
+int mrp_set_timer_priority(mrp_timer_t *t, mrp_priority_t prio)
+{
+    if (t == NULL || is_deleted(t) || prio < 0 || prio >= MRP_PRIORITY_MAX)
+        return FALSE;
+
+    t->prio = prio;
+
+    /* move it along if it has expired but has not been dispatched yet */
+    if (t->heapidx < 0 && !mrp_list_empty(&t->hook)) {
+        mrp_list_delete(&t->hook);
+        mrp_list_append(&t->ml->expired[prio], &t->hook);
+    }
+
+    return TRUE;
+}
+
+
+mrp_priority_t mrp_get_timer_priority(mrp_timer_t *t)
+{
+    return t != NULL ? t->prio : MRP_PRIORITY_NORMAL;
+}
+
+
+void mrp_del_timer(mrp_timer_t *t)
+{
+    /*
+     * Notes: It is not safe to simply free this entry here as we might
+     *        be dispatching with this entry being the next to process.
+     *        If the timer is armed we take it out of the heap and relink
+     *        it to the list of deleted items which will be then processed
+     *        at end of the mainloop iteration. Otherwise (the timer is on
+     *        the list of expired timers being dispatched) we only mark
+     *        this entry for deletion and the rest will be taken care of in
+     *        dispatch_timers().
+     */
+
+    if (t != NULL && !is_deleted(t)) {
+        mark_deleted(t);
+
+        if (t->heapidx >= 0) {
+            remove_timer(t);
+            mrp_list_append(&t->ml->deleted, &t->hook);
+        }
+    }
+}
+
+
+static inline void delete_timer(mrp_timer_t *t)
+{
+    mrp_list_delete(&t->hook);
+    mrp_list_append(&t->ml->deleted, &t->hook);
+}
+
+
+/*
+ * Notes:
+ *
+ *     By default the next timer expiration is turned into an epoll_wait
+ *     timeout, which has millisecond granularity. In high-resolution mode
+ *     we arm a timerfd with the absolute expiration time of the next timer
+ *     instead and let epoll wake us up through it. Since the timerfd is
+ *     only rearmed when the next expiration time changes, in the common
+ *     case of long-running periodic timers this costs no extra syscalls.
+ */
+
+static void dispatch_timerfd(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
+                             mrp_io_event_t events, void *user_data)
+{
+    uint64_t nexp;
+
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+    MRP_UNUSED(user_data);
+
+    if (read(fd, &nexp, sizeof(nexp)) == sizeof(nexp))
+        ml->timerfd_expire = 0;
+}
+
+
+static void arm_timerfd(mrp_mainloop_t *ml, uint64_t expire)
+{
+    struct itimerspec its;
+
+    if (expire == ml->timerfd_expire)
+        return;
+
+    mrp_clear(&its);
+    its.it_value.tv_sec  = expire / USECS_PER_SEC;
+    its.it_value.tv_nsec = (expire % USECS_PER_SEC) * NSECS_PER_USEC;
+
+    if (timerfd_settime(ml->timerfd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+        ml->timerfd_expire = expire;
+    else
+        ml->timerfd_expire = 0;
+}
+
+
+int mrp_mainloop_hires_timers(mrp_mainloop_t *ml, int enable)
+{
+    if (enable) {
+        if (ml->timerfd >= 0)
+            return TRUE;
+
+        ml->timerfd = timerfd_create(CLOCK_MONOTONIC,
+                                     TFD_NONBLOCK | TFD_CLOEXEC);
+
+        if (ml->timerfd < 0)
+            return FALSE;
+
+        ml->timerwatch = mrp_add_io_watch(ml, ml->timerfd, MRP_IO_EVENT_IN,
+                                          dispatch_timerfd, NULL);
+
+        if (ml->timerwatch == NULL) {
+            close(ml->timerfd);
+            ml->timerfd = -1;
+            return FALSE;
+        }
+
+        ml->timerfd_expire = 0;
+    }
+    else {
+        if (ml->timerfd < 0)
+            return TRUE;
+
+        mrp_del_io_watch(ml->timerwatch);
+        close(ml->timerfd);
+        ml->timerwatch = NULL;
+        ml->timerfd    = -1;
+    }
+
+    return TRUE;
+}
+
+
+/*
+ * deferred/idle callbacks
+ *
+ * Notes:
+ *
+ *     Enabled deferred callbacks are kept on per-priority lists and
+ *     disabled ones on a separate list, so disabled callbacks cost
+ *     nothing during dispatching. Callbacks are moved between the lists
+ *     right away when they are enabled, disabled or deleted. This is
+ *     safe even during dispatching, since dispatch_deferred() never
+ *     keeps a pointer to any other entry than the one it is calling.
+ */
+
+mrp_deferred_t *mrp_add_deferred(mrp_mainloop_t *ml, mrp_deferred_cb_t cb,
+                                 void *user_data)
+{
+    mrp_deferred_t *d;
+
+    if (cb == NULL)
+        return NULL;
+
+    if ((d = pool_alloc(ml, MRP_MAINLOOP_POOL_DEFERRED)) != NULL) {
+        mrp_list_init(&d->hook);
+        d->free      = free_pooled;
+        d->ml        = ml;
+        d->cb        = cb;
+        d->user_data = user_data;
+        d->prio      = MRP_PRIORITY_NORMAL;
+
+        mrp_list_append(&ml->deferred[d->prio], &d->hook);
+    }
+
+    return d;
+}
+
+
+static inline void delete_deferred(mrp_deferred_t *d)
+{
+    mrp_list_delete(&d->hook);
+    mrp_list_append(&d->ml->deleted, &d->hook);
+}
+
+
+void mrp_del_deferred(mrp_deferred_t *d)
+{
+    /*
+     * Notes: We might be dispatching this very entry, so we can't free
+     *        it here. We mark it deleted and relink it to the list of
+     *        deleted items which will be processed at the end of the
+     *        mainloop iteration.
+     */
+
+    if (d != NULL && !is_deleted(d)) {
+        mark_deleted(d);
+        delete_deferred(d);
+    }
+}
+
+
+void mrp_disable_deferred(mrp_deferred_t *d)
+{
+    if (d != NULL && !is_deleted(d) && !d->inactive) {
+        d->inactive = TRUE;
         mrp_list_delete(&d->hook);
         mrp_list_append(&d->ml->inactive_deferred, &d->hook);
     }
-
 }
 
 
 void mrp_enable_deferred(mrp_deferred_t *d)
 {
-    if (d != NULL) {
-        if (!is_deleted(d)) {
-            d->inactive = FALSE;
+    if (d != NULL && !is_deleted(d) && d->inactive) {
+        d->inactive = FALSE;
+        mrp_list_delete(&d->hook);
+        mrp_list_append(&d->ml->deferred[d->prio], &d->hook);
+    }
+}
+
+
+int mrp_set_deferred_priority(mrp_deferred_t *d, mrp_priority_t prio)
+{
+    if (d == NULL || is_deleted(d) || prio < 0 || prio >= MRP_PRIORITY_MAX)
+        return FALSE;
+
+    if (d->prio != prio) {
+        d->prio = prio;
+
+        if (!d->inactive) {
             mrp_list_delete(&d->hook);
-            mrp_list_append(&d->ml->deferred, &d->hook);
+            mrp_list_append(&d->ml->deferred[prio], &d->hook);
         }
     }
+
+    return TRUE;
+}
+
+
+mrp_priority_t mrp_get_deferred_priority(mrp_deferred_t *d)
+{
+    return d != NULL ? d->prio : MRP_PRIORITY_NORMAL;
+}
+
+
+static int have_deferred(mrp_mainloop_t *ml)
+{
+    int prio;
+
+    for (prio = 0; prio < MRP_PRIORITY_MAX; prio++)
+        if (!mrp_list_empty(&ml->deferred[prio]))
+            return TRUE;
+
+    return FALSE;
 }
 
 
@@ -671,8 +1388,9 @@ mrp_sighandler_t *mrp_add_sighandler(mrp_mainloop_t *ml, int signum,
     if (cb == NULL || ml->sigfd == -1)
         return NULL;
 
-    if ((s = mrp_allocz(sizeof(*s))) != NULL) {
+    if ((s = pool_alloc(ml, MRP_MAINLOOP_POOL_SIGHANDLER)) != NULL) {
         mrp_list_init(&s->hook);
+        s->free      = free_pooled;
         s->ml        = ml;
         s->signum    = signum;
         s->cb        = cb;
@@ -718,799 +1436,2806 @@ void mrp_del_sighandler(mrp_sighandler_t *h)
 
 
 /*
- * external mainloops we pump
+ * callbacks posted from other threads
+ *
+ * Notes:
+ *
+ *     Other threads push items to a lock-free LIFO stack, which we
+ *     then swap out in one go, reverse and dispatch in the mainloop
+ *     thread. Since we only ever take the whole stack, there is no
+ *     ABA problem to worry about. Only the thread that finds the stack
+ *     empty needs to kick the eventfd, so a burst of posts results in
+ *     a single wakeup and a single dispatch pass.
  */
 
-static int free_subloop(void *ptr)
+static void dispatch_posted(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
+                            mrp_io_event_t events, void *user_data)
 {
-    mrp_subloop_t *sl = (mrp_subloop_t *)ptr;
-
-    mrp_free(sl->pollfds);
-    mrp_free(sl->events);
-    mrp_free(sl);
+    posted_t *p, *prev, *next;
+    uint64_t  cnt;
 
-    return TRUE;
-}
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+    MRP_UNUSED(user_data);
 
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        mrp_log_error("Failed to read mainloop wakeup fd (%d: %s).",
+                      errno, strerror(errno));
 
-static void subloop_event_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
-                             mrp_io_event_t events, void *user_data)
-{
-    mrp_subloop_t *sl = (mrp_subloop_t *)user_data;
+    p = __atomic_exchange_n(&ml->posted, NULL, __ATOMIC_ACQUIRE);
 
-    MRP_UNUSED(ml);
-    MRP_UNUSED(w);
-    MRP_UNUSED(fd);
-    MRP_UNUSED(events);
+    for (prev = NULL; p != NULL; p = next) {
+        next    = p->next;
+        p->next = prev;
+        prev    = p;
+    }
 
-    sl->poll = TRUE;
+    for (p = prev; p != NULL; p = next) {
+        next = p->next;
+        p->cb(ml, p->user_data);
+        mrp_free(p);
+    }
 }
 
 
-mrp_subloop_t *mrp_add_subloop(mrp_mainloop_t *ml, mrp_subloop_ops_t *ops,
-                               void *user_data)
+static int setup_wakeup(mrp_mainloop_t *ml)
 {
-    mrp_subloop_t *sl;
+    ml->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-    if (ops == NULL || user_data == NULL)
-        return NULL;
+    if (ml->wakefd < 0)
+        return FALSE;
 
-    if ((sl = mrp_allocz(sizeof(*sl))) != NULL) {
-        mrp_list_init(&sl->hook);
-        sl->free      = free_subloop;
-        sl->cb        = ops;
-        sl->user_data = user_data;
-        sl->epollfd   = epoll_create1(EPOLL_CLOEXEC);
+    ml->wakewatch = mrp_add_io_watch(ml, ml->wakefd, MRP_IO_EVENT_IN,
+                                     dispatch_posted, NULL);
 
-        if (sl->epollfd < 0) {
-            mrp_free(sl);
-            return NULL;
-        }
+    if (ml->wakewatch == NULL) {
+        close(ml->wakefd);
+        ml->wakefd = -1;
+        return FALSE;
+    }
 
-        sl->w = mrp_add_io_watch(ml, sl->epollfd, MRP_IO_EVENT_IN,
-                                 subloop_event_cb, sl);
+    return TRUE;
+}
 
-        if (sl->w == NULL) {
-            close(sl->epollfd);
-            mrp_free(sl);
-            return NULL;
-        }
 
-        mrp_list_append(&ml->subloops, &sl->hook);
+static void purge_posted(mrp_mainloop_t *ml)
+{
+    posted_t *p, *next;
+
+    p = __atomic_exchange_n(&ml->posted, NULL, __ATOMIC_ACQUIRE);
+
+    for ( ; p != NULL; p = next) {
+        next = p->next;
+        mrp_free(p);
     }
+}
 
-    return sl;
+
+int mrp_mainloop_wakeup(mrp_mainloop_t *ml)
+{
+    uint64_t one = 1;
+
+    return write(ml->wakefd, &one, sizeof(one)) == sizeof(one) ||
+        errno == EAGAIN;
 }
 
 
-void mrp_del_subloop(mrp_subloop_t *sl)
+int mrp_mainloop_post(mrp_mainloop_t *ml, mrp_post_cb_t cb, void *user_data)
 {
-    mrp_mainloop_t     *ml;
-    struct epoll_event  dummy;
-    int                 i;
+    posted_t *p, *head;
 
-    /*
-     * Notes: It is not safe to free the loop here as there might be
-     *        a delivered but unprocessed epoll event with a pointers
-     *        to the loops pollfds. However, since we do not dispatch
-     *        loops by traversing the list of loops, it is safe to relink
-     *        it to the list of data structures to be deleted at the
-     *        end of the next main loop iteration. So we just remove the
-     *        pollfds from epoll, mark this as deleted and relink it.
-     */
+    if (cb == NULL)
+        return FALSE;
 
-    if (sl != NULL && !is_deleted(sl)) {
-        ml = sl->w->ml;
-        mrp_del_io_watch(sl->w);
+    if ((p = mrp_allocz(sizeof(*p))) == NULL)
+        return FALSE;
 
-        for (i = 0; i < sl->npollfd; i++)
-            epoll_ctl(sl->epollfd, EPOLL_CTL_DEL, sl->pollfds[i].fd, &dummy);
+    p->cb        = cb;
+    p->user_data = user_data;
 
-        close(sl->epollfd);
-        sl->epollfd = -1;
+    head = __atomic_load_n(&ml->posted, __ATOMIC_RELAXED);
+    do {
+        p->next = head;
+    } while (!__atomic_compare_exchange_n(&ml->posted, &head, p, TRUE,
+                                          __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
 
-        mark_deleted(sl);
-        mrp_list_delete(&sl->hook);
-        mrp_list_append(&ml->deleted, &sl->hook);
-    }
+    if (head == NULL)
+        return mrp_mainloop_wakeup(ml);
+    else
+        return TRUE;
 }
 
 
 /*
- * external mainloop that pumps us
+ * default worker pool
  */
 
-static void super_io_cb(void *super_data, void *id, int fd,
-                        mrp_io_event_t events, void *user_data)
+mrp_workpool_t *mrp_mainloop_get_workpool(mrp_mainloop_t *ml)
 {
-    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
-    mrp_superloop_ops_t *ops = ml->super_ops;
+    if (ml->workpool == NULL)
+        ml->workpool = mrp_workpool_create(ml, "mainloop", 0);
 
-    MRP_UNUSED(super_data);
-    MRP_UNUSED(id);
-    MRP_UNUSED(fd);
-    MRP_UNUSED(events);
-
-    ml->super_events |= MRP_SUPER_EVENT_IO;
-    ops->mod_defer(ml->super_data, ml->work, TRUE);
+    return ml->workpool;
 }
 
 
-static void super_timer_cb(void *super_data, void *id, void *user_data)
+/*
+ * io_uring backend
+ *
+ * Notes:
+ *
+ *     When enabled, we poll with io_uring instead of epoll_wait. Our
+ *     epoll fd is added to the ring as a poll request, so readiness of
+ *     ordinary I/O watches is still handled through epoll, while the
+ *     completion-based I/O requests (mrp_io_read() and friends) are
+ *     executed by the kernel directly. Queued requests get submitted by
+ *     the same io_uring_enter() call we use for waiting, so a transport
+ *     using completion-based I/O needs a single syscall per iteration
+ *     instead of an epoll_wait() followed by one or more reads.
+ */
+
+#ifdef URING_ENABLED
+
+static inline int uring_enter(uring_t *u, unsigned int nsubmit,
+                              unsigned int nwait, int timeout)
 {
-    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
-    mrp_superloop_ops_t *ops = ml->super_ops;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec      ts;
+    unsigned int                  flags;
+    int                           n;
+
+    flags = nwait ? IORING_ENTER_GETEVENTS : 0;
+
+    mrp_clear(&arg);
+    if (timeout >= 0 && nwait) {
+        ts.tv_sec  = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000LL;
+        arg.ts     = (uint64_t)(uintptr_t)&ts;
+    }
 
-    MRP_UNUSED(super_data);
-    MRP_UNUSED(id);
+    n = syscall(__NR_io_uring_enter, u->fd, nsubmit, nwait,
+                flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    u->stats->nenter++;
 
-    ml->super_events |= MRP_SUPER_EVENT_TIMER;
-    ops->mod_defer(ml->super_data, ml->work, TRUE);
+    if (n > 0)
+        u->nsqe -= MRP_MIN((unsigned int)n, u->nsqe);
+
+    return n;
 }
 
 
-static void super_work_cb(void *super_data, void *id, void *user_data)
+static struct io_uring_sqe *uring_get_sqe(uring_t *u)
 {
-    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
-    mrp_superloop_ops_t *ops = ml->super_ops;
-    unsigned int         timeout;
-
-    MRP_UNUSED(super_data);
-    MRP_UNUSED(id);
+    struct io_uring_sqe *sqe;
+    unsigned int         head, tail;
 
-    mrp_mainloop_poll(ml, FALSE);
-    mrp_mainloop_dispatch(ml);
+    head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    tail = *u->sq_tail;
 
-    if (!ml->quit) {
-        mrp_mainloop_prepare(ml);
+    if (tail - head >= u->entries) {
+        uring_enter(u, u->nsqe, 0, 0);
 
-        /*
-         * Notes:
-         *
-         *     Some mainloop abstractions (eg. the one in PulseAudio)
-         *     have deferred callbacks that starve all other event
-         *     processing until no more deferred callbacks are pending.
-         *     For this reason, we cannot map our deferred callbacks
-         *     directly to superloop deferred callbacks (in some cases
-         *     this could starve the superloop indefinitely). Hence, if
-         *     we have enabled deferred callbacks, we arm our timer with
-         *     0 timeout to let the superloop do one round of its event
-         *     processing.
-         */
+        head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
 
-        timeout = mrp_list_empty(&ml->deferred) ? ml->poll_timeout : 0;
-        ops->mod_timer(ml->super_data, ml->timer, timeout);
-        ops->mod_defer(ml->super_data, ml->work, FALSE);
+        if (tail - head >= u->entries)
+            return NULL;
     }
-    else {
-        ops->del_io(ml->super_data, ml->iow);
-        ops->del_timer(ml->super_data, ml->timer);
-        ops->del_defer(ml->super_data, ml->work);
 
-        ml->iow   = NULL;
-        ml->timer = NULL;
-        ml->work  = NULL;
-    }
+    sqe = u->sqes + (tail & *u->sq_mask);
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
 }
 
 
-int mrp_set_superloop(mrp_mainloop_t *ml, mrp_superloop_ops_t *ops,
-                      void *loop_data)
+static void uring_queue_sqe(uring_t *u, struct io_uring_sqe *sqe)
 {
-    mrp_io_event_t events;
-    int            timeout;
+    unsigned int tail = *u->sq_tail;
 
-    if (ml->super_ops == NULL) {
-        ml->super_ops  = ops;
-        ml->super_data = loop_data;
+    u->sq_array[tail & *u->sq_mask] = sqe - u->sqes;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->nsqe++;
+}
 
-        mrp_mainloop_prepare(ml);
 
-        events    = MRP_IO_EVENT_IN | MRP_IO_EVENT_OUT | MRP_IO_EVENT_HUP;
-        ml->iow   = ops->add_io(ml->super_data, ml->epollfd, events,
-                                super_io_cb, ml);
-        ml->work  = ops->add_defer(ml->super_data, super_work_cb, ml);
+static int uring_submit_req(mrp_mainloop_t *ml, mrp_io_req_t *req, int poll);
+
+static void uring_reap(mrp_mainloop_t *ml)
+{
+    uring_t             *u = ml->uring;
+    struct io_uring_cqe *cqe;
+    mrp_io_req_t        *req;
+    unsigned int         head, tail;
+
+    head = *u->cq_head;
+    tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        cqe = u->cqes + (head & *u->cq_mask);
+        head++;
+
+        if (cqe->user_data == URING_EPOLL_TAG) {
+            u->epoll_armed = FALSE;
+            u->epoll_ready = TRUE;
+            continue;
+        }
+
+        if (cqe->user_data == URING_CANCEL_TAG ||
+            cqe->user_data &  URING_POLL_BIT)
+            continue;
+
+        req = (mrp_io_req_t *)(uintptr_t)cqe->user_data;
+
+        req->inflight = FALSE;
+        req->result   = cqe->res;
+        u->ninflight--;
 
         /*
-         * Notes:
-         *
-         *     Some mainloop abstractions (eg. the one in PulseAudio)
-         *     have deferred callbacks that starve all other event
-         *     processing until no more deferred callbacks are pending.
-         *     For this reason, we cannot map our deferred callbacks
-         *     directly to superloop deferred callbacks (in some cases
-         *     this could starve the superloop indefinitely). Hence, if
-         *     we have enabled deferred callbacks, we arm our timer with
-         *     0 timeout to let the superloop do one round of its event
-         *     processing.
+         * Notes: Older kernels honour O_NONBLOCK for requests on sockets
+         *        and fail with -EAGAIN instead of waiting for readiness.
+         *        We resubmit these with a linked poll in front of them.
          */
 
-        timeout   = mrp_list_empty(&ml->deferred) ? ml->poll_timeout : 0;
-        ml->timer = ops->add_timer(ml->super_data, timeout, super_timer_cb, ml);
+        if (cqe->res == -EAGAIN && !is_deleted(req) &&
+            uring_submit_req(ml, req, TRUE))
+            continue;
 
-        if (ml->iow != NULL && ml->timer != NULL && ml->work != NULL)
-            return TRUE;
+        mrp_list_delete(&req->hook);
+
+        if (is_deleted(req))
+            mrp_list_append(&ml->deleted, &req->hook);
         else
-            mrp_clear_superloop(ml, ops, loop_data);
+            mrp_list_append(&ml->io_done, &req->hook);
     }
 
-    return FALSE;
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
 }
 
 
-int mrp_clear_superloop(mrp_mainloop_t *ml, mrp_superloop_ops_t *ops,
-                        void *loop_data)
+static int uring_submit_req(mrp_mainloop_t *ml, mrp_io_req_t *req, int poll)
 {
-    if (ml->super_ops == ops && ml->super_data == loop_data) {
-        if (ml->iow != NULL)
-            ops->del_io(ml->super_data, ml->iow);
+    uring_t             *u = ml->uring;
+    struct io_uring_sqe *sqe;
 
-        ml->super_ops  = NULL;
-        ml->super_data = NULL;
+    if (poll) {
+        if ((sqe = uring_get_sqe(u)) == NULL)
+            return FALSE;
 
-        return TRUE;
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = req->fd;
+        sqe->flags         = IOSQE_IO_LINK;
+        sqe->user_data     = (uint64_t)(uintptr_t)req | URING_POLL_BIT;
+
+        if (req->type == IO_REQ_READ || req->type == IO_REQ_RECVMSG)
+            sqe->poll32_events = POLLIN;
+        else
+            sqe->poll32_events = POLLOUT;
+
+        uring_queue_sqe(u, sqe);
     }
-    else
+
+    if ((sqe = uring_get_sqe(u)) == NULL)
         return FALSE;
-}
 
+    sqe->fd        = req->fd;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+
+    switch (req->type) {
+    case IO_REQ_READ:
+        sqe->opcode = IORING_OP_READ;
+        sqe->addr   = (uint64_t)(uintptr_t)req->buf;
+        sqe->len    = req->size;
+        sqe->off    = (uint64_t)-1;
+        break;
+    case IO_REQ_WRITE:
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->addr   = (uint64_t)(uintptr_t)req->buf;
+        sqe->len    = req->size;
+        sqe->off    = (uint64_t)-1;
+        break;
+    case IO_REQ_RECVMSG:
+        sqe->opcode    = IORING_OP_RECVMSG;
+        sqe->addr      = (uint64_t)(uintptr_t)req->msg;
+        sqe->len       = 1;
+        sqe->msg_flags = req->flags;
+        break;
+    case IO_REQ_SENDMSG:
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->addr      = (uint64_t)(uintptr_t)req->msg;
+        sqe->len       = 1;
+        sqe->msg_flags = req->flags;
+        break;
+    }
 
+    uring_queue_sqe(u, sqe);
 
-/*
- * mainloop
- */
+    req->inflight = TRUE;
+    req->polled   = poll;
+    u->ninflight++;
 
-static void purge_io_watches(mrp_mainloop_t *ml)
-{
-    mrp_list_hook_t *p, *n, *sp, *sn;
-    mrp_io_watch_t  *w, *s;
+    return TRUE;
+}
 
-    mrp_list_foreach(&ml->iowatches, p, n) {
-        w = mrp_list_entry(p, typeof(*w), hook);
-        mrp_list_delete(&w->hook);
 
-        mrp_list_foreach(&w->slave, sp, sn) {
-            s = mrp_list_entry(sp, typeof(*s), slave);
-            mrp_list_delete(&s->slave);
-            mrp_free(s);
-        }
+static void uring_queue_cancel(uring_t *u, mrp_io_req_t *req)
+{
+    struct io_uring_sqe *sqe;
 
-        mrp_free(w);
+    if ((sqe = uring_get_sqe(u)) != NULL) {
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->addr      = (uint64_t)(uintptr_t)req;
+        sqe->user_data = URING_CANCEL_TAG;
+        uring_queue_sqe(u, sqe);
+    }
+
+    if (req->polled && (sqe = uring_get_sqe(u)) != NULL) {
+        sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+        sqe->addr      = (uint64_t)(uintptr_t)req | URING_POLL_BIT;
+        sqe->user_data = URING_CANCEL_TAG;
+        uring_queue_sqe(u, sqe);
     }
 }
 
 
-static void purge_timers(mrp_mainloop_t *ml)
+static void uring_cancel_req(mrp_mainloop_t *ml, mrp_io_req_t *req)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t;
+    uring_t *u = ml->uring;
 
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
-        mrp_list_delete(&t->hook);
-        mrp_free(t);
+    /*
+     * Notes: We wait for the canceled request to complete, so that
+     *        once we return the kernel is not going to touch its buffers
+     *        any more and the caller is free to release them.
+     */
+
+    uring_queue_cancel(u, req);
+
+    while (req->inflight) {
+        if (uring_enter(u, u->nsqe, 1, -1) < 0 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY) {
+            mrp_log_error("Failed to cancel I/O request %p (%d: %s).", req,
+                          errno, strerror(errno));
+            break;
+        }
+
+        uring_reap(ml);
     }
 }
 
 
-static void purge_deferred(mrp_mainloop_t *ml)
+static void uring_cancel_all(mrp_mainloop_t *ml)
 {
+    uring_t         *u = ml->uring;
     mrp_list_hook_t *p, *n;
-    mrp_deferred_t  *d;
+    mrp_io_req_t    *req;
 
-    mrp_list_foreach(&ml->deferred, p, n) {
-        d = mrp_list_entry(p, typeof(*d), hook);
-        mrp_list_delete(&d->hook);
-        mrp_free(d);
+    /*
+     * Notes: Closing the ring does not wait for requests in flight, so
+     *        the kernel could still write into buffers whose owners have
+     *        already freed them. Cancel all requests and reap every one
+     *        of them before the ring and the requests are torn down.
+     *        Marking them deleted keeps uring_reap() from resubmitting.
+     */
+
+    if (u == NULL)
+        return;
+
+    mrp_list_foreach(&ml->io_pending, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+
+        if (req->inflight) {
+            mark_deleted(req);
+            uring_queue_cancel(u, req);
+        }
     }
 
-    mrp_list_foreach(&ml->inactive_deferred, p, n) {
-        d = mrp_list_entry(p, typeof(*d), hook);
-        mrp_list_delete(&d->hook);
-        mrp_free(d);
+    while (u->ninflight > 0) {
+        if (uring_enter(u, u->nsqe, 1, -1) < 0 && errno != EINTR &&
+            errno != EAGAIN && errno != EBUSY) {
+            mrp_log_error("Failed to cancel %d pending I/O requests "
+                          "(%d: %s).", u->ninflight, errno, strerror(errno));
+            break;
+        }
+
+        uring_reap(ml);
     }
 }
 
 
-static void purge_sighandlers(mrp_mainloop_t *ml)
+static int uring_poll(mrp_mainloop_t *ml, int timeout)
 {
-    mrp_list_hook_t  *p, *n;
-    mrp_sighandler_t *s;
+    uring_t             *u = ml->uring;
+    struct io_uring_sqe *sqe;
+    int                  n;
+
+    if (!u->epoll_armed && (sqe = uring_get_sqe(u)) != NULL) {
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->fd            = ml->epollfd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data     = URING_EPOLL_TAG;
+        uring_queue_sqe(u, sqe);
+
+        u->epoll_armed = TRUE;
+    }
 
-    mrp_list_foreach(&ml->sighandlers, p, n) {
-        s = mrp_list_entry(p, typeof(*s), hook);
-        mrp_list_delete(&s->hook);
-        mrp_free(s);
+    if (timeout != 0 || u->nsqe > 0) {
+        if (uring_enter(u, u->nsqe, timeout ? 1 : 0, timeout) < 0 &&
+            errno != EINTR && errno != ETIME && errno != EAGAIN &&
+            errno != EBUSY)
+            mrp_log_error("io_uring_enter failed (%d: %s).",
+                          errno, strerror(errno));
     }
-}
 
+    uring_reap(ml);
 
-static void purge_deleted(mrp_mainloop_t *ml)
-{
-    mrp_list_hook_t *p, *n;
-    deleted_t       *d;
+    if (u->epoll_ready || timeout == 0) {
+        u->epoll_ready = FALSE;
 
-    mrp_list_foreach(&ml->deleted, p, n) {
-        d = mrp_list_entry(p, typeof(*d), hook);
-        mrp_list_delete(&d->hook);
-        if (d->free == NULL)
-            mrp_free(d);
-        else {
-            if (!d->free(d)) {
-                mrp_log_error("Failed to free purged item %p.", d);
-                mrp_list_prepend(p, &d->hook);
-            }
-        }
+        n = epoll_wait(ml->epollfd, ml->events, ml->nevent, 0);
+        ml->io_stats.npoll++;
+
+        if (n < 0)
+            n = 0;
     }
+    else
+        n = 0;
+
+    return n;
 }
 
 
-static void purge_subloops(mrp_mainloop_t *ml)
+static void uring_destroy(uring_t *u)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_subloop_t   *sl;
+    if (u == NULL)
+        return;
 
-    mrp_list_foreach(&ml->subloops, p, n) {
-        sl = mrp_list_entry(p, typeof(*sl), hook);
-        mrp_list_delete(&sl->hook);
-        free_subloop(sl);
-    }
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED &&
+        u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_size);
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_size);
+    if (u->fd >= 0)
+        close(u->fd);
+
+    mrp_free(u);
 }
 
 
-mrp_mainloop_t *mrp_mainloop_create(void)
+static uring_t *uring_create(void)
 {
-    mrp_mainloop_t *ml;
+    struct io_uring_params  p;
+    uring_t                *u;
+    void                   *sq, *cq;
 
-    if ((ml = mrp_allocz(sizeof(*ml))) != NULL) {
-        ml->epollfd = epoll_create1(EPOLL_CLOEXEC);
-        ml->sigfd   = -1;
+    if ((u = mrp_allocz(sizeof(*u))) == NULL)
+        return NULL;
 
-        if (ml->epollfd >= 0) {
-            mrp_list_init(&ml->iowatches);
-            mrp_list_init(&ml->timers);
-            mrp_list_init(&ml->deferred);
-            mrp_list_init(&ml->inactive_deferred);
-            mrp_list_init(&ml->sighandlers);
-            mrp_list_init(&ml->deleted);
-            mrp_list_init(&ml->subloops);
+    mrp_clear(&p);
+    u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
 
-            if (!setup_sighandlers(ml)) {
-                close(ml->epollfd);
-                goto fail;
-            }
+    if (u->fd < 0)
+        goto fail;
 
-        }
-        else {
-        fail:
-            mrp_free(ml);
-            ml = NULL;
-        }
+    if (!(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = EOPNOTSUPP;
+        goto fail;
     }
 
-    return ml;
+    u->entries = p.sq_entries;
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        u->sq_size = u->cq_size = MRP_MAX(u->sq_size, u->cq_size);
+
+    sq = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->sq_ring = sq;
+
+    if (sq == MAP_FAILED)
+        goto fail;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        cq = sq;
+    else
+        cq = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->cq_ring = cq;
+
+    if (cq == MAP_FAILED)
+        goto fail;
+
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes      = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+
+    if (u->sqes == MAP_FAILED)
+        goto fail;
+
+    u->sq_head  = sq + p.sq_off.head;
+    u->sq_tail  = sq + p.sq_off.tail;
+    u->sq_mask  = sq + p.sq_off.ring_mask;
+    u->sq_array = sq + p.sq_off.array;
+    u->cq_head  = cq + p.cq_off.head;
+    u->cq_tail  = cq + p.cq_off.tail;
+    u->cq_mask  = cq + p.cq_off.ring_mask;
+    u->cqes     = cq + p.cq_off.cqes;
+
+    return u;
+
+ fail:
+    mrp_log_warning("io_uring is not available (%d: %s).", errno,
+                    strerror(errno));
+    uring_destroy(u);
+
+    return NULL;
 }
 
+#else /* !URING_ENABLED */
 
-void mrp_mainloop_destroy(mrp_mainloop_t *ml)
+static inline void uring_reap(mrp_mainloop_t *ml)
 {
-    if (ml != NULL) {
-        purge_io_watches(ml);
-        purge_timers(ml);
-        purge_deferred(ml);
-        purge_sighandlers(ml);
-        purge_subloops(ml);
-        purge_deleted(ml);
+    MRP_UNUSED(ml);
+}
 
 
-        mrp_free(ml->events);
-        mrp_free(ml);
-    }
+static inline int uring_submit_req(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                                   int poll)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(req);
+    MRP_UNUSED(poll);
+
+    return FALSE;
 }
 
 
-static int prepare_subloop(mrp_subloop_t *sl)
+static inline void uring_cancel_req(mrp_mainloop_t *ml, mrp_io_req_t *req)
 {
-    /*
-     * Notes:
-     *
-     *     If we have a relatively large number of file descriptors to
-     *     poll but typically only a small fraction of them has pending
-     *     events per mainloop iteration epoll has significant advantages
-     *     over poll. This is the main reason why our mainloop uses epoll.
-     *     However, there is a considerable amount of pain one needs to
-     *     go through to integrate an external poll-based (sub-)mainloop
-     *     (e.g. glib's GMainLoop) with an epoll-based mainloop. I mean,
-     *     just look at the code below !
-     *
-     *     If it eventually turns out that we typically only have a small
-     *     number of file descriptors while at the same time we practically
-     *     always need to pump GMainLoop, it is probably a good idea to
-     *     bite the bullet and change our mainloop to be poll-based as well.
-     *     But let's not go there yet...
-     */
+    MRP_UNUSED(ml);
+    MRP_UNUSED(req);
+}
+
+
+static inline void uring_cancel_all(mrp_mainloop_t *ml)
+{
+    MRP_UNUSED(ml);
+}
+
+
+static inline int uring_poll(mrp_mainloop_t *ml, int timeout)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(timeout);
+
+    return 0;
+}
+
+
+static inline void uring_destroy(uring_t *u)
+{
+    MRP_UNUSED(u);
+}
+
+
+static inline uring_t *uring_create(void)
+{
+    mrp_log_warning("io_uring support is not compiled in.");
+
+    return NULL;
+}
+
+#endif /* !URING_ENABLED */
+
+
+int mrp_mainloop_use_uring(mrp_mainloop_t *ml, int enable)
+{
+    if (enable) {
+        if (ml->uring != NULL)
+            return TRUE;
+
+        if (ml->super_ops != NULL)
+            return FALSE;
+
+        if ((ml->uring = uring_create()) == NULL)
+            return FALSE;
+
+        ml->uring->stats = &ml->io_stats;
+
+        return TRUE;
+    }
+    else {
+        if (ml->uring == NULL)
+            return TRUE;
+
+        if (ml->uring->ninflight > 0)
+            return FALSE;
+
+        uring_destroy(ml->uring);
+        ml->uring = NULL;
+
+        return TRUE;
+    }
+}
+
+
+/*
+ * completion-based I/O requests
+ *
+ * Notes:
+ *
+ *     Without io_uring, requests are emulated with an I/O watch and
+ *     a non-blocking syscall once the file descriptor becomes ready.
+ */
+
+static void delete_io_req(mrp_io_req_t *req)
+{
+    mark_deleted(req);
+    mrp_list_delete(&req->hook);
+    mrp_list_append(&req->ml->deleted, &req->hook);
+}
+
+
+static ssize_t do_io_req(mrp_io_req_t *req)
+{
+    ssize_t n;
+
+    switch (req->type) {
+    case IO_REQ_READ:
+        n = read(req->fd, req->buf, req->size);
+        break;
+    case IO_REQ_WRITE:
+        n = write(req->fd, req->buf, req->size);
+        break;
+    case IO_REQ_RECVMSG:
+        n = recvmsg(req->fd, req->msg, req->flags);
+        break;
+    case IO_REQ_SENDMSG:
+        n = sendmsg(req->fd, req->msg, req->flags);
+        break;
+    default:
+        n     = -1;
+        errno = EINVAL;
+    }
+
+    return n < 0 ? -errno : n;
+}
+
+
+static void io_req_ready(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
+                         mrp_io_event_t events, void *user_data)
+{
+    mrp_io_req_t *req = (mrp_io_req_t *)user_data;
+
+    MRP_UNUSED(fd);
+    MRP_UNUSED(events);
+
+    req->result = do_io_req(req);
+    ml->io_stats.nemulated++;
+
+    if (req->result == -EAGAIN || req->result == -EINTR)
+        return;
+
+    mrp_del_io_watch(w);
+    req->w = NULL;
+
+    INSTRUMENTED_CALL(ml, PROFILE_IOREQ, req->cb,
+                      req->cb(ml, req, req->result, req->user_data));
+
+    if (!is_deleted(req))
+        delete_io_req(req);
+}
+
+
+static mrp_io_req_t *submit_io_req(mrp_mainloop_t *ml, io_req_type_t type,
+                                   int fd, void *buf, size_t size,
+                                   struct msghdr *msg, int flags,
+                                   mrp_io_req_cb_t cb, void *user_data)
+{
+    mrp_io_req_t   *req;
+    mrp_io_event_t  events;
+
+    if (fd < 0 || cb == NULL)
+        return NULL;
+
+    if ((req = mrp_allocz(sizeof(*req))) == NULL)
+        return NULL;
+
+    mrp_list_init(&req->hook);
+    req->ml        = ml;
+    req->type      = type;
+    req->fd        = fd;
+    req->buf       = buf;
+    req->size      = size;
+    req->msg       = msg;
+    req->flags     = flags;
+    req->cb        = cb;
+    req->user_data = user_data;
+
+    ml->io_stats.nreq++;
+
+    if (ml->uring != NULL) {
+        if (!uring_submit_req(ml, req, FALSE))
+            goto fail;
+    }
+    else {
+        if (type == IO_REQ_READ || type == IO_REQ_RECVMSG)
+            events = MRP_IO_EVENT_IN;
+        else
+            events = MRP_IO_EVENT_OUT;
+
+        req->w = mrp_add_io_watch(ml, fd, events, io_req_ready, req);
+
+        if (req->w == NULL)
+            goto fail;
+    }
+
+    mrp_list_append(&ml->io_pending, &req->hook);
+
+    return req;
+
+ fail:
+    mrp_free(req);
+    return NULL;
+}
+
+
+mrp_io_req_t *mrp_io_read(mrp_mainloop_t *ml, int fd, void *buf, size_t size,
+                          mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IO_REQ_READ, fd, buf, size, NULL, 0,
+                         cb, user_data);
+}
+
+
+mrp_io_req_t *mrp_io_write(mrp_mainloop_t *ml, int fd, const void *buf,
+                           size_t size, mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IO_REQ_WRITE, fd, (void *)buf, size, NULL, 0,
+                         cb, user_data);
+}
+
+
+mrp_io_req_t *mrp_io_recvmsg(mrp_mainloop_t *ml, int fd, struct msghdr *msg,
+                             int flags, mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IO_REQ_RECVMSG, fd, NULL, 0, msg, flags,
+                         cb, user_data);
+}
+
+
+mrp_io_req_t *mrp_io_sendmsg(mrp_mainloop_t *ml, int fd, struct msghdr *msg,
+                             int flags, mrp_io_req_cb_t cb, void *user_data)
+{
+    return submit_io_req(ml, IO_REQ_SENDMSG, fd, NULL, 0, msg, flags,
+                         cb, user_data);
+}
+
+
+void mrp_io_cancel(mrp_io_req_t *req)
+{
+    if (req == NULL || is_deleted(req))
+        return;
+
+    if (req->w != NULL) {
+        mrp_del_io_watch(req->w);
+        req->w = NULL;
+    }
+
+    mark_deleted(req);
+
+    if (req->inflight)
+        uring_cancel_req(req->ml, req);
+
+    if (!req->inflight)
+        delete_io_req(req);
+}
+
+
+int mrp_io_req_native(mrp_mainloop_t *ml)
+{
+    return ml->uring != NULL;
+}
+
+
+int mrp_mainloop_io_stats(mrp_mainloop_t *ml, mrp_io_stats_t *stats)
+{
+    if (ml == NULL || stats == NULL)
+        return FALSE;
+
+    *stats = ml->io_stats;
+
+    return TRUE;
+}
+
+
+static void dispatch_io_reqs(mrp_mainloop_t *ml)
+{
+    mrp_io_req_t *req;
+
+    while (!mrp_list_empty(&ml->io_done)) {
+        req = mrp_list_entry(ml->io_done.next, typeof(*req), hook);
+
+        if (!is_deleted(req))
+            INSTRUMENTED_CALL(ml, PROFILE_IOREQ, req->cb,
+                              req->cb(ml, req, req->result, req->user_data));
+
+        delete_io_req(req);
+
+        if (ml->quit)
+            break;
+    }
+}
+
+
+static void purge_io_reqs(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_io_req_t    *req;
+
+    mrp_list_foreach(&ml->io_pending, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+        mrp_list_delete(&req->hook);
+        mrp_free(req);
+    }
+
+    mrp_list_foreach(&ml->io_done, p, n) {
+        req = mrp_list_entry(p, typeof(*req), hook);
+        mrp_list_delete(&req->hook);
+        mrp_free(req);
+    }
+}
+
+
+/*
+ * external mainloops we pump
+ */
+
+static int free_subloop(void *ptr)
+{
+    mrp_subloop_t *sl = (mrp_subloop_t *)ptr;
+
+    mrp_free(sl->pollfds);
+    mrp_free(sl->qfds);
+    mrp_free(sl->fdtab);
+    mrp_free(sl->events);
+    mrp_free(sl);
+
+    return TRUE;
+}
+
+
+static void subloop_event_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
+                             mrp_io_event_t events, void *user_data)
+{
+    mrp_subloop_t *sl = (mrp_subloop_t *)user_data;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(w);
+    MRP_UNUSED(fd);
+    MRP_UNUSED(events);
+
+    sl->poll = TRUE;
+}
+
+
+mrp_subloop_t *mrp_add_subloop(mrp_mainloop_t *ml, mrp_subloop_ops_t *ops,
+                               void *user_data)
+{
+    mrp_subloop_t *sl;
+
+    if (ops == NULL || user_data == NULL)
+        return NULL;
+
+    if ((sl = mrp_allocz(sizeof(*sl))) != NULL) {
+        mrp_list_init(&sl->hook);
+        sl->free      = free_subloop;
+        sl->cb        = ops;
+        sl->user_data = user_data;
+        sl->epollfd   = epoll_create1(EPOLL_CLOEXEC);
+
+        if (sl->epollfd < 0) {
+            mrp_free(sl);
+            return NULL;
+        }
+
+        sl->w = mrp_add_io_watch(ml, sl->epollfd, MRP_IO_EVENT_IN,
+                                 subloop_event_cb, sl);
+
+        if (sl->w == NULL) {
+            close(sl->epollfd);
+            mrp_free(sl);
+            return NULL;
+        }
+
+        mrp_list_append(&ml->subloops, &sl->hook);
+    }
+
+    return sl;
+}
+
+
+void mrp_del_subloop(mrp_subloop_t *sl)
+{
+    mrp_mainloop_t *ml;
+
+    /*
+     * Notes: It is not safe to free the loop here as there might be
+     *        a delivered but unprocessed epoll event with a pointers
+     *        to the loops pollfds. However, since we do not dispatch
+     *        loops by traversing the list of loops, it is safe to relink
+     *        it to the list of data structures to be deleted at the
+     *        end of the next main loop iteration. So we just close the
+     *        epollfd (which removes all the pollfds), mark this as
+     *        deleted and relink it.
+     */
+
+    if (sl != NULL && !is_deleted(sl)) {
+        ml = sl->w->ml;
+        mrp_del_io_watch(sl->w);
+
+        close(sl->epollfd);
+        sl->epollfd = -1;
+
+        mark_deleted(sl);
+        mrp_list_delete(&sl->hook);
+        mrp_list_append(&ml->deleted, &sl->hook);
+    }
+}
+
+
+int mrp_subloop_stats(mrp_subloop_t *sl, mrp_subloop_stats_t *stats)
+{
+    if (sl == NULL || stats == NULL)
+        return FALSE;
+
+    *stats = sl->stats;
+
+    return TRUE;
+}
+
+
+/*
+ * external mainloop that pumps us
+ */
+
+static void super_io_cb(void *super_data, void *id, int fd,
+                        mrp_io_event_t events, void *user_data)
+{
+    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
+    mrp_superloop_ops_t *ops = ml->super_ops;
+
+    MRP_UNUSED(super_data);
+    MRP_UNUSED(id);
+    MRP_UNUSED(fd);
+    MRP_UNUSED(events);
+
+    ml->super_events |= MRP_SUPER_EVENT_IO;
+    ops->mod_defer(ml->super_data, ml->work, TRUE);
+}
+
+
+static void super_timer_cb(void *super_data, void *id, void *user_data)
+{
+    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
+    mrp_superloop_ops_t *ops = ml->super_ops;
+
+    MRP_UNUSED(super_data);
+    MRP_UNUSED(id);
+
+    ml->super_events |= MRP_SUPER_EVENT_TIMER;
+    ops->mod_defer(ml->super_data, ml->work, TRUE);
+}
+
+
+static void super_work_cb(void *super_data, void *id, void *user_data)
+{
+    mrp_mainloop_t      *ml  = (mrp_mainloop_t *)user_data;
+    mrp_superloop_ops_t *ops = ml->super_ops;
+    unsigned int         timeout;
+
+    MRP_UNUSED(super_data);
+    MRP_UNUSED(id);
+
+    mrp_mainloop_poll(ml, FALSE);
+    mrp_mainloop_dispatch(ml);
+
+    if (!ml->quit) {
+        mrp_mainloop_prepare(ml);
+
+        /*
+         * Notes:
+         *
+         *     Some mainloop abstractions (eg. the one in PulseAudio)
+         *     have deferred callbacks that starve all other event
+         *     processing until no more deferred callbacks are pending.
+         *     For this reason, we cannot map our deferred callbacks
+         *     directly to superloop deferred callbacks (in some cases
+         *     this could starve the superloop indefinitely). Hence, if
+         *     we have enabled deferred callbacks, we arm our timer with
+         *     0 timeout to let the superloop do one round of its event
+         *     processing.
+         */
+
+        timeout = !have_deferred(ml) ? ml->poll_timeout : 0;
+        ops->mod_timer(ml->super_data, ml->timer, timeout);
+        ops->mod_defer(ml->super_data, ml->work, FALSE);
+    }
+    else {
+        ops->del_io(ml->super_data, ml->iow);
+        ops->del_timer(ml->super_data, ml->timer);
+        ops->del_defer(ml->super_data, ml->work);
+
+        ml->iow   = NULL;
+        ml->timer = NULL;
+        ml->work  = NULL;
+    }
+}
+
+
+int mrp_set_superloop(mrp_mainloop_t *ml, mrp_superloop_ops_t *ops,
+                      void *loop_data)
+{
+    mrp_io_event_t events;
+    int            timeout;
+
+    if (ml->super_ops == NULL && ml->uring == NULL) {
+        ml->super_ops  = ops;
+        ml->super_data = loop_data;
+
+        mrp_mainloop_prepare(ml);
+
+        events    = MRP_IO_EVENT_IN | MRP_IO_EVENT_OUT | MRP_IO_EVENT_HUP;
+        ml->iow   = ops->add_io(ml->super_data, ml->epollfd, events,
+                                super_io_cb, ml);
+        ml->work  = ops->add_defer(ml->super_data, super_work_cb, ml);
+
+        /*
+         * Notes:
+         *
+         *     Some mainloop abstractions (eg. the one in PulseAudio)
+         *     have deferred callbacks that starve all other event
+         *     processing until no more deferred callbacks are pending.
+         *     For this reason, we cannot map our deferred callbacks
+         *     directly to superloop deferred callbacks (in some cases
+         *     this could starve the superloop indefinitely). Hence, if
+         *     we have enabled deferred callbacks, we arm our timer with
+         *     0 timeout to let the superloop do one round of its event
+         *     processing.
+         */
+
+        timeout   = !have_deferred(ml) ? ml->poll_timeout : 0;
+        ml->timer = ops->add_timer(ml->super_data, timeout, super_timer_cb, ml);
+
+        if (ml->iow != NULL && ml->timer != NULL && ml->work != NULL)
+            return TRUE;
+        else
+            mrp_clear_superloop(ml, ops, loop_data);
+    }
+
+    return FALSE;
+}
+
+
+int mrp_clear_superloop(mrp_mainloop_t *ml, mrp_superloop_ops_t *ops,
+                        void *loop_data)
+{
+    if (ml->super_ops == ops && ml->super_data == loop_data) {
+        if (ml->iow != NULL)
+            ops->del_io(ml->super_data, ml->iow);
+
+        ml->super_ops  = NULL;
+        ml->super_data = NULL;
+
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
+
+
+
+/*
+ * mainloop
+ */
+
+static void purge_io_watches(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n, *sp, *sn;
+    mrp_io_watch_t  *w, *s;
+
+    mrp_list_foreach(&ml->iowatches, p, n) {
+        w = mrp_list_entry(p, typeof(*w), hook);
+        mrp_list_delete(&w->hook);
+
+        mrp_list_foreach(&w->slave, sp, sn) {
+            s = mrp_list_entry(sp, typeof(*s), slave);
+            mrp_list_delete(&s->slave);
+            pool_free(s);
+        }
+
+        pool_free(w);
+    }
+}
+
+
+static void purge_timers(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_timer_t     *t;
+    int              i;
+
+    for (i = 0; i < ml->ntimer; i++)
+        pool_free(ml->timers[i]);
+
+    for (i = 0; i < MRP_PRIORITY_MAX; i++) {
+        mrp_list_foreach(&ml->expired[i], p, n) {
+            t = mrp_list_entry(p, typeof(*t), hook);
+            mrp_list_delete(&t->hook);
+            pool_free(t);
+        }
+    }
+
+    mrp_free(ml->timers);
+    ml->timers     = NULL;
+    ml->ntimer     = 0;
+    ml->ntimerslot = 0;
+}
+
+
+static void purge_deferred(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_deferred_t  *d;
+    int              i;
+
+    for (i = 0; i < MRP_PRIORITY_MAX; i++) {
+        mrp_list_foreach(&ml->deferred[i], p, n) {
+            d = mrp_list_entry(p, typeof(*d), hook);
+            mrp_list_delete(&d->hook);
+            pool_free(d);
+        }
+    }
+
+    mrp_list_foreach(&ml->inactive_deferred, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        pool_free(d);
+    }
+}
+
+
+static void purge_sighandlers(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t  *p, *n;
+    mrp_sighandler_t *s;
+
+    mrp_list_foreach(&ml->sighandlers, p, n) {
+        s = mrp_list_entry(p, typeof(*s), hook);
+        mrp_list_delete(&s->hook);
+        pool_free(s);
+    }
+}
+
+
+static void purge_deleted(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    deleted_t       *d;
+
+    mrp_list_foreach(&ml->deleted, p, n) {
+        d = mrp_list_entry(p, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        if (d->free == NULL)
+            mrp_free(d);
+        else {
+            if (!d->free(d)) {
+                mrp_log_error("Failed to free purged item %p.", d);
+                mrp_list_prepend(p, &d->hook);
+            }
+        }
+    }
+}
+
+
+static void purge_subloops(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_subloop_t   *sl;
+
+    mrp_list_foreach(&ml->subloops, p, n) {
+        sl = mrp_list_entry(p, typeof(*sl), hook);
+        mrp_list_delete(&sl->hook);
+        free_subloop(sl);
+    }
+}
+
+
+mrp_mainloop_t *mrp_mainloop_create(void)
+{
+    mrp_mainloop_t *ml;
+    int             i;
+
+    if ((ml = mrp_allocz(sizeof(*ml))) != NULL) {
+        ml->epollfd = epoll_create1(EPOLL_CLOEXEC);
+        ml->sigfd   = -1;
+        ml->timerfd = -1;
+        ml->wakefd  = -1;
+
+        if (ml->epollfd >= 0) {
+            mrp_list_init(&ml->iowatches);
+            for (i = 0; i < MRP_PRIORITY_MAX; i++) {
+                mrp_list_init(&ml->expired[i]);
+                mrp_list_init(&ml->deferred[i]);
+            }
+            mrp_list_init(&ml->inactive_deferred);
+            mrp_list_init(&ml->sighandlers);
+            mrp_list_init(&ml->deleted);
+            mrp_list_init(&ml->subloops);
+            mrp_list_init(&ml->io_pending);
+            mrp_list_init(&ml->io_done);
+            mrp_list_init(&ml->trims);
+
+            if (!create_pools(ml)) {
+                close(ml->epollfd);
+                goto fail;
+            }
+
+            if (!setup_sighandlers(ml)) {
+                destroy_pools(ml);
+                close(ml->epollfd);
+                goto fail;
+            }
+
+            if (!setup_wakeup(ml)) {
+                purge_io_watches(ml);
+                destroy_pools(ml);
+                close(ml->sigfd);
+                close(ml->epollfd);
+                goto fail;
+            }
+
+        }
+        else {
+        fail:
+            mrp_free(ml);
+            ml = NULL;
+        }
+    }
+
+    return ml;
+}
+
+
+void mrp_mainloop_destroy(mrp_mainloop_t *ml)
+{
+    if (ml != NULL) {
+        mrp_workpool_destroy(ml->workpool);
+        ml->workpool = NULL;
+
+        uring_cancel_all(ml);
+        purge_io_reqs(ml);
+        uring_destroy(ml->uring);
+        ml->uring = NULL;
+
+        purge_trims(ml);
+        purge_io_watches(ml);
+        purge_timers(ml);
+        purge_deferred(ml);
+        purge_sighandlers(ml);
+        purge_subloops(ml);
+        purge_deleted(ml);
+        destroy_pools(ml);
+
+        purge_posted(ml);
+
+        mrp_mainloop_profiling(ml, FALSE);
+        mrp_mainloop_watchdog(ml, 0);
+
+        if (ml->timerfd >= 0)
+            close(ml->timerfd);
+        if (ml->wakefd >= 0)
+            close(ml->wakefd);
+
+        mrp_free(ml->events);
+        mrp_free(ml->sorted);
+        mrp_free(ml);
+    }
+}
+
+
+static int subloop_ctl(mrp_subloop_t *sl, int op, int fd, uint32_t events)
+{
+    struct epoll_event evt;
+
+    evt.events  = events;
+    evt.data.fd = fd;
+
+    switch (op) {
+    case EPOLL_CTL_ADD: sl->stats.nadd++; break;
+    case EPOLL_CTL_MOD: sl->stats.nmod++; break;
+    case EPOLL_CTL_DEL: sl->stats.ndel++; break;
+    }
+
+    return epoll_ctl(sl->epollfd, op, fd, &evt);
+}
+
+
+static void update_subloop_fds(mrp_subloop_t *sl, struct pollfd *fds, int nfd)
+{
+    subloop_fd_t *r;
+    uint32_t      round;
+    int           maxfd, i;
+
+    /*
+     * Notes:
+     *
+     *     We keep track of the registration of each file descriptor in
+     *     a table indexed by the fd, and only issue the epoll operations
+     *     necessary to bring it in sync with the new set of pollfds. The
+     *     same fd might show up in several pollfds (with different events)
+     *     so we merge those into a single registration first.
+     *
+     *     If an fd gets closed and reused behind our back, epoll will
+     *     have dropped it. We catch that when it is modified and fail
+     *     with ENOENT, but not when it comes back with the very same
+     *     events. This is no worse than what we used to do...
+     */
+
+    if ((round = ++sl->round) == 0) {
+        for (i = 0; i < sl->nfdtab; i++)
+            sl->fdtab[i].seen = sl->fdtab[i].done = 0;
+        round = sl->round = 1;
+    }
+
+    for (i = 0, maxfd = -1; i < nfd; i++)
+        maxfd = MRP_MAX(maxfd, fds[i].fd);
+
+    if (maxfd >= sl->nfdtab) {
+        if (!mrp_reallocz(sl->fdtab, sl->nfdtab, maxfd + 1))
+            MRP_ASSERT(FALSE, "failed to allocate subloop fd table");
+        sl->nfdtab = maxfd + 1;
+    }
+
+    /* collect the events we need for each fd */
+    for (i = 0; i < nfd; i++) {
+        if (fds[i].fd < 0)
+            continue;
+
+        r = sl->fdtab + fds[i].fd;
+
+        if (r->seen != round) {
+            r->seen = round;
+            r->want = fds[i].events;
+        }
+        else
+            r->want |= fds[i].events;
+    }
+
+    /* add or modify new or changed fds */
+    for (i = 0; i < nfd; i++) {
+        if (fds[i].fd < 0)
+            continue;
+
+        r = sl->fdtab + fds[i].fd;
+
+        if (r->done == round)
+            continue;
+
+        r->done = round;
+
+        if (!r->registered) {
+            if (subloop_ctl(sl, EPOLL_CTL_ADD, fds[i].fd, r->want) < 0 &&
+                (errno != EEXIST ||
+                 subloop_ctl(sl, EPOLL_CTL_MOD, fds[i].fd, r->want) < 0))
+                continue;
+        }
+        else if (r->events != r->want) {
+            if (subloop_ctl(sl, EPOLL_CTL_MOD, fds[i].fd, r->want) < 0 &&
+                (errno != ENOENT ||
+                 subloop_ctl(sl, EPOLL_CTL_ADD, fds[i].fd, r->want) < 0)) {
+                r->registered = FALSE;
+                continue;
+            }
+        }
+
+        r->events     = r->want;
+        r->registered = TRUE;
+    }
+
+    /* remove fds that are gone */
+    for (i = 0; i < sl->npollfd; i++) {
+        if (sl->pollfds[i].fd < 0)
+            continue;
+
+        r = sl->fdtab + sl->pollfds[i].fd;
+
+        if (r->seen != round && r->registered) {
+            subloop_ctl(sl, EPOLL_CTL_DEL, sl->pollfds[i].fd, 0);
+            r->registered = FALSE;
+            r->events     = 0;
+        }
+    }
+}
+
+
+static int prepare_subloop(mrp_subloop_t *sl)
+{
+    /*
+     * Notes:
+     *
+     *     If we have a relatively large number of file descriptors to
+     *     poll but typically only a small fraction of them has pending
+     *     events per mainloop iteration epoll has significant advantages
+     *     over poll. This is the main reason why our mainloop uses epoll.
+     *     However, there is a considerable amount of pain one needs to
+     *     go through to integrate an external poll-based (sub-)mainloop
+     *     (e.g. glib's GMainLoop) with an epoll-based mainloop. I mean,
+     *     just look at the code below !
+     *
+     *     To keep the cost down, we query into a buffer we reuse, and
+     *     once the pollfd set changes we swap it with the current one
+     *     after having updated epoll with the differences.
+     */
+
+    struct pollfd *fds;
+    int            timeout, n, i;
+
+    if (sl->cb->prepare(sl->user_data))
+        sl->cb->dispatch(sl->user_data);
+    sl->poll = FALSE;
+
+    sl->stats.nprepare++;
+
+    while ((n = sl->cb->query(sl->user_data, sl->qfds, sl->nqslot,
+                              &timeout)) > sl->nqslot) {
+        sl->qfds = mrp_reallocz(sl->qfds, sl->nqslot, n);
+        MRP_ASSERT(sl->qfds != NULL, "failed to allocate pollfd's");
+        sl->nqslot = n;
+    }
+
+    fds = sl->qfds;
+
+#if 0
+    printf("-------------------------\n");
+    dump_pollfds("old: ", sl->pollfds, sl->npollfd);
+    dump_pollfds("new: ", fds, n);
+    printf("-------------------------\n");
+#endif
+
+    /*
+     * check if the set of pollfds has changed at all
+     */
+
+    if (n == sl->npollfd) {
+        for (i = 0; i < n; i++) {
+            if (fds[i].fd     != sl->pollfds[i].fd ||
+                fds[i].events != sl->pollfds[i].events)
+                break;
+        }
+
+        if (i == n) {
+            for (i = 0; i < n; i++)
+                sl->pollfds[i].revents = 0;
+
+            return timeout;
+        }
+    }
+
+    sl->stats.nchange++;
+
+    update_subloop_fds(sl, fds, n);
+
+    /*
+     * swap the query buffer with the current pollfds
+     */
+
+    sl->qfds      = sl->pollfds;
+    sl->pollfds   = fds;
+    sl->npollfd   = n;
+    i             = sl->nqslot;
+    sl->nqslot    = sl->npollslot;
+    sl->npollslot = i;
+
+    for (i = 0; i < n; i++)
+        fds[i].revents = 0;
+
+    /*
+     * resize event buffer if needed
+     */
+
+    if (sl->nevent < n) {
+        sl->nevent = n;
+        sl->events = mrp_realloc(sl->events, sl->nevent * sizeof(*sl->events));
+
+        MRP_ASSERT(sl->events != NULL || sl->nevent == 0,
+                   "can't allocate epoll event buffer");
+    }
+
+    return timeout;
+}
+
+
+static int prepare_subloops(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_subloop_t   *sl;
+    int              ext_timeout, min_timeout;
+
+    min_timeout = -1;
+
+    mrp_list_foreach(&ml->subloops, p, n) {
+        sl = mrp_list_entry(p, typeof(*sl), hook);
+
+        if (!is_deleted(sl)) {
+            ext_timeout = prepare_subloop(sl);
+
+            if (ext_timeout >= 0 &&
+                (min_timeout < 0 || ext_timeout < min_timeout))
+                min_timeout = ext_timeout;
+        }
+    }
+
+    return min_timeout;
+}
+
+
+int mrp_mainloop_prepare(mrp_mainloop_t *ml)
+{
+    mrp_timer_t *t;
+    int          timeout, ext_timeout;
+    uint64_t     now;
+
+    if (MRP_UNLIKELY(ml->instrument & INSTRUMENT_PROFILE))
+        ml->profile->loop_start = profile_now();
+
+    if (have_deferred(ml) || !mrp_list_empty(&ml->io_done) ||
+        ml->poll_next != 0) {
+        timeout = 0;
+    }
+    else {
+        t = next_timer(ml);
+
+        if (t == NULL)
+            timeout = -1;
+        else {
+            now = time_now();
+            if (MRP_UNLIKELY(t->deadline <= now))
+                timeout = 0;
+            else if (ml->timerfd >= 0) {
+                arm_timerfd(ml, t->deadline);
+                timeout = -1;
+            }
+            else
+                timeout = usecs_to_msecs(t->deadline - now);
+        }
+    }
+
+    ext_timeout = prepare_subloops(ml);
+
+    if (ext_timeout >= 0 && (timeout < 0 || ext_timeout < timeout))
+        ml->poll_timeout = ext_timeout;
+    else
+        ml->poll_timeout = timeout;
+
+    if (ml->nevent < ml->niowatch) {
+        ml->nevent = ml->niowatch;
+        ml->events = mrp_realloc(ml->events, ml->nevent * sizeof(*ml->events));
+        ml->sorted = mrp_realloc(ml->sorted, ml->nevent * sizeof(*ml->sorted));
+
+        MRP_ASSERT(ml->events != NULL && ml->sorted != NULL,
+                   "can't allocate epoll event buffer");
+    }
+
+    return TRUE;
+}
+
+
+ int mrp_mainloop_poll(mrp_mainloop_t *ml, int may_block)
+{
+    uint64_t start;
+    int      n, timeout;
+
+    timeout = may_block ? ml->poll_timeout : 0;
+
+    if (MRP_UNLIKELY(ml->instrument & INSTRUMENT_PROFILE))
+        start = profile_now();
+    else
+        start = 0;
+
+    if (ml->poll_next != 0) {
+        /*
+         * Notes: We still have unprocessed events left over from the
+         *     previous iteration because of the dispatch budget. Don't
+         *     poll for new ones until those are done, so every ready
+         *     watch gets its turn before any of them is dispatched
+         *     again.
+         */
+        if (ml->uring != NULL)
+            uring_reap(ml);
+    }
+    else if (ml->uring != NULL)
+        ml->poll_result = uring_poll(ml, timeout);
+    else if (ml->nevent > 0) {
+        n = epoll_wait(ml->epollfd, ml->events, ml->nevent, timeout);
+        ml->io_stats.npoll++;
+
+        if (n < 0 && errno == EINTR)
+            n = 0;
+
+        ml->poll_result = n;
+    }
+    else {
+        /*
+         * Notes: Practically we should never branch here because
+         *     we always have at least ml->sigfd registered for epoll.
+         */
+        if (timeout > 0)
+            usleep(timeout * USECS_PER_MSEC);
+
+        ml->poll_result = 0;
+    }
+
+    if (MRP_UNLIKELY(ml->instrument & INSTRUMENT_PROFILE) && start != 0) {
+        /* exclude poll wait from the iteration time */
+        start = profile_account(ml, PROFILE_POLL, NULL, start);
+
+        if (ml->profile->loop_start != 0)
+            ml->profile->loop_start += start;
+    }
+
+    return TRUE;
+}
+
+
+static int poll_subloop(mrp_subloop_t *sl)
+{
+    struct epoll_event *e;
+    struct pollfd      *pfd;
+    int                 n, i;
+
+    if (sl->poll) {
+        n = epoll_wait(sl->epollfd, sl->events, sl->nevent, 0);
+
+        if (n <= 0)
+            return 0;
+
+        for (i = 0, e = sl->events; i < n; i++, e++)
+            sl->fdtab[e->data.fd].revents = e->events;
+
+        /* hand out the events to every pollfd of the fd */
+        for (i = 0, pfd = sl->pollfds; i < sl->npollfd; i++, pfd++) {
+            if (pfd->fd >= 0)
+                pfd->revents = sl->fdtab[pfd->fd].revents &
+                    (pfd->events | POLLERR | POLLHUP | POLLNVAL);
+        }
+
+        for (i = 0, e = sl->events; i < n; i++, e++)
+            sl->fdtab[e->data.fd].revents = 0;
+
+        return n;
+    }
+    else
+        return 0;
+}
+
+
+static void dispatch_deferred(mrp_mainloop_t *ml, mrp_priority_t prio)
+{
+    mrp_list_hook_t *active = &ml->deferred[prio];
+    mrp_list_hook_t  pending;
+    mrp_deferred_t  *d;
+
+    /*
+     * Notes: We take the current batch of enabled callbacks and put each
+     *        one back to the active list before calling it. Callbacks
+     *        enabled or reprioritized during dispatching will be called
+     *        during the next iteration.
+     */
+
+    mrp_list_move(&pending, active);
+
+    while (!mrp_list_empty(&pending)) {
+        d = mrp_list_entry(pending.next, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        mrp_list_append(active, &d->hook);
+
+        INSTRUMENTED_CALL(ml, PROFILE_DEFERRED, d->cb,
+                          d->cb(ml, d, d->user_data));
+
+        if (ml->quit)
+            break;
+    }
+
+    /* put back any callbacks we did not get to because of quitting */
+    while (!mrp_list_empty(&pending)) {
+        d = mrp_list_entry(pending.prev, typeof(*d), hook);
+        mrp_list_delete(&d->hook);
+        mrp_list_prepend(active, &d->hook);
+    }
+}
+
+
+static void collect_timers(mrp_mainloop_t *ml)
+{
+    mrp_timer_t *t;
+    uint64_t     now;
+
+    /*
+     * Notes:
+     *
+     *     We first move all expired timers from the heap to the lists of
+     *     expired timers (one per priority) and then dispatch them from
+     *     there. This way a periodic timer rearmed with a zero (or very
+     *     short) interval cannot keep us here forever, and callbacks are
+     *     free to add, modify or delete any timers (including the expired
+     *     ones).
+     */
+
+    now = time_now();
+
+    while ((t = next_timer(ml)) != NULL && t->expire <= now) {
+        remove_timer(t);
+        mrp_list_append(&ml->expired[t->prio], &t->hook);
+    }
+}
+
+
+static void dispatch_timers(mrp_mainloop_t *ml, mrp_priority_t prio)
+{
+    mrp_list_hook_t *expired = &ml->expired[prio];
+    mrp_timer_t     *t;
+
+    while (!mrp_list_empty(expired)) {
+        t = mrp_list_entry(expired->next, typeof(*t), hook);
+        mrp_list_delete(&t->hook);
+
+        if (!is_deleted(t))
+            INSTRUMENTED_CALL(ml, PROFILE_TIMER, t->cb,
+                              t->cb(ml, t, t->user_data));
+
+        if (is_deleted(t))
+            delete_timer(t);
+        else if (t->heapidx < 0) {
+            if (!rearm_timer(t))
+                mrp_log_error("Failed to rearm timer %p.", t);
+        }
+
+        if (ml->quit)
+            break;
+    }
+}
+
+
+static void restore_timers(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_timer_t     *t;
+    int              prio;
+
+    /* put back any timers we did not get to because of quitting */
+    for (prio = 0; prio < MRP_PRIORITY_MAX; prio++) {
+        mrp_list_foreach(&ml->expired[prio], p, n) {
+            t = mrp_list_entry(p, typeof(*t), hook);
+            mrp_list_delete(&t->hook);
+
+            if (is_deleted(t))
+                delete_timer(t);
+            else
+                insert_timer(t);
+        }
+    }
+}
+
+
+static void dispatch_subloops(mrp_mainloop_t *ml)
+{
+    mrp_list_hook_t *p, *n;
+    mrp_subloop_t   *sl;
+
+    mrp_list_foreach(&ml->subloops, p, n) {
+        sl = mrp_list_entry(p, typeof(*sl), hook);
+
+        if (!is_deleted(sl)) {
+            poll_subloop(sl);
+
+            if (sl->cb->check(sl->user_data, sl->pollfds,
+                              sl->npollfd))
+                INSTRUMENTED_CALL(ml, PROFILE_SUBLOOP, sl->cb->dispatch,
+                                  sl->cb->dispatch(sl->user_data));
+        }
+    }
+}
+
 
+static void dispatch_slaves(mrp_io_watch_t *w, struct epoll_event *e)
+{
+    mrp_mainloop_t  *ml = w->ml;
+    mrp_io_watch_t  *s;
+    mrp_list_hook_t *p, *n;
+    mrp_io_event_t   events;
+
+    events = e->events & ~(MRP_IO_EVENT_INOUT & w->events);
+
+    mrp_list_foreach(&w->slave, p, n) {
+        if (events == MRP_IO_EVENT_NONE)
+            break;
+
+        s = mrp_list_entry(p, typeof(*s), slave);
+
+        if (!is_deleted(s))
+            INSTRUMENTED_CALL(ml, PROFILE_IO, s->cb,
+                              s->cb(ml, s, s->fd, events, s->user_data));
+
+        events &= ~(MRP_IO_EVENT_INOUT & s->events);
+
+        if (is_deleted(s))
+            delete_io_watch(s);
+    }
+}
+
+
+/*
+ * Notes:
+ *
+ *     If any I/O watch has a non-default priority, we sort freshly
+ *     polled events into consecutive bands by priority, keeping their
+ *     original order within each band. poll_band[prio] is the end of
+ *     the band for prio. I/O events left over because of the dispatch
+ *     budget are carried over with their bands intact.
+ */
+
+static mrp_priority_t event_priority(struct epoll_event *e)
+{
+    mrp_io_watch_t  *w = e->data.ptr, *s;
+    mrp_list_hook_t *p, *n;
+    mrp_priority_t   prio;
+
+    prio = w->prio;
+
+    /* watches sharing an fd get dispatched at the highest of their prios */
+    mrp_list_foreach(&w->slave, p, n) {
+        s = mrp_list_entry(p, typeof(*s), slave);
+
+        if (s->prio < prio)
+            prio = s->prio;
+    }
+
+    return prio;
+}
+
+
+static void sort_poll_events(mrp_mainloop_t *ml)
+{
+    struct epoll_event *e, *tmp;
+    int                 start[MRP_PRIORITY_MAX];
+    int                 i, n, prio;
+
+    n = ml->poll_result;
+
+    if (MRP_LIKELY(ml->nprio_io == 0) || n <= 1) {
+        for (prio = 0; prio < MRP_PRIORITY_MAX; prio++)
+            ml->poll_band[prio] = prio < MRP_PRIORITY_NORMAL ? 0 : n;
+        return;
+    }
+
+    memset(ml->poll_band, 0, sizeof(ml->poll_band));
+
+    for (i = 0, e = ml->events; i < n; i++, e++)
+        ml->poll_band[event_priority(e)]++;
+
+    for (prio = 0, i = 0; prio < MRP_PRIORITY_MAX; prio++) {
+        start[prio]          = i;
+        i                   += ml->poll_band[prio];
+        ml->poll_band[prio]  = i;
+    }
+
+    for (i = 0, e = ml->events; i < n; i++, e++)
+        ml->sorted[start[event_priority(e)]++] = *e;
+
+    tmp        = ml->events;
+    ml->events = ml->sorted;
+    ml->sorted = tmp;
+}
+
+
+static void begin_poll_events(mrp_mainloop_t *ml)
+{
+    int n;
+
+    if (ml->poll_next == 0)
+        sort_poll_events(ml);
+
+    n = ml->poll_result;
+
+    if (ml->max_events > 0 && n - ml->poll_next > ml->max_events)
+        n = ml->poll_next + ml->max_events;
+
+    ml->poll_end      = n;
+    ml->poll_deadline = 0;
+}
+
+
+static void dispatch_poll_events(mrp_mainloop_t *ml, mrp_priority_t prio)
+{
+    struct epoll_event *e;
+    mrp_io_watch_t     *w;
+    int                 i, n;
+
+    i = ml->poll_next;
+    n = MRP_MIN(ml->poll_band[prio], ml->poll_end);
+
+    /*
+     * Notes: The time budget only covers I/O dispatching, so we start
+     *        the clock with the first event, after the deferred and timer
+     *        callbacks of the higher priority bands have already run.
+     */
+
+    if (ml->max_usecs != 0 && ml->poll_deadline == 0 && i < n)
+        ml->poll_deadline = time_now() + ml->max_usecs;
+
+    for (e = ml->events + i; i < n; e++) {
+        w = e->data.ptr;
+        i++;
+
+        if (w->trigger & MRP_IO_TRIGGER_ONESHOT)
+            w->armed = FALSE;
+
+        if (!is_deleted(w))
+            INSTRUMENTED_CALL(ml, PROFILE_IO, w->cb,
+                              w->cb(ml, w, w->fd, e->events, w->user_data));
+
+        if (!mrp_list_empty(&w->slave))
+            dispatch_slaves(w, e);
+
+        /*
+         * Notes: A level-triggered fd would keep waking us up after the
+         *        peer has hung up, so we stop polling it. Edge-triggered
+         *        and one-shot watches don't have this problem, and for
+         *        deleted watches delete_io_watch() takes care of it.
+         */
+
+        if ((e->events & EPOLLRDHUP) && w->trigger == MRP_IO_TRIGGER_LEVEL &&
+            !is_deleted(w))
+            epoll_ctl(ml->epollfd, EPOLL_CTL_DEL, w->fd, e);
+
+        if (is_deleted(w))
+            delete_io_watch(w);
+
+        if (ml->quit)
+            break;
+
+        if (ml->poll_deadline != 0 && time_now() >= ml->poll_deadline) {
+            ml->poll_end = i;
+            break;
+        }
+    }
+
+    if (i > ml->poll_next)
+        ml->poll_next = i;
+}
+
+
+static void end_poll_events(mrp_mainloop_t *ml)
+{
+    /* carry any events left over to the next iteration */
+    if (ml->poll_next >= ml->poll_result || ml->quit)
+        ml->poll_next = 0;
+}
+
+
+int mrp_mainloop_dispatch(mrp_mainloop_t *ml)
+{
+    instrument_t   i;
+    mrp_priority_t prio;
+
+    /*
+     * Notes: The watchdog monitors the dispatch phase as a whole, so
+     *        we can detect stalls outside of the user callbacks, too.
+     *        Individual callbacks override it by nesting.
+     */
+
+    if (MRP_UNLIKELY(ml->instrument & INSTRUMENT_WATCHDOG))
+        instrument_enter(ml, mrp_mainloop_dispatch, &i);
+    else
+        i.wd_seq = 0;
+
+    collect_timers(ml);
+    begin_poll_events(ml);
+
+    /*
+     * Notes: We dispatch everything in priority order. Within a priority
+     *        deferred callbacks come first, then timers and I/O events.
+     *        Completed I/O requests and subloops run at normal priority.
+     */
+
+    for (prio = MRP_PRIORITY_HIGH; prio < MRP_PRIORITY_MAX; prio++) {
+        dispatch_deferred(ml, prio);
+
+        if (ml->quit)
+            break;
+
+        dispatch_timers(ml, prio);
+
+        if (ml->quit)
+            break;
+
+        if (prio == MRP_PRIORITY_NORMAL) {
+            dispatch_io_reqs(ml);
+
+            if (ml->quit)
+                break;
+        }
+
+        dispatch_poll_events(ml, prio);
+
+        if (ml->quit)
+            break;
+
+        if (prio == MRP_PRIORITY_NORMAL)
+            dispatch_subloops(ml);
+    }
+
+    restore_timers(ml);
+    end_poll_events(ml);
+
+    /* carried over events might still point to deleted watches */
+    if (ml->poll_next == 0)
+        purge_deleted(ml);
+
+    if (MRP_UNLIKELY(ml->instrument != 0)) {
+        if (ml->watchdog != NULL && i.wd_seq != 0)
+            instrument_leave(ml, PROFILE_LOOP, &i);
+
+        if (ml->profile != NULL && ml->profile->loop_start != 0) {
+            profile_account(ml, PROFILE_LOOP, NULL, ml->profile->loop_start);
+            ml->profile->loop_start = 0;
+        }
+    }
+
+    return !ml->quit;
+}
+
+
+int mrp_mainloop_iterate(mrp_mainloop_t *ml)
+{
+    return
+        mrp_mainloop_prepare(ml) &&
+        mrp_mainloop_poll(ml, TRUE) &&
+        mrp_mainloop_dispatch(ml) &&
+        !ml->quit;
+}
+
+
+int mrp_mainloop_run(mrp_mainloop_t *ml)
+{
+    while (mrp_mainloop_iterate(ml))
+        ;
+
+    return ml->exit_code;
+}
+
+
+void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code)
+{
+    ml->exit_code = exit_code;
+    ml->quit      = TRUE;
+}
+
+
+/*
+ * callback latency profiling
+ */
+
+static uint64_t profile_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void profile_update(profile_entry_t *e, uint64_t nsecs)
+{
+    uint64_t usecs = nsecs / 1000;
+    int      bucket;
+
+    /* bucket 0: < 1 usecs, bucket n: [2^(n-1), 2^n) usecs */
+    if (usecs == 0)
+        bucket = 0;
+    else
+        bucket = MRP_MIN(64 - __builtin_clzll(usecs), PROFILE_NBUCKET - 1);
+
+    e->count++;
+    e->total += nsecs;
+    e->hist[bucket]++;
+
+    if (nsecs > e->max)
+        e->max = nsecs;
+}
+
+
+static uint64_t profile_account(mrp_mainloop_t *ml, profile_type_t type,
+                                void *cb, uint64_t start)
+{
+    profile_t       *p = ml->profile;
+    profile_entry_t *e;
+    uint64_t         now;
+
+    /* profiling might have been toggled by the callback */
+    if (p == NULL || start == 0)
+        return 0;
+
+    now = profile_now();
+
+    switch (type) {
+    case PROFILE_LOOP:
+        e = &p->loop;
+        break;
+    case PROFILE_POLL:
+        e = &p->poll;
+        break;
+    default:
+        if ((e = mrp_htbl_lookup(p->entries, cb)) == NULL) {
+            if ((e = mrp_allocz(sizeof(*e))) == NULL)
+                return now - start;
+
+            e->cb   = cb;
+            e->type = type;
+
+            if (!mrp_htbl_insert(p->entries, cb, e)) {
+                mrp_free(e);
+                return now - start;
+            }
+
+            p->nentry++;
+        }
+    }
+
+    profile_update(e, now - start);
+
+    return now - start;
+}
+
+
+static int profile_comp(const void *key1, const void *key2)
+{
+    return key1 == key2 ? 0 : (key1 < key2 ? -1 : 1);
+}
+
+
+static uint32_t profile_hash(const void *key)
+{
+    uintptr_t k = (uintptr_t)key;
+
+    return (uint32_t)((k >> 4) ^ (k >> 20));
+}
+
+
+static void profile_free(void *key, void *object)
+{
+    MRP_UNUSED(key);
+
+    mrp_free(object);
+}
+
+
+int mrp_mainloop_profiling(mrp_mainloop_t *ml, int enable)
+{
+    mrp_htbl_config_t  hcfg;
+    profile_t         *p;
+
+    if (enable) {
+        if (ml->profile != NULL)
+            return TRUE;
+
+        if ((p = mrp_allocz(sizeof(*p))) == NULL)
+            return FALSE;
+
+        mrp_clear(&hcfg);
+        hcfg.comp    = profile_comp;
+        hcfg.hash    = profile_hash;
+        hcfg.free    = profile_free;
+        hcfg.nbucket = 64;
+
+        if ((p->entries = mrp_htbl_create(&hcfg)) == NULL) {
+            mrp_free(p);
+            return FALSE;
+        }
+
+        p->since        = profile_now();
+        ml->profile     = p;
+        ml->instrument |= INSTRUMENT_PROFILE;
+    }
+    else {
+        if ((p = ml->profile) == NULL)
+            return TRUE;
+
+        ml->profile     = NULL;
+        ml->instrument &= ~INSTRUMENT_PROFILE;
+        mrp_htbl_destroy(p->entries, TRUE);
+        mrp_free(p);
+    }
+
+    return TRUE;
+}
+
+
+void mrp_mainloop_reset_profile(mrp_mainloop_t *ml)
+{
+    profile_t *p = ml->profile;
+
+    if (p == NULL)
+        return;
+
+    mrp_htbl_reset(p->entries, TRUE);
+    p->nentry = 0;
+    mrp_clear(&p->loop);
+    mrp_clear(&p->poll);
+    p->since = profile_now();
+}
+
+
+typedef struct {
+    profile_entry_t **entries;
+    int               nentry;
+} collect_t;
+
+
+static int collect_cb(void *key, void *object, void *user_data)
+{
+    collect_t *c = (collect_t *)user_data;
+
+    MRP_UNUSED(key);
+
+    c->entries[c->nentry++] = object;
+
+    return MRP_HTBL_ITER_MORE;
+}
+
+
+static int total_cmp(const void *p1, const void *p2)
+{
+    const profile_entry_t *e1 = *(const profile_entry_t **)p1;
+    const profile_entry_t *e2 = *(const profile_entry_t **)p2;
+
+    return e1->total < e2->total ? 1 : (e1->total > e2->total ? -1 : 0);
+}
 
-    struct epoll_event  evt;
-    struct pollfd      *fds, *pollfds;
-    int                 timeout;
-    int                 nfd, npollfd, n, i;
-    int                 nmatch;
 
-    pollfds = sl->pollfds;
-    npollfd = sl->npollfd;
+static void dump_entry(FILE *fp, const char *name, profile_entry_t *e)
+{
+    uint64_t avg;
+    int      i, last;
 
-    if (sl->cb->prepare(sl->user_data))
-        sl->cb->dispatch(sl->user_data);
-    sl->poll = FALSE;
+    avg = e->count ? e->total / e->count : 0;
 
-    nfd = npollfd;
-    fds = nfd ? mrp_allocz(nfd * sizeof(*fds)) : NULL;
+    fprintf(fp, "%s\n", name);
+    fprintf(fp, "    %llu calls, total %.3f ms, avg %.3f us, max %.3f us\n",
+            (unsigned long long)e->count, e->total / 1000000.0,
+            avg / 1000.0, e->max / 1000.0);
 
-    MRP_ASSERT(nfd == 0 || fds != NULL, "failed to allocate pollfd's");
+    for (last = PROFILE_NBUCKET - 1; last > 0 && !e->hist[last]; last--)
+        ;
 
-    while ((n = sl->cb->query(sl->user_data, fds, nfd, &timeout)) > nfd) {
-        fds = mrp_reallocz(fds, nfd, n);
-        nfd = n;
-        MRP_ASSERT(fds != NULL, "failed to allocate pollfd's");
+    fprintf(fp, "    usecs:");
+    for (i = 0; i <= last; i++) {
+        if (i == 0)
+            fprintf(fp, " <1:%llu", (unsigned long long)e->hist[i]);
+        else if (i == PROFILE_NBUCKET - 1)
+            fprintf(fp, " >=%llu:%llu", 1ULL << (i - 1),
+                    (unsigned long long)e->hist[i]);
+        else
+            fprintf(fp, " <%llu:%llu", 1ULL << i,
+                    (unsigned long long)e->hist[i]);
     }
-    nfd = n;
-
+    fprintf(fp, "\n");
+}
 
-#if 0
-    printf("-------------------------\n");
-    dump_pollfds("old: ", sl->pollfds, sl->npollfd);
-    dump_pollfds("new: ", fds, nfd);
-    printf("-------------------------\n");
-#endif
 
+static const char *profile_type_name(profile_type_t type)
+{
+    switch (type) {
+    case PROFILE_IO:       return "I/O watch";
+    case PROFILE_TIMER:    return "timer";
+    case PROFILE_DEFERRED: return "deferred";
+    case PROFILE_SUBLOOP:  return "subloop";
+    case PROFILE_IOREQ:    return "I/O request";
+    default:               return "<unknown>";
+    }
+}
 
-    /*
-     * skip over the identical portion of the old and new pollfd's
-     */
 
-    for (i = nmatch = 0; i < npollfd && i < n; i++, nmatch++) {
-        if (fds[i].fd     != pollfds[i].fd ||
-            fds[i].events != pollfds[i].events)
-            break;
-        else
-            fds[i].revents = pollfds[i].revents = 0;
+void mrp_mainloop_dump_profile(mrp_mainloop_t *ml, FILE *fp, int max)
+{
+    profile_t        *p = ml->profile;
+    profile_entry_t  *e;
+    collect_t         c;
+    Dl_info           info;
+    char              name[512];
+    const char       *obj;
+    void             *base;
+    int               i;
+
+    if (p == NULL) {
+        fprintf(fp, "Mainloop profiling is disabled.\n");
+        return;
     }
 
+    fprintf(fp, "Mainloop profile for the last %.3f seconds:\n",
+            (profile_now() - p->since) / 1000000000.0);
 
-    if (nmatch == npollfd && npollfd == nfd) {
-        mrp_free(fds);
-        goto out;
-    }
+    dump_entry(fp, "loop iterations (excluding poll wait)", &p->loop);
+    dump_entry(fp, "poll wait", &p->poll);
 
+    if (p->nentry == 0)
+        return;
 
-    /*
-     * replace file descriptors with the new set (remove old, add new)
-     */
+    c.entries = mrp_allocz_array(profile_entry_t *, p->nentry);
+    c.nentry  = 0;
 
-    for (i = 0 ; i < npollfd; i++)
-        epoll_ctl(sl->epollfd, EPOLL_CTL_DEL, pollfds[i].fd, &evt);
+    if (c.entries == NULL)
+        return;
 
-    for (i = 0; i < nfd; i++) {
-        evt.events   = fds[i].events;
-        evt.data.ptr = &fds[i];
-        epoll_ctl(sl->epollfd, EPOLL_CTL_ADD, fds[i].fd, &evt);
-        fds[i].revents = 0;
-    }
+    mrp_htbl_foreach(p->entries, collect_cb, &c);
+    qsort(c.entries, c.nentry, sizeof(c.entries[0]), total_cmp);
 
+    if (max <= 0 || max > c.nentry)
+        max = c.nentry;
 
-    mrp_free(sl->pollfds);
-    sl->pollfds = fds;
-    sl->npollfd = nfd;
+    fprintf(fp, "top %d of %d callbacks by total time:\n", max, c.nentry);
 
+    for (i = 0; i < max; i++) {
+        e = c.entries[i];
 
-    /*
-     * resize event buffer if needed
-     */
+        /*
+         * Notes: Static functions are not in the dynamic symbol table,
+         *        for those we print the offset within the object which
+         *        can be resolved offline, for instance with addr2line.
+         */
 
-    if (sl->nevent < nfd) {
-        sl->nevent = nfd;
-        sl->events = mrp_realloc(sl->events, sl->nevent * sizeof(*sl->events));
+        if (dladdr(e->cb, &info) != 0 && info.dli_fname != NULL) {
+            obj = strrchr(info.dli_fname, '/');
+            obj = obj ? obj + 1 : info.dli_fname;
 
-        MRP_ASSERT(sl->events != NULL || sl->nevent == 0,
-                   "can't allocate epoll event buffer");
+            if (info.dli_sname != NULL) {
+                base = info.dli_saddr;
+                snprintf(name, sizeof(name), "%s %p: %s+0x%lx (%s)",
+                         profile_type_name(e->type), e->cb, info.dli_sname,
+                         (unsigned long)(e->cb - base), obj);
+            }
+            else {
+                base = info.dli_fbase;
+                snprintf(name, sizeof(name), "%s %p: %s+0x%lx",
+                         profile_type_name(e->type), e->cb, obj,
+                         (unsigned long)(e->cb - base));
+            }
+        }
+        else
+            snprintf(name, sizeof(name), "%s %p",
+                     profile_type_name(e->type), e->cb);
+
+        dump_entry(fp, name, e);
     }
 
- out:
-    return timeout;
+    mrp_free(c.entries);
 }
 
 
-static int prepare_subloops(mrp_mainloop_t *ml)
+/*
+ * object pool statistics and sizing
+ */
+
+int mrp_mainloop_pool_stats(mrp_mainloop_t *ml, mrp_mainloop_pool_t type,
+                            mrp_objpool_stats_t *stats)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_subloop_t   *sl;
-    int              ext_timeout, min_timeout;
+    if (type < 0 || type >= MRP_MAINLOOP_POOL_MAX)
+        return FALSE;
 
-    min_timeout = INT_MAX;
+    return mrp_objpool_stats(ml->pools[type], stats);
+}
 
-    mrp_list_foreach(&ml->subloops, p, n) {
-        sl = mrp_list_entry(p, typeof(*sl), hook);
 
-        if (!is_deleted(sl)) {
-            ext_timeout = prepare_subloop(sl);
-            min_timeout = MRP_MIN(min_timeout, ext_timeout);
-        }
-    }
+int mrp_mainloop_pool_grow(mrp_mainloop_t *ml, mrp_mainloop_pool_t type,
+                           int nobj)
+{
+    if (type < 0 || type >= MRP_MAINLOOP_POOL_MAX || nobj < 0)
+        return FALSE;
 
-    return min_timeout;
+    return mrp_objpool_grow(ml->pools[type], nobj);
 }
 
 
-int mrp_mainloop_prepare(mrp_mainloop_t *ml)
+void mrp_mainloop_dump_pools(mrp_mainloop_t *ml, FILE *fp)
 {
-    mrp_timer_t *next_timer;
-    int          timeout, ext_timeout;
-    uint64_t     now;
+    mrp_objpool_stats_t st;
+    int                 i;
 
-    if (!mrp_list_empty(&ml->deferred)) {
-        timeout = 0;
-    }
-    else {
-        next_timer = ml->next_timer;
+    fprintf(fp, "%-32s %5s %6s %5s %6s %7s %10s %10s %5s\n", "pool", "size",
+            "chunks", "empty", "in use", "max", "allocs", "frees", "fails");
 
-        if (next_timer == NULL)
-            timeout = -1;
-        else {
-            now = time_now();
-            if (MRP_UNLIKELY(next_timer->expire <= now))
-                timeout = 0;
-            else
-                timeout = usecs_to_msecs(next_timer->expire - now);
-        }
+    for (i = 0; i < MRP_MAINLOOP_POOL_MAX; i++) {
+        if (!mrp_objpool_stats(ml->pools[i], &st))
+            continue;
+
+        fprintf(fp, "%-32s %5zu %6zu %5zu %6zu %7zu %10zu %10zu %5zu\n",
+                st.name, st.objsize, st.nchunk, st.nempty, st.nobj, st.maxobj,
+                st.nalloc, st.nfree, st.nfail);
     }
+}
 
-    ext_timeout = prepare_subloops(ml);
 
-    if (ext_timeout != -1)
-        ml->poll_timeout = MRP_MIN(timeout, ext_timeout);
-    else
-        ml->poll_timeout = timeout;
+/*
+ * automatic trimming of object pools
+ *
+ * Notes:
+ *
+ *     The trimming timers belong to the mainloop. Both the pool and the
+ *     mainloop can go away first: destroying the pool (or changing its
+ *     policy) releases the registration through the pool, and destroying
+ *     the mainloop clears the policy of every pool it still trims.
+ */
 
-    if (ml->nevent < ml->niowatch) {
-        ml->nevent = ml->niowatch;
-        ml->events = mrp_realloc(ml->events, ml->nevent * sizeof(*ml->events));
+typedef struct {
+    mrp_list_hook_t  hook;                       /* to list of trimmed pools */
+    mrp_objpool_t   *pool;                       /* pool we trim */
+    mrp_timer_t     *t;                          /* trimming timer */
+} pool_trim_t;
 
-        MRP_ASSERT(ml->events != NULL, "can't allocate epoll event buffer");
-    }
 
-    return TRUE;
+static void trim_pool_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    pool_trim_t *pt = (pool_trim_t *)user_data;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(t);
+
+    mrp_objpool_trim(pt->pool);
 }
 
 
- int mrp_mainloop_poll(mrp_mainloop_t *ml, int may_block)
+static void release_trim(void *data)
 {
-    int n, timeout;
-
-    timeout = may_block ? ml->poll_timeout : 0;
+    pool_trim_t *pt = (pool_trim_t *)data;
 
-    if (ml->nevent > 0) {
-        n = epoll_wait(ml->epollfd, ml->events, ml->nevent, timeout);
+    mrp_del_timer(pt->t);
+    mrp_list_delete(&pt->hook);
+    mrp_free(pt);
+}
 
-        if (n < 0 && errno == EINTR)
-            n = 0;
 
-        ml->poll_result = n;
-    }
-    else {
-        /*
-         * Notes: Practically we should never branch here because
-         *     we always have at least ml->sigfd registered for epoll.
-         */
-        if (timeout > 0)
-            usleep(timeout * USECS_PER_MSEC);
+static void purge_trims(mrp_mainloop_t *ml)
+{
+    pool_trim_t *pt;
 
-        ml->poll_result = 0;
+    while (!mrp_list_empty(&ml->trims)) {
+        pt = mrp_list_entry(ml->trims.next, typeof(*pt), hook);
+        mrp_objpool_set_trim(pt->pool, NULL, NULL, NULL);
     }
-
-    return TRUE;
 }
 
 
-static int poll_subloop(mrp_subloop_t *sl)
+int mrp_objpool_autotrim(mrp_objpool_t *pool, mrp_mainloop_t *ml,
+                         mrp_objpool_trim_t *trim)
 {
-    struct epoll_event *e;
-    struct pollfd      *pfd;
-    int                 n, i;
+    pool_trim_t *pt;
 
-    if (sl->poll) {
-        n = epoll_wait(sl->epollfd, sl->events, sl->nevent, 0);
+    if (pool == NULL)
+        return FALSE;
 
-        if (n < 0 && errno == EINTR)
-            n = 0;
+    if (trim == NULL)
+        return mrp_objpool_set_trim(pool, NULL, NULL, NULL);
 
-        for (i = 0, e = sl->events; i < n; i++, e++) {
-            pfd = (struct pollfd *)sl->events[i].data.ptr;
+    if (ml == NULL || !trim->interval)
+        return FALSE;
 
-            pfd->revents = e->events;
-        }
+    if ((pt = mrp_allocz(sizeof(*pt))) == NULL)
+        return FALSE;
 
-        return n;
+    mrp_list_init(&pt->hook);
+    pt->pool = pool;
+    pt->t    = mrp_add_timer(ml, trim->interval, trim_pool_cb, pt);
+
+    if (pt->t == NULL) {
+        mrp_free(pt);
+        return FALSE;
     }
-    else
-        return 0;
+
+    mrp_list_append(&ml->trims, &pt->hook);
+
+    return mrp_objpool_set_trim(pool, trim, release_trim, pt);
 }
 
 
-static void dispatch_deferred(mrp_mainloop_t *ml)
+/*
+ * dispatch budget
+ */
+
+int mrp_mainloop_set_dispatch_budget(mrp_mainloop_t *ml, int max_events,
+                                     unsigned int max_usecs)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_deferred_t  *d;
+    if (max_events < 0)
+        return FALSE;
 
-    mrp_list_foreach(&ml->deferred, p, n) {
-        d = mrp_list_entry(p, typeof(*d), hook);
+    ml->max_events = max_events;
+    ml->max_usecs  = max_usecs;
 
-        if (!is_deleted(d) && !d->inactive)
-            d->cb(ml, d, d->user_data);
+    return TRUE;
+}
 
-        if (is_deleted(d))
-            delete_deferred(d);
-        else if (d->inactive)
-            disable_deferred(d);
 
-        if (ml->quit)
-            break;
-    }
+void mrp_mainloop_set_io_budget(mrp_mainloop_t *ml, unsigned int max_work)
+{
+    ml->io_budget = max_work;
 }
 
 
-static void dispatch_timers(mrp_mainloop_t *ml)
-{
-    mrp_list_hook_t *p, *n;
-    mrp_timer_t     *t;
-    uint64_t         now;
+/*
+ * stall watchdog
+ *
+ * Notes:
+ *
+ *     When enabled, a watchdog thread periodically checks how long the
+ *     mainloop has been busy dispatching the current callback. If this
+ *     exceeds the configured budget, the callback is reported together
+ *     with a backtrace of the mainloop thread. The backtrace is taken by
+ *     the mainloop thread itself in a handler for WATCHDOG_SIGNAL, which
+ *     we send to it from the watchdog thread. The collected frames are
+ *     then resolved and logged by the watchdog thread. Notice that the
+ *     signal might cause a non-restartable blocking system call (for
+ *     instance a sleep) in the stalled callback to return early.
+ */
 
-    now = time_now();
+static void   *wd_frames[WATCHDOG_FRAMES];       /* captured backtrace */
+static int     wd_nframe;                        /* backtrace depth */
+static int     wd_captured;                      /* backtrace ready */
+static pthread_mutex_t wd_lock = PTHREAD_MUTEX_INITIALIZER;
 
-    mrp_list_foreach(&ml->timers, p, n) {
-        t = mrp_list_entry(p, typeof(*t), hook);
 
-        if (!is_deleted(t)) {
-            if (t->expire <= now) {
-                t->cb(ml, t, t->user_data);
+static void instrument_enter(mrp_mainloop_t *ml, void *cb, instrument_t *i)
+{
+    watchdog_t *wd = ml->watchdog;
 
-                if (!is_deleted(t))
-                    rearm_timer(t);
-            }
-            else
-                break;
-        }
+    i->cb = cb;
 
-        if (is_deleted(t))
-            delete_timer(t);
+    if (ml->profile != NULL)
+        i->start = profile_now();
+    else
+        i->start = 0;
 
-        if (ml->quit)
-            break;
+    if (wd != NULL) {
+        i->wd_cb    = __atomic_load_n(&wd->cb, __ATOMIC_RELAXED);
+        i->wd_start = __atomic_load_n(&wd->start, __ATOMIC_RELAXED);
+        i->wd_seq   = __atomic_add_fetch(&wd->seq, 1, __ATOMIC_RELAXED);
+
+        __atomic_store_n(&wd->cb, cb, __ATOMIC_RELAXED);
+        __atomic_store_n(&wd->start, profile_now(), __ATOMIC_RELEASE);
     }
+    else
+        i->wd_seq = 0;
 }
 
 
-static void dispatch_subloops(mrp_mainloop_t *ml)
+static void instrument_leave(mrp_mainloop_t *ml, profile_type_t type,
+                             instrument_t *i)
 {
-    mrp_list_hook_t *p, *n;
-    mrp_subloop_t   *sl;
+    watchdog_t *wd = ml->watchdog;
+    uint64_t    now;
 
-    mrp_list_foreach(&ml->subloops, p, n) {
-        sl = mrp_list_entry(p, typeof(*sl), hook);
+    if (type != PROFILE_LOOP)
+        profile_account(ml, type, i->cb, i->start);
 
-        if (!is_deleted(sl)) {
-            poll_subloop(sl);
+    if (wd == NULL || i->wd_seq == 0)
+        return;
 
-            if (sl->cb->check(sl->user_data, sl->pollfds,
-                              sl->npollfd))
-                sl->cb->dispatch(sl->user_data);
-        }
+    if (__atomic_load_n(&wd->reported, __ATOMIC_ACQUIRE) == i->wd_seq) {
+        now = profile_now();
+        mrp_log_warning("watchdog: stalled callback %p finished after %.3f ms.",
+                        i->cb,
+                        (now - __atomic_load_n(&wd->start, __ATOMIC_RELAXED))
+                        / 1000000.0);
     }
+
+    /* restore the outer callback, with the clock restarted if any */
+    __atomic_store_n(&wd->cb, i->wd_cb, __ATOMIC_RELAXED);
+    __atomic_store_n(&wd->start, i->wd_start ? profile_now() : 0,
+                     __ATOMIC_RELEASE);
 }
 
 
-static void dispatch_slaves(mrp_io_watch_t *w, struct epoll_event *e)
+static void watchdog_sighandler(int signum)
 {
-    mrp_mainloop_t  *ml = w->ml;
-    mrp_io_watch_t  *s;
-    mrp_list_hook_t *p, *n;
-    mrp_io_event_t   events;
+    MRP_UNUSED(signum);
 
-    events = e->events & ~(MRP_IO_EVENT_INOUT & w->events);
+    wd_nframe = backtrace(wd_frames, WATCHDOG_FRAMES);
+    __atomic_store_n(&wd_captured, TRUE, __ATOMIC_RELEASE);
+}
 
-    mrp_list_foreach(&w->slave, p, n) {
-        if (events == MRP_IO_EVENT_NONE)
-            break;
 
-        s = mrp_list_entry(p, typeof(*s), slave);
+static void watchdog_report(watchdog_t *wd, void *cb, uint64_t busy)
+{
+    Dl_info          info;
+    char           **syms;
+    struct timespec  ts;
+    int              i, n;
+
+    if (dladdr(cb, &info) != 0 && info.dli_sname != NULL)
+        mrp_log_warning("watchdog: callback %p (%s) has been running for "
+                        "%.3f ms (budget %.3f ms).", cb, info.dli_sname,
+                        busy / 1000000.0, wd->budget / 1000000.0);
+    else
+        mrp_log_warning("watchdog: callback %p has been running for "
+                        "%.3f ms (budget %.3f ms).", cb,
+                        busy / 1000000.0, wd->budget / 1000000.0);
 
-        if (!is_deleted(s))
-            s->cb(ml, s, s->fd, events, s->user_data);
+    pthread_mutex_lock(&wd_lock);
 
-        events &= ~(MRP_IO_EVENT_INOUT & s->events);
+    __atomic_store_n(&wd_captured, FALSE, __ATOMIC_RELEASE);
 
-        if (is_deleted(s))
-            delete_io_watch(s);
+    if (pthread_kill(wd->main, WATCHDOG_SIGNAL) != 0) {
+        pthread_mutex_unlock(&wd_lock);
+        return;
     }
-}
-
-
-static void dispatch_poll_events(mrp_mainloop_t *ml)
-{
-    struct epoll_event *e;
-    mrp_io_watch_t     *w;
-    int                 i;
 
-    for (i = 0, e = ml->events; i < ml->poll_result; i++, e++) {
-        w = e->data.ptr;
+    /* give the mainloop thread up to 100 ms to take the backtrace */
+    for (i = 0; i < 100; i++) {
+        if (__atomic_load_n(&wd_captured, __ATOMIC_ACQUIRE))
+            break;
 
-        if (!is_deleted(w))
-            w->cb(ml, w, w->fd, e->events, w->user_data);
+        ts.tv_sec  = 0;
+        ts.tv_nsec = 1000000;
+        nanosleep(&ts, NULL);
+    }
 
-        if (!mrp_list_empty(&w->slave))
-            dispatch_slaves(w, e);
+    if (__atomic_load_n(&wd_captured, __ATOMIC_ACQUIRE)) {
+        n    = wd_nframe;
+        syms = backtrace_symbols(wd_frames, n);
 
-        if (e->events & EPOLLRDHUP)
-            epoll_ctl(ml->epollfd, EPOLL_CTL_DEL, w->fd, e);
+        mrp_log_warning("watchdog: backtrace of the mainloop thread:");
 
-        if (is_deleted(w))
-            delete_io_watch(w);
+        for (i = 0; i < n; i++)
+            mrp_log_warning("watchdog:   #%d %s", i,
+                            syms ? syms[i] : "<unknown>");
 
-        if (ml->quit)
-            break;
+        free(syms);
     }
+    else
+        mrp_log_warning("watchdog: failed to get mainloop backtrace.");
 
-    if (ml->quit)
-        return;
-
-    dispatch_subloops(ml);
+    pthread_mutex_unlock(&wd_lock);
 }
 
 
-int mrp_mainloop_dispatch(mrp_mainloop_t *ml)
+static void *watchdog_thread(void *data)
 {
-    dispatch_deferred(ml);
+    watchdog_t      *wd = (watchdog_t *)data;
+    struct timespec  ts;
+    uint64_t         interval, start, now, deadline;
+    uint32_t         seq;
+    void            *cb;
 
-    if (ml->quit)
-        goto quit;
+    /* check four times per budget, but at most once per millisecond */
+    interval = MRP_MAX(wd->budget / 4, (uint64_t)1000000);
 
-    dispatch_timers(ml);
+    pthread_mutex_lock(&wd->lock);
 
-    if (ml->quit)
-        goto quit;
+    while (!wd->stop) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        deadline   = ts.tv_sec * 1000000000ULL + ts.tv_nsec + interval;
+        ts.tv_sec  = deadline / 1000000000ULL;
+        ts.tv_nsec = deadline % 1000000000ULL;
 
-    dispatch_poll_events(ml);
+        pthread_cond_timedwait(&wd->cond, &wd->lock, &ts);
 
- quit:
-    purge_deleted(ml);
+        if (wd->stop)
+            break;
 
-    return !ml->quit;
-}
+        start = __atomic_load_n(&wd->start, __ATOMIC_ACQUIRE);
+        seq   = __atomic_load_n(&wd->seq, __ATOMIC_RELAXED);
+        cb    = __atomic_load_n(&wd->cb, __ATOMIC_RELAXED);
+        now   = profile_now();
 
+        if (start == 0 || now - start < wd->budget || seq == wd->reported)
+            continue;
 
-int mrp_mainloop_iterate(mrp_mainloop_t *ml)
-{
-    return
-        mrp_mainloop_prepare(ml) &&
-        mrp_mainloop_poll(ml, TRUE) &&
-        mrp_mainloop_dispatch(ml) &&
-        !ml->quit;
-}
+        __atomic_store_n(&wd->reported, seq, __ATOMIC_RELEASE);
 
+        pthread_mutex_unlock(&wd->lock);
+        watchdog_report(wd, cb, now - start);
+        pthread_mutex_lock(&wd->lock);
+    }
 
-int mrp_mainloop_run(mrp_mainloop_t *ml)
-{
-    while (mrp_mainloop_iterate(ml))
-        ;
+    pthread_mutex_unlock(&wd->lock);
 
-    return ml->exit_code;
+    return NULL;
 }
 
 
-void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code)
+int mrp_mainloop_watchdog(mrp_mainloop_t *ml, unsigned int msecs)
 {
-    ml->exit_code = exit_code;
-    ml->quit      = TRUE;
+    watchdog_t         *wd;
+    pthread_condattr_t  cattr;
+    pthread_attr_t      attr;
+    struct sigaction    sa;
+    sigset_t            set, saved;
+    void               *frames[1];
+
+    if ((wd = ml->watchdog) != NULL) {
+        ml->watchdog    = NULL;
+        ml->instrument &= ~INSTRUMENT_WATCHDOG;
+
+        pthread_mutex_lock(&wd->lock);
+        wd->stop = TRUE;
+        pthread_cond_signal(&wd->cond);
+        pthread_mutex_unlock(&wd->lock);
+
+        pthread_join(wd->thread, NULL);
+        pthread_cond_destroy(&wd->cond);
+        pthread_mutex_destroy(&wd->lock);
+        mrp_free(wd);
+    }
+
+    if (msecs == 0)
+        return TRUE;
+
+    if ((wd = mrp_allocz(sizeof(*wd))) == NULL)
+        return FALSE;
+
+    wd->ml     = ml;
+    wd->main   = pthread_self();
+    wd->budget = (uint64_t)msecs * 1000000ULL;
+
+    /* backtrace(3) might need to load libgcc, don't do it in a handler */
+    backtrace(frames, 1);
+
+    mrp_clear(&sa);
+    sa.sa_handler = watchdog_sighandler;
+    sa.sa_flags   = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    if (sigaction(WATCHDOG_SIGNAL, &sa, NULL) < 0)
+        goto fail;
+
+    sigemptyset(&set);
+    sigaddset(&set, WATCHDOG_SIGNAL);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    pthread_mutex_init(&wd->lock, NULL);
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wd->cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+
+    /* the watchdog thread should not receive any signals */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &saved);
+
+    pthread_attr_init(&attr);
+    if (pthread_create(&wd->thread, &attr, watchdog_thread, wd) != 0) {
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &saved, NULL);
+        pthread_cond_destroy(&wd->cond);
+        pthread_mutex_destroy(&wd->lock);
+        goto fail;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+    ml->watchdog    = wd;
+    ml->instrument |= INSTRUMENT_WATCHDOG;
+
+    return TRUE;
+
+ fail:
+    mrp_log_error("Failed to start mainloop watchdog (%d: %s).", errno,
+                  strerror(errno));
+    mrp_free(wd);
+
+    return FALSE;
 }
 
 
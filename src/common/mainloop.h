@@ -30,15 +30,34 @@
 #ifndef __MURPHY_MAINLOOP_H__
 #define __MURPHY_MAINLOOP_H__
 
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/types.h>
 #include <sys/poll.h>
 #include <sys/epoll.h>
 
 #include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
 
 MRP_CDECL_BEGIN
 
 typedef struct mrp_mainloop_s mrp_mainloop_t;
 
+/*
+ * dispatch priorities
+ *
+ * Within a single mainloop iteration all deferred callbacks, expired
+ * timers and pending I/O events of a higher priority are dispatched
+ * before any of a lower priority.
+ */
+
+typedef enum {
+    MRP_PRIORITY_HIGH = 0,                       /* latency-critical work */
+    MRP_PRIORITY_NORMAL,                         /* default priority */
+    MRP_PRIORITY_LOW,                            /* bulk/background work */
+    MRP_PRIORITY_MAX
+} mrp_priority_t;
+
 /*
  * I/O watches
  */
@@ -54,7 +73,13 @@ typedef enum {
     MRP_IO_EVENT_HUP   = EPOLLRDHUP|EPOLLHUP,
     MRP_IO_EVENT_ERR   = EPOLLERR,
     MRP_IO_EVENT_INOUT = EPOLLIN|EPOLLOUT,
-    MRP_IO_EVENT_ALL   = EPOLLIN|EPOLLPRI|EPOLLOUT|EPOLLRDHUP|EPOLLERR
+    MRP_IO_EVENT_ALL   = EPOLLIN|EPOLLPRI|EPOLLOUT|EPOLLRDHUP|EPOLLERR,
+
+    /* trigger modes, can be or'd to the events when adding a watch */
+    MRP_IO_TRIGGER_LEVEL   = 0x0,            /* level-triggered (default) */
+    MRP_IO_TRIGGER_EDGE    = EPOLLET,        /* edge-triggered */
+    MRP_IO_TRIGGER_ONESHOT = EPOLLONESHOT,   /* disarmed after each event */
+    MRP_IO_TRIGGER_MASK    = EPOLLET|EPOLLONESHOT
 } mrp_io_event_t;
 
 typedef struct mrp_io_watch_s mrp_io_watch_t;
@@ -68,6 +93,16 @@ mrp_io_watch_t *mrp_add_io_watch(mrp_mainloop_t *ml, int fd,
                                  mrp_io_watch_cb_t cb, void *user_data);
 /** Unregister an I/O watch. */
 void mrp_del_io_watch(mrp_io_watch_t *watch);
+/** Rearm a one-shot I/O watch after it has been triggered. */
+int mrp_rearm_io_watch(mrp_io_watch_t *w);
+/** Set the maximum amount of work per wakeup for a watch (0 for no limit). */
+void mrp_set_io_watch_budget(mrp_io_watch_t *w, unsigned int max_work);
+/** Get the maximum amount of work per wakeup for a watch. */
+unsigned int mrp_get_io_watch_budget(mrp_io_watch_t *w);
+/** Set the dispatch priority of an I/O watch. */
+int mrp_set_io_watch_priority(mrp_io_watch_t *w, mrp_priority_t prio);
+/** Get the dispatch priority of an I/O watch. */
+mrp_priority_t mrp_get_io_watch_priority(mrp_io_watch_t *w);
 
 
 /*
@@ -82,6 +117,24 @@ typedef void (*mrp_timer_cb_t)(mrp_mainloop_t *ml, mrp_timer_t *t,
 /** Add a new timer. */
 mrp_timer_t *mrp_add_timer(mrp_mainloop_t *ml, unsigned int msecs,
                            mrp_timer_cb_t cb, void *user_data);
+/** Add a new timer with an interval given in microseconds. */
+mrp_timer_t *mrp_add_timer_usec(mrp_mainloop_t *ml, uint64_t usecs,
+                                mrp_timer_cb_t cb, void *user_data);
+/** Use the current interval of the timer when modifying it. */
+#define MRP_TIMER_RESTART      ((unsigned int)-1)
+#define MRP_TIMER_RESTART_USEC ((uint64_t)-1)
+/** Modify the interval of a timer and rearm it relative to now. */
+void mrp_mod_timer(mrp_timer_t *t, unsigned int msecs);
+/** Modify the interval (in microseconds) of a timer and rearm it. */
+void mrp_mod_timer_usec(mrp_timer_t *t, uint64_t usecs);
+/** Let a timer fire up to msecs late to coalesce it with other timers. */
+void mrp_set_timer_slack(mrp_timer_t *t, unsigned int msecs);
+/** Let a timer fire up to usecs late to coalesce it with other timers. */
+void mrp_set_timer_slack_usec(mrp_timer_t *t, uint64_t usecs);
+/** Set the dispatch priority of a timer. */
+int mrp_set_timer_priority(mrp_timer_t *t, mrp_priority_t prio);
+/** Get the dispatch priority of a timer. */
+mrp_priority_t mrp_get_timer_priority(mrp_timer_t *t);
 /** Delete a timer. */
 void mrp_del_timer(mrp_timer_t *t);
 
@@ -107,6 +160,12 @@ void mrp_disable_deferred(mrp_deferred_t *d);
 /** Enable a deferred callback. */
 void mrp_enable_deferred(mrp_deferred_t *d);
 
+/** Set the dispatch priority of a deferred callback. */
+int mrp_set_deferred_priority(mrp_deferred_t *d, mrp_priority_t prio);
+
+/** Get the dispatch priority of a deferred callback. */
+mrp_priority_t mrp_get_deferred_priority(mrp_deferred_t *d);
+
 /*
  * signals
  */
@@ -123,6 +182,59 @@ mrp_sighandler_t *mrp_add_sighandler(mrp_mainloop_t *ml, int signum,
 void mrp_del_sighandler(mrp_sighandler_t *h);
 
 
+/*
+ * callbacks posted from other threads
+ */
+
+/** Posted callback type, called in the mainloop thread. */
+typedef void (*mrp_post_cb_t)(mrp_mainloop_t *ml, void *user_data);
+
+/** Post a callback to the mainloop, safe to call from any thread. */
+int mrp_mainloop_post(mrp_mainloop_t *ml, mrp_post_cb_t cb, void *user_data);
+
+/** Wake up the mainloop if it is blocked polling, from any thread. */
+int mrp_mainloop_wakeup(mrp_mainloop_t *ml);
+
+
+/*
+ * completion-based I/O requests
+ */
+
+struct msghdr;
+typedef struct mrp_io_req_s mrp_io_req_t;
+
+/** I/O request completion callback, result is a byte count or -errno. */
+typedef void (*mrp_io_req_cb_t)(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                                ssize_t result, void *user_data);
+/** Read up to size bytes from fd into buf, call cb when done. */
+mrp_io_req_t *mrp_io_read(mrp_mainloop_t *ml, int fd, void *buf, size_t size,
+                          mrp_io_req_cb_t cb, void *user_data);
+/** Write size bytes from buf to fd, call cb when done. */
+mrp_io_req_t *mrp_io_write(mrp_mainloop_t *ml, int fd, const void *buf,
+                           size_t size, mrp_io_req_cb_t cb, void *user_data);
+/** Receive a message from the socket fd, call cb when done. */
+mrp_io_req_t *mrp_io_recvmsg(mrp_mainloop_t *ml, int fd, struct msghdr *msg,
+                             int flags, mrp_io_req_cb_t cb, void *user_data);
+/** Send a message to the socket fd, call cb when done. */
+mrp_io_req_t *mrp_io_sendmsg(mrp_mainloop_t *ml, int fd, struct msghdr *msg,
+                             int flags, mrp_io_req_cb_t cb, void *user_data);
+/** Cancel a pending request, its buffers are free to reuse once it returns. */
+void mrp_io_cancel(mrp_io_req_t *req);
+
+/** Check whether I/O requests are executed natively by the kernel. */
+int mrp_io_req_native(mrp_mainloop_t *ml);
+
+typedef struct {
+    uint64_t npoll;                              /* epoll_wait calls */
+    uint64_t nenter;                             /* io_uring_enter calls */
+    uint64_t nreq;                               /* I/O requests submitted */
+    uint64_t nemulated;                          /* syscalls by emulation */
+} mrp_io_stats_t;
+
+/** Get the number of polling and I/O syscalls made by the mainloop. */
+int mrp_mainloop_io_stats(mrp_mainloop_t *ml, mrp_io_stats_t *stats);
+
+
 /*
  * subloops - external mainloops pumped by this mainloop
  */
@@ -144,6 +256,17 @@ mrp_subloop_t *mrp_add_subloop(mrp_mainloop_t *ml, mrp_subloop_ops_t *ops,
 /** Stop pumping a registered external mainloop. */
 void mrp_del_subloop(mrp_subloop_t *sl);
 
+typedef struct {
+    uint64_t nprepare;                           /* number of prepares */
+    uint64_t nchange;                            /* pollfd set changes */
+    uint64_t nadd;                               /* EPOLL_CTL_ADDs issued */
+    uint64_t nmod;                               /* EPOLL_CTL_MODs issued */
+    uint64_t ndel;                               /* EPOLL_CTL_DELs issued */
+} mrp_subloop_stats_t;
+
+/** Get epoll usage statistics of a subloop. */
+int mrp_subloop_stats(mrp_subloop_t *sl, mrp_subloop_stats_t *stats);
+
 
 /*
  * superloops - external mainloop to pump murphy mainloops
@@ -207,6 +330,58 @@ int mrp_mainloop_iterate(mrp_mainloop_t *ml);
 /** Quit the mainloop. */
 void mrp_mainloop_quit(mrp_mainloop_t *ml, int exit_code);
 
+/** Enable or disable timerfd-based microsecond precision timers. */
+int mrp_mainloop_hires_timers(mrp_mainloop_t *ml, int enable);
+
+/** Enable or disable polling and completion-based I/O using io_uring. */
+int mrp_mainloop_use_uring(mrp_mainloop_t *ml, int enable);
+
+/** Enable or disable per-callback latency profiling. */
+int mrp_mainloop_profiling(mrp_mainloop_t *ml, int enable);
+
+/** Reset all collected profiling data. */
+void mrp_mainloop_reset_profile(mrp_mainloop_t *ml);
+
+/** Dump profiling data, at most max callbacks (<= 0 for all) by total time. */
+void mrp_mainloop_dump_profile(mrp_mainloop_t *ml, FILE *fp, int max);
+
+/*
+ * mainloop object pools
+ */
+
+typedef enum {
+    MRP_MAINLOOP_POOL_IO_WATCH = 0,              /* I/O watches */
+    MRP_MAINLOOP_POOL_TIMER,                     /* timers */
+    MRP_MAINLOOP_POOL_DEFERRED,                  /* deferred callbacks */
+    MRP_MAINLOOP_POOL_SIGHANDLER,                /* signal handlers */
+    MRP_MAINLOOP_POOL_MAX
+} mrp_mainloop_pool_t;
+
+/** Get usage statistics of the given mainloop object pool. */
+int mrp_mainloop_pool_stats(mrp_mainloop_t *ml, mrp_mainloop_pool_t type,
+                            mrp_objpool_stats_t *stats);
+
+/** Preallocate room for nobj more objects in the given pool. */
+int mrp_mainloop_pool_grow(mrp_mainloop_t *ml, mrp_mainloop_pool_t type,
+                           int nobj);
+
+/** Dump usage statistics of all mainloop object pools. */
+void mrp_mainloop_dump_pools(mrp_mainloop_t *ml, FILE *fp);
+
+/** Trim idle chunks of @pool from @ml according to @trim, or stop if NULL. */
+int mrp_objpool_autotrim(mrp_objpool_t *pool, mrp_mainloop_t *ml,
+                         mrp_objpool_trim_t *trim);
+
+/** Limit the I/O events and time (usecs) dispatched per iteration (0: none). */
+int mrp_mainloop_set_dispatch_budget(mrp_mainloop_t *ml, int max_events,
+                                     unsigned int max_usecs);
+
+/** Set the default maximum amount of work per wakeup for new I/O watches. */
+void mrp_mainloop_set_io_budget(mrp_mainloop_t *ml, unsigned int max_work);
+
+/** Report callbacks running longer than msecs (0 to disable the watchdog). */
+int mrp_mainloop_watchdog(mrp_mainloop_t *ml, unsigned int msecs);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_MAINLOOP_H__ */
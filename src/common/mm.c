@@ -32,6 +32,8 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <malloc.h>
+#include <pthread.h>
 #include <execinfo.h>
 
 #include <murphy/common/macros.h>
@@ -50,6 +52,7 @@
 
 typedef struct {
     mrp_list_hook_t blocks;                   /* list of allocated blocks */
+    pthread_mutex_t lock;                     /* lock protecting blocks */
     size_t          hdrsize;                  /* header size */
     int             depth;                    /* backtrace depth */
     uint32_t        cur_blocks;               /* currently allocated blocks */
@@ -89,6 +92,7 @@ static mm_t __mm = {                          /* allocator state */
                          MRP_MM_ALIGN),
     .depth   = BACKTRACE_DEPTH,
     .poison  = 0xdeadbeef,
+    .lock    = PTHREAD_MUTEX_INITIALIZER,
 };
 
 
@@ -110,12 +114,20 @@ static void __attribute__((constructor)) setup(void)
     __mm.poison     = 0xdeadbeef;
     __mm.chunk_size = sysconf(_SC_PAGESIZE) * 2;
 
+    config = getenv(MRP_MM_SAMPLE_ENVVAR);
+
+    if (config != NULL && *config)
+        mrp_mm_sample(strtoul(config, NULL, 0));
+
     config = getenv(MRP_MM_CONFIG_ENVVAR);
 
-    if (config == NULL || strcmp(config, "debug") != 0)
-        mrp_mm_config(MRP_MM_PASSTHRU);
-    else
+    if (config != NULL && !strcmp(config, "debug"))
         mrp_mm_config(MRP_MM_DEBUG);
+    else if (config != NULL && !strcmp(config, "slab") &&
+             mrp_mm_config(MRP_MM_SLAB))
+        ;
+    else
+        mrp_mm_config(MRP_MM_PASSTHRU);
 }
 
 
@@ -137,7 +149,6 @@ static memblk_t *memblk_alloc(size_t size, const char *file, int line,
 
     if ((blk = malloc(__mm.hdrsize + size)) != NULL) {
         mrp_list_init(&blk->hook);
-        mrp_list_append(&__mm.blocks, &blk->hook);
 
         blk->file = file;
         blk->line = line;
@@ -146,11 +157,17 @@ static memblk_t *memblk_alloc(size_t size, const char *file, int line,
 
         memcpy(blk->bt, bt, __mm.depth * sizeof(*bt));
 
+        pthread_mutex_lock(&__mm.lock);
+
+        mrp_list_append(&__mm.blocks, &blk->hook);
+
         __mm.cur_blocks++;
         __mm.cur_alloc += size;
 
         __mm.max_blocks = MRP_MAX(__mm.max_blocks, __mm.cur_blocks);
         __mm.max_alloc  = MRP_MAX(__mm.max_alloc , __mm.cur_alloc);
+
+        pthread_mutex_unlock(&__mm.lock);
     }
 
     return blk;
@@ -163,11 +180,15 @@ static memblk_t *memblk_resize(memblk_t *blk, size_t size, const char *file,
     memblk_t *resized;
 
     if (blk != NULL) {
+        pthread_mutex_lock(&__mm.lock);
+
         mrp_list_delete(&blk->hook);
 
         resized = realloc(blk, __mm.hdrsize + size);
 
         if (resized != NULL) {
+            blk = resized;
+            mrp_list_init(&blk->hook);
             mrp_list_append(&__mm.blocks, &blk->hook);
 
             __mm.cur_alloc -= blk->size;
@@ -185,6 +206,8 @@ static memblk_t *memblk_resize(memblk_t *blk, size_t size, const char *file,
         else
             mrp_list_append(&__mm.blocks, &blk->hook);
 
+        pthread_mutex_unlock(&__mm.lock);
+
         return resized;
     }
     else
@@ -201,11 +224,15 @@ static void memblk_free(memblk_t *blk, const char *file, int line,
     MRP_UNUSED(bt);
 
     if (blk != NULL) {
+        pthread_mutex_lock(&__mm.lock);
+
         mrp_list_delete(&blk->hook);
 
         __mm.cur_blocks--;
         __mm.cur_alloc -= blk->size;
 
+        pthread_mutex_unlock(&__mm.lock);
+
         if (__mm.poison != 0)
             memset(&blk->bt[__mm.depth], __mm.poison, blk->size);
 
@@ -367,320 +394,1677 @@ static void __passthru_free(void *ptr, const char *file, int line,
 
 
 /*
- * common public interface - uses either passthru or debugging
+ * slab allocator
+ *
+ * Notes:
+ *
+ *     Small allocations are served from a set of size classes, each of
+ *     them backed by an object pool. Larger ones are passed on to malloc.
+ *     Every allocation is preceded by a small header telling which size
+ *     class it came from or, for allocations not coming from any class,
+ *     its offset from the start of the underlying malloc'ed block. The
+ *     size class pools are created with the passthru allocator and are
+ *     kept around once created.
+ *
+ *     We can get called from any thread, so each pool has its own lock.
+ *     To keep the common case lock-free, every thread keeps a small cache
+ *     of free objects for each class, which it refills from and flushes
+ *     back to the pools in batches. The pools themselves may end up calling
+ *     back to us (for debug or log messages). Any allocation made while we
+ *     are already inside a pool that cannot be served from the cache is
+ *     passed on to malloc.
  */
 
-void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func)
-{
-    return __mm.alloc(size, file, line, func);
-}
+#define SLAB_MAX   512                        /* largest slab object */
+#define SLAB_NONE  ((uint32_t)-1)             /* not from any size class */
+#define SLAB_CACHE 32                         /* per-thread cache size */
+#define SLAB_BATCH (SLAB_CACHE / 2)           /* cache refill/flush batch */
 
+typedef struct {
+    uint32_t cls;                             /* size class, or SLAB_NONE */
+    uint32_t offs;                            /* offset from block start */
+} slabhdr_t;
 
-void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
-                     const char *func)
+typedef struct {
+    size_t           size;                    /* object size */
+    mrp_objpool_t   *pool;                    /* object pool */
+    pthread_mutex_t  lock;                    /* lock protecting pool */
+} slab_t;
+
+typedef struct {
+    void *objs;                               /* cached free objects */
+    int   nobj;                               /* number of cached objects */
+} slabcache_t;
+
+static const size_t slab_sizes[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+#define SLAB_NCLASS MRP_ARRAY_SIZE(slab_sizes)
+
+static struct {
+    slab_t         cls[SLAB_NCLASS];          /* size classes */
+    uint8_t        idx[SLAB_MAX / MRP_MM_ALIGN + 1]; /* size -> class */
+    size_t         nlarge;                    /* allocations from malloc */
+    pthread_key_t  key;                       /* for flushing at exit */
+    int            ready;                     /* classes created */
+} __slab;
+
+static __thread slabcache_t slab_cache[SLAB_NCLASS]; /* per-thread caches */
+static __thread int         slab_busy;        /* inside a pool, no nesting */
+static __thread int         slab_thread;      /* thread exit hook set up */
+
+
+static inline uint32_t slab_class(size_t size)
 {
-    return __mm.realloc(ptr, size, file, line, func);
+    if (size > SLAB_MAX)
+        return SLAB_NONE;
+    else
+        return __slab.idx[(size + MRP_MM_ALIGN - 1) / MRP_MM_ALIGN];
 }
 
 
-char *mrp_mm_strdup(const char *s, const char *file, int line, const char *func)
+static void slab_flush(uint32_t cls, int n)
 {
-    char   *p;
-    size_t  size;
+    slabcache_t *cache = slab_cache + cls;
+    slab_t      *slab  = __slab.cls + cls;
+    void        *obj;
 
-    if (s != NULL) {
-        size = strlen(s) + 1;
-        p    = mrp_mm_alloc(size, file, line, func);
+    pthread_mutex_lock(&slab->lock);
+    slab_busy = TRUE;
 
-        if (p != NULL)
-            strcpy(p, s);
+    while (n-- > 0 && (obj = cache->objs) != NULL) {
+        cache->objs = *(void **)obj;
+        cache->nobj--;
+        mrp_objpool_free(((slabhdr_t *)obj) - 1);
     }
-    else
-        p = NULL;
 
-    return p;
+    slab_busy = FALSE;
+    pthread_mutex_unlock(&slab->lock);
 }
 
 
-int mrp_mm_memalign(void **ptr, size_t align, size_t size, const char *file,
-                    int line, const char *func)
+static void slab_flush_all(void *data)
 {
-    return __mm.memalign(ptr, align, size, file, line, func);
+    uint32_t cls;
+
+    MRP_UNUSED(data);
+
+    for (cls = 0; cls < SLAB_NCLASS; cls++)
+        slab_flush(cls, slab_cache[cls].nobj);
 }
 
 
-void mrp_mm_free(void *ptr, const char *file, int line, const char *func)
+static inline void slab_thread_init(void)
 {
-    return __mm.free(ptr, file, line, func);
+    /* flush our cache at exit, whether we allocate or only free */
+    if (MRP_UNLIKELY(!slab_thread)) {
+        pthread_setspecific(__slab.key, __slab.cls);
+        slab_thread = TRUE;
+    }
 }
 
 
-int mrp_mm_config(mrp_mm_type_t type)
+static void slab_refill(uint32_t cls)
 {
-    if (__mm.cur_blocks != 0)
-        return FALSE;
+    slabcache_t *cache = slab_cache + cls;
+    slab_t      *slab  = __slab.cls + cls;
+    slabhdr_t   *hdr;
+    int          n;
 
-    switch (type) {
-    case MRP_MM_PASSTHRU:
-        __mm.alloc    = __passthru_alloc;
-        __mm.realloc  = __passthru_realloc;
-        __mm.memalign = __passthru_memalign;
-        __mm.free     = __passthru_free;
-        __mm.mode     = MRP_MM_PASSTHRU;
-        return TRUE;
+    slab_thread_init();
 
-    case MRP_MM_DEBUG:
-        __mm.alloc    = __mm_alloc;
-        __mm.realloc  = __mm_realloc;
-        __mm.memalign = __mm_memalign;
-        __mm.free     = __mm_free;
-        __mm.mode     = MRP_MM_DEBUG;
-        return TRUE;
+    pthread_mutex_lock(&slab->lock);
+    slab_busy = TRUE;
 
-    default:
-        mrp_log_error("Invalid memory allocator type 0x%x requested.", type);
-        return FALSE;
+    for (n = 0; n < SLAB_BATCH; n++) {
+        if ((hdr = mrp_objpool_alloc(slab->pool)) == NULL)
+            break;
+
+        hdr->cls  = cls;
+        hdr->offs = sizeof(*hdr);
+
+        *(void **)(hdr + 1) = cache->objs;
+        cache->objs = hdr + 1;
+        cache->nobj++;
     }
+
+    slab_busy = FALSE;
+    pthread_mutex_unlock(&slab->lock);
 }
 
-void mrp_mm_check(FILE *fp)
+
+static int slab_init(void)
 {
-    mrp_list_hook_t *p, *n;
-    memblk_t        *blk;
+    mrp_objpool_config_t  cfg;
+    slab_t               *slab;
+    char                  name[32];
+    size_t                i, size;
 
-    fprintf(fp, "Checking unfreed memory...\n");
-    mrp_list_foreach(&__mm.blocks, p, n) {
-        blk = mrp_list_entry(p, memblk_t, hook);
+    if (__slab.ready)
+        return TRUE;
 
-        fprintf(fp, "unfreed block %p of size %zd (from %s@%s:%d)\n",
-               memblk_to_ptr(blk), blk->size, blk->func, blk->file, blk->line);
+    for (i = 0, size = 0; i < MRP_ARRAY_SIZE(__slab.idx); i++) {
+        while (slab_sizes[size] < i * MRP_MM_ALIGN)
+            size++;
+        __slab.idx[i] = size;
     }
 
-#if 0
-    test_sizes();
-#endif
-}
+    for (i = 0; i < SLAB_NCLASS; i++) {
+        slab = __slab.cls + i;
 
+        if (slab->pool != NULL)
+            continue;
 
-/*
- * object pool interface
- */
+        snprintf(name, sizeof(name), "slab-%zd", slab_sizes[i]);
 
-typedef unsigned int mask_t;
+        mrp_clear(&cfg);
+        cfg.name    = name;
+        cfg.objsize = sizeof(slabhdr_t) + slab_sizes[i];
 
-#define W sizeof(mask_t)
-#define B (W * 8)
-#define MASK_BYTES (sizeof(mask_t))
-#define MASK_BITS  (MASK_BYTES * 8)
-#define MASK_EMPTY ((mask_t)-1)
-#define MASK_FULL  ((mask_t) 0)
+        if ((slab->pool = mrp_objpool_create(&cfg)) == NULL)
+            return FALSE;
 
-typedef struct pool_chunk_s pool_chunk_t;
+        slab->size = slab_sizes[i];
+        pthread_mutex_init(&slab->lock, NULL);
+    }
 
-static int pool_calc_sizes(mrp_objpool_t *pool);
-static int pool_grow(mrp_objpool_t *pool, int nobj);
-static int pool_shrink(mrp_objpool_t *pool, int nobj);
-static pool_chunk_t *chunk_alloc(int nperchunk);
-static void chunk_free(pool_chunk_t *chunk);
-static inline int chunk_empty(pool_chunk_t *chunk);
-static void pool_foreach_object(mrp_objpool_t *pool,
-                                void (*cb)(void *obj, void *user_data),
-                                void *user_data);
-static void chunk_foreach_object(pool_chunk_t *chunk,
-                                 void (*cb)(void *obj, void *user_data),
-                                 void *user_data);
+    if (pthread_key_create(&__slab.key, slab_flush_all) != 0)
+        return FALSE;
 
+    __slab.ready = TRUE;
 
-/*
- * an object pool
- */
+    return TRUE;
+}
 
-struct mrp_objpool_s {
-    char             *name;                      /* verbose pool name */
-    size_t            limit;                     /* max. number of objects */
-    size_t            objsize;                   /* size of a single object */
-    size_t            prealloc;                  /* preallocate this many */
-    size_t            nobj;                      /* currently allocated */
-    int             (*setup)(void *);            /* object setup callback */
-    void            (*cleanup)(void *);          /* object cleanup callback */
-    uint32_t          flags;                     /* pool flags */
-    int               poison;                    /* poisoning pattern */
 
-    size_t            nperchunk;                 /* objects per chunk */
-    size_t            dataidx;                   /* data  */
-    mrp_list_hook_t   space;                     /* chunk with frees slots */
-    size_t            nspace;                    /* number of such chunks */
-    mrp_list_hook_t   full;                      /* fully allocated chunks */
-    size_t            nfull;                     /* number of such chunks */
-};
+static int slab_in_use(void)
+{
+    mrp_objpool_stats_t stats;
+    size_t              i;
 
+    if (!__slab.ready)
+        return FALSE;
 
-/*
- * a chunk of memory allocated to an object pool
- */
+    if (__atomic_load_n(&__slab.nlarge, __ATOMIC_RELAXED) != 0)
+        return TRUE;
 
-struct pool_chunk_s {
-    mrp_objpool_t   *pool;                       /* pool we're alloced to */
-    mrp_list_hook_t  hook;                       /* hook to chunk list */
-    mask_t           cache;                      /* cache bits */
-    mask_t           used[];                     /* allocation mask */
-};
+    slab_flush_all(NULL);
 
+    for (i = 0; i < SLAB_NCLASS; i++) {
+        mrp_clear(&stats);
+        pthread_mutex_lock(&__slab.cls[i].lock);
+        mrp_objpool_stats(__slab.cls[i].pool, &stats);
+        pthread_mutex_unlock(&__slab.cls[i].lock);
 
+        if (stats.nobj != 0)
+            return TRUE;
+    }
 
-mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg)
+    return FALSE;
+}
+
+
+static inline slabhdr_t *slab_hdr(void *ptr)
 {
-    mrp_objpool_t *pool;
+    return ((slabhdr_t *)ptr) - 1;
+}
 
-    if ((pool = mrp_allocz(sizeof(*pool))) != NULL) {
-        if ((pool->name = mrp_strdup(cfg->name)) == NULL)
-            goto fail;
 
-        pool->limit    = cfg->limit;
-        pool->objsize  = MRP_MAX(cfg->objsize, (size_t)MRP_MM_OBJSIZE_MIN);
-        pool->prealloc = cfg->prealloc;
-        pool->setup    = cfg->setup;
-        pool->cleanup  = cfg->cleanup;
-        pool->flags    = cfg->flags;
-        pool->poison   = cfg->poison;
+static void *__slab_alloc(size_t size, const char *file, int line,
+                          const char *func)
+{
+    slabcache_t *cache;
+    slabhdr_t   *hdr;
+    void        *obj;
+    uint32_t     cls;
 
-        mrp_list_init(&pool->space);
-        mrp_list_init(&pool->full);
-        pool->nspace = 0;
-        pool->nfull  = 0;
+    MRP_UNUSED(file);
+    MRP_UNUSED(line);
+    MRP_UNUSED(func);
 
-        if (!pool_calc_sizes(pool))
-            goto fail;
+    if ((cls = slab_class(size)) != SLAB_NONE) {
+        cache = slab_cache + cls;
 
-        if (!mrp_objpool_grow(pool, pool->prealloc))
-            goto fail;
+        if (cache->objs == NULL && !slab_busy)
+            slab_refill(cls);
 
-        mrp_debug("pool <%s> created, with %zd/%zd objects.", pool->name,
-                  pool->prealloc, pool->limit);
+        if ((obj = cache->objs) != NULL) {
+            cache->objs = *(void **)obj;
+            cache->nobj--;
 
-        return pool;
+            return obj;
+        }
     }
 
+    if ((hdr = malloc(sizeof(*hdr) + size)) == NULL)
+        return NULL;
 
- fail:
-    mrp_objpool_destroy(pool);
-    return NULL;
-}
-
+    __atomic_add_fetch(&__slab.nlarge, 1, __ATOMIC_RELAXED);
 
-static void free_object(void *obj, void *user_data)
-{
-    mrp_objpool_t *pool = (mrp_objpool_t *)user_data;
+    hdr->cls  = SLAB_NONE;
+    hdr->offs = sizeof(*hdr);
 
-    printf("Releasing unfreed object %p from pool <%s>.\n", obj, pool->name);
-    mrp_objpool_free(obj);
+    return hdr + 1;
 }
 
 
-void mrp_objpool_destroy(mrp_objpool_t *pool)
+static void __slab_free(void *ptr, const char *file, int line,
+                        const char *func)
 {
+    slabcache_t *cache;
+    slabhdr_t   *hdr;
 
-    if (pool->cleanup != NULL)
-        pool_foreach_object(pool, free_object, pool);
+    MRP_UNUSED(file);
+    MRP_UNUSED(line);
+    MRP_UNUSED(func);
 
-    mrp_free(pool->name);
-    mrp_free(pool);
-}
+    if (ptr == NULL)
+        return;
 
+    hdr = slab_hdr(ptr);
 
-void *mrp_objpool_alloc(mrp_objpool_t *pool)
-{
-    pool_chunk_t *chunk;
-    void         *obj;
-    unsigned int  cidx, uidx, sidx;
+    if (hdr->cls != SLAB_NONE) {
+        slab_thread_init();
 
-    if (pool->limit && pool->nobj >= pool->limit)
-        return NULL;
+        cache = slab_cache + hdr->cls;
 
-    if (mrp_list_empty(&pool->space)) {
-        if (!pool_grow(pool, 1))
-            return NULL;
+        *(void **)ptr = cache->objs;
+        cache->objs   = ptr;
+        cache->nobj++;
+
+        if (cache->nobj > SLAB_CACHE && !slab_busy)
+            slab_flush(hdr->cls, SLAB_BATCH);
+    }
+    else {
+        __atomic_sub_fetch(&__slab.nlarge, 1, __ATOMIC_RELAXED);
+        free(ptr - hdr->offs);
     }
+}
 
-    chunk = mrp_list_entry(pool->space.next, pool_chunk_t, hook);
-    cidx  = ffs(chunk->cache);
 
-    if (!cidx) {
-        mrp_log_error("object pool bug: no free slots in cache mask.");
-        return NULL;
-    }
-    else
-        cidx--;
+static void *__slab_realloc(void *ptr, size_t size, const char *file,
+                            int line, const char *func)
+{
+    slabhdr_t *hdr, *resized;
+    void      *new;
+    size_t     old;
 
-    uidx = ffs(chunk->used[cidx]);
+    if (ptr == NULL)
+        return __slab_alloc(size, file, line, func);
 
-    if (!uidx) {
-        mrp_log_error("object pool bug: no free slots in used mask.");
+    if (size == 0) {
+        __slab_free(ptr, file, line, func);
         return NULL;
     }
-    else
-        uidx--;
-
-    sidx = cidx * MASK_BITS + uidx;
-    obj  = ((void *)&chunk->used[pool->dataidx]) + (sidx * pool->objsize);
 
-    mrp_debug("%p: %u/%u: %u, offs %zd\n", obj, cidx, uidx, sidx,
-              sidx * pool->objsize);
+    hdr = slab_hdr(ptr);
 
-    chunk->used[cidx] &= ~(1 << uidx);
+    if (hdr->cls != SLAB_NONE) {
+        if (slab_class(size) == hdr->cls)
+            return ptr;
 
-    if (chunk->used[cidx] == MASK_FULL) {
-        chunk->cache &= ~(1 << cidx);
+        old = __slab.cls[hdr->cls].size;
+    }
+    else {
+        /* blocks from malloc stay there, unless they were aligned */
+        if (hdr->offs == sizeof(*hdr)) {
+            resized = realloc(hdr, sizeof(*hdr) + size);
 
-        if (chunk->cache == MASK_FULL) {          /* chunk exhausted */
-            mrp_list_delete(&chunk->hook);
-            pool->nspace--;
-            mrp_list_append(&pool->full, &chunk->hook);
-            pool->nfull++;
+            return resized != NULL ? resized + 1 : NULL;
         }
-    }
 
-    if (pool->setup == NULL || pool->setup(obj)) {
-        pool->nobj++;
-        return obj;
+        old = malloc_usable_size(ptr - hdr->offs) - hdr->offs;
     }
-    else {
-        mrp_objpool_free(obj);
+
+    if ((new = __slab_alloc(size, file, line, func)) == NULL)
         return NULL;
-    }
+
+    memcpy(new, ptr, MRP_MIN(old, size));
+    __slab_free(ptr, file, line, func);
+
+    return new;
 }
 
 
-void mrp_objpool_free(void *obj)
+static int __slab_memalign(void **ptr, size_t align, size_t size,
+                           const char *file, int line, const char *func)
 {
-    pool_chunk_t  *chunk;
-    mrp_objpool_t *pool;
-    unsigned int   cidx, uidx, sidx;
-    mask_t         cache, used;
-    void          *base;
+    slabhdr_t *hdr;
+    void      *base;
+    int        err;
 
-    if (obj == NULL)
-        return;
+    if (align <= MRP_MM_ALIGN) {
+        *ptr = __slab_alloc(size, file, line, func);
+
+        return *ptr != NULL ? 0 : ENOMEM;
+    }
+
+    if (align > UINT32_MAX)
+        return EINVAL;
+
+    /* leave room for the header in front of the aligned block */
+    if ((err = posix_memalign(&base, align, align + size)) != 0)
+        return err;
+
+    __atomic_add_fetch(&__slab.nlarge, 1, __ATOMIC_RELAXED);
+
+    *ptr      = base + align;
+    hdr       = slab_hdr(*ptr);
+    hdr->cls  = SLAB_NONE;
+    hdr->offs = align;
+
+    return 0;
+}
+
+
+static void slab_check(FILE *fp)
+{
+    mrp_objpool_stats_t stats;
+    size_t              i;
+
+    slab_flush_all(NULL);
+
+    fprintf(fp, "Slab allocator usage:\n");
+
+    for (i = 0; i < SLAB_NCLASS; i++) {
+        mrp_clear(&stats);
+        pthread_mutex_lock(&__slab.cls[i].lock);
+        mrp_objpool_stats(__slab.cls[i].pool, &stats);
+        pthread_mutex_unlock(&__slab.cls[i].lock);
+
+        fprintf(fp, "  %4zd bytes: %zd in use (max. %zd), %zd chunks, "
+                "%zd allocs, %zd frees\n", __slab.cls[i].size, stats.nobj,
+                stats.maxobj, stats.nchunk, stats.nalloc, stats.nfree);
+    }
+
+    fprintf(fp, "  large: %zd in use\n",
+            __atomic_load_n(&__slab.nlarge, __ATOMIC_RELAXED));
+}
+
+
+/*
+ * sampling allocation profiler
+ *
+ * Notes:
+ *
+ *     When enabled, we pick about one allocation per every rate bytes
+ *     allocated and record its address, size, call site and backtrace.
+ *     Allocations of at least rate bytes are always sampled. Each sample
+ *     stands for max(size, rate) bytes, which gives an estimate of the
+ *     live memory allocated at each call site. The
+ *     interval to the next sample is drawn at random to avoid aliasing
+ *     with periodic allocation patterns. Samples are kept in an open
+ *     addressing table keyed by address. To keep frees cheap, a small
+ *     table of counters, indexed by the hash of sampled addresses, lets
+ *     us tell most non-sampled blocks apart without taking any locks.
+ *     All bookkeeping uses libc directly, so the profiler itself never
+ *     shows up in (or recurses into) the profile.
+ */
+
+#define SAMPLE_DEPTH  8                       /* backtrace depth */
+#define SAMPLE_SKIP   2                       /* our own frames to skip */
+#define SAMPLE_FILTER 65536                   /* filter size */
+#define SAMPLE_MINTBL 1024                    /* initial table size */
+
+typedef struct {
+    void       *ptr;                          /* sampled block */
+    size_t      size;                         /* requested size */
+    size_t      weight;                       /* estimated bytes */
+    const char *file;                         /* allocating file */
+    int         line;                         /* allocating line */
+    const char *func;                         /* allocating function */
+    int         depth;                        /* backtrace depth */
+    void       *bt[SAMPLE_DEPTH];             /* backtrace */
+} sample_t;
+
+static struct {
+    size_t           rate;                    /* mean sampling interval */
+    unsigned int     gen;                     /* configuration generation */
+    pthread_mutex_t  lock;                    /* lock protecting table */
+    sample_t        *tbl;                     /* samples by address */
+    size_t           size;                    /* table size */
+    size_t           nsample;                 /* number of samples */
+    uint8_t          filter[SAMPLE_FILTER];   /* sampled address filter */
+} __sample = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread ssize_t      sample_left;     /* bytes till next sample */
+static __thread unsigned int sample_gen;      /* generation seen */
+static __thread uint32_t     sample_seed;     /* interval PRNG state */
+
+
+static inline uint32_t sample_hash(void *ptr)
+{
+    uint64_t h = (uint64_t)(ptrdiff_t)ptr;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (uint32_t)h;
+}
+
+
+static ssize_t sample_interval(void)
+{
+    uint32_t x;
+
+    if (sample_seed == 0)
+        sample_seed = sample_hash(&x) | 1;
+
+    /* xorshift32, uniform in [1, 2 * rate) with mean rate */
+    x  = sample_seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sample_seed = x;
+
+    return 1 + (ssize_t)(x % (2 * __sample.rate));
+}
+
+
+static sample_t *sample_lookup(void *ptr)
+{
+    size_t    mask = __sample.size - 1;
+    size_t    i    = sample_hash(ptr) & mask;
+    sample_t *s;
+
+    for (s = __sample.tbl + i; s->ptr != NULL; s = __sample.tbl + i) {
+        if (s->ptr == ptr)
+            return s;
+        i = (i + 1) & mask;
+    }
+
+    return s;
+}
+
+
+static int sample_resize(size_t size)
+{
+    sample_t *old = __sample.tbl, *s;
+    size_t    n   = __sample.size, i;
+
+    if ((__sample.tbl = calloc(size, sizeof(*__sample.tbl))) == NULL) {
+        __sample.tbl = old;
+        return FALSE;
+    }
+
+    __sample.size = size;
+
+    for (i = 0; i < n; i++) {
+        if (old[i].ptr != NULL) {
+            s  = sample_lookup(old[i].ptr);
+            *s = old[i];
+        }
+    }
+
+    free(old);
+
+    return TRUE;
+}
+
+
+static void sample_delete(sample_t *s)
+{
+    size_t    mask = __sample.size - 1;
+    size_t    i, j, k;
+
+    /* backward shift deletion, keeps lookups tombstone-free */
+    i = s - __sample.tbl;
+    j = i;
+
+    for (;;) {
+        j = (j + 1) & mask;
+
+        if (__sample.tbl[j].ptr == NULL)
+            break;
+
+        k = sample_hash(__sample.tbl[j].ptr) & mask;
+
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            __sample.tbl[i] = __sample.tbl[j];
+            i = j;
+        }
+    }
+
+    __sample.tbl[i].ptr = NULL;
+    __sample.nsample--;
+}
+
+
+static void sample_insert(sample_t *sample)
+{
+    uint8_t  *cnt;
+    sample_t *s;
+
+    if (2 * (__sample.nsample + 1) > __sample.size)
+        if (!sample_resize(__sample.size ? 2 * __sample.size : SAMPLE_MINTBL))
+            return;
+
+    s = sample_lookup(sample->ptr);
+
+    if (s->ptr == NULL)
+        __sample.nsample++;
+
+    *s = *sample;
+
+    cnt = __sample.filter + (sample_hash(s->ptr) % SAMPLE_FILTER);
+    if (*cnt < UINT8_MAX)
+        __atomic_add_fetch(cnt, 1, __ATOMIC_RELAXED);
+}
+
+
+static void sample_alloc(void *ptr, size_t size, const char *file, int line,
+                         const char *func)
+{
+    void     *bt[SAMPLE_SKIP + SAMPLE_DEPTH];
+    sample_t  s;
+    int       depth;
+
+    if (sample_gen != __sample.gen) {
+        sample_gen  = __sample.gen;
+        sample_left = sample_interval();
+    }
+
+    if (size < __sample.rate) {
+        if ((sample_left -= size) > 0)
+            return;
+
+        sample_left = sample_interval();
+    }
+
+    depth = backtrace(bt, MRP_ARRAY_SIZE(bt)) - SAMPLE_SKIP;
+
+    s.ptr   = ptr;
+    s.size  = size;
+    s.file  = file;
+    s.line  = line;
+    s.func  = func;
+    s.depth = MRP_MAX(depth, 0);
+    memcpy(s.bt, bt + SAMPLE_SKIP, s.depth * sizeof(bt[0]));
+
+    pthread_mutex_lock(&__sample.lock);
+
+    if (__sample.rate) {
+        s.weight = MRP_MAX(size, __sample.rate);
+        sample_insert(&s);
+    }
+
+    pthread_mutex_unlock(&__sample.lock);
+}
+
+
+static void sample_restore(sample_t *saved)
+{
+    pthread_mutex_lock(&__sample.lock);
+
+    if (__sample.rate)
+        sample_insert(saved);
+
+    pthread_mutex_unlock(&__sample.lock);
+}
+
+
+static int sample_free(void *ptr, sample_t *saved)
+{
+    uint8_t  *cnt;
+    sample_t *s;
+    int       found;
+
+    cnt = __sample.filter + (sample_hash(ptr) % SAMPLE_FILTER);
+
+    if (MRP_LIKELY(__atomic_load_n(cnt, __ATOMIC_RELAXED) == 0))
+        return FALSE;
+
+    pthread_mutex_lock(&__sample.lock);
+
+    if (__sample.size > 0 && (s = sample_lookup(ptr))->ptr != NULL) {
+        if (saved != NULL)
+            *saved = *s;
+
+        sample_delete(s);
+
+        /* saturated counters are never decremented */
+        if (*cnt < UINT8_MAX)
+            __atomic_sub_fetch(cnt, 1, __ATOMIC_RELAXED);
+
+        found = TRUE;
+    }
+    else
+        found = FALSE;
+
+    pthread_mutex_unlock(&__sample.lock);
+
+    return found;
+}
+
+
+static inline int sampling(void)
+{
+    return MRP_UNLIKELY(__atomic_load_n(&__sample.rate, __ATOMIC_RELAXED));
+}
+
+
+int mrp_mm_sample(size_t rate)
+{
+    pthread_mutex_lock(&__sample.lock);
+
+    free(__sample.tbl);
+    __sample.tbl     = NULL;
+    __sample.size    = 0;
+    __sample.nsample = 0;
+    memset(__sample.filter, 0, sizeof(__sample.filter));
+
+    __atomic_store_n(&__sample.rate, rate, __ATOMIC_RELAXED);
+    __sample.gen++;
+
+    pthread_mutex_unlock(&__sample.lock);
+
+    return TRUE;
+}
+
+
+static int sample_cmp_site(const void *p1, const void *p2)
+{
+    const sample_t *s1 = p1, *s2 = p2;
+    int             d;
+
+    if (s1->file != s2->file)
+        return s1->file < s2->file ? -1 : 1;
+    if (s1->line != s2->line)
+        return s1->line - s2->line;
+    if (s1->func != s2->func)
+        return s1->func < s2->func ? -1 : 1;
+    if ((d = s1->depth - s2->depth) != 0)
+        return d;
+
+    return memcmp(s1->bt, s2->bt, s1->depth * sizeof(s1->bt[0]));
+}
+
+
+static int sample_cmp_weight(const void *p1, const void *p2)
+{
+    const sample_t *s1 = p1, *s2 = p2;
+
+    return s1->weight < s2->weight ? 1 : (s1->weight > s2->weight ? -1 : 0);
+}
+
+
+void mrp_mm_dump_samples(FILE *fp, int max)
+{
+    sample_t *sites, *site;
+    size_t    nsite, nsample, total, rate, i, j, *counts;
+    char    **syms;
+
+    pthread_mutex_lock(&__sample.lock);
+
+    rate    = __sample.rate;
+    nsample = __sample.nsample;
+    sites   = nsample ? malloc(nsample * sizeof(*sites)) : NULL;
+
+    for (i = j = 0; sites != NULL && i < __sample.size; i++)
+        if (__sample.tbl[i].ptr != NULL)
+            sites[j++] = __sample.tbl[i];
+
+    pthread_mutex_unlock(&__sample.lock);
+
+    if (!rate) {
+        fprintf(fp, "Allocation sampling is disabled.\n");
+        return;
+    }
+
+    counts = sites ? calloc(nsample, sizeof(*counts)) : NULL;
+
+    if (nsample > 0 && (sites == NULL || counts == NULL)) {
+        fprintf(fp, "Failed to collect allocation samples.\n");
+        free(sites);
+        return;
+    }
+
+    /* merge samples with identical call site and backtrace */
+    qsort(sites, nsample, sizeof(*sites), sample_cmp_site);
+
+    for (i = 0, nsite = 0, total = 0; i < nsample; i++) {
+        total += sites[i].weight;
+
+        if (nsite > 0 && !sample_cmp_site(sites + nsite - 1, sites + i)) {
+            site          = sites + nsite - 1;
+            site->weight += sites[i].weight;
+            site->size   += sites[i].size;
+            counts[nsite - 1]++;
+        }
+        else {
+            sites[nsite] = sites[i];
+            counts[nsite++] = 1;
+        }
+    }
+
+    /* stash the sample counts in the pointers, we sort by weight */
+    for (i = 0; i < nsite; i++)
+        sites[i].ptr = (void *)counts[i];
+
+    qsort(sites, nsite, sizeof(*sites), sample_cmp_weight);
+
+    fprintf(fp, "Sampled live memory (1 sample per ~%zu bytes): "
+            "%zu samples, ~%zu bytes in %zu sites\n", rate, nsample, total,
+            nsite);
+
+    if (max <= 0 || (size_t)max > nsite)
+        max = nsite;
+
+    for (i = 0; i < (size_t)max; i++) {
+        site = sites + i;
+
+        fprintf(fp, "  ~%zu bytes in %zu samples (%zu bytes sampled) "
+                "from %s@%s:%d\n", site->weight, (size_t)site->ptr,
+                site->size, site->func ? site->func : "<unknown>",
+                site->file ? site->file : "<unknown>", site->line);
+
+        if ((syms = backtrace_symbols(site->bt, site->depth)) != NULL) {
+            for (j = 0; j < (size_t)site->depth; j++)
+                fprintf(fp, "      %s\n", syms[j]);
+            free(syms);
+        }
+    }
+
+    free(counts);
+    free(sites);
+}
+
+
+/*
+ * common public interface - uses either passthru, debugging or slab
+ */
+
+void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func)
+{
+    void *ptr = __mm.alloc(size, file, line, func);
+
+    if (sampling() && ptr != NULL)
+        sample_alloc(ptr, size, file, line, func);
+
+    return ptr;
+}
+
+
+void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
+                     const char *func)
+{
+    sample_t  old;
+    void     *new;
+    int       sampled;
+
+    if (!sampling())
+        return __mm.realloc(ptr, size, file, line, func);
+
+    /*
+     * Notes: Once the backend has released ptr, another thread may get
+     *        the same address and sample it. So we drop the old sample
+     *        before calling the backend, and put it back if the block
+     *        is left intact because of a failure.
+     */
+
+    sampled = ptr != NULL && sample_free(ptr, &old);
+    new     = __mm.realloc(ptr, size, file, line, func);
+
+    if (new != NULL)
+        sample_alloc(new, size, file, line, func);
+    else if (sampled && size != 0)
+        sample_restore(&old);
+
+    return new;
+}
+
+
+char *mrp_mm_strdup(const char *s, const char *file, int line, const char *func)
+{
+    char   *p;
+    size_t  size;
+
+    if (s != NULL) {
+        size = strlen(s) + 1;
+        p    = mrp_mm_alloc(size, file, line, func);
+
+        if (p != NULL)
+            strcpy(p, s);
+    }
+    else
+        p = NULL;
+
+    return p;
+}
+
+
+int mrp_mm_memalign(void **ptr, size_t align, size_t size, const char *file,
+                    int line, const char *func)
+{
+    int err = __mm.memalign(ptr, align, size, file, line, func);
+
+    if (sampling() && err == 0)
+        sample_alloc(*ptr, size, file, line, func);
+
+    return err;
+}
+
+
+void mrp_mm_free(void *ptr, const char *file, int line, const char *func)
+{
+    if (sampling() && ptr != NULL)
+        sample_free(ptr, NULL);
+
+    return __mm.free(ptr, file, line, func);
+}
+
+
+int mrp_mm_config(mrp_mm_type_t type)
+{
+    if (__mm.cur_blocks != 0)
+        return FALSE;
+
+    if (__mm.mode == MRP_MM_SLAB && type != MRP_MM_SLAB && slab_in_use())
+        return FALSE;
+
+    switch (type) {
+    case MRP_MM_PASSTHRU:
+        __mm.alloc    = __passthru_alloc;
+        __mm.realloc  = __passthru_realloc;
+        __mm.memalign = __passthru_memalign;
+        __mm.free     = __passthru_free;
+        __mm.mode     = MRP_MM_PASSTHRU;
+        return TRUE;
+
+    case MRP_MM_DEBUG:
+        __mm.alloc    = __mm_alloc;
+        __mm.realloc  = __mm_realloc;
+        __mm.memalign = __mm_memalign;
+        __mm.free     = __mm_free;
+        __mm.mode     = MRP_MM_DEBUG;
+        return TRUE;
+
+    case MRP_MM_SLAB:
+        if (__mm.mode == MRP_MM_SLAB)
+            return TRUE;
+
+        /* create the size class pools with the passthru allocator */
+        mrp_mm_config(MRP_MM_PASSTHRU);
+
+        if (!slab_init())
+            return FALSE;
+
+        __mm.alloc    = __slab_alloc;
+        __mm.realloc  = __slab_realloc;
+        __mm.memalign = __slab_memalign;
+        __mm.free     = __slab_free;
+        __mm.mode     = MRP_MM_SLAB;
+        return TRUE;
+
+    default:
+        mrp_log_error("Invalid memory allocator type 0x%x requested.", type);
+        return FALSE;
+    }
+}
+
+void mrp_mm_check(FILE *fp)
+{
+    mrp_list_hook_t *p, *n;
+    memblk_t        *blk;
+
+    if (__mm.mode == MRP_MM_SLAB)
+        slab_check(fp);
+    else {
+        fprintf(fp, "Checking unfreed memory...\n");
+        pthread_mutex_lock(&__mm.lock);
+        mrp_list_foreach(&__mm.blocks, p, n) {
+            blk = mrp_list_entry(p, memblk_t, hook);
+
+            fprintf(fp, "unfreed block %p of size %zd (from %s@%s:%d)\n",
+                    memblk_to_ptr(blk), blk->size, blk->func, blk->file,
+                    blk->line);
+        }
+        pthread_mutex_unlock(&__mm.lock);
+    }
+
+    if (sampling())
+        mrp_mm_dump_samples(fp, 0);
+
+#if 0
+    test_sizes();
+#endif
+}
+
+
+/*
+ * object pool interface
+ */
+
+typedef unsigned int mask_t;
+
+#define W sizeof(mask_t)
+#define B (W * 8)
+#define MASK_BYTES (sizeof(mask_t))
+#define MASK_BITS  (MASK_BYTES * 8)
+#define MASK_EMPTY ((mask_t)-1)
+#define MASK_FULL  ((mask_t) 0)
+
+typedef struct pool_chunk_s pool_chunk_t;
+typedef struct pool_mag_s   pool_mag_t;
+typedef struct pool_cache_s pool_cache_t;
+
+static int pool_calc_sizes(mrp_objpool_t *pool);
+static int pool_grow(mrp_objpool_t *pool, int nobj);
+static int pool_shrink(mrp_objpool_t *pool, int nchunk);
+static pool_chunk_t *chunk_alloc(int nperchunk);
+static void chunk_free(pool_chunk_t *chunk);
+static inline int chunk_empty(pool_chunk_t *chunk);
+static void pool_foreach_object(mrp_objpool_t *pool,
+                                void (*cb)(void *obj, void *user_data),
+                                void *user_data);
+static void chunk_foreach_object(pool_chunk_t *chunk,
+                                 void (*cb)(void *obj, void *user_data),
+                                 void *user_data);
+static void *mt_alloc(mrp_objpool_t *pool);
+static void mt_free(mrp_objpool_t *pool, void *obj);
+static int mt_init(mrp_objpool_t *pool);
+static void mt_cleanup(mrp_objpool_t *pool);
+static void mag_drain(pool_mag_t *mag);
+static pool_mag_t *mag_get(pool_mag_t **depot);
+static void mag_put(pool_mag_t **depot, pool_mag_t *mag);
+
+
+/*
+ * an object pool
+ */
+
+struct mrp_objpool_s {
+    char             *name;                      /* verbose pool name */
+    size_t            limit;                     /* max. number of objects */
+    size_t            objsize;                   /* size of a single object */
+    size_t            prealloc;                  /* preallocate this many */
+    size_t            nobj;                      /* currently allocated */
+    int             (*setup)(void *);            /* object setup callback */
+    void            (*cleanup)(void *);          /* object cleanup callback */
+    uint32_t          flags;                     /* pool flags */
+    int               poison;                    /* poisoning pattern */
+
+    size_t            nperchunk;                 /* objects per chunk */
+    size_t            dataidx;                   /* data  */
+    mrp_list_hook_t   space;                     /* chunk with frees slots */
+    size_t            nspace;                    /* number of such chunks */
+    mrp_list_hook_t   full;                      /* fully allocated chunks */
+    size_t            nfull;                     /* number of such chunks */
+
+    size_t            maxobj;                    /* max. allocated objects */
+    size_t            nalloc;                    /* number of allocations */
+    size_t            nfree;                     /* number of frees */
+    size_t            nfail;                     /* failed allocations */
+    size_t            ngrow;                     /* number of chunks added */
+    size_t            nshrink;                   /* number of chunks removed */
+
+    pthread_mutex_t   lock;                      /* lock, if thread-safe */
+    pthread_key_t     key;                       /* key for per-thread cache */
+    mrp_list_hook_t   caches;                    /* per-thread caches */
+    pool_mag_t       *full_mags;                 /* depot of full magazines */
+    pool_mag_t       *empty_mags;                /* depot of empty magazines */
+
+    mrp_objpool_trim_t trim;                     /* trimming policy */
+    void            (*trim_release)(void *);     /* trimming owner cb */
+    void             *trim_data;                 /* opaque owner data */
+    size_t            peak;                      /* max. nobj this period */
+    int               nidle;                     /* periods with excess */
+    size_t            excess;                    /* min. excess chunks seen */
+    size_t            ntrim;                     /* number of chunks trimmed */
+};
+
+
+/*
+ * a chunk of memory allocated to an object pool
+ */
+
+struct pool_chunk_s {
+    mrp_objpool_t   *pool;                       /* pool we're alloced to */
+    mrp_list_hook_t  hook;                       /* hook to chunk list */
+    mask_t           cache;                      /* cache bits */
+    mask_t           used[];                     /* allocation mask */
+};
+
+
+/*
+ * a magazine of free objects and a per-thread cache of magazines
+ *
+ * Thread-safe pools keep free objects in per-thread caches of two
+ * magazines, a loaded and a previous one. Allocations and frees are
+ * served from these without locking. Only when both magazines are
+ * empty (or full) do we lock the pool and exchange a magazine with the
+ * shared depot, or refill from (or flush to) the chunks.
+ */
+
+#define MAG_SIZE 32                              /* objects per magazine */
+
+struct pool_mag_s {
+    pool_mag_t      *next;                       /* next magazine in depot */
+    int              nobj;                       /* number of objects */
+    void            *obj[MAG_SIZE];              /* free objects */
+};
+
+struct pool_cache_s {
+    mrp_objpool_t   *pool;                       /* pool we belong to */
+    mrp_list_hook_t  hook;                       /* to list of caches */
+    pool_mag_t      *loaded;                     /* loaded magazine */
+    pool_mag_t      *prev;                       /* previous magazine */
+};
+
+
+static inline int pool_mt(mrp_objpool_t *pool)
+{
+    return pool->flags & MRP_OBJPOOL_FLAG_THREADSAFE;
+}
+
+
+static inline void pool_lock(mrp_objpool_t *pool)
+{
+    if (pool_mt(pool))
+        pthread_mutex_lock(&pool->lock);
+}
+
+
+static inline void pool_unlock(mrp_objpool_t *pool)
+{
+    if (pool_mt(pool))
+        pthread_mutex_unlock(&pool->lock);
+}
+
+
+
+mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg)
+{
+    mrp_objpool_t *pool;
+
+    if ((pool = mrp_allocz(sizeof(*pool))) != NULL) {
+        if ((pool->name = mrp_strdup(cfg->name)) == NULL)
+            goto fail;
+
+        pool->limit    = cfg->limit;
+        pool->objsize  = MRP_MAX(cfg->objsize, (size_t)MRP_MM_OBJSIZE_MIN);
+        pool->prealloc = cfg->prealloc;
+        pool->setup    = cfg->setup;
+        pool->cleanup  = cfg->cleanup;
+        pool->flags    = cfg->flags;
+        pool->poison   = cfg->poison;
+
+        mrp_list_init(&pool->space);
+        mrp_list_init(&pool->full);
+        pool->nspace = 0;
+        pool->nfull  = 0;
+
+        if (pool_mt(pool) && !mt_init(pool))
+            goto fail;
+
+        if (!pool_calc_sizes(pool))
+            goto fail;
+
+        if (!mrp_objpool_grow(pool, pool->prealloc))
+            goto fail;
+
+        mrp_debug("pool <%s> created, with %zd/%zd objects.", pool->name,
+                  pool->prealloc, pool->limit);
+
+        return pool;
+    }
+
+
+ fail:
+    mrp_objpool_destroy(pool);
+    return NULL;
+}
+
+
+static void free_object(void *obj, void *user_data)
+{
+    mrp_objpool_t *pool = (mrp_objpool_t *)user_data;
+
+    printf("Releasing unfreed object %p from pool <%s>.\n", obj, pool->name);
+    mrp_objpool_free(obj);
+}
+
+
+void mrp_objpool_destroy(mrp_objpool_t *pool)
+{
+    mrp_list_hook_t *p, *n;
+    pool_chunk_t    *chunk;
+
+    if (pool == NULL)
+        return;
+
+    mrp_objpool_set_trim(pool, NULL, NULL, NULL);
+
+    if (pool_mt(pool))
+        mt_cleanup(pool);
+
+    if (pool->cleanup != NULL)
+        pool_foreach_object(pool, free_object, pool);
+
+    mrp_list_foreach(&pool->full, p, n) {
+        chunk = mrp_list_entry(p, pool_chunk_t, hook);
+        mrp_list_delete(&chunk->hook);
+        chunk_free(chunk);
+    }
+
+    mrp_list_foreach(&pool->space, p, n) {
+        chunk = mrp_list_entry(p, pool_chunk_t, hook);
+        mrp_list_delete(&chunk->hook);
+        chunk_free(chunk);
+    }
+
+    mrp_free(pool->name);
+    mrp_free(pool);
+}
+
+
+static void *pool_take(mrp_objpool_t *pool)
+{
+    pool_chunk_t *chunk;
+    void         *obj;
+    unsigned int  cidx, uidx, sidx;
+
+    if (pool->limit && pool->nobj >= pool->limit) {
+        pool->nfail++;
+        return NULL;
+    }
+
+    if (mrp_list_empty(&pool->space)) {
+        if (!pool_grow(pool, 1)) {
+            pool->nfail++;
+            return NULL;
+        }
+    }
+
+    chunk = mrp_list_entry(pool->space.next, pool_chunk_t, hook);
+    cidx  = ffs(chunk->cache);
+
+    if (!cidx) {
+        mrp_log_error("object pool bug: no free slots in cache mask.");
+        return NULL;
+    }
+    else
+        cidx--;
+
+    uidx = ffs(chunk->used[cidx]);
+
+    if (!uidx) {
+        mrp_log_error("object pool bug: no free slots in used mask.");
+        return NULL;
+    }
+    else
+        uidx--;
+
+    sidx = cidx * MASK_BITS + uidx;
+    obj  = ((void *)&chunk->used[pool->dataidx]) + (sidx * pool->objsize);
+
+    mrp_debug("%p: %u/%u: %u, offs %zd\n", obj, cidx, uidx, sidx,
+              sidx * pool->objsize);
+
+    chunk->used[cidx] &= ~((mask_t)1 << uidx);
+
+    if (chunk->used[cidx] == MASK_FULL) {
+        chunk->cache &= ~(1 << cidx);
+
+        if (chunk->cache == MASK_FULL) {          /* chunk exhausted */
+            mrp_list_delete(&chunk->hook);
+            pool->nspace--;
+            mrp_list_append(&pool->full, &chunk->hook);
+            pool->nfull++;
+        }
+    }
+
+    pool->nobj++;
+    pool->nalloc++;
+
+    if (pool->nobj > pool->maxobj)
+        pool->maxobj = pool->nobj;
+
+    if (pool->nobj > pool->peak)
+        pool->peak = pool->nobj;
+
+    return obj;
+}
+
+
+static void pool_put(void *obj)
+{
+    pool_chunk_t  *chunk;
+    mrp_objpool_t *pool;
+    unsigned int   cidx, uidx, sidx;
+    mask_t         cache, used;
+    void          *base;
+
+    chunk = (pool_chunk_t *)(((ptrdiff_t)obj) & ~(__mm.chunk_size - 1));
+    pool  = chunk->pool;
+
+    base = (void *)&chunk->used[pool->dataidx];
+    sidx = (obj - base) / pool->objsize;
+    cidx = sidx / MASK_BITS;
+    uidx = sidx & (MASK_BITS - 1);
+
+    mrp_debug("%p: %u/%u: %u, offs %zd\n", obj, cidx, uidx, sidx,
+              sidx * pool->objsize);
+
+    cache = chunk->cache;
+    used  = chunk->used[cidx];
+
+    if (used & ((mask_t)1 << uidx)) {
+        mrp_log_error("Trying to free unallocated object %p of pool <%s>.",
+                      obj, pool->name);
+        return;
+    }
+
+    /* thread-safe pools clean up objects before caching them */
+    if (!pool_mt(pool)) {
+        if (pool->cleanup != NULL)
+            pool->cleanup(obj);
+
+        if (pool->flags & MRP_OBJPOOL_FLAG_POISON)
+            memset(obj, pool->poison, pool->objsize);
+    }
+
+    chunk->used[cidx] |= ((mask_t)1 << uidx);
+    chunk->cache      |= ((mask_t)1 << cidx);
+
+    if (cache == MASK_FULL) {                    /* chunk was full */
+        mrp_list_delete(&chunk->hook);
+        pool->nfull--;
+        mrp_list_append(&pool->space, &chunk->hook);
+        pool->nspace++;
+    }
+
+    pool->nobj--;
+    pool->nfree++;
+}
+
+
+void *mrp_objpool_alloc(mrp_objpool_t *pool)
+{
+    void *obj;
+
+    if (pool_mt(pool))
+        return mt_alloc(pool);
+
+    if ((obj = pool_take(pool)) == NULL)
+        return NULL;
+
+    if (pool->setup == NULL || pool->setup(obj))
+        return obj;
+    else {
+        mrp_objpool_free(obj);
+        pool->nalloc--;
+        pool->nfree--;
+        pool->nfail++;
+        return NULL;
+    }
+}
+
+
+void mrp_objpool_free(void *obj)
+{
+    pool_chunk_t  *chunk;
+    mrp_objpool_t *pool;
+
+    if (obj == NULL)
+        return;
 
     chunk = (pool_chunk_t *)(((ptrdiff_t)obj) & ~(__mm.chunk_size - 1));
     pool  = chunk->pool;
 
-    base = (void *)&chunk->used[pool->dataidx];
-    sidx = (obj - base) / pool->objsize;
-    cidx = sidx / MASK_BITS;
-    uidx = sidx & (MASK_BITS - 1);
+    if (pool_mt(pool))
+        mt_free(pool, obj);
+    else
+        pool_put(obj);
+}
+
+
+int mrp_objpool_grow(mrp_objpool_t *pool, int nobj)
+{
+    int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    int ngrow;
+
+    pool_lock(pool);
+    ngrow = pool_grow(pool, nchunk);
+    pool_unlock(pool);
+
+    return ngrow == nchunk;
+}
+
+
+int mrp_objpool_shrink(mrp_objpool_t *pool, int nobj)
+{
+    int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    int nshrink;
+
+    pool_lock(pool);
+    nshrink = pool_shrink(pool, nchunk);
+    pool_unlock(pool);
+
+    return nshrink == nchunk;
+}
+
+
+int mrp_objpool_stats(mrp_objpool_t *pool, mrp_objpool_stats_t *stats)
+{
+    mrp_list_hook_t *p, *n;
+    pool_chunk_t    *chunk;
+    size_t           nempty;
+
+    if (pool == NULL || stats == NULL)
+        return FALSE;
+
+    pool_lock(pool);
+
+    nempty = 0;
+    mrp_list_foreach(&pool->space, p, n) {
+        chunk = mrp_list_entry(p, pool_chunk_t, hook);
+
+        if (chunk_empty(chunk))
+            nempty++;
+    }
 
-    mrp_debug("%p: %u/%u: %u, offs %zd\n", obj, cidx, uidx, sidx,
-              sidx * pool->objsize);
+    stats->name      = pool->name;
+    stats->objsize   = pool->objsize;
+    stats->nperchunk = pool->nperchunk;
+    stats->nchunk    = pool->nspace + pool->nfull;
+    stats->nobj      = pool->nobj;
+    stats->maxobj    = pool->maxobj;
+    stats->nalloc    = pool->nalloc;
+    stats->nfree     = pool->nfree;
+    stats->nfail     = pool->nfail;
+    stats->ngrow     = pool->ngrow;
+    stats->nshrink   = pool->nshrink;
+    stats->nfull     = pool->nfull;
+    stats->npartial  = pool->nspace - nempty;
+    stats->nempty    = nempty;
+    stats->peak      = pool->peak;
+    stats->ntrim     = pool->ntrim;
+
+    pool_unlock(pool);
 
-    cache = chunk->cache;
-    used  = chunk->used[cidx];
+    return TRUE;
+}
 
-    if (used & (1 << uidx)) {
-        mrp_log_error("Trying to free unallocated object %p of pool <%s>.",
-                      obj, pool->name);
-        return;
+
+/*
+ * automatic trimming of idle chunks
+ */
+
+int mrp_objpool_trim(mrp_objpool_t *pool)
+{
+    pool_mag_t *mag;
+    size_t      need, nchunk, excess;
+    int         ntrim;
+
+    if (pool == NULL)
+        return 0;
+
+    ntrim = 0;
+
+    pool_lock(pool);
+
+    /*
+     * Notes:
+     *     We size the pool for the peak allocation of the last period
+     *     plus the spare objects, but never below the preallocation.
+     *     To avoid thrashing between growing and shrinking, we only
+     *     trim once the pool has been oversized for nidle consecutive
+     *     periods, and then only by the smallest excess seen meanwhile.
+     */
+
+    need   = MRP_MAX(pool->peak + pool->trim.spare, pool->prealloc);
+    need   = (need + pool->nperchunk - 1) / pool->nperchunk;
+    nchunk = pool->nspace + pool->nfull;
+
+    pool->peak = pool->nobj;
+
+    if (nchunk <= need) {
+        pool->nidle = 0;
+        goto out;
+    }
+
+    excess = nchunk - need;
+
+    if (pool->nidle == 0 || excess < pool->excess)
+        pool->excess = excess;
+
+    if (++pool->nidle < pool->trim.idle)
+        goto out;
+
+    /* objects parked in the depot would pin their chunks, put them back */
+    if (pool_mt(pool)) {
+        while ((mag = mag_get(&pool->full_mags)) != NULL) {
+            mag_drain(mag);
+            mag_put(&pool->empty_mags, mag);
+        }
+    }
+
+    ntrim = pool_shrink(pool, pool->excess);
+    pool->ntrim += ntrim;
+    pool->nidle  = 0;
+
+    mrp_debug("pool <%s>: trimmed %d of %zd excess chunks", pool->name,
+              ntrim, pool->excess);
+
+ out:
+    pool_unlock(pool);
+
+    return ntrim;
+}
+
+
+int mrp_objpool_set_trim(mrp_objpool_t *pool, mrp_objpool_trim_t *trim,
+                         void (*release)(void *data), void *data)
+{
+    void  (*old_release)(void *);
+    void   *old_data;
+
+    if (pool == NULL)
+        return FALSE;
+
+    pool_lock(pool);
+
+    old_release = pool->trim_release;
+    old_data    = pool->trim_data;
+
+    if (trim != NULL) {
+        pool->trim         = *trim;
+        pool->trim_release = release;
+        pool->trim_data    = data;
+    }
+    else {
+        mrp_clear(&pool->trim);
+        pool->trim_release = NULL;
+        pool->trim_data    = NULL;
+    }
+
+    pool->peak  = pool->nobj;
+    pool->nidle = 0;
+
+    pool_unlock(pool);
+
+    /* let the previous owner (if any) drop its trimming resources */
+    if (old_release != NULL)
+        old_release(old_data);
+
+    return TRUE;
+}
+
+
+/*
+ * thread-safe pools
+ */
+
+static pool_mag_t *mag_get(pool_mag_t **depot)
+{
+    pool_mag_t *mag;
+
+    if ((mag = *depot) != NULL) {
+        *depot    = mag->next;
+        mag->next = NULL;
+    }
+
+    return mag;
+}
+
+
+static void mag_put(pool_mag_t **depot, pool_mag_t *mag)
+{
+    mag->next = *depot;
+    *depot    = mag;
+}
+
+
+static void mag_drain(pool_mag_t *mag)
+{
+    while (mag->nobj > 0)
+        pool_put(mag->obj[--mag->nobj]);
+}
+
+
+static void cache_drain(pool_cache_t *c)
+{
+    mrp_list_delete(&c->hook);
+
+    mag_drain(c->loaded);
+    mag_drain(c->prev);
+
+    mrp_free(c->loaded);
+    mrp_free(c->prev);
+    mrp_free(c);
+}
+
+
+static void cache_release(void *data)
+{
+    pool_cache_t  *c    = data;
+    mrp_objpool_t *pool = c->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    cache_drain(c);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static pool_cache_t *cache_get(mrp_objpool_t *pool)
+{
+    pool_cache_t *c;
+
+    if (MRP_LIKELY((c = pthread_getspecific(pool->key)) != NULL))
+        return c;
+
+    if ((c = mrp_allocz(sizeof(*c))) == NULL)
+        return NULL;
+
+    c->pool   = pool;
+    c->loaded = mrp_allocz(sizeof(*c->loaded));
+    c->prev   = mrp_allocz(sizeof(*c->prev));
+    mrp_list_init(&c->hook);
+
+    if (c->loaded == NULL || c->prev == NULL ||
+        pthread_setspecific(pool->key, c) != 0) {
+        mrp_free(c->loaded);
+        mrp_free(c->prev);
+        mrp_free(c);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    mrp_list_append(&pool->caches, &c->hook);
+    pthread_mutex_unlock(&pool->lock);
+
+    return c;
+}
+
+
+static void cache_reload(mrp_objpool_t *pool, pool_cache_t *c)
+{
+    pool_mag_t *full;
+    void       *obj;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((full = mag_get(&pool->full_mags)) != NULL) {
+        mag_put(&pool->empty_mags, c->prev);
+        c->prev   = c->loaded;
+        c->loaded = full;
+    }
+    else {
+        while (c->loaded->nobj < MAG_SIZE / 2) {
+            if ((obj = pool_take(pool)) == NULL)
+                break;
+            c->loaded->obj[c->loaded->nobj++] = obj;
+        }
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void cache_unload(mrp_objpool_t *pool, pool_cache_t *c)
+{
+    pool_mag_t *empty;
+
+    pthread_mutex_lock(&pool->lock);
+
+    if ((empty = mag_get(&pool->empty_mags)) == NULL)
+        empty = mrp_allocz(sizeof(*empty));
+
+    if (empty != NULL) {
+        mag_put(&pool->full_mags, c->prev);
+        c->prev   = c->loaded;
+        c->loaded = empty;
+    }
+    else
+        mag_drain(c->loaded);
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static void *mt_alloc(mrp_objpool_t *pool)
+{
+    pool_cache_t *c;
+    pool_mag_t   *mag;
+    void         *obj;
+
+    if ((c = cache_get(pool)) == NULL)
+        return NULL;
+
+    if (c->loaded->nobj == 0) {
+        if (c->prev->nobj > 0) {
+            mag       = c->prev;
+            c->prev   = c->loaded;
+            c->loaded = mag;
+        }
+        else {
+            cache_reload(pool, c);
+
+            if (c->loaded->nobj == 0)
+                return NULL;
+        }
+    }
+
+    obj = c->loaded->obj[--c->loaded->nobj];
+
+    if (pool->setup == NULL || pool->setup(obj))
+        return obj;
+    else {
+        mt_free(pool, obj);
+        return NULL;
     }
+}
+
+
+static void mt_free(mrp_objpool_t *pool, void *obj)
+{
+    pool_cache_t *c;
+    pool_mag_t   *mag;
 
     if (pool->cleanup != NULL)
         pool->cleanup(obj);
@@ -688,33 +2072,73 @@ void mrp_objpool_free(void *obj)
     if (pool->flags & MRP_OBJPOOL_FLAG_POISON)
         memset(obj, pool->poison, pool->objsize);
 
-    chunk->used[cidx] |= (1 << uidx);
-    chunk->cache      |= (1 << cidx);
+    if ((c = cache_get(pool)) == NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool_put(obj);
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
 
-    if (cache == MASK_FULL) {                    /* chunk was full */
-        mrp_list_delete(&chunk->hook);
-        pool->nfull--;
-        mrp_list_append(&pool->space, &chunk->hook);
-        pool->nspace++;
+    if (c->loaded->nobj == MAG_SIZE) {
+        if (c->prev->nobj == 0) {
+            mag       = c->prev;
+            c->prev   = c->loaded;
+            c->loaded = mag;
+        }
+        else
+            cache_unload(pool, c);
     }
 
-    pool->nobj--;
+    c->loaded->obj[c->loaded->nobj++] = obj;
 }
 
 
-int mrp_objpool_grow(mrp_objpool_t *pool, int nobj)
+static int mt_init(mrp_objpool_t *pool)
 {
-    int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    mrp_list_init(&pool->caches);
+
+    if (pthread_key_create(&pool->key, cache_release) != 0) {
+        pool->flags &= ~MRP_OBJPOOL_FLAG_THREADSAFE;
+        return FALSE;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
 
-    return pool_grow(pool, nchunk) == nchunk;
+    return TRUE;
 }
 
 
-int mrp_objpool_shrink(mrp_objpool_t *pool, int nobj)
+static void mt_cleanup(mrp_objpool_t *pool)
 {
-    int nchunk = (nobj + pool->nperchunk - 1) / pool->nperchunk;
+    mrp_list_hook_t *p, *n;
+    pool_cache_t    *c;
+    pool_mag_t      *mag;
+
+    /*
+     * Notes:
+     *     We assume that the pool is not in use by any other thread
+     *     while it is being destroyed. We put every cached object back
+     *     to its chunk, then let the caller treat us as a single-threaded
+     *     pool for the rest of the destruction.
+     */
+
+    pthread_key_delete(pool->key);
+
+    mrp_list_foreach(&pool->caches, p, n) {
+        c = mrp_list_entry(p, typeof(*c), hook);
+        cache_drain(c);
+    }
 
-    return pool_shrink(pool, nchunk) == nchunk;
+    while ((mag = mag_get(&pool->full_mags)) != NULL) {
+        mag_drain(mag);
+        mrp_free(mag);
+    }
+
+    while ((mag = mag_get(&pool->empty_mags)) != NULL)
+        mrp_free(mag);
+
+    pthread_mutex_destroy(&pool->lock);
+    pool->flags &= ~MRP_OBJPOOL_FLAG_THREADSAFE;
 }
 
 
@@ -813,6 +2237,7 @@ static int pool_grow(mrp_objpool_t *pool, int nchunk)
             chunk->pool = pool;
             mrp_list_append(&pool->space, &chunk->hook);
             pool->nspace++;
+            pool->ngrow++;
         }
         else
             break;
@@ -836,6 +2261,7 @@ static int pool_shrink(mrp_objpool_t *pool, int nchunk)
             mrp_list_delete(&chunk->hook);
             chunk_free(chunk);
             pool->nspace--;
+            pool->nshrink++;
             cnt++;
         }
 
@@ -899,9 +2325,11 @@ static void chunk_foreach_object(pool_chunk_t *chunk,
 static inline int chunk_empty(pool_chunk_t *chunk)
 {
     mask_t mask;
-    int    i, n;
+    int    i, n, nword;
+
+    nword = (chunk->pool->nperchunk + MASK_BITS - 1) / MASK_BITS;
 
-    if (chunk->cache != (MASK_EMPTY & 0xffff))
+    if (chunk->cache != (((mask_t)1 << nword) - 1))
         return FALSE;
     else {
         for (n = chunk->pool->nperchunk, i = 0; n > 0; n -= MASK_BITS, i++) {
@@ -973,6 +2401,170 @@ static void chunk_free(pool_chunk_t *chunk)
 }
 
 
+
+/*
+ * memory arenas
+ */
+
+typedef struct arena_blk_s arena_blk_t;
+
+struct arena_blk_s {
+    arena_blk_t *next;                           /* next block */
+    size_t       size;                           /* usable size */
+    char         data[];                         /* block data */
+};
+
+struct mrp_arena_s {
+    size_t       blksize;                        /* default block size */
+    arena_blk_t *blocks;                         /* blocks, current first */
+    char        *ptr;                            /* next free byte */
+    char        *end;                            /* end of current block */
+};
+
+
+mrp_arena_t *mrp_arena_create(size_t blksize)
+{
+    mrp_arena_t *arena;
+
+    if ((arena = mrp_allocz(sizeof(*arena))) != NULL)
+        arena->blksize = blksize ? blksize : MRP_ARENA_BLKSIZE;
+
+    return arena;
+}
+
+
+void mrp_arena_destroy(mrp_arena_t *arena)
+{
+    arena_blk_t *blk, *next;
+
+    if (arena == NULL)
+        return;
+
+    for (blk = arena->blocks; blk != NULL; blk = next) {
+        next = blk->next;
+        mrp_free(blk);
+    }
+
+    mrp_free(arena);
+}
+
+
+static void *arena_grow(mrp_arena_t *arena, size_t size)
+{
+    arena_blk_t *blk;
+
+    /*
+     * Notes:
+     *     Large allocations get a block of their own. We link these
+     *     behind the current block, so that we keep on allocating from
+     *     whatever space is left in it.
+     */
+
+    if (size > arena->blksize / 4) {
+        if ((blk = mrp_alloc(sizeof(*blk) + size)) == NULL)
+            return NULL;
+
+        blk->size = size;
+
+        if (arena->blocks != NULL) {
+            blk->next = arena->blocks->next;
+            arena->blocks->next = blk;
+        }
+        else {
+            blk->next     = NULL;
+            arena->blocks = blk;
+            arena->ptr    = arena->end = blk->data + size;
+        }
+
+        return blk->data;
+    }
+
+    if ((blk = mrp_alloc(sizeof(*blk) + arena->blksize)) == NULL)
+        return NULL;
+
+    blk->size     = arena->blksize;
+    blk->next     = arena->blocks;
+    arena->blocks = blk;
+    arena->ptr    = blk->data + size;
+    arena->end    = blk->data + blk->size;
+
+    return blk->data;
+}
+
+
+void *mrp_arena_alloc(mrp_arena_t *arena, size_t size)
+{
+    void *ptr;
+
+    size = MRP_ALIGN(size ? size : 1, MRP_MM_ALIGN);
+
+    if (MRP_UNLIKELY((size_t)(arena->end - arena->ptr) < size))
+        return arena_grow(arena, size);
+
+    ptr         = arena->ptr;
+    arena->ptr += size;
+
+    return ptr;
+}
+
+
+void *mrp_arena_allocz(mrp_arena_t *arena, size_t size)
+{
+    void *ptr;
+
+    if ((ptr = mrp_arena_alloc(arena, size)) != NULL)
+        memset(ptr, 0, size);
+
+    return ptr;
+}
+
+
+char *mrp_arena_strdup(mrp_arena_t *arena, const char *s)
+{
+    if (s == NULL)
+        return NULL;
+
+    return mrp_arena_datadup(arena, s, strlen(s) + 1);
+}
+
+
+void *mrp_arena_datadup(mrp_arena_t *arena, const void *ptr, size_t size)
+{
+    void *dup;
+
+    if ((dup = mrp_arena_alloc(arena, size)) != NULL)
+        memcpy(dup, ptr, size);
+
+    return dup;
+}
+
+
+void mrp_arena_reset(mrp_arena_t *arena)
+{
+    arena_blk_t *blk, *next, *keep;
+
+    /* keep one ordinary block around, free everything else */
+    keep = NULL;
+
+    for (blk = arena->blocks; blk != NULL; blk = next) {
+        next = blk->next;
+
+        if (keep == NULL && blk->size == arena->blksize)
+            keep = blk;
+        else
+            mrp_free(blk);
+    }
+
+    if ((arena->blocks = keep) != NULL) {
+        keep->next = NULL;
+        arena->ptr = keep->data;
+        arena->end = keep->data + keep->size;
+    }
+    else
+        arena->ptr = arena->end = NULL;
+}
+
+
 #if 0
 static void test_sizes(void)
 {
@@ -41,6 +41,7 @@ MRP_CDECL_BEGIN
 
 #define MRP_MM_ALIGN 8                       /* object alignment */
 #define MRP_MM_CONFIG_ENVVAR "__MURPHY_MM_CONFIG"
+#define MRP_MM_SAMPLE_ENVVAR "__MURPHY_MM_SAMPLE"
 
 #define mrp_alloc(size)        mrp_mm_alloc((size), __LOC__)
 #define mrp_free(ptr)          mrp_mm_free((ptr), __LOC__)
@@ -100,16 +101,29 @@ MRP_CDECL_BEGIN
 #define mrp_alloc_array(type, n)  ((type *)mrp_alloc(sizeof(type) * (n)))
 #define mrp_allocz_array(type, n) ((type *)mrp_allocz(sizeof(type) * (n)))
 
+/*
+ * All allocator backends are thread-safe, so mrp_alloc and friends may
+ * be called from any thread. Object pools and arenas are not, unless
+ * stated otherwise below.
+ */
+
 typedef enum {
     MRP_MM_PASSTHRU = 0,                 /* passthru allocator */
     MRP_MM_DEFAULT  = MRP_MM_PASSTHRU,   /* default is passthru */
-    MRP_MM_DEBUG                         /* debugging allocator */
+    MRP_MM_DEBUG,                        /* debugging allocator */
+    MRP_MM_SLAB                          /* size-class slab allocator */
 } mrp_mm_type_t;
 
 
 int mrp_mm_config(mrp_mm_type_t type);
 void mrp_mm_check(FILE *fp);
 
+/** Sample about one allocation per @rate bytes allocated, 0 disables. */
+int mrp_mm_sample(size_t rate);
+
+/** Dump live sampled memory by call site, top @max (0 for all) sites. */
+void mrp_mm_dump_samples(FILE *fp, int max);
+
 void *mrp_mm_alloc(size_t size, const char *file, int line, const char *func);
 void *mrp_mm_realloc(void *ptr, size_t size, const char *file, int line,
                      const char *func);
@@ -126,6 +140,7 @@ void mrp_mm_free(void *ptr, const char *file, int line, const char *func);
 
 enum {
     MRP_OBJPOOL_FLAG_POISON = 0x1,               /* poison free'd objects */
+    MRP_OBJPOOL_FLAG_THREADSAFE = 0x2,           /* usable from any thread */
 };
 
 
@@ -147,6 +162,48 @@ typedef struct {
 
 typedef struct mrp_objpool_s mrp_objpool_t;
 
+
+/*
+ * object pool usage statistics
+ */
+
+typedef struct {
+    const char *name;                            /* verbose pool name */
+    size_t      objsize;                         /* (aligned) object size */
+    size_t      nperchunk;                       /* objects per chunk */
+    size_t      nchunk;                          /* number of chunks */
+    size_t      nobj;                            /* currently allocated */
+    size_t      maxobj;                          /* max. allocated objects */
+    size_t      nalloc;                          /* number of allocations */
+    size_t      nfree;                           /* number of frees */
+    size_t      nfail;                           /* failed allocations */
+    size_t      ngrow;                           /* number of chunks added */
+    size_t      nshrink;                         /* number of chunks removed */
+    size_t      nfull;                           /* fully allocated chunks */
+    size_t      npartial;                        /* partly allocated chunks */
+    size_t      nempty;                          /* completely free chunks */
+    size_t      peak;                            /* max. allocated in period */
+    size_t      ntrim;                           /* number of chunks trimmed */
+} mrp_objpool_stats_t;
+
+
+/*
+ * object pool trimming policy
+ *
+ * A pool with a trimming policy periodically checks how many objects
+ * it had at most allocated during the last check period. Completely
+ * free chunks not needed for this peak plus spare objects are released,
+ * once there has been such an excess for idle consecutive periods.
+ * The periodic checks are driven by the owner of the policy, usually a
+ * mainloop (see mrp_objpool_autotrim in mainloop.h).
+ */
+
+typedef struct {
+    unsigned int interval;                       /* check period (msecs) */
+    size_t       spare;                          /* free objects to keep */
+    int          idle;                           /* idle periods before trim */
+} mrp_objpool_trim_t;
+
 /** Create a new object pool with the given configuration. */
 mrp_objpool_t *mrp_objpool_create(mrp_objpool_config_t *cfg);
 
@@ -165,6 +222,51 @@ int mrp_objpool_grow(mrp_objpool_t *pool, int nobj);
 /** Shrink @pool by @nobj new objects, if possible. */
 int mrp_objpool_shrink(mrp_objpool_t *pool, int nobj);
 
+/** Get usage statistics of @pool. */
+int mrp_objpool_stats(mrp_objpool_t *pool, mrp_objpool_stats_t *stats);
+
+/** Set the trimming policy of @pool, release(data) when it is dropped. */
+int mrp_objpool_set_trim(mrp_objpool_t *pool, mrp_objpool_trim_t *trim,
+                         void (*release)(void *data), void *data);
+
+/** Run a trimming check period on @pool, return the chunks trimmed. */
+int mrp_objpool_trim(mrp_objpool_t *pool);
+
+
+/*
+ * memory arenas
+ *
+ * An arena hands out memory by bumping a pointer in a block, allocating
+ * new blocks as necessary. Individual allocations are never freed.
+ * Instead, everything allocated from an arena is released at once by
+ * resetting or destroying the arena. Arenas are not thread-safe.
+ */
+
+#define MRP_ARENA_BLKSIZE 4096                   /* default block size */
+
+typedef struct mrp_arena_s mrp_arena_t;
+
+/** Create a new arena, allocating memory in blocks of @blksize bytes. */
+mrp_arena_t *mrp_arena_create(size_t blksize);
+
+/** Destroy @arena, releasing all memory allocated from it. */
+void mrp_arena_destroy(mrp_arena_t *arena);
+
+/** Allocate @size bytes from @arena. */
+void *mrp_arena_alloc(mrp_arena_t *arena, size_t size);
+
+/** Allocate @size bytes of zeroed memory from @arena. */
+void *mrp_arena_allocz(mrp_arena_t *arena, size_t size);
+
+/** Duplicate the given string in @arena. */
+char *mrp_arena_strdup(mrp_arena_t *arena, const char *s);
+
+/** Duplicate the given data in @arena. */
+void *mrp_arena_datadup(mrp_arena_t *arena, const void *ptr, size_t size);
+
+/** Release all memory allocated from @arena, keeping it usable. */
+void mrp_arena_reset(mrp_arena_t *arena);
+
 MRP_CDECL_END
 
 #endif /* __MURPHY_MM_H__ */
@@ -27,6 +27,7 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdarg.h>
@@ -40,111 +41,163 @@
 #include <murphy/common/msg.h>
 
 #define NDIRECT_TYPE      256            /* directly indexed types */
+#define MSG_INDEX_MIN     32             /* min. fields for indexed lookup */
+#define MSG_INDEX_ISORT   256            /* max. fields for insertion sort */
+
+struct mrp_msg_index_s {
+    uint16_t         tag;                /* field tag */
+    uint32_t         pos;                /* position in the field list */
+    mrp_msg_field_t *field;              /* indexed field */
+};
 
 static mrp_data_descr_t **direct_types;  /* directly indexed types */
 static mrp_data_descr_t **other_types;   /* linearly searched types */
 static int                nother_type;
 
 
-static inline void destroy_field(mrp_msg_field_t *f)
+/*
+ * allocation helpers for messages and data, optionally from an arena
+ */
+
+static inline void *msg_allocz(mrp_arena_t *arena, size_t size)
+{
+    if (arena != NULL)
+        return mrp_arena_allocz(arena, size);
+    else
+        return mrp_allocz(size);
+}
+
+
+static inline char *msg_strdup(mrp_arena_t *arena, const char *s)
+{
+    if (arena != NULL)
+        return mrp_arena_strdup(arena, s);
+    else
+        return mrp_strdup(s);
+}
+
+
+static inline void *msg_datadup(mrp_arena_t *arena, void *ptr, size_t size)
+{
+    if (arena != NULL)
+        return mrp_arena_datadup(arena, ptr, size);
+    else
+        return mrp_datadup(ptr, size);
+}
+
+
+static inline void destroy_field(mrp_arena_t *arena, mrp_msg_field_t *f)
 {
     uint32_t i;
+    int      borrowed;
 
     if (f != NULL) {
         mrp_list_delete(&f->hook);
 
+        if (arena != NULL)
+            return;
+
+        /*
+         * Notes:
+         *     Borrowed strings, blobs and byte arrays point directly into
+         *     a shared message buffer. Borrowed string arrays own only the
+         *     array of pointers, the strings are in the buffer. Arrays
+         *     still in wire format own nothing.
+         */
+
+        borrowed = f->flags & MRP_MSG_FIELD_BORROWED;
+
         switch (f->type) {
         case MRP_MSG_FIELD_STRING:
-            mrp_free(f->str);
+            if (!borrowed)
+                mrp_free(f->str);
             break;
 
         case MRP_MSG_FIELD_BLOB:
-            mrp_free(f->blb);
+            if (!borrowed)
+                mrp_free(f->blb);
             break;
 
         default:
             if (f->type & MRP_MSG_FIELD_ARRAY) {
+                if (f->flags & MRP_MSG_FIELD_ENCODED)
+                    break;
+
                 if ((f->type & ~MRP_MSG_FIELD_ARRAY) == MRP_MSG_FIELD_STRING) {
-                    for (i = 0; i < f->size[0]; i++) {
-                        mrp_free(f->astr[i]);
+                    if (!borrowed) {
+                        for (i = 0; i < f->size[0]; i++) {
+                            mrp_free(f->astr[i]);
+                        }
                     }
                 }
+                else if (borrowed)
+                    break;
 
                 mrp_free(f->aany);
             }
             break;
         }
 
-        mrp_free(f);
+        if (!(f->flags & MRP_MSG_FIELD_EMBEDDED))
+            mrp_free(f);
     }
 }
 
 
-static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
+static inline mrp_msg_field_t *create_field(mrp_arena_t *arena, uint16_t tag,
+                                            va_list *ap)
 {
     mrp_msg_field_t *f;
     uint16_t         type, base;
     uint32_t         size;
     void            *blb;
 
-    if ((f = mrp_allocz(sizeof(*f))) != NULL) {
+    /* allocate room for size[0], needed by blobs and arrays */
+    if ((f = msg_allocz(arena, MRP_OFFSET(typeof(*f), size[1]))) != NULL) {
         mrp_list_init(&f->hook);
         type = va_arg(*ap, uint32_t);
 
 #define CREATE(_f, _tag, _type, _fldtype, _fld, _last, _errlbl) do {      \
-                                                                          \
-            (_f) = mrp_allocz(MRP_OFFSET(typeof(*_f), _last) +            \
-                              sizeof(_f->_last));                         \
-                                                                          \
-            if ((_f) != NULL) {                                           \
-                (_f)->tag  = _tag;                                        \
-                (_f)->type = _type;                                       \
-                (_f)->_fld = va_arg(*ap, _fldtype);                       \
-            }                                                             \
-            else {                                                        \
-                goto _errlbl;                                             \
-            }                                                             \
+            (_f)->tag  = _tag;                                            \
+            (_f)->type = _type;                                           \
+            (_f)->_fld = va_arg(*ap, _fldtype);                           \
         } while (0)
 
 #define CREATE_ARRAY(_f, _tag, _type, _fld, _fldtype, _errlbl) do {       \
             uint16_t _base;                                               \
             uint32_t _i;                                                  \
                                                                           \
-            (_f) = mrp_allocz(MRP_OFFSET(typeof(*_f), size[1]));          \
+            (_f)->tag  = _tag;                                            \
+            (_f)->type = _type | MRP_MSG_FIELD_ARRAY;                     \
+            _base      = _type & ~MRP_MSG_FIELD_ARRAY;                    \
                                                                           \
-            if ((_f) != NULL) {                                           \
-                (_f)->tag  = _tag;                                        \
-                (_f)->type = _type | MRP_MSG_FIELD_ARRAY;                 \
-                _base      = _type & ~MRP_MSG_FIELD_ARRAY;                \
+            _f->size[0] = va_arg(*ap, uint32_t);                          \
+            _f->_fld    = msg_allocz(arena, _f->size[0] *                 \
+                                     sizeof(*_f->_fld));                  \
                                                                           \
-                _f->size[0] = va_arg(*ap, uint32_t);                      \
-                _f->_fld    = mrp_allocz_array(typeof(*_f->_fld),         \
-                                               _f->size[0]);              \
-                                                                          \
-                if (_f->_fld == NULL)                                     \
-                    goto _errlbl;                                         \
-                else                                                      \
-                    memcpy(_f->_fld, va_arg(*ap, typeof(_f->_fld)),       \
-                           _f->size[0] * sizeof(_f->_fld[0]));            \
+            if (_f->_fld == NULL) {                                       \
+                _f->size[0] = 0;                                          \
+                goto _errlbl;                                             \
+            }                                                             \
+            else                                                          \
+                memcpy(_f->_fld, va_arg(*ap, typeof(_f->_fld)),           \
+                       _f->size[0] * sizeof(_f->_fld[0]));                \
                                                                           \
-                if (_base == MRP_MSG_FIELD_STRING) {                      \
-                    for (_i = 0; _i < _f->size[0]; _i++) {                \
-                        _f->astr[_i] = mrp_strdup(_f->astr[_i]);          \
-                        if (_f->astr[_i] == NULL)                         \
-                            goto _errlbl;                                 \
+            if (_base == MRP_MSG_FIELD_STRING) {                          \
+                for (_i = 0; _i < _f->size[0]; _i++) {                    \
+                    _f->astr[_i] = msg_strdup(arena, _f->astr[_i]);       \
+                    if (_f->astr[_i] == NULL) {                           \
+                        _f->size[0] = _i;                                 \
+                        goto _errlbl;                                     \
                     }                                                     \
                 }                                                         \
             }                                                             \
-            else                                                          \
-                goto _errlbl;                                             \
         } while (0)
 
-        f = NULL;
-
         switch (type) {
         case MRP_MSG_FIELD_STRING:
             CREATE(f, tag, type, char *, str, str, fail);
-            f->str = mrp_strdup(f->str);
+            f->str = msg_strdup(arena, f->str);
             if (f->str == NULL)
                 goto fail;
             break;
@@ -185,13 +238,9 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
 
             blb        = f->blb;
             f->size[0] = size;
-            f->blb     = mrp_allocz(size);
+            f->blb     = msg_datadup(arena, blb, size);
 
-            if (f->blb != NULL) {
-                memcpy(f->blb, blb, size);
-                f->size[0] = size;
-            }
-            else
+            if (f->blb == NULL)
                 goto fail;
             break;
 
@@ -248,7 +297,7 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
     return f;
 
  fail:
-    destroy_field(f);
+    destroy_field(arena, f);
     return NULL;
 
 #undef CREATE
@@ -256,22 +305,196 @@ static inline mrp_msg_field_t *create_field(uint16_t tag, va_list *ap)
 }
 
 
+/*
+ * shared message buffers
+ */
+
+mrp_msg_buffer_t *mrp_msg_buffer_create(void *data)
+{
+    mrp_msg_buffer_t *buf;
+
+    if ((buf = mrp_allocz(sizeof(*buf))) != NULL) {
+        mrp_refcnt_init(&buf->refcnt);
+        buf->data = data;
+    }
+
+    return buf;
+}
+
+
+mrp_msg_buffer_t *mrp_msg_buffer_ref(mrp_msg_buffer_t *buf)
+{
+    return mrp_ref_obj(buf, refcnt);
+}
+
+
+void mrp_msg_buffer_unref(mrp_msg_buffer_t *buf)
+{
+    if (mrp_unref_obj(buf, refcnt)) {
+        mrp_free(buf->data);
+        mrp_free(buf);
+    }
+}
+
+
+int mrp_msg_buffer_reclaim(mrp_msg_buffer_t *buf)
+{
+    /*
+     * Notes: Returns TRUE if the caller got the data back. Otherwise the
+     *     data is still referenced by someone and will be freed when the
+     *     last reference to the buffer is gone.
+     */
+
+    if (mrp_unref_obj(buf, refcnt)) {
+        mrp_free(buf);
+        return TRUE;
+    }
+    else
+        return FALSE;
+}
+
+
+static inline size_t wire_size(uint16_t base)
+{
+    switch (base) {
+    case MRP_MSG_FIELD_BOOL:
+    case MRP_MSG_FIELD_UINT32:
+    case MRP_MSG_FIELD_SINT32:
+        return sizeof(uint32_t);
+    case MRP_MSG_FIELD_UINT16:
+    case MRP_MSG_FIELD_SINT16:
+        return sizeof(uint16_t);
+    case MRP_MSG_FIELD_UINT64:
+    case MRP_MSG_FIELD_SINT64:
+        return sizeof(uint64_t);
+    case MRP_MSG_FIELD_DOUBLE:
+        return sizeof(double);
+    default:
+        return 0;
+    }
+}
+
+
+static int materialize_field(mrp_msg_field_t *f)
+{
+    uint8_t   *p;
+    char     **astr;
+    uint32_t   n, i, len;
+
+    if (!(f->flags & MRP_MSG_FIELD_ENCODED))
+        return TRUE;
+
+    p = f->aany;
+    n = f->size[0];
+
+#define CONVERT(_fld, _wtype, _conv) do {                                 \
+        typeof(f->_fld) _a;                                               \
+        _wtype          _w;                                               \
+                                                                          \
+        if ((_a = mrp_allocz(n * sizeof(_a[0]))) == NULL)                 \
+            return FALSE;                                                 \
+                                                                          \
+        for (i = 0; i < n; i++, p += sizeof(_w)) {                        \
+            memcpy(&_w, p, sizeof(_w));                                   \
+            _a[i] = _conv(_w);                                            \
+        }                                                                 \
+                                                                          \
+        f->_fld = _a;                                                     \
+    } while (0)
+
+#define NOCONV(_w) (_w)
+
+    switch (f->type & ~MRP_MSG_FIELD_ARRAY) {
+    case MRP_MSG_FIELD_STRING:
+        if ((astr = mrp_allocz(n * sizeof(astr[0]))) == NULL)
+            return FALSE;
+
+        for (i = 0; i < n; i++) {
+            memcpy(&len, p, sizeof(len));
+            len  = be32toh(len);
+            p   += sizeof(len);
+
+            astr[i] = len > 0 ? (char *)p : "";
+            p      += len;
+        }
+
+        f->astr = astr;
+        break;
+
+    case MRP_MSG_FIELD_BOOL:   CONVERT(abln, uint32_t, be32toh); break;
+    case MRP_MSG_FIELD_UINT16: CONVERT(au16, uint16_t, be16toh); break;
+    case MRP_MSG_FIELD_SINT16: CONVERT(as16, uint16_t, be16toh); break;
+    case MRP_MSG_FIELD_UINT32: CONVERT(au32, uint32_t, be32toh); break;
+    case MRP_MSG_FIELD_SINT32: CONVERT(as32, uint32_t, be32toh); break;
+    case MRP_MSG_FIELD_UINT64: CONVERT(au64, uint64_t, be64toh); break;
+    case MRP_MSG_FIELD_SINT64: CONVERT(as64, uint64_t, be64toh); break;
+    case MRP_MSG_FIELD_DOUBLE: CONVERT(adbl, double  , NOCONV ); break;
+    default:
+        errno = EINVAL;
+        return FALSE;
+    }
+
+#undef CONVERT
+#undef NOCONV
+
+    f->flags &= ~MRP_MSG_FIELD_ENCODED;
+
+    return TRUE;
+}
+
+
+int mrp_msg_materialize(mrp_msg_t *msg)
+{
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f = mrp_list_entry(p, typeof(*f), hook);
+
+        if (!materialize_field(f))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
 static void msg_destroy(mrp_msg_t *msg)
 {
     mrp_list_hook_t *p, *n;
     mrp_msg_field_t *f;
 
     if (msg != NULL) {
+        /* messages in an arena are released by resetting the arena */
+        if (msg->arena != NULL)
+            return;
+
         mrp_list_foreach(&msg->fields, p, n) {
             f = mrp_list_entry(p, typeof(*f), hook);
-            destroy_field(f);
+            destroy_field(NULL, f);
         }
 
+        mrp_msg_buffer_unref(msg->buf);
+        mrp_free(msg->index);
         mrp_free(msg);
     }
 }
 
 
+static mrp_msg_t *msg_create_empty(mrp_arena_t *arena)
+{
+    mrp_msg_t *msg;
+
+    if ((msg = msg_allocz(arena, sizeof(*msg))) != NULL) {
+        mrp_list_init(&msg->fields);
+        msg->refcnt = 1;
+        msg->arena  = arena;
+    }
+
+    return msg;
+}
+
+
 mrp_msg_t *mrp_msg_create(uint16_t tag, ...)
 {
     mrp_msg_t       *msg;
@@ -279,12 +502,9 @@ mrp_msg_t *mrp_msg_create(uint16_t tag, ...)
     va_list          ap;
 
     va_start(ap, tag);
-    if ((msg = mrp_allocz(sizeof(*msg))) != NULL) {
-        mrp_list_init(&msg->fields);
-        msg->refcnt = 1;
-
+    if ((msg = msg_create_empty(NULL)) != NULL) {
         while (tag != MRP_MSG_FIELD_INVALID) {
-            f = create_field(tag, &ap);
+            f = create_field(NULL, tag, &ap);
 
             if (f != NULL) {
                 mrp_list_append(&msg->fields, &f->hook);
@@ -331,7 +551,7 @@ int mrp_msg_append(mrp_msg_t *msg, uint16_t tag, ...)
     va_list          ap;
 
     va_start(ap, tag);
-    f = create_field(tag, &ap);
+    f = create_field(msg->arena, tag, &ap);
     va_end(ap);
 
     if (f != NULL) {
@@ -350,7 +570,7 @@ int mrp_msg_prepend(mrp_msg_t *msg, uint16_t tag, ...)
     va_list          ap;
 
     va_start(ap, tag);
-    f = create_field(tag, &ap);
+    f = create_field(msg->arena, tag, &ap);
     va_end(ap);
 
     if (f != NULL) {
@@ -363,7 +583,103 @@ int mrp_msg_prepend(mrp_msg_t *msg, uint16_t tag, ...)
 }
 
 
-mrp_msg_field_t *mrp_msg_find(mrp_msg_t *msg, uint16_t tag)
+static int index_cmp(const void *p1, const void *p2)
+{
+    const mrp_msg_index_t *i1 = p1, *i2 = p2;
+
+    if (i1->tag != i2->tag)
+        return i1->tag < i2->tag ? -1 : 1;
+    else
+        return i1->pos < i2->pos ? -1 : (i1->pos > i2->pos ? 1 : 0);
+}
+
+
+static int build_index(mrp_msg_t *msg)
+{
+    mrp_msg_index_t *index, tmp;
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+    size_t           size;
+    uint32_t         i, j, k;
+
+    /*
+     * Notes:
+     *     Fields are never removed from a message, so an index is stale
+     *     exactly when the number of fields no longer matches it. Fields
+     *     with the same tag are kept in list order, so that we find the
+     *     same one as a linear search would. For smaller messages, and
+     *     ones with fields mostly in tag order, insertion sort is faster
+     *     than qsort.
+     */
+
+    size = msg->nfield * sizeof(*index);
+
+    if (msg->arena != NULL)
+        index = mrp_arena_alloc(msg->arena, size);
+    else
+        index = mrp_realloc(msg->index, size);
+
+    if (index == NULL)
+        return FALSE;
+
+    i = 0;
+    mrp_list_foreach(&msg->fields, p, n) {
+        if (i >= msg->nfield)
+            break;
+
+        f = mrp_list_entry(p, typeof(*f), hook);
+
+        index[i].tag   = f->tag;
+        index[i].pos   = i;
+        index[i].field = f;
+        i++;
+    }
+
+    if (i <= MSG_INDEX_ISORT) {
+        for (j = 1; j < i; j++) {
+            tmp = index[j];
+
+            for (k = j; k > 0 && index[k - 1].tag > tmp.tag; k--)
+                index[k] = index[k - 1];
+
+            index[k] = tmp;
+        }
+    }
+    else
+        qsort(index, i, sizeof(*index), index_cmp);
+
+    msg->index  = index;
+    msg->nindex = i;
+
+    return TRUE;
+}
+
+
+static mrp_msg_field_t *find_indexed(mrp_msg_t *msg, uint16_t tag)
+{
+    mrp_msg_index_t *index = msg->index;
+    size_t           lo, hi, mid;
+
+    lo = 0;
+    hi = msg->nindex;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (index[mid].tag < tag)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo < msg->nindex && index[lo].tag == tag)
+        return index[lo].field;
+    else
+        return NULL;
+}
+
+
+static mrp_msg_field_t *find_linear(mrp_msg_t *msg, uint16_t tag)
 {
     mrp_msg_field_t *f;
     mrp_list_hook_t *p, *n;
@@ -378,6 +694,32 @@ mrp_msg_field_t *mrp_msg_find(mrp_msg_t *msg, uint16_t tag)
 }
 
 
+mrp_msg_field_t *mrp_msg_find(mrp_msg_t *msg, uint16_t tag)
+{
+    mrp_msg_field_t *f;
+
+    /*
+     * Notes:
+     *     For messages with more than a handful of fields we build an
+     *     index of fields sorted by tag on the first lookup and do binary
+     *     searches. Appending or prepending fields invalidates the index,
+     *     and it is rebuilt on the next lookup.
+     */
+
+    if (msg->nfield >= MSG_INDEX_MIN &&
+        (msg->nindex == msg->nfield || build_index(msg)))
+        f = find_indexed(msg, tag);
+    else
+        f = find_linear(msg, tag);
+
+    if (f != NULL && MRP_UNLIKELY(f->flags & MRP_MSG_FIELD_ENCODED))
+        if (!materialize_field(f))
+            return NULL;
+
+    return f;
+}
+
+
 static const char *field_type_name(uint16_t type)
 {
 #define BASIC(t, n) [MRP_MSG_FIELD_##t] = n
@@ -440,6 +782,9 @@ int mrp_msg_dump(mrp_msg_t *msg, FILE *fp)
     uint16_t         base;
     const char      *tname;
 
+    if (!mrp_msg_materialize(msg))
+        return -1;
+
     l = fprintf(fp, "{\n");
     mrp_list_foreach(&msg->fields, p, n) {
         f = mrp_list_entry(p, typeof(*f), hook);
@@ -572,6 +917,11 @@ ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp)
     uint16_t         type;
     size_t           size;
 
+    if (!mrp_msg_materialize(msg)) {
+        *bufp = NULL;
+        return -1;
+    }
+
     size = msg->nfield * (2 * sizeof(uint16_t) + sizeof(uint64_t));
 
     if (mrp_msgbuf_write(&mb, size)) {
@@ -716,15 +1066,22 @@ ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp)
 
 
 mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size)
+{
+    return mrp_msg_default_decode_arena(buf, size, NULL);
+}
+
+
+mrp_msg_t *mrp_msg_default_decode_arena(void *buf, size_t size,
+                                        mrp_arena_t *arena)
 {
     mrp_msg_t       *msg;
     mrp_msgbuf_t     mb;
     mrp_msg_value_t  v;
     void            *value;
     uint16_t         nfield, tag, type, base;
-    uint32_t         len, n, i;
+    uint32_t         len, n, i, j;
 
-    msg = mrp_msg_create_empty();
+    msg = msg_create_empty(arena);
 
     if (msg == NULL)
         return NULL;
@@ -836,63 +1193,63 @@ mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size)
                 int64_t  as64[n];
                 double   adbl[n];
 
-                for (i = 0; i < n; i++) {
+                for (j = 0; j < n; j++) {
 
                     switch (base) {
                     case MRP_MSG_FIELD_STRING:
                         len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len),
                                                       1, nodata));
                         if (len > 0)
-                            astr[i] = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
+                            astr[j] = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
                         else
-                            astr[i] = "";
+                            astr[j] = "";
                         break;
 
                     case MRP_MSG_FIELD_BOOL:
-                        abln[i] = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1,
+                        abln[j] = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1,
                                                           nodata));
                         break;
 
                     case MRP_MSG_FIELD_UINT8:
-                        au8[i] = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
+                        au8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.u8), 1, nodata);
                         break;
 
                     case MRP_MSG_FIELD_SINT8:
-                        as8[i] = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
+                        as8[j] = MRP_MSGBUF_PULL(&mb, typeof(v.s8), 1, nodata);
                         break;
 
                     case MRP_MSG_FIELD_UINT16:
-                        au16[i] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16),
+                        au16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.u16),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_SINT16:
-                        as16[i] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16),
+                        as16[j] = be16toh(MRP_MSGBUF_PULL(&mb, typeof(v.s16),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_UINT32:
-                        au32[i] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32),
+                        au32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.u32),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_SINT32:
-                        as32[i] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32),
+                        as32[j] = be32toh(MRP_MSGBUF_PULL(&mb, typeof(v.s32),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_UINT64:
-                        au64[i] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64),
+                        au64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.u64),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_SINT64:
-                        as64[i] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64),
+                        as64[j] = be64toh(MRP_MSGBUF_PULL(&mb, typeof(v.s64),
                                                           1, nodata));
                         break;
 
                     case MRP_MSG_FIELD_DOUBLE:
-                        adbl[i] = MRP_MSGBUF_PULL(&mb, typeof(v.dbl),
+                        adbl[j] = MRP_MSGBUF_PULL(&mb, typeof(v.dbl),
                                                   1, nodata);
                     break;
 
@@ -941,6 +1298,166 @@ mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size)
 }
 
 
+mrp_msg_t *mrp_msg_default_decode_view(mrp_msg_buffer_t *buf, void *data,
+                                       size_t size)
+{
+    mrp_msg_t       *msg;
+    mrp_msg_field_t *f;
+    mrp_msgbuf_t     mb;
+    uint16_t         nfield, base;
+    uint32_t         len, n, i, j;
+    size_t           fsize, wsize;
+    char            *str;
+
+    /*
+     * Notes:
+     *     All fields are allocated in a single block together with the
+     *     message. Strings, blobs and byte arrays are left in the buffer.
+     *     Other arrays are only validated here and left in wire format
+     *     until they are looked up. Since we hand out pointers to strings
+     *     in the buffer, we insist on them being properly terminated.
+     */
+
+    msg = NULL;
+
+    mrp_msgbuf_read(&mb, data, size);
+
+    nfield = be16toh(MRP_MSGBUF_PULL(&mb, typeof(nfield), 1, invalid));
+    fsize  = MRP_ALIGN(MRP_OFFSET(mrp_msg_field_t, size[1]),
+                       __alignof__(mrp_msg_field_t));
+
+    if ((msg = mrp_allocz(sizeof(*msg) + nfield * fsize)) == NULL)
+        return NULL;
+
+    mrp_list_init(&msg->fields);
+    msg->refcnt = 1;
+    msg->buf    = mrp_msg_buffer_ref(buf);
+
+    for (i = 0; i < nfield; i++) {
+        f = (void *)msg + sizeof(*msg) + i * fsize;
+
+        mrp_list_init(&f->hook);
+        f->flags = MRP_MSG_FIELD_EMBEDDED;
+        f->tag   = be16toh(MRP_MSGBUF_PULL(&mb, uint16_t, 1, invalid));
+        f->type  = be16toh(MRP_MSGBUF_PULL(&mb, uint16_t, 1, invalid));
+
+        switch (f->type) {
+        case MRP_MSG_FIELD_STRING:
+            len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, invalid));
+            if (len > 0) {
+                f->str = MRP_MSGBUF_PULL_DATA(&mb, len, 1, invalid);
+                if (f->str[len - 1] != '\0')
+                    goto invalid;
+            }
+            else
+                f->str = "";
+            f->flags |= MRP_MSG_FIELD_BORROWED;
+            break;
+
+        case MRP_MSG_FIELD_BOOL:
+            f->bln = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_UINT8:
+            f->u8 = MRP_MSGBUF_PULL(&mb, typeof(f->u8), 1, invalid);
+            break;
+
+        case MRP_MSG_FIELD_SINT8:
+            f->s8 = MRP_MSGBUF_PULL(&mb, typeof(f->s8), 1, invalid);
+            break;
+
+        case MRP_MSG_FIELD_UINT16:
+            f->u16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->u16), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_SINT16:
+            f->s16 = be16toh(MRP_MSGBUF_PULL(&mb, typeof(f->s16), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_UINT32:
+            f->u32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(f->u32), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_SINT32:
+            f->s32 = be32toh(MRP_MSGBUF_PULL(&mb, typeof(f->s32), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_UINT64:
+            f->u64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(f->u64), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_SINT64:
+            f->s64 = be64toh(MRP_MSGBUF_PULL(&mb, typeof(f->s64), 1, invalid));
+            break;
+
+        case MRP_MSG_FIELD_DOUBLE:
+            f->dbl = MRP_MSGBUF_PULL(&mb, typeof(f->dbl), 1, invalid);
+            break;
+
+        case MRP_MSG_FIELD_BLOB:
+            len        = be32toh(MRP_MSGBUF_PULL(&mb, uint32_t, 1, invalid));
+            f->blb     = MRP_MSGBUF_PULL_DATA(&mb, len, 1, invalid);
+            f->size[0] = len;
+            f->flags  |= MRP_MSG_FIELD_BORROWED;
+            break;
+
+        default:
+            if (!(f->type & MRP_MSG_FIELD_ARRAY))
+                goto invalid;
+
+            base       = f->type & ~MRP_MSG_FIELD_ARRAY;
+            n          = be32toh(MRP_MSGBUF_PULL(&mb, typeof(n), 1, invalid));
+            f->size[0] = n;
+
+            switch (base) {
+            case MRP_MSG_FIELD_UINT8:
+            case MRP_MSG_FIELD_SINT8:
+                f->aany   = MRP_MSGBUF_PULL_DATA(&mb, n, 1, invalid);
+                f->flags |= MRP_MSG_FIELD_BORROWED;
+                break;
+
+            case MRP_MSG_FIELD_STRING:
+                data = mb.p;
+                for (j = 0; j < n; j++) {
+                    len = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1,
+                                                  invalid));
+                    if (len > 0) {
+                        str = MRP_MSGBUF_PULL_DATA(&mb, len, 1, invalid);
+                        if (str[len - 1] != '\0')
+                            goto invalid;
+                    }
+                }
+                f->aany   = data;
+                f->flags |= MRP_MSG_FIELD_BORROWED | MRP_MSG_FIELD_ENCODED;
+                break;
+
+            default:
+                if ((wsize = wire_size(base)) == 0 || n > mb.l / wsize)
+                    goto invalid;
+                f->aany   = MRP_MSGBUF_PULL_DATA(&mb, n * wsize, 1, invalid);
+                f->flags |= MRP_MSG_FIELD_ENCODED;
+                break;
+            }
+
+            if (n == 0) {                /* nothing to point to or convert */
+                f->aany   = NULL;
+                f->flags &= ~(MRP_MSG_FIELD_BORROWED | MRP_MSG_FIELD_ENCODED);
+            }
+        }
+
+        mrp_list_append(&msg->fields, &f->hook);
+        msg->nfield++;
+    }
+
+    return msg;
+
+ invalid:
+    errno = EINVAL;
+    mrp_msg_unref(msg);
+    return NULL;
+}
+
+
 static int guarded_array_size(void *data, mrp_data_member_t *array)
 {
 #define MAX_ITEMS (32 * 1024)
@@ -1355,6 +1872,13 @@ static mrp_data_member_t *member_type(mrp_data_member_t *fields, int nfield,
 
 
 void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
+{
+    return mrp_data_decode_arena(bufp, sizep, descr, NULL);
+}
+
+
+void *mrp_data_decode_arena(void **bufp, size_t *sizep,
+                            mrp_data_descr_t *descr, mrp_arena_t *arena)
 {
     void              *data;
     mrp_data_member_t *fields, *f;
@@ -1368,7 +1892,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
 
     fields = descr->fields;
     nfield = descr->nfield;
-    data   = mrp_allocz(descr->size);
+    data   = msg_allocz(arena, descr->size);
 
     if (MRP_UNLIKELY(data == NULL))
         return NULL;
@@ -1391,7 +1915,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
                 value  = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
             else
                 value = "";
-            v->str = mrp_strdup((char *)value);
+            v->str = msg_strdup(arena, (char *)value);
             if (v->str == NULL)
                 goto nomem;
             break;
@@ -1439,7 +1963,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
         case MRP_MSG_FIELD_BLOB:
             len    = be32toh(MRP_MSGBUF_PULL(&mb, typeof(len), 1, nodata));
             value  = MRP_MSGBUF_PULL_DATA(&mb, len, 1, nodata);
-            v->blb = mrp_datadup(value, len);
+            v->blb = msg_datadup(arena, value, len);
             if (v->blb == NULL)
                 goto nomem;
             break;
@@ -1478,7 +2002,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
                 goto fail;
             }
 
-            v->aany = mrp_allocz(size);
+            v->aany = msg_allocz(arena, size);
             if (v->aany == NULL)
                 goto nomem;
 
@@ -1492,7 +2016,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
                     else
                         value = "";
 
-                    v->astr[j] = mrp_strdup(value);
+                    v->astr[j] = msg_strdup(arena, value);
                     if (v->astr[j] == NULL)
                         goto nomem;
                     break;
@@ -1568,7 +2092,7 @@ void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr)
  nodata:
  nomem:
  fail:
-    if (data != NULL) {
+    if (data != NULL && arena == NULL) {
         for (i = 0, f = fields; i < nfield; i++, f++) {
             switch (f->type) {
             case MRP_MSG_FIELD_STRING:
@@ -37,6 +37,7 @@
 
 #include <murphy/common/list.h>
 #include <murphy/common/refcnt.h>
+#include <murphy/common/mm.h>
 
 
 /*
@@ -120,19 +121,69 @@ typedef enum {
 
 typedef MRP_MSG_VALUE_UNION mrp_msg_value_t;
 
+/*
+ * message field flags
+ *
+ * These are used internally to keep track of fields decoded in view mode
+ * (see below). Fields created by the API have no flags set.
+ */
+
+typedef enum {
+    MRP_MSG_FIELD_BORROWED = 0x1,        /* data points into a msg buffer */
+    MRP_MSG_FIELD_ENCODED  = 0x2,        /* array still in wire format */
+    MRP_MSG_FIELD_EMBEDDED = 0x4,        /* allocated with the message */
+} mrp_msg_field_flag_t;
+
 typedef struct {
     mrp_list_hook_t hook;                /* hook to list of fields */
     uint16_t        tag;                 /* message field tag */
     uint16_t        type;                /* message field type */
+    uint16_t        flags;               /* MRP_MSG_FIELD_* flags */
     MRP_MSG_VALUE_UNION;                 /* message field value */
     uint32_t        size[0];             /* size, if an array or a blob */
 } mrp_msg_field_t;
 
 
+/*
+ * shared message buffers
+ *
+ * A shared message buffer is a reference-counted wrapper around a chunk
+ * of memory containing received, encoded messages. Messages decoded from
+ * a shared buffer in view mode do not copy strings, blobs or byte arrays
+ * out of the buffer, they point directly into it. Other arrays are left
+ * in wire format and only converted to host format when the field is
+ * first looked up. Fields decoded like this are read-only. The message
+ * holds a reference to the buffer for as long as it is alive.
+ */
+
+typedef struct {
+    mrp_refcnt_t  refcnt;                /* reference count */
+    void         *data;                  /* buffer memory */
+} mrp_msg_buffer_t;
+
+/** Create a shared buffer, taking over the ownership of @data. */
+mrp_msg_buffer_t *mrp_msg_buffer_create(void *data);
+
+/** Add a reference to the given shared buffer. */
+mrp_msg_buffer_t *mrp_msg_buffer_ref(mrp_msg_buffer_t *buf);
+
+/** Remove a reference, freeing the buffer and its data with the last one. */
+void mrp_msg_buffer_unref(mrp_msg_buffer_t *buf);
+
+/** Drop the creator's reference, reclaim the data if it was the last one. */
+int mrp_msg_buffer_reclaim(mrp_msg_buffer_t *buf);
+
+
+typedef struct mrp_msg_index_s mrp_msg_index_t;
+
 typedef struct {
-    mrp_list_hook_t fields;              /* list of message fields */
-    size_t          nfield;              /* number of fields */
-    mrp_refcnt_t    refcnt;              /* reference count */
+    mrp_list_hook_t   fields;            /* list of message fields */
+    size_t            nfield;            /* number of fields */
+    mrp_refcnt_t      refcnt;            /* reference count */
+    mrp_arena_t      *arena;             /* arena we live in, if any */
+    mrp_msg_buffer_t *buf;               /* buffer we point into, if any */
+    mrp_msg_index_t  *index;             /* fields sorted by tag, if any */
+    size_t            nindex;            /* number of indexed fields */
 } mrp_msg_t;
 
 
@@ -166,6 +217,17 @@ ssize_t mrp_msg_default_encode(mrp_msg_t *msg, void **bufp);
 /** Decode the given message using the default message decoder. */
 mrp_msg_t *mrp_msg_default_decode(void *buf, size_t size);
 
+/** Decode the given message allocating it from @arena. */
+mrp_msg_t *mrp_msg_default_decode_arena(void *buf, size_t size,
+                                        mrp_arena_t *arena);
+
+/** Decode the given message from @buf in view mode, without copying data. */
+mrp_msg_t *mrp_msg_default_decode_view(mrp_msg_buffer_t *buf, void *data,
+                                       size_t size);
+
+/** Convert any arrays still in wire format in the message to host format. */
+int mrp_msg_materialize(mrp_msg_t *msg);
+
 
 /*
  * custom data types
@@ -261,6 +323,10 @@ size_t mrp_data_encode(void **bufp, void *data, mrp_data_descr_t *descr,
 /** Decode a structure using the given message descriptor. */
 void *mrp_data_decode(void **bufp, size_t *sizep, mrp_data_descr_t *descr);
 
+/** Decode a structure allocating it from @arena, do not mrp_data_free it. */
+void *mrp_data_decode_arena(void **bufp, size_t *sizep,
+                            mrp_data_descr_t *descr, mrp_arena_t *arena);
+
 /** Dump the given data buffer. */
 int mrp_data_dump(void *data, mrp_data_descr_t *descr, FILE *fp);
 
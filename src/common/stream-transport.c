@@ -57,6 +57,7 @@ typedef struct {
     MRP_TRANSPORT_PUBLIC_FIELDS;         /* common transport fields */
     int             sock;                /* TCP socket */
     mrp_io_watch_t *iow;                 /* socket I/O watch */
+    mrp_io_req_t   *ireq;                /* pending read, if native I/O */
     void           *ibuf;                /* input buffer */
     size_t          isize;               /* input buffer size */
     size_t          idata;               /* amount of input data */
@@ -67,6 +68,7 @@ static void strm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
                         mrp_io_event_t events, void *user_data);
 static int strm_disconnect(mrp_transport_t *mt);
 static int open_socket(strm_t *t, int family);
+static int watch_socket(strm_t *t);
 
 
 
@@ -251,7 +253,6 @@ static int strm_open(mrp_transport_t *mt)
 static int strm_createfrom(mrp_transport_t *mt, void *conn)
 {
     strm_t           *t = (strm_t *)mt;
-    mrp_io_event_t   events;
     int              on;
     long             nb;
 
@@ -267,13 +268,8 @@ static int strm_createfrom(mrp_transport_t *mt, void *conn)
             fcntl(t->sock, F_SETFL, O_NONBLOCK, nb);
         }
 
-        if (t->connected) {
-            events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
-            t->iow = mrp_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
-
-            if (t->iow != NULL)
-                return TRUE;
-        }
+        if (t->connected)
+            return watch_socket(t);
     }
 
     return FALSE;
@@ -314,7 +310,6 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
     strm_t         *t, *lt;
     mrp_sockaddr_t  addr;
     socklen_t       addrlen;
-    mrp_io_event_t  events;
     int             on;
     long            nb;
 
@@ -338,10 +333,7 @@ static int strm_accept(mrp_transport_t *mt, mrp_transport_t *mlt)
             fcntl(t->sock, F_SETFL, O_CLOEXEC, on);
         }
 
-        events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
-        t->iow = mrp_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
-
-        if (t->iow != NULL)
+        if (watch_socket(t))
             return TRUE;
         else {
             close(t->sock);
@@ -359,8 +351,15 @@ static void strm_close(mrp_transport_t *mt)
 
     mrp_del_io_watch(t->iow);
     t->iow = NULL;
+    mrp_io_cancel(t->ireq);
+    t->ireq = NULL;
 
-    mrp_free(t->ibuf);
+    if (mt->rxbuf != NULL) {             /* closed while passing on input */
+        mrp_msg_buffer_unref(mt->rxbuf);
+        mt->rxbuf = NULL;
+    }
+    else
+        mrp_free(t->ibuf);
     t->ibuf  = NULL;
     t->isize = 0;
     t->idata = 0;
@@ -372,18 +371,151 @@ static void strm_close(mrp_transport_t *mt)
 }
 
 
+static int grow_input(strm_t *t)
+{
+    uint32_t *sizep, size;
+    int       old;
+
+    /*
+     * enlarge the buffer to hold at least the full pending message
+     */
+
+    if (t->isize > sizeof(size)) {
+        old      = t->isize;
+        sizep    = t->ibuf;
+        size     = sizeof(size) + ntohl(*sizep);
+        t->isize = size;
+    }
+    else {
+        old      = 0;
+        t->isize = DEFAULT_SIZE;
+    }
+
+    if (!mrp_reallocz(t->ibuf, old, t->isize))
+        return FALSE;
+    else
+        return TRUE;
+}
+
+
+static int reclaim_input(strm_t *t, size_t used)
+{
+    mrp_transport_t  *mt    = (mrp_transport_t *)t;
+    mrp_msg_buffer_t *rxbuf = mt->rxbuf;
+    void             *ibuf;
+
+    /*
+     * Take back our input buffer after passing on messages in view mode.
+     * If any of the messages is still alive, it owns the buffer now and we
+     * switch to a new one. We copy the unprocessed input to the same offset
+     * so the caller can process the rest as usual.
+     */
+
+    mt->rxbuf = NULL;
+
+    if (mrp_msg_buffer_reclaim(rxbuf))
+        return TRUE;
+
+    ibuf = t->ibuf;
+
+    if ((t->ibuf = mrp_allocz(t->isize)) == NULL) {
+        t->isize = 0;
+        t->idata = 0;
+        return FALSE;
+    }
+
+    memcpy(t->ibuf + used, ibuf + used, t->idata - used);
+
+    return TRUE;
+}
+
+
+static int process_input(strm_t *t)
+{
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+    uint32_t        *sizep, size;
+    ssize_t          left;
+    void            *data;
+    int              error;
+
+    /*
+     * Notes: Returns 0 if all complete messages were processed, -1 if
+     *        the transport got destroyed, or an error code otherwise.
+     */
+
+    if (t->idata < sizeof(size))
+        return 0;
+
+    sizep = t->ibuf;
+    size  = ntohl(*sizep);
+
+    while (t->idata >= sizeof(size) + size) {
+        data = t->ibuf + sizeof(size);
+
+        if (MRP_TRANSPORT_ZEROCOPY_MSG(mt))
+            mt->rxbuf = mrp_msg_buffer_create(t->ibuf);
+
+        error = t->recv_data(mt, data, size, NULL, 0);
+
+        if (mt->rxbuf != NULL && !reclaim_input(t, sizeof(size) + size))
+            return ENOMEM;
+
+        if (error)
+            return error;
+
+        if (t->check_destroy(mt))
+            return -1;
+
+        left = t->idata - (sizeof(size) + size);
+        memmove(t->ibuf, t->ibuf + sizeof(size) + size, left);
+        t->idata = left;
+
+        if (t->idata >= sizeof(size)) {
+            sizep = t->ibuf;
+            size = ntohl(*sizep);
+        }
+        else
+            size = (uint32_t)-1;
+    }
+
+    return 0;
+}
+
+
+static void input_closed(strm_t *t, int error)
+{
+    mrp_transport_t *mt = (mrp_transport_t *)t;
+
+    strm_disconnect(mt);
+
+    if (t->evt.closed != NULL)
+        MRP_TRANSPORT_BUSY(mt, {
+                mt->evt.closed(mt, error, mt->user_data);
+            });
+
+    t->check_destroy(mt);
+}
+
+
 static void strm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
                          mrp_io_event_t events, void *user_data)
 {
     strm_t           *t  = (strm_t *)user_data;
     mrp_transport_t *mt = (mrp_transport_t *)t;
-    uint32_t        *sizep, size;
-    ssize_t          n, space, left;
-    void            *data;
-    int              old, error;
+    ssize_t          n, space;
+    unsigned int     budget;
+    int              error;
 
     MRP_UNUSED(ml);
-    MRP_UNUSED(w);
+
+    /*
+     * Notes: If the watch has a budget, we stop reading once it has
+     *     been used up, even if there is more input available. Since
+     *     the socket stays readable, we'll get called again after the
+     *     rest of the mainloop had its share.
+     */
+
+    budget = mrp_get_io_watch_budget(w);
 
     if (events & MRP_IO_EVENT_IN) {
         if (MRP_UNLIKELY(mt->listened != 0)) {
@@ -395,83 +527,112 @@ static void strm_recv_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
             return;
         }
 
-        /*
-         * enlarge the buffer if we're out of space
-         */
-    realloc:
-        if (t->idata == t->isize) {
-            if (t->isize > sizeof(size)) {
-                old       = t->isize;
-                sizep     = t->ibuf;
-                size      = sizeof(size) + ntohl(*sizep);
-                t->isize  = size;
-            }
-            else {
-                old      = 0;
-                t->isize = DEFAULT_SIZE;
-            }
-            if (!mrp_reallocz(t->ibuf, old, t->isize)) {
-                error = ENOMEM;
-            fatal_error:
-            closed:
-                strm_disconnect(mt);
-
-                if (t->evt.closed != NULL)
-                    MRP_TRANSPORT_BUSY(mt, {
-                            mt->evt.closed(mt, error, mt->user_data);
-                        });
-
-                t->check_destroy(mt);
-                return;
-            }
+        if (t->idata == t->isize && !grow_input(t)) {
+            input_closed(t, ENOMEM);
+            return;
         }
 
-
         space = t->isize - t->idata;
         while ((n = read(fd, t->ibuf + t->idata, space)) > 0) {
+            t->nread++;
             t->idata += n;
 
-            if (t->idata >= sizeof(size)) {
-                sizep = t->ibuf;
-                size  = ntohl(*sizep);
-
-                while (t->idata >= sizeof(size) + size) {
-                    data  = t->ibuf + sizeof(size);
-                    error = t->recv_data(mt, data, size, NULL, 0);
-
-                    if (error)
-                        goto fatal_error;
-
-                    if (t->check_destroy(mt))
-                        return;
-
-                    left = t->idata - (sizeof(size) + size);
-                    memmove(t->ibuf, t->ibuf + sizeof(size) + size, left);
-                    t->idata = left;
+            if ((error = process_input(t)) != 0) {
+                if (error > 0)
+                    input_closed(t, error);
+                return;
+            }
 
-                    if (t->idata >= sizeof(size)) {
-                        sizep = t->ibuf;
-                        size = ntohl(*sizep);
-                    }
-                    else
-                        size = (uint32_t)-1;
-                }
+            if (t->idata == t->isize && !grow_input(t)) {
+                input_closed(t, ENOMEM);
+                return;
             }
+
             space = t->isize - t->idata;
-            if (space == 0)
-                goto realloc;
+
+            if (budget != 0 && --budget == 0)
+                return;
         }
 
+        t->nread++;
+
         if (n < 0 && errno != EAGAIN) {
-            error = EIO;
-            goto fatal_error;
+            input_closed(t, EIO);
+            return;
         }
     }
 
-    if (events & MRP_IO_EVENT_HUP) {
-        error = 0;
-        goto closed;
+    if (events & MRP_IO_EVENT_HUP)
+        input_closed(t, 0);
+}
+
+
+static void strm_recv_done(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                           ssize_t result, void *user_data);
+
+static int strm_recv_start(strm_t *t)
+{
+    if (t->idata == t->isize && !grow_input(t))
+        return FALSE;
+
+    t->ireq = mrp_io_read(t->ml, t->sock, t->ibuf + t->idata,
+                          t->isize - t->idata, strm_recv_done, t);
+
+    return t->ireq != NULL;
+}
+
+
+static void strm_recv_done(mrp_mainloop_t *ml, mrp_io_req_t *req,
+                           ssize_t result, void *user_data)
+{
+    strm_t *t = (strm_t *)user_data;
+    int     error;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(req);
+
+    t->ireq = NULL;
+
+    if (result <= 0) {
+        if (result == -EAGAIN || result == -EINTR)
+            goto restart;
+
+        input_closed(t, result == 0 ? 0 : EIO);
+        return;
     }
+
+    t->idata += result;
+
+    if ((error = process_input(t)) != 0) {
+        if (error > 0)
+            input_closed(t, error);
+        return;
+    }
+
+ restart:
+    if (t->connected && t->sock >= 0 && !strm_recv_start(t))
+        input_closed(t, ENOMEM);
+}
+
+
+static int watch_socket(strm_t *t)
+{
+    mrp_io_event_t events;
+
+    /*
+     * Notes: With native completion-based I/O (io_uring) we keep a read
+     *        request pending on connected sockets, which saves us the
+     *        extra read per readiness notification. Otherwise we fall
+     *        back to the usual I/O watch.
+     */
+
+    if (mrp_io_req_native(t->ml))
+        return strm_recv_start(t);
+
+    events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
+    t->iow = mrp_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
+
+    return t->iow != NULL;
 }
 
 
@@ -518,7 +679,6 @@ static int strm_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
     strm_t         *t    = (strm_t *)mt;
     int             on;
     long            nb;
-    mrp_io_event_t  events;
 
     t->sock = socket(addr->any.sa_family, SOCK_STREAM, 0);
 
@@ -526,10 +686,7 @@ static int strm_connect(mrp_transport_t *mt, mrp_sockaddr_t *addr,
         return FALSE;
 
     if (connect(t->sock, &addr->any, addrlen) == 0) {
-        events = MRP_IO_EVENT_IN | MRP_IO_EVENT_HUP;
-        t->iow = mrp_add_io_watch(t->ml, t->sock, events, strm_recv_cb, t);
-
-        if (t->iow != NULL) {
+        if (watch_socket(t)) {
             on = 1;
             setsockopt(t->sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
             nb = 1;
@@ -555,6 +712,8 @@ static int strm_disconnect(mrp_transport_t *mt)
     if (t->connected) {
         mrp_del_io_watch(t->iow);
         t->iow = NULL;
+        mrp_io_cancel(t->ireq);
+        t->ireq = NULL;
 
         shutdown(t->sock, SHUT_RDWR);
 
@@ -584,6 +743,7 @@ static int strm_send(mrp_transport_t *mt, mrp_msg_t *msg)
             iov[1].iov_len  = size;
 
             n = writev(t->sock, iov, 2);
+            t->nwrite++;
             mrp_free(buf);
 
             if (n == (ssize_t)(size + sizeof(len)))
@@ -609,6 +769,7 @@ static int strm_sendraw(mrp_transport_t *mt, void *data, size_t size)
 
     if (t->connected) {
         n = write(t->sock, data, size);
+        t->nwrite++;
 
         if (n == (ssize_t)size)
             return TRUE;
@@ -650,6 +811,7 @@ static int strm_senddata(mrp_transport_t *mt, void *data, uint16_t tag)
                 *tagp = htobe16(tag);
 
                 n = write(t->sock, buf, len + sizeof(*lenp));
+                t->nwrite++;
 
                 mrp_free(buf);
 
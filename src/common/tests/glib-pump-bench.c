@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+
+#include "glib-pump.c"
+
+/*
+ * A simple benchmark for pumping GMainLoop from our mainloop.
+ *
+ * For each given number of glib I/O watches we pump GMainLoop for a
+ * number of iterations, once with a static set of watches and once
+ * with one watch replaced in every iteration, and measure how many
+ * epoll_ctl calls per iteration the subloop needs to track the glib
+ * pollfd set and the average cost of a mainloop iteration.
+ */
+
+#define DEFAULT_ROUNDS 10000
+
+typedef struct {
+    mrp_mainloop_t *ml;
+    int            (*pipes)[2];
+    guint           *ids;
+    int              npipe;
+    int              nwatch;
+    int              nread;
+} bench_t;
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static gboolean read_cb(GIOChannel *chnl, GIOCondition cond, gpointer data)
+{
+    bench_t *b = (bench_t *)data;
+    char     buf[64];
+
+    MRP_UNUSED(cond);
+
+    if (read(g_io_channel_unix_get_fd(chnl), buf, sizeof(buf)) > 0)
+        b->nread++;
+
+    return TRUE;
+}
+
+
+static void add_watch(bench_t *b, int i)
+{
+    GIOChannel *chnl;
+
+    chnl      = g_io_channel_unix_new(b->pipes[i][0]);
+    b->ids[i] = g_io_add_watch(chnl, G_IO_IN, read_cb, b);
+    g_io_channel_unref(chnl);
+}
+
+
+static void del_watch(bench_t *b, int i)
+{
+    if (b->ids[i] != 0) {
+        g_source_remove(b->ids[i]);
+        b->ids[i] = 0;
+    }
+}
+
+
+static int kick(bench_t *b, int i)
+{
+    return write(b->pipes[i][1], "x", 1) == 1;
+}
+
+
+static int run_bench(int nwatch, int nround, int churn)
+{
+    bench_t             b;
+    mrp_subloop_stats_t s;
+    uint64_t            start, end, nctl;
+    int                 i, j, n;
+
+    mrp_clear(&b);
+    b.nwatch = nwatch;
+    b.npipe  = churn ? 2 * nwatch : nwatch;
+    b.pipes  = mrp_allocz_array(typeof(*b.pipes), b.npipe);
+    b.ids    = mrp_allocz_array(guint, b.npipe);
+    b.ml     = mrp_mainloop_create();
+
+    if (b.pipes == NULL || b.ids == NULL || b.ml == NULL) {
+        printf("failed to set up benchmark\n");
+        return FALSE;
+    }
+
+    for (i = 0; i < b.npipe; i++) {
+        if (pipe(b.pipes[i]) < 0) {
+            printf("failed to create pipe #%d (%s)\n", i, strerror(errno));
+            return FALSE;
+        }
+    }
+
+    if (!glib_pump_setup(b.ml))
+        return FALSE;
+
+    for (i = 0; i < nwatch; i++)
+        add_watch(&b, i);
+
+    /* let the pollfd set settle before we start measuring */
+    kick(&b, 0);
+    mrp_mainloop_iterate(b.ml);
+    mrp_subloop_stats(glib_glue->sl, &s);
+    nctl = s.nadd + s.nmod + s.ndel;
+
+    start = now_nsecs();
+    for (i = 0; i < nround; i++) {
+        if (churn) {
+            /* slide the window of watched pipes by one */
+            j = (i + nwatch) % b.npipe;
+            del_watch(&b, i % b.npipe);
+            add_watch(&b, j);
+        }
+        else
+            j = i % b.npipe;
+
+        kick(&b, j);
+        mrp_mainloop_iterate(b.ml);
+    }
+    end = now_nsecs();
+
+    mrp_subloop_stats(glib_glue->sl, &s);
+    nctl = s.nadd + s.nmod + s.ndel - nctl;
+
+    printf("%5d watches, %-6s: %6.2f epoll_ctl/iteration "
+           "(%llu add, %llu mod, %llu del, %llu changes), %8.1f ns/iteration\n",
+           nwatch, churn ? "churn" : "static", (double)nctl / nround,
+           (unsigned long long)s.nadd, (unsigned long long)s.nmod,
+           (unsigned long long)s.ndel, (unsigned long long)s.nchange,
+           (double)(end - start) / nround);
+
+    if (b.nread < nround)
+        printf("  warning: only %d of %d writes were read\n", b.nread, nround);
+
+    for (i = 0; i < b.npipe; i++)
+        del_watch(&b, i);
+
+    glib_pump_cleanup();
+    mrp_mainloop_destroy(b.ml);
+
+    for (n = 0; n < b.npipe; n++) {
+        close(b.pipes[n][0]);
+        close(b.pipes[n][1]);
+    }
+
+    mrp_free(b.pipes);
+    mrp_free(b.ids);
+
+    return TRUE;
+}
+
+
+static void raise_fd_limit(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int sizes[] = { 1, 10, 100, 500 };
+    int i, n;
+
+    raise_fd_limit();
+
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            n = (int)strtol(argv[i], NULL, 10);
+
+            if (n <= 0) {
+                printf("usage: %s [number-of-watches ...]\n", argv[0]);
+                exit(1);
+            }
+
+            if (!run_bench(n, DEFAULT_ROUNDS, FALSE) ||
+                !run_bench(n, DEFAULT_ROUNDS, TRUE))
+                exit(1);
+        }
+    }
+    else {
+        for (i = 0; i < (int)MRP_ARRAY_SIZE(sizes); i++)
+            if (!run_bench(sizes[i], DEFAULT_ROUNDS, FALSE) ||
+                !run_bench(sizes[i], DEFAULT_ROUNDS, TRUE))
+                exit(1);
+    }
+
+    return 0;
+}
@@ -110,6 +110,7 @@ static int glib_pump_setup(mrp_mainloop_t *ml)
     glib_glue    = NULL;
 
     if ((main_context = g_main_context_default())             != NULL &&
+        (main_context = g_main_context_ref(main_context))     != NULL &&
         (main_loop    = g_main_loop_new(main_context, FALSE)) != NULL &&
         (glib_glue    = mrp_allocz(sizeof(*glib_glue)))       != NULL) {
 
@@ -32,11 +32,16 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
 
 #include <murphy/common/mm.h>
 #include <murphy/common/list.h>
 #include <murphy/common/macros.h>
+#include <murphy/common/utils.h>
 #include <murphy/common/hashtbl.h>
+#include <murphy/common/flat-hashtbl.h>
+#include <murphy/common/concurrent-hashtbl.h>
 
 #define MEMBER_OFFSET MRP_OFFSET
 #define ALLOC_ARR(type, n) mrp_allocz(sizeof(type) * (n))
@@ -384,6 +389,595 @@ test_run(void)
 }
 
 
+int
+unhash_odd_cb(void *key, void *obj, void *data)
+{
+    entry_t *entry = obj;
+    int     *cnt   = data;
+
+    (void)key;
+
+    (*cnt)++;
+
+    if (entry->int1 & 0x1)
+        return MRP_HTBL_ITER_MORE | MRP_HTBL_ITER_UNHASH;
+    else
+        return MRP_HTBL_ITER_MORE;
+}
+
+
+void
+test_resize(void)
+{
+    hash_tbl_cfg_t  cfg;
+    entry_t        *entry, *found;
+    char           *key;
+    int             i, cnt;
+
+    /*
+     * Start with the smallest possible table and let it grow (and
+     * shrink) while we populate (and empty) it. Iterate over it with
+     * a rehash pending, unhashing every other entry from the callback.
+     */
+
+    INFO("running resize tests...");
+
+    mrp_clear(&cfg);
+    cfg.nbucket = 1;
+    cfg.hash    = hash_func;
+    cfg.comp    = cmp_func;
+    test.ht     = hash_tbl_create(&cfg);
+
+    if (test.ht == NULL)
+        FATAL("failed to create hash table for resize tests");
+
+    test.keyidx = 0;
+    populate();
+
+    for (i = 0, entry = test.entries; i < test.nentry; i++, entry++) {
+        key = ENTRY_KEY(entry, test.keyidx);
+
+        if ((found = hash_tbl_lookup(test.ht, key)) != entry)
+            FATAL("expected entry '%s' not found (%p != %p)", key, found,
+                  entry);
+    }
+
+    cnt = 0;
+    mrp_htbl_foreach(test.ht, unhash_odd_cb, &cnt);
+
+    if (cnt != test.nentry)
+        FATAL("iterated over %d entries instead of %d", cnt, test.nentry);
+
+    for (i = 0, entry = test.entries; i < test.nentry; i++, entry++) {
+        key   = ENTRY_KEY(entry, test.keyidx);
+        found = (i & 0x1) ? NULL : entry;
+
+        if (hash_tbl_lookup(test.ht, key) != found)
+            FATAL("lookup of '%s' failed after unhashing", key);
+
+        if (found != NULL && hash_tbl_del(test.ht, key, FALSE) != entry)
+            FATAL("failed to remove entry '%s'", key);
+    }
+
+    cnt = 0;
+    mrp_htbl_foreach(test.ht, unhash_odd_cb, &cnt);
+
+    if (cnt != 0)
+        FATAL("found %d entries in emptied hash table", cnt);
+
+    hash_tbl_delete(test.ht, FALSE);
+    test.ht = NULL;
+
+    INFO("done.");
+}
+
+
+void
+test_flat(void)
+{
+    hash_tbl_cfg_t  cfg;
+    mrp_fhtbl_t    *ht;
+    entry_t        *entry, *found;
+    char           *key;
+    int             i, cnt;
+
+    /*
+     * Run the same checks against a flat hash table: let it grow while
+     * we populate it, unhash every other entry while iterating, check
+     * lookups, then empty it.
+     */
+
+    INFO("running flat hash table tests...");
+
+    mrp_clear(&cfg);
+    cfg.nentry = 1;
+    cfg.hash   = hash_func;
+    cfg.comp   = cmp_func;
+    ht         = mrp_fhtbl_create(&cfg);
+
+    if (ht == NULL)
+        FATAL("failed to create flat hash table");
+
+    for (i = 0, entry = test.entries; i < test.nentry; i++, entry++) {
+        key = ENTRY_KEY(entry, 0);
+
+        if (!mrp_fhtbl_insert(ht, key, entry))
+            FATAL("failed to hash in entry '%s'", key);
+    }
+
+    for (i = 0, entry = test.entries; i < test.nentry; i++, entry++) {
+        key = ENTRY_KEY(entry, 0);
+
+        if ((found = mrp_fhtbl_lookup(ht, key)) != entry)
+            FATAL("expected entry '%s' not found (%p != %p)", key, found,
+                  entry);
+    }
+
+    cnt = 0;
+    mrp_fhtbl_foreach(ht, unhash_odd_cb, &cnt);
+
+    if (cnt != test.nentry)
+        FATAL("iterated over %d entries instead of %d", cnt, test.nentry);
+
+    for (i = 0, entry = test.entries; i < test.nentry; i++, entry++) {
+        key   = ENTRY_KEY(entry, 0);
+        found = (i & 0x1) ? NULL : entry;
+
+        if (mrp_fhtbl_lookup(ht, key) != found)
+            FATAL("lookup of '%s' failed after unhashing", key);
+
+        if (found != NULL && mrp_fhtbl_remove(ht, key, FALSE) != entry)
+            FATAL("failed to remove entry '%s'", key);
+    }
+
+    cnt = 0;
+    mrp_fhtbl_foreach(ht, unhash_odd_cb, &cnt);
+
+    if (cnt != 0)
+        FATAL("found %d entries in emptied flat hash table", cnt);
+
+    mrp_fhtbl_destroy(ht, FALSE);
+
+    INFO("done.");
+}
+
+
+/*
+ * benchmark chained (mrp_htbl_t) against flat (mrp_fhtbl_t) hash tables
+ */
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+static void bench_shuffle(char **keys, int n)
+{
+    char *tmp;
+    int   i, j;
+
+    for (i = n - 1; i > 0; i--) {
+        j       = rand() % (i + 1);
+        tmp     = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+
+#define BENCH_TABLE(_name, _type, _prefix)                                \
+    static void bench_##_prefix(char **keys, char **miss, int n)          \
+    {                                                                     \
+        mrp_htbl_config_t  cfg;                                           \
+        _type             *ht;                                            \
+        double             t0, t1, t2, t3, t4;                            \
+        int                i, r, nround;                                  \
+                                                                          \
+        nround = n < 1000000 ? 1000000 / n : 1;                           \
+                                                                          \
+        mrp_clear(&cfg);                                                  \
+        cfg.hash = mrp_string_hash;                                       \
+        cfg.comp = cmp_func;                                              \
+                                                                          \
+        if ((ht = mrp_##_prefix##_create(&cfg)) == NULL)                  \
+            FATAL("failed to create %s hash table", _name);               \
+                                                                          \
+        t0 = bench_now();                                                 \
+        for (i = 0; i < n; i++)                                           \
+            mrp_##_prefix##_insert(ht, keys[i], keys[i]);                 \
+        bench_shuffle(keys, n);                                           \
+        t1 = bench_now();                                                 \
+        for (r = 0; r < nround; r++)                                      \
+            for (i = 0; i < n; i++)                                       \
+                if (mrp_##_prefix##_lookup(ht, keys[i]) != keys[i])       \
+                    FATAL("%s lookup failed", _name);                     \
+        t2 = bench_now();                                                 \
+        for (r = 0; r < nround; r++)                                      \
+            for (i = 0; i < n; i++)                                       \
+                if (mrp_##_prefix##_lookup(ht, miss[i]) != NULL)          \
+                    FATAL("%s lookup succeeded", _name);                  \
+        t3 = bench_now();                                                 \
+        for (i = 0; i < n; i++)                                           \
+            mrp_##_prefix##_remove(ht, keys[i], FALSE);                   \
+        t4 = bench_now();                                                 \
+                                                                          \
+        printf("%-8s %8d %10.1f %10.1f %10.1f %10.1f\n", _name, n,         \
+               (t1 - t0) / n, (t2 - t1) / ((double)n * nround),           \
+               (t3 - t2) / ((double)n * nround), (t4 - t3) / n);          \
+                                                                          \
+        mrp_##_prefix##_destroy(ht, FALSE);                               \
+    }
+
+BENCH_TABLE("chained", mrp_htbl_t, htbl)
+BENCH_TABLE("flat", mrp_fhtbl_t, fhtbl)
+
+
+int
+bench(int max)
+{
+    char **keys, **miss;
+    int    n, i;
+
+    printf("%-8s %8s %10s %10s %10s %10s\n", "table", "keys",
+           "insert", "hit", "miss", "remove");
+
+    for (n = 100; n <= max; n *= 10) {
+        keys = ALLOC_ARR(char *, n);
+        miss = ALLOC_ARR(char *, n);
+
+        if (keys == NULL || miss == NULL)
+            FATAL("failed to allocate benchmark keys");
+
+        for (i = 0; i < n; i++) {
+            keys[i] = MKSTR("entry-string-%d", i);
+            miss[i] = MKSTR("missing-string-%d", i);
+
+            if (keys[i] == NULL || miss[i] == NULL)
+                FATAL("failed to allocate benchmark keys");
+        }
+
+        bench_shuffle(keys, n);
+
+        bench_htbl(keys, miss, n);
+        bench_fhtbl(keys, miss, n);
+
+        for (i = 0; i < n; i++) {
+            FREE(keys[i]);
+            FREE(miss[i]);
+        }
+
+        FREE(keys);
+        FREE(miss);
+    }
+
+    return 0;
+}
+
+
+/*
+ * compare the distribution of string hash functions on realistic keys
+ */
+
+static uint32_t fnv_hash(const void *key)
+{
+    const unsigned char *p = key;
+    uint32_t             h = 2166136261u;
+
+    while (*p) {
+        h ^= *p++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+
+static int cmp_u32(const void *p1, const void *p2)
+{
+    uint32_t h1 = *(const uint32_t *)p1, h2 = *(const uint32_t *)p2;
+
+    return h1 < h2 ? -1 : (h1 > h2 ? 1 : 0);
+}
+
+
+static void report_hash(const char *name, mrp_htbl_hash_fn_t hash,
+                        char **keys, int n)
+{
+    uint32_t *h, *chain;
+    size_t    nbucket, nempty, max, ndistinct;
+    double    t, probes;
+    size_t    i;
+
+    for (nbucket = 1; nbucket < (size_t)n / 2; nbucket <<= 1)
+        ;
+
+    h     = ALLOC_ARR(uint32_t, n);
+    chain = ALLOC_ARR(uint32_t, nbucket);
+
+    if (h == NULL || chain == NULL)
+        FATAL("failed to allocate hash report buffers");
+
+    for (i = 0; i < (size_t)n; i++)                 /* warm up caches */
+        h[i] = hash(keys[i]);
+
+    t = bench_now();
+    for (i = 0; i < (size_t)n; i++)
+        h[i] = hash(keys[i]);
+    t = (bench_now() - t) / n;
+
+    for (i = 0; i < (size_t)n; i++)
+        chain[h[i] & (nbucket - 1)]++;
+
+    nempty = max = 0;
+    probes = 0;
+    for (i = 0; i < nbucket; i++) {
+        if (chain[i] == 0)
+            nempty++;
+        if (chain[i] > max)
+            max = chain[i];
+        probes += chain[i] * (chain[i] + 1.0) / 2;
+    }
+
+    qsort(h, n, sizeof(*h), cmp_u32);
+    for (i = 1, ndistinct = 1; i < (size_t)n; i++)
+        if (h[i] != h[i - 1])
+            ndistinct++;
+
+    printf("  %-10s %10zu %8zu %8.2f %8.1f%% %8.1f\n", name, n - ndistinct,
+           max, probes / n, 100.0 * nempty / nbucket, t);
+
+    FREE(h);
+    FREE(chain);
+}
+
+
+int
+report(int n)
+{
+    static const char *sets[] = {
+        "/org/freedesktop/murphy/resource/set/%d",
+        "/org/murphy/zone/%d/application/%d",
+        "mrp_plugin_%d_init@plugins/plugin-%d.c",
+        "murphy-plugin-%d-%d",
+        "entry-string-%d:%d",
+    };
+    char   **keys;
+    size_t   nbucket;
+    int      s, i;
+
+    /*
+     * For every key set, we report the number of full 32-bit collisions,
+     * the longest chain and the average number of probes for successful
+     * lookups with a load of 1 - 2 keys per bucket (ideally 1 + load / 2),
+     * the ratio of empty buckets (ideally e^-load), and the hashing time
+     * per key.
+     */
+
+    if ((keys = ALLOC_ARR(char *, n)) == NULL)
+        FATAL("failed to allocate report keys");
+
+    for (nbucket = 1; nbucket < (size_t)n / 2; nbucket <<= 1)
+        ;
+
+    for (s = 0; s < (int)MRP_ARRAY_SIZE(sets); s++) {
+        for (i = 0; i < n; i++)
+            if ((keys[i] = MKSTR(sets[s], i, i % 100)) == NULL)
+                FATAL("failed to allocate report keys");
+
+        printf("%s (%d keys, load %.2f)\n", sets[s], n, (double)n / nbucket);
+        printf("  %-10s %10s %8s %8s %9s %8s\n", "hash", "collisions",
+               "chain", "probes", "empty", "ns/key");
+
+        report_hash("shift-xor", hash_func, keys, n);
+        report_hash("fnv-1a", fnv_hash, keys, n);
+        report_hash("murphy", mrp_string_hash, keys, n);
+
+        for (i = 0; i < n; i++)
+            FREE(keys[i]);
+    }
+
+    FREE(keys);
+
+    return 0;
+}
+
+
+/*
+ * stress a concurrent hash table with several readers and a writer
+ */
+
+#define STRESS_NKEY 4096
+#define STRESS_LIVE 0x5a5a5a5a
+#define STRESS_DEAD 0xdeaddead
+
+typedef struct {
+    uint32_t  magic;                    /* STRESS_LIVE, or STRESS_DEAD */
+    int       idx;                      /* key index */
+} stress_obj_t;
+
+typedef struct {
+    mrp_chtbl_t *ht;                    /* table being stressed */
+    char       **keys;                  /* keys to use */
+    int          done;                  /* readers should stop */
+} stress_t;
+
+typedef struct {
+    stress_t     *st;                   /* common stress test state */
+    pthread_t     tid;                  /* reader thread */
+    unsigned int  seed;                 /* key index PRNG seed */
+    size_t        nlookup;              /* number of lookups */
+    size_t        nhit;                 /* number of successful lookups */
+    size_t        nforeach;             /* number of iterations */
+} stress_reader_t;
+
+
+static void stress_check(stress_obj_t *obj, int idx)
+{
+    if (obj->magic != STRESS_LIVE || (idx >= 0 && obj->idx != idx))
+        FATAL("corrupted object %p (magic 0x%x, index %d, expected %d)",
+              obj, obj->magic, obj->idx, idx);
+}
+
+
+static void stress_free(void *key, void *object)
+{
+    stress_obj_t *obj = object;
+
+    (void)key;
+
+    stress_check(obj, -1);
+    obj->magic = STRESS_DEAD;
+    FREE(obj);
+}
+
+
+static int stress_count(void *key, void *object, void *user_data)
+{
+    int *cnt = user_data;
+
+    (void)key;
+
+    stress_check(object, -1);
+    (*cnt)++;
+
+    return MRP_HTBL_ITER_MORE;
+}
+
+
+static void *stress_reader(void *arg)
+{
+    stress_reader_t *r  = arg;
+    stress_t        *st = r->st;
+    stress_obj_t    *obj;
+    int              idx, cnt;
+
+    while (!__atomic_load_n(&st->done, __ATOMIC_ACQUIRE)) {
+        idx = rand_r(&r->seed) % STRESS_NKEY;
+
+        mrp_chtbl_read_lock(st->ht);
+
+        if ((obj = mrp_chtbl_lookup(st->ht, st->keys[idx])) != NULL) {
+            stress_check(obj, idx);
+            r->nhit++;
+        }
+
+        mrp_chtbl_read_unlock(st->ht);
+
+        if ((++r->nlookup % 1024) == 0) {
+            cnt = 0;
+            mrp_chtbl_foreach(st->ht, stress_count, &cnt);
+            r->nforeach++;
+        }
+    }
+
+    return NULL;
+}
+
+
+int
+stress(int nreader, int nop)
+{
+    hash_tbl_cfg_t    cfg;
+    stress_t          st;
+    stress_reader_t  *readers;
+    stress_obj_t     *obj, **objs;
+    unsigned int      seed;
+    int               i, idx, nlive;
+
+    INFO("stressing with %d readers, %d updates...", nreader, nop);
+
+    mrp_clear(&st);
+    mrp_clear(&cfg);
+    cfg.comp = mrp_string_comp;
+    cfg.free = stress_free;
+
+    st.ht   = mrp_chtbl_create(&cfg);
+    st.keys = ALLOC_ARR(char *, STRESS_NKEY);
+    objs    = ALLOC_ARR(stress_obj_t *, STRESS_NKEY);
+    readers = ALLOC_ARR(stress_reader_t, nreader);
+
+    if (st.ht == NULL || st.keys == NULL || objs == NULL || readers == NULL)
+        FATAL("failed to set up stress test");
+
+    for (i = 0; i < STRESS_NKEY; i++)
+        if ((st.keys[i] = MKSTR("/org/murphy/stress/key/%d", i)) == NULL)
+            FATAL("failed to set up stress test");
+
+    for (i = 0; i < nreader; i++) {
+        readers[i].st   = &st;
+        readers[i].seed = i + 1;
+
+        if (pthread_create(&readers[i].tid, NULL, stress_reader,
+                           readers + i) != 0)
+            FATAL("failed to create reader thread #%d", i);
+    }
+
+    seed  = 0;
+    nlive = 0;
+    for (i = 0; i < nop; i++) {
+        idx = rand_r(&seed) % STRESS_NKEY;
+
+        if (objs[idx] != NULL) {
+            if (mrp_chtbl_remove(st.ht, st.keys[idx], TRUE) != objs[idx])
+                FATAL("failed to remove entry '%s'", st.keys[idx]);
+
+            objs[idx] = NULL;
+            nlive--;
+        }
+        else {
+            if ((obj = ALLOC_ARR(stress_obj_t, 1)) == NULL)
+                FATAL("failed to allocate stress object");
+
+            obj->magic = STRESS_LIVE;
+            obj->idx   = idx;
+
+            if (!mrp_chtbl_insert(st.ht, st.keys[idx], obj))
+                FATAL("failed to insert entry '%s'", st.keys[idx]);
+
+            objs[idx] = obj;
+            nlive++;
+        }
+    }
+
+    __atomic_store_n(&st.done, TRUE, __ATOMIC_RELEASE);
+
+    for (i = 0; i < nreader; i++) {
+        pthread_join(readers[i].tid, NULL);
+
+        INFO("reader #%d: %zu lookups, %zu hits, %zu iterations", i,
+             readers[i].nlookup, readers[i].nhit, readers[i].nforeach);
+    }
+
+    for (i = 0; i < STRESS_NKEY; i++)
+        if (mrp_chtbl_lookup(st.ht, st.keys[i]) != objs[i])
+            FATAL("final lookup of '%s' failed", st.keys[i]);
+
+    idx = 0;
+    mrp_chtbl_foreach(st.ht, stress_count, &idx);
+
+    if (idx != nlive)
+        FATAL("found %d entries instead of %d", idx, nlive);
+
+    mrp_chtbl_destroy(st.ht, TRUE);
+
+    for (i = 0; i < STRESS_NKEY; i++)
+        FREE(st.keys[i]);
+
+    FREE(st.keys);
+    FREE(objs);
+    FREE(readers);
+
+    INFO("done.");
+
+    return 0;
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -391,6 +985,16 @@ main(int argc, char *argv[])
 
     memset(&test, 0, sizeof(test));
 
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return bench(argc > 2 ? (int)strtoul(argv[2], NULL, 10) : 1000000);
+
+    if (argc > 1 && !strcmp(argv[1], "report"))
+        return report(argc > 2 ? (int)strtoul(argv[2], NULL, 10) : 100000);
+
+    if (argc > 1 && !strcmp(argv[1], "stress"))
+        return stress(argc > 2 ? (int)strtoul(argv[2], NULL, 10) : 4,
+                      argc > 3 ? (int)strtoul(argv[3], NULL, 10) : 1000000);
+
     if (argc < 2 || (test.nentry = (int)strtoul(argv[1], NULL, 10)) <= 16)
         test.nentry = 16;
 
@@ -403,6 +1007,9 @@ main(int argc, char *argv[])
         test.size = test.nentry / 4; test_run();
     }
 
+    test_resize();
+    test_flat();
+
     test_exit();
 
     return 0;
@@ -0,0 +1,765 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+
+/*
+ * Mainloop micro-benchmarks.
+ *
+ * We measure the cost of the mainloop hot paths:
+ *
+ *   - adding, deleting and dispatching expired timers,
+ *   - the latency of dispatching an I/O event with N watched pipes,
+ *     and the per-event cost of dispatching N ready pipes at once,
+ *   - the per-callback cost of dispatching enabled deferred callbacks,
+ *   - the latency of dispatching a signal,
+ *   - the per-iteration overhead of pumping a subloop with N pollfds.
+ *
+ * Results are printed as a table, as CSV or as JSON, so they can be
+ * collected and compared across releases.
+ */
+
+#define DEFAULT_ROUNDS 10000
+#define NSECS_PER_SEC  1000000000ULL
+
+typedef enum {
+    FORMAT_TEXT = 0,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} format_t;
+
+typedef struct {
+    format_t  format;                            /* output format */
+    int       rounds;                            /* rounds per benchmark */
+    int      *sizes;                             /* object counts to use */
+    int       nsize;                             /* number of counts */
+    int       nresult;                           /* results printed so far */
+} bench_config_t;
+
+typedef struct {
+    const char *name;                            /* benchmark name */
+    int         n;                               /* number of objects */
+    int         nop;                             /* operations measured */
+    double      mean;                            /* mean per op (nsecs) */
+    uint64_t   *samples;                         /* latency samples, if any */
+    int         nsample;                         /* number of samples */
+} result_t;
+
+typedef struct {
+    mrp_mainloop_t  *ml;                         /* mainloop */
+    int            (*pipes)[2];                  /* pipes for I/O */
+    mrp_io_watch_t **watches;                    /* I/O watches */
+    int              npipe;                      /* number of pipes */
+    int              nfired;                     /* callbacks fired */
+    uint64_t         stamp;                      /* time of last callback */
+} bench_t;
+
+static bench_config_t cfg;
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+
+static int sample_cmp(const void *p1, const void *p2)
+{
+    uint64_t s1 = *(const uint64_t *)p1, s2 = *(const uint64_t *)p2;
+
+    return s1 < s2 ? -1 : (s1 > s2 ? 1 : 0);
+}
+
+
+static uint64_t percentile(result_t *r, int pct)
+{
+    int idx;
+
+    if (r->nsample == 0)
+        return 0;
+
+    idx = (r->nsample - 1) * pct / 100;
+
+    return r->samples[idx];
+}
+
+
+static void print_result(result_t *r)
+{
+    double   ops;
+    uint64_t p50, p99, max;
+    int      dist;
+
+    dist = (r->nsample > 0);
+
+    if (dist) {
+        qsort(r->samples, r->nsample, sizeof(r->samples[0]), sample_cmp);
+
+        p50 = percentile(r, 50);
+        p99 = percentile(r, 99);
+        max = r->samples[r->nsample - 1];
+    }
+    else
+        p50 = p99 = max = 0;
+
+    ops = r->mean > 0 ? 1e9 / r->mean : 0.0;
+
+    switch (cfg.format) {
+    case FORMAT_TEXT:
+        if (cfg.nresult == 0)
+            printf("%-16s %8s %8s %12s %10s %10s %10s %12s\n", "benchmark",
+                   "n", "ops", "mean ns", "p50 ns", "p99 ns", "max ns",
+                   "ops/s");
+        if (dist)
+            printf("%-16s %8d %8d %12.1f %10llu %10llu %10llu %12.0f\n",
+                   r->name, r->n, r->nop, r->mean, (unsigned long long)p50,
+                   (unsigned long long)p99, (unsigned long long)max, ops);
+        else
+            printf("%-16s %8d %8d %12.1f %10s %10s %10s %12.0f\n",
+                   r->name, r->n, r->nop, r->mean, "-", "-", "-", ops);
+        break;
+
+    case FORMAT_CSV:
+        if (cfg.nresult == 0)
+            printf("benchmark,n,ops,mean_ns,p50_ns,p99_ns,max_ns,ops_per_sec\n");
+        if (dist)
+            printf("%s,%d,%d,%.1f,%llu,%llu,%llu,%.0f\n", r->name, r->n,
+                   r->nop, r->mean, (unsigned long long)p50,
+                   (unsigned long long)p99, (unsigned long long)max, ops);
+        else
+            printf("%s,%d,%d,%.1f,,,,%.0f\n", r->name, r->n, r->nop,
+                   r->mean, ops);
+        break;
+
+    case FORMAT_JSON:
+        printf("%s\n    { \"benchmark\": \"%s\", \"n\": %d, \"ops\": %d, "
+               "\"mean_ns\": %.1f, ", cfg.nresult ? "," : "[",
+               r->name, r->n, r->nop, r->mean);
+        if (dist)
+            printf("\"p50_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu, ",
+                   (unsigned long long)p50, (unsigned long long)p99,
+                   (unsigned long long)max);
+        else
+            printf("\"p50_ns\": null, \"p99_ns\": null, \"max_ns\": null, ");
+        printf("\"ops_per_sec\": %.0f }", ops);
+        break;
+    }
+
+    cfg.nresult++;
+    fflush(stdout);
+}
+
+
+static void report(const char *name, int n, int nop, uint64_t start,
+                   uint64_t end)
+{
+    result_t r;
+
+    mrp_clear(&r);
+    r.name = name;
+    r.n    = n;
+    r.nop  = nop;
+    r.mean = nop ? (double)(end - start) / nop : 0.0;
+
+    print_result(&r);
+}
+
+
+static void report_samples(const char *name, int n, uint64_t *samples,
+                           int nsample)
+{
+    result_t r;
+    uint64_t total;
+    int      i;
+
+    for (i = 0, total = 0; i < nsample; i++)
+        total += samples[i];
+
+    mrp_clear(&r);
+    r.name    = name;
+    r.n       = n;
+    r.nop     = nsample;
+    r.mean    = nsample ? (double)total / nsample : 0.0;
+    r.samples = samples;
+    r.nsample = nsample;
+
+    print_result(&r);
+}
+
+
+static int bench_setup(bench_t *b, int npipe)
+{
+    int i;
+
+    mrp_clear(b);
+
+    if ((b->ml = mrp_mainloop_create()) == NULL)
+        return FALSE;
+
+    if (npipe > 0) {
+        b->pipes   = mrp_allocz_array(typeof(*b->pipes), npipe);
+        b->watches = mrp_allocz_array(mrp_io_watch_t *, npipe);
+
+        if (b->pipes == NULL || b->watches == NULL)
+            return FALSE;
+
+        for (i = 0; i < npipe; i++) {
+            if (pipe(b->pipes[i]) < 0) {
+                fprintf(stderr, "failed to create pipe #%d (%s)\n", i,
+                        strerror(errno));
+                return FALSE;
+            }
+
+            fcntl(b->pipes[i][0], F_SETFL, O_NONBLOCK);
+            b->npipe++;
+        }
+    }
+
+    return TRUE;
+}
+
+
+static void bench_cleanup(bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < b->npipe; i++) {
+        mrp_del_io_watch(b->watches[i]);
+        close(b->pipes[i][0]);
+        close(b->pipes[i][1]);
+    }
+
+    mrp_mainloop_destroy(b->ml);
+    mrp_free(b->pipes);
+    mrp_free(b->watches);
+}
+
+
+/*
+ * timers
+ */
+
+static void idle_timer_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(t);
+    MRP_UNUSED(user_data);
+}
+
+
+static void expire_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(ml);
+
+    mrp_del_timer(t);
+    b->nfired++;
+}
+
+
+static int bench_timers(int n)
+{
+    bench_t       b;
+    mrp_timer_t **timers;
+    uint64_t      start, end;
+    int           i;
+
+    if (!bench_setup(&b, 0) ||
+        (timers = mrp_allocz_array(mrp_timer_t *, n)) == NULL)
+        return FALSE;
+
+    srand(n);
+
+    start = now_nsecs();
+    for (i = 0; i < n; i++)
+        timers[i] = mrp_add_timer(b.ml, 60000 + rand() % 60000,
+                                  idle_timer_cb, &b);
+    end = now_nsecs();
+    report("timer-add", n, n, start, end);
+
+    start = now_nsecs();
+    for (i = 0; i < n; i++)
+        mrp_del_timer(timers[i]);
+    end = now_nsecs();
+    report("timer-del", n, n, start, end);
+
+    for (i = 0; i < n; i++)
+        timers[i] = mrp_add_timer(b.ml, 0, expire_cb, &b);
+
+    start = now_nsecs();
+    while (b.nfired < n)
+        mrp_mainloop_iterate(b.ml);
+    end = now_nsecs();
+    report("timer-expire", n, n, start, end);
+
+    mrp_free(timers);
+    bench_cleanup(&b);
+
+    return TRUE;
+}
+
+
+/*
+ * I/O watches
+ */
+
+static void io_cb(mrp_mainloop_t *ml, mrp_io_watch_t *w, int fd,
+                  mrp_io_event_t events, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+    char     buf[64];
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(w);
+    MRP_UNUSED(events);
+
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+
+    b->stamp = now_nsecs();
+    b->nfired++;
+}
+
+
+static int kick(bench_t *b, int i)
+{
+    return write(b->pipes[i][1], "x", 1) == 1;
+}
+
+
+static int bench_io(int n, int nround)
+{
+    bench_t   b;
+    uint64_t *samples, start, end;
+    int       i, j;
+
+    if (!bench_setup(&b, n) ||
+        (samples = mrp_allocz_array(uint64_t, nround)) == NULL)
+        return FALSE;
+
+    for (i = 0; i < n; i++) {
+        b.watches[i] = mrp_add_io_watch(b.ml, b.pipes[i][0], MRP_IO_EVENT_IN,
+                                        io_cb, &b);
+        if (b.watches[i] == NULL) {
+            fprintf(stderr, "failed to add I/O watch #%d\n", i);
+            return FALSE;
+        }
+    }
+
+    srand(n);
+
+    /* latency of a single ready pipe among n watched ones */
+    for (i = 0; i < nround; i++) {
+        b.nfired = 0;
+        start    = now_nsecs();
+
+        if (!kick(&b, rand() % n))
+            return FALSE;
+
+        while (b.nfired == 0)
+            mrp_mainloop_iterate(b.ml);
+
+        samples[i] = b.stamp - start;
+    }
+
+    report_samples("io-latency", n, samples, nround);
+
+    /* per-event cost with all n pipes ready at once */
+    b.nfired = 0;
+    start    = now_nsecs();
+    for (i = 0; i < nround / n + 1; i++) {
+        for (j = 0; j < n; j++)
+            if (!kick(&b, j))
+                return FALSE;
+
+        while (b.nfired < (i + 1) * n)
+            mrp_mainloop_iterate(b.ml);
+    }
+    end = now_nsecs();
+    report("io-dispatch", n, b.nfired, start, end);
+
+    mrp_free(samples);
+    bench_cleanup(&b);
+
+    return TRUE;
+}
+
+
+/*
+ * deferred callbacks
+ */
+
+static void deferred_cb(mrp_mainloop_t *ml, mrp_deferred_t *d, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(d);
+
+    b->nfired++;
+}
+
+
+static int bench_deferred(int n, int nround)
+{
+    bench_t          b;
+    mrp_deferred_t **deferred;
+    uint64_t         start, end;
+    int              i, niter;
+
+    if (!bench_setup(&b, 0) ||
+        (deferred = mrp_allocz_array(mrp_deferred_t *, 2 * n)) == NULL)
+        return FALSE;
+
+    /* every other callback is disabled, these should cost nothing */
+    for (i = 0; i < 2 * n; i++) {
+        deferred[i] = mrp_add_deferred(b.ml, deferred_cb, &b);
+
+        if (deferred[i] == NULL) {
+            fprintf(stderr, "failed to add deferred callback #%d\n", i);
+            return FALSE;
+        }
+
+        if (i & 0x1)
+            mrp_disable_deferred(deferred[i]);
+    }
+
+    niter = nround / n + 1;
+
+    start = now_nsecs();
+    for (i = 0; i < niter; i++)
+        mrp_mainloop_iterate(b.ml);
+    end = now_nsecs();
+    report("deferred", n, b.nfired, start, end);
+
+    for (i = 0; i < 2 * n; i++)
+        mrp_del_deferred(deferred[i]);
+
+    mrp_free(deferred);
+    bench_cleanup(&b);
+
+    return TRUE;
+}
+
+
+/*
+ * signals
+ */
+
+static void signal_cb(mrp_mainloop_t *ml, mrp_sighandler_t *h, int signum,
+                      void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(h);
+    MRP_UNUSED(signum);
+
+    b->stamp = now_nsecs();
+    b->nfired++;
+}
+
+
+static int bench_signals(int nround)
+{
+    bench_t           b;
+    mrp_sighandler_t *h;
+    uint64_t         *samples, start;
+    int               i;
+
+    if (!bench_setup(&b, 0) ||
+        (samples = mrp_allocz_array(uint64_t, nround)) == NULL)
+        return FALSE;
+
+    if ((h = mrp_add_sighandler(b.ml, SIGUSR1, signal_cb, &b)) == NULL) {
+        fprintf(stderr, "failed to add signal handler\n");
+        return FALSE;
+    }
+
+    for (i = 0; i < nround; i++) {
+        b.nfired = 0;
+        start    = now_nsecs();
+
+        kill(getpid(), SIGUSR1);
+
+        while (b.nfired == 0)
+            mrp_mainloop_iterate(b.ml);
+
+        samples[i] = b.stamp - start;
+    }
+
+    report_samples("signal-latency", 1, samples, nround);
+
+    mrp_del_sighandler(h);
+    mrp_free(samples);
+    bench_cleanup(&b);
+
+    return TRUE;
+}
+
+
+/*
+ * subloops
+ */
+
+static int subloop_prepare(void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    return FALSE;
+}
+
+
+static int subloop_query(void *user_data, struct pollfd *fds, int nfd,
+                         int *timeout)
+{
+    bench_t *b = (bench_t *)user_data;
+    int      i;
+
+    if (nfd >= b->npipe) {
+        for (i = 0; i < b->npipe; i++) {
+            fds[i].fd      = b->pipes[i][0];
+            fds[i].events  = POLLIN;
+            fds[i].revents = 0;
+        }
+    }
+
+    *timeout = -1;
+
+    return b->npipe;
+}
+
+
+static int subloop_check(void *user_data, struct pollfd *fds, int nfd)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(fds);
+    MRP_UNUSED(nfd);
+
+    return FALSE;
+}
+
+
+static void subloop_dispatch(void *user_data)
+{
+    MRP_UNUSED(user_data);
+}
+
+
+static uint64_t run_iterations(mrp_mainloop_t *ml, int niter)
+{
+    uint64_t start;
+    int      i;
+
+    start = now_nsecs();
+    for (i = 0; i < niter; i++)
+        mrp_mainloop_iterate(ml);
+
+    return now_nsecs() - start;
+}
+
+
+static int bench_subloop(int n, int nround)
+{
+    static mrp_subloop_ops_t ops = {
+        .prepare  = subloop_prepare,
+        .query    = subloop_query,
+        .check    = subloop_check,
+        .dispatch = subloop_dispatch,
+    };
+    bench_t         b;
+    mrp_deferred_t *d;
+    mrp_subloop_t  *sl;
+    uint64_t        base, with;
+
+    if (!bench_setup(&b, n))
+        return FALSE;
+
+    /* keep the mainloop from blocking */
+    if ((d = mrp_add_deferred(b.ml, deferred_cb, &b)) == NULL)
+        return FALSE;
+
+    base = run_iterations(b.ml, nround);
+
+    if ((sl = mrp_add_subloop(b.ml, &ops, &b)) == NULL) {
+        fprintf(stderr, "failed to add subloop\n");
+        return FALSE;
+    }
+
+    with = run_iterations(b.ml, nround);
+
+    report("loop-iteration", n, nround, 0, base);
+    report("subloop-overhead", n, nround, base, with > base ? with : base);
+
+    mrp_del_subloop(sl);
+    mrp_del_deferred(d);
+    bench_cleanup(&b);
+
+    return TRUE;
+}
+
+
+/*
+ * command line processing
+ */
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        printf("\n");
+    }
+
+    printf("usage: %s [options] [object-count ...]\n\n"
+           "The possible options are:\n"
+           "  -f, --format=FORMAT            output format to use\n"
+           "      FORMAT is one of text, csv, or json\n"
+           "  -r, --rounds=N                 number of rounds per benchmark\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(int argc, char **argv)
+{
+#   define OPTIONS "f:r:h"
+    struct option options[] = {
+        { "format", required_argument, NULL, 'f' },
+        { "rounds", required_argument, NULL, 'r' },
+        { "help"  , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    static int  default_sizes[] = { 1, 16, 256 };
+    char       *end;
+    int         opt, i;
+
+    mrp_clear(&cfg);
+    cfg.format = FORMAT_TEXT;
+    cfg.rounds = DEFAULT_ROUNDS;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'f':
+            if (!strcmp(optarg, "text"))
+                cfg.format = FORMAT_TEXT;
+            else if (!strcmp(optarg, "csv"))
+                cfg.format = FORMAT_CSV;
+            else if (!strcmp(optarg, "json"))
+                cfg.format = FORMAT_JSON;
+            else
+                print_usage(argv[0], EINVAL, "invalid format '%s'.", optarg);
+            break;
+
+        case 'r':
+            cfg.rounds = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg.rounds <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of rounds '%s'.", optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+
+    if (optind < argc) {
+        cfg.nsize = argc - optind;
+        cfg.sizes = mrp_allocz_array(int, cfg.nsize);
+
+        for (i = 0; i < cfg.nsize; i++) {
+            cfg.sizes[i] = (int)strtoul(argv[optind + i], &end, 10);
+            if ((end && *end) || cfg.sizes[i] <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid object count '%s'.", argv[optind + i]);
+        }
+    }
+    else {
+        cfg.sizes = default_sizes;
+        cfg.nsize = MRP_ARRAY_SIZE(default_sizes);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i, n;
+
+    parse_cmdline(argc, argv);
+
+    for (i = 0; i < cfg.nsize; i++) {
+        n = cfg.sizes[i];
+
+        if (!bench_timers(n * 64) ||
+            !bench_io(n, cfg.rounds) ||
+            !bench_deferred(n, cfg.rounds * 16) ||
+            !bench_subloop(n, cfg.rounds))
+            exit(1);
+    }
+
+    if (!bench_signals(cfg.rounds))
+        exit(1);
+
+    if (cfg.format == FORMAT_JSON)
+        printf("%s]\n", cfg.nresult ? "\n" : "[");
+
+    return 0;
+}
@@ -36,6 +36,7 @@
 #include <unistd.h>
 #include <signal.h>
 #include <getopt.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -83,6 +84,9 @@
 typedef struct {
     int nio;
     int ntimer;
+    int jitter;
+    int hires;
+    int npthread;
     int deferred;
     int nsignal;
 
@@ -235,6 +239,197 @@ static void check_timers(void)
 }
 
 
+/*
+ * timer jitter
+ */
+
+#define JITTER_SAMPLES 1000
+
+typedef struct {
+    mrp_timer_t    *timer;
+    int             count;
+    int             target;
+    struct timeval  prev;
+    double          min;
+    double          max;
+    double          sum;
+} test_jitter_t;
+
+
+static test_jitter_t jitter;
+
+
+static void jitter_cb(mrp_mainloop_t *ml, mrp_timer_t *timer, void *user_data)
+{
+    test_jitter_t  *j = (test_jitter_t *)user_data;
+    struct timeval  now;
+    double          lag;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(timer);
+
+    timeval_now(&now);
+    lag = timeval_diff(&now, &j->prev) - cfg.jitter;
+    j->prev = now;
+
+    if (!j->count || lag < j->min)
+        j->min = lag;
+    if (!j->count || lag > j->max)
+        j->max = lag;
+    j->sum += lag;
+
+    if (++j->count >= j->target) {
+        info("MRPH jitter timer has finished.");
+
+        mrp_del_timer(j->timer);
+        j->timer = NULL;
+        cfg.nrunning--;
+    }
+}
+
+
+static void setup_jitter(mrp_mainloop_t *ml)
+{
+    test_jitter_t *j = &jitter;
+
+    if (cfg.jitter <= 0)
+        return;
+
+    if (cfg.hires && !mrp_mainloop_hires_timers(ml, TRUE))
+        fatal("failed to enable high-resolution timers");
+
+    j->target = (int)(1.0 * cfg.runtime * USECS_PER_SEC / cfg.jitter);
+    if (j->target > JITTER_SAMPLES)
+        j->target = JITTER_SAMPLES;
+    if (!j->target)
+        return;
+
+    timeval_now(&j->prev);
+    j->timer = mrp_add_timer_usec(ml, cfg.jitter, jitter_cb, j);
+
+    if (j->timer == NULL)
+        fatal("MRPH jitter timer: failed to create");
+
+    info("MRPH jitter timer: interval=%d usecs, target=%d, %s resolution",
+         cfg.jitter, j->target, cfg.hires ? "high" : "normal");
+
+    cfg.nrunning++;
+}
+
+
+static void check_jitter(void)
+{
+    test_jitter_t *j = &jitter;
+
+    if (!j->target)
+        return;
+
+    if (j->count != j->target)
+        warning("MRPH jitter timer: FAIL (only %d/%d)", j->count, j->target);
+    else
+        info("MRPH jitter timer: OK (%d/%d)", j->count, j->target);
+
+    if (j->count > 0)
+        info("MRPH jitter timer: %d usecs, lag min %.1f, avg %.1f, "
+             "max %.1f usecs", cfg.jitter, j->min, j->sum / j->count, j->max);
+}
+
+
+/*
+ * callbacks posted from other threads
+ */
+
+#define POST_COUNT 10000
+
+typedef struct {
+    int             id;
+    mrp_mainloop_t *ml;
+    pthread_t       tid;
+    int             posted;
+    int             received;
+    int             misordered;
+} test_post_t;
+
+
+static test_post_t *posters;
+
+
+static void post_cb(mrp_mainloop_t *ml, void *user_data)
+{
+    int          n = (int)(intptr_t)user_data;
+    test_post_t *t = posters + n / POST_COUNT;
+
+    MRP_UNUSED(ml);
+
+    if (n % POST_COUNT != t->received)
+        t->misordered++;
+
+    if (++t->received == POST_COUNT) {
+        info("MRPH post thread #%d has finished.", t->id);
+        cfg.nrunning--;
+    }
+}
+
+
+static void *post_thread(void *arg)
+{
+    test_post_t *t = (test_post_t *)arg;
+    int          i;
+
+    for (i = 0; i < POST_COUNT; i++) {
+        if (mrp_mainloop_post(t->ml, post_cb,
+                              (void *)(intptr_t)(t->id * POST_COUNT + i)))
+            t->posted++;
+        else
+            error("MRPH post thread #%d: failed to post #%d", t->id, i);
+    }
+
+    return NULL;
+}
+
+
+static void setup_post(mrp_mainloop_t *ml)
+{
+    test_post_t *t;
+    int          i;
+
+    if (cfg.npthread <= 0)
+        return;
+
+    if ((posters = mrp_allocz_array(test_post_t, cfg.npthread)) == NULL)
+        fatal("could not allocate %d post threads", cfg.npthread);
+
+    for (i = 0, t = posters; i < cfg.npthread; i++, t++) {
+        t->id = i;
+        t->ml = ml;
+
+        if (pthread_create(&t->tid, NULL, post_thread, t) != 0)
+            fatal("MRPH post thread #%d: failed to create", t->id);
+
+        cfg.nrunning++;
+    }
+}
+
+
+static void check_post(void)
+{
+    test_post_t *t;
+    int          i;
+
+    for (i = 0, t = posters; i < cfg.npthread; i++, t++) {
+        pthread_join(t->tid, NULL);
+
+        if (t->received != t->posted || t->posted != POST_COUNT ||
+            t->misordered)
+            warning("MRPH post thread #%d: FAIL (%d/%d/%d, %d misordered)",
+                    t->id, t->received, t->posted, POST_COUNT, t->misordered);
+        else
+            info("MRPH post thread #%d: OK (%d/%d)", t->id, t->received,
+                 t->posted);
+    }
+}
+
+
 /*
  * native I/O
  */
@@ -1241,6 +1436,9 @@ static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
            "  -r, --runtime                  how many seconds to run tests\n"
            "  -i, --ios                      number of I/O watches\n"
            "  -t, --timers                   number of timers\n"
+           "  -j, --jitter=USECS             measure jitter of a USECS timer\n"
+           "  -H, --hires                    use high-resolution timers\n"
+           "  -P, --post-threads             number of posting threads\n"
            "  -I, --glib-ios                 number of glib I/O watches\n"
            "  -T, --glib-timers              number of glib timers\n"
            "  -S, --dbus-signals             number of D-Bus signals\n"
@@ -1271,11 +1469,14 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
 #else
 #   define PULSE_OPTION ""
 #endif
-#   define OPTIONS "r:i:t:s:I:T:S:M:l:o:vdh"PULSE_OPTION
+#   define OPTIONS "r:i:t:j:HP:s:I:T:S:M:l:o:vdh"PULSE_OPTION
     struct option options[] = {
         { "runtime"     , required_argument, NULL, 'r' },
         { "ios"         , required_argument, NULL, 'i' },
         { "timers"      , required_argument, NULL, 't' },
+        { "jitter"      , required_argument, NULL, 'j' },
+        { "hires"       , no_argument      , NULL, 'H' },
+        { "post-threads", required_argument, NULL, 'P' },
         { "signals"     , required_argument, NULL, 's' },
         { "glib-ios"    , required_argument, NULL, 'I' },
         { "glib-timers" , required_argument, NULL, 'T' },
@@ -1320,6 +1521,24 @@ int parse_cmdline(test_config_t *cfg, int argc, char **argv)
                             "invalid number of timers '%s'.", optarg);
             break;
 
+        case 'j':
+            cfg->jitter = (int)strtoul(optarg, &end, 10);
+            if (end && *end)
+                print_usage(argv[0], EINVAL,
+                            "invalid jitter timer interval '%s'.", optarg);
+            break;
+
+        case 'H':
+            cfg->hires = TRUE;
+            break;
+
+        case 'P':
+            cfg->npthread = (int)strtoul(optarg, &end, 10);
+            if (end && *end)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of post threads '%s'.", optarg);
+            break;
+
         case 's':
             cfg->nsignal = (int)strtoul(optarg, &end, 10);
             if (end && *end)
@@ -1419,6 +1638,8 @@ int main(int argc, char *argv[])
         fatal("failed to create main loop.");
 
     setup_timers(ml);
+    setup_jitter(ml);
+    setup_post(ml);
     setup_io(ml);
     setup_signals(ml);
 
@@ -1457,6 +1678,8 @@ int main(int argc, char *argv[])
 
     check_io();
     check_timers();
+    check_jitter();
+    check_post();
     check_signals();
 
     check_glib_io();
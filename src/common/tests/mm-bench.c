@@ -0,0 +1,351 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/msg.h>
+
+/*
+ * Memory allocator benchmark.
+ *
+ * We measure how fast the different allocator backends are on a typical
+ * message workload: creating a message with a number of fields, encoding
+ * it, decoding the result and releasing everything. Since the backend can
+ * only be chosen before anything has been allocated, unless asked to run
+ * with a single backend, we re-execute ourselves once for every backend
+ * with MRP_MM_CONFIG_ENVVAR set accordingly. Optionally, messages are
+ * decoded into an arena which is then reset instead of freeing the
+ * decoded message.
+ */
+
+#define DEFAULT_ROUNDS 100000
+#define DEFAULT_FIELDS 16
+#define NSECS_PER_SEC  1000000000ULL
+
+typedef struct {
+    const char    *name;                         /* backend name */
+    mrp_mm_type_t  type;                         /* backend type */
+} backend_t;
+
+static backend_t backends[] = {
+    { "passthru", MRP_MM_PASSTHRU },
+    { "slab"    , MRP_MM_SLAB     },
+};
+
+typedef struct {
+    const char *argv0;                           /* our binary */
+    backend_t  *backend;                         /* backend to use, if any */
+    int         rounds;                          /* messages to process */
+    int         nfield;                          /* fields per message */
+    int         arena;                           /* decode into an arena */
+    int         header;                          /* print header */
+} bench_config_t;
+
+static bench_config_t cfg;
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+
+static mrp_msg_t *create_msg(int nfield)
+{
+    static const char *strings[] = {
+        "foo", "a somewhat longer string value",
+        "and then one which is clearly long enough not to fit into any of "
+        "the smaller size classes, but still small enough to be typical",
+    };
+    mrp_msg_t *msg;
+    int        i, ok;
+
+    if ((msg = mrp_msg_create_empty()) == NULL)
+        return NULL;
+
+    for (i = 0, ok = TRUE; i < nfield && ok; i++) {
+        switch (i % 4) {
+        case 0:
+            ok = mrp_msg_append(msg, i + 1, MRP_MSG_FIELD_STRING,
+                                strings[(i / 4) % MRP_ARRAY_SIZE(strings)]);
+            break;
+        case 1:
+            ok = mrp_msg_append(msg, i + 1, MRP_MSG_FIELD_UINT32, i);
+            break;
+        case 2:
+            ok = mrp_msg_append(msg, i + 1, MRP_MSG_FIELD_DOUBLE, i / 3.0);
+            break;
+        case 3:
+            ok = mrp_msg_append(msg, i + 1, MRP_MSG_FIELD_BOOL, i & 1);
+            break;
+        }
+    }
+
+    if (!ok) {
+        mrp_msg_unref(msg);
+        msg = NULL;
+    }
+
+    return msg;
+}
+
+
+static int bench_msg(backend_t *backend, int nfield, int rounds)
+{
+    mrp_msg_t   *msg, *decoded;
+    mrp_arena_t *arena;
+    void        *buf;
+    ssize_t      size;
+    uint64_t     start, end;
+    double       mean;
+    int          i;
+
+    if (!mrp_mm_config(backend->type)) {
+        fprintf(stderr, "failed to activate %s allocator\n", backend->name);
+        return FALSE;
+    }
+
+    if (cfg.arena) {
+        if ((arena = mrp_arena_create(0)) == NULL)
+            return FALSE;
+    }
+    else
+        arena = NULL;
+
+    start = now_nsecs();
+
+    for (i = 0; i < rounds; i++) {
+        if ((msg = create_msg(nfield)) == NULL)
+            return FALSE;
+
+        if ((size = mrp_msg_default_encode(msg, &buf)) <= 0)
+            return FALSE;
+
+        if (arena != NULL)
+            decoded = mrp_msg_default_decode_arena(buf, size, arena);
+        else
+            decoded = mrp_msg_default_decode(buf, size);
+
+        if (decoded == NULL)
+            return FALSE;
+
+        mrp_msg_unref(decoded);
+        mrp_msg_unref(msg);
+        mrp_free(buf);
+
+        if (arena != NULL)
+            mrp_arena_reset(arena);
+    }
+
+    end  = now_nsecs();
+    mean = (double)(end - start) / rounds;
+
+    if (cfg.header)
+        printf("%-10s %-6s %8s %10s %12s %12s\n", "allocator", "arena",
+               "fields", "messages", "mean ns", "msgs/s");
+
+    printf("%-10s %-6s %8d %10d %12.1f %12.0f\n", backend->name,
+           arena ? "yes" : "no", nfield, rounds, mean,
+           mean > 0 ? 1e9 / mean : 0.0);
+    fflush(stdout);
+
+    mrp_arena_destroy(arena);
+
+    return TRUE;
+}
+
+
+static int run_backend(backend_t *backend, int header)
+{
+    char   rounds[32], nfield[32], *argv[16];
+    pid_t  pid;
+    int    argc, status;
+
+    snprintf(rounds, sizeof(rounds), "%d", cfg.rounds);
+    snprintf(nfield, sizeof(nfield), "%d", cfg.nfield);
+
+    argc = 0;
+    argv[argc++] = (char *)cfg.argv0;
+    argv[argc++] = "-b";
+    argv[argc++] = (char *)backend->name;
+    argv[argc++] = "-r";
+    argv[argc++] = rounds;
+    argv[argc++] = "-n";
+    argv[argc++] = nfield;
+    if (cfg.arena)
+        argv[argc++] = "-a";
+    if (header)
+        argv[argc++] = "-H";
+    argv[argc] = NULL;
+
+    switch ((pid = fork())) {
+    case -1:
+        return FALSE;
+
+    case 0:
+        setenv(MRP_MM_CONFIG_ENVVAR, backend->name, TRUE);
+        execv("/proc/self/exe", argv);
+        exit(1);
+
+    default:
+        if (waitpid(pid, &status, 0) != pid)
+            return FALSE;
+        return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+}
+
+
+/*
+ * command line processing
+ */
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        printf("\n");
+    }
+
+    printf("usage: %s [options]\n\n"
+           "The possible options are:\n"
+           "  -b, --backend=BACKEND          allocator backend to test\n"
+           "      BACKEND is one of passthru, or slab, default is all\n"
+           "  -r, --rounds=N                 number of messages to process\n"
+           "  -n, --fields=N                 number of fields per message\n"
+           "  -a, --arena                    decode messages into an arena\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(int argc, char **argv)
+{
+#   define OPTIONS "b:r:n:aHh"
+    struct option options[] = {
+        { "backend", required_argument, NULL, 'b' },
+        { "rounds" , required_argument, NULL, 'r' },
+        { "fields" , required_argument, NULL, 'n' },
+        { "arena"  , no_argument      , NULL, 'a' },
+        { "header" , no_argument      , NULL, 'H' },
+        { "help"   , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    char   *end;
+    size_t  i;
+    int     opt;
+
+    mrp_clear(&cfg);
+    cfg.argv0  = argv[0];
+    cfg.rounds = DEFAULT_ROUNDS;
+    cfg.nfield = DEFAULT_FIELDS;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'b':
+            for (i = 0; i < MRP_ARRAY_SIZE(backends); i++)
+                if (!strcmp(optarg, backends[i].name))
+                    cfg.backend = backends + i;
+            if (cfg.backend == NULL)
+                print_usage(argv[0], EINVAL, "invalid backend '%s'.", optarg);
+            break;
+
+        case 'r':
+            cfg.rounds = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg.rounds <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of rounds '%s'.", optarg);
+            break;
+
+        case 'n':
+            cfg.nfield = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg.nfield <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of fields '%s'.", optarg);
+            break;
+
+        case 'a':
+            cfg.arena = TRUE;
+            break;
+
+        case 'H':
+            cfg.header = TRUE;
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t i;
+
+    parse_cmdline(argc, argv);
+
+    if (cfg.backend != NULL)
+        return bench_msg(cfg.backend, cfg.nfield, cfg.rounds) ? 0 : 1;
+
+    for (i = 0; i < MRP_ARRAY_SIZE(backends); i++)
+        if (!run_backend(backends + i, i == 0))
+            exit(1);
+
+    return 0;
+}
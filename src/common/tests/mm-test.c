@@ -28,7 +28,9 @@
  */
 
 #include <stdio.h>
+#include <pthread.h>
 #include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
 
 #define fatal(fmt, args...) do {                                          \
         fprintf(stderr, "fatal error: "fmt"\n" , ## args);                \
@@ -265,6 +267,156 @@ static int pool_tests(void)
 }
 
 
+static void trim_done(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    MRP_UNUSED(t);
+    MRP_UNUSED(user_data);
+
+    mrp_mainloop_quit(ml, 0);
+}
+
+
+static int trim_tests(void)
+{
+    mrp_objpool_config_t  cfg;
+    mrp_objpool_trim_t    trim;
+    mrp_objpool_stats_t   stats;
+    mrp_objpool_t        *pool;
+    mrp_mainloop_t       *ml;
+    void                **ptrs;
+    size_t                need;
+    int                   max, keep, i;
+    int                   success;
+
+    max  = 8192;
+    keep = 100;
+    ptrs = mrp_allocz(max * sizeof(*ptrs));
+    ml   = mrp_mainloop_create();
+
+    if (ptrs == NULL || ml == NULL) {
+        error("Failed to set up trimming tests.");
+        mrp_free(ptrs);
+        mrp_mainloop_destroy(ml);
+        return FALSE;
+    }
+
+    mrp_clear(&cfg);
+    cfg.name    = "trim pool";
+    cfg.objsize = sizeof(obj_t);
+
+    if ((pool = mrp_objpool_create(&cfg)) == NULL) {
+        error("Failed to create trim test pool.");
+        success = FALSE;
+        goto out;
+    }
+
+    info("Allocating a burst of objects...");
+    for (i = 0; i < max; i++) {
+        if ((ptrs[i] = mrp_objpool_alloc(pool)) == NULL) {
+            error("Failed to allocate test object #%d.", i);
+            success = FALSE;
+            goto out;
+        }
+    }
+
+    for (i = keep; i < max; i++) {
+        mrp_objpool_free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+
+    trim.interval = 10;
+    trim.spare    = 0;
+    trim.idle     = 3;
+
+    if (!mrp_objpool_autotrim(pool, ml, &trim)) {
+        error("Failed to enable automatic trimming.");
+        success = FALSE;
+        goto out;
+    }
+
+    info("Waiting for idle chunks to get trimmed...");
+    mrp_add_timer(ml, 200, trim_done, NULL);
+    mrp_mainloop_run(ml);
+
+    mrp_objpool_stats(pool, &stats);
+    need = (keep + stats.nperchunk - 1) / stats.nperchunk;
+
+    info("%zd chunks (%zd full, %zd partial, %zd empty), %zd trimmed",
+         stats.nchunk, stats.nfull, stats.npartial, stats.nempty,
+         stats.ntrim);
+
+    success = (stats.nchunk == need && stats.ntrim > 0);
+
+    if (!success)
+        error("Pool has %zd chunks, expected %zd.", stats.nchunk, need);
+
+ out:
+    for (i = 0; i < keep; i++)
+        mrp_objpool_free(ptrs[i]);
+    mrp_free(ptrs);
+
+    /* destroy the mainloop first, the pool must not touch its timer */
+    info("Destroying trim test pool...");
+    mrp_mainloop_destroy(ml);
+    mrp_objpool_destroy(pool);
+
+    return success;
+}
+
+
+static void *free_objects(void *data)
+{
+    void **ptrs = (void **)data;
+    int    i;
+
+    for (i = 0; ptrs[i] != NULL; i++)
+        mrp_free(ptrs[i]);
+
+    return NULL;
+}
+
+
+static int slab_tests(void)
+{
+    void      *ptrs[17];
+    pthread_t  tid;
+    int        i;
+
+    if (!mrp_mm_config(MRP_MM_SLAB)) {
+        error("Failed to switch to the slab allocator.");
+        return FALSE;
+    }
+
+    /* few enough to stay in the per-thread cache of the freeing thread */
+    for (i = 0; i < (int)MRP_ARRAY_SIZE(ptrs) - 1; i++) {
+        if ((ptrs[i] = mrp_alloc(64)) == NULL) {
+            error("Failed to allocate object from slab.");
+            return FALSE;
+        }
+    }
+    ptrs[i] = NULL;
+
+    info("Freeing %d slab objects in a separate thread...", i);
+
+    if (pthread_create(&tid, NULL, free_objects, ptrs) != 0) {
+        error("Failed to create freeing thread.");
+        return FALSE;
+    }
+
+    pthread_join(tid, NULL);
+
+    mrp_mm_check(stdout);
+
+    /* can't switch away while any slab object is still in use */
+    if (!mrp_mm_config(MRP_MM_PASSTHRU)) {
+        error("Objects freed by an exited thread were not released.");
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
 int main(int argc, char *argv[])
 {
     int max;
@@ -280,5 +432,11 @@ int main(int argc, char *argv[])
     info("Running object pool tests...");
     pool_tests();
 
+    info("Running object pool trimming tests...");
+    trim_tests();
+
+    info("Running slab allocator tests...");
+    slab_tests();
+
     return 0;
 }
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/msg.h>
+
+/*
+ * A simple message field lookup benchmark.
+ *
+ * For each given number of fields we create a message with the fields in
+ * random tag order and measure the average cost of looking up a field by
+ * its tag, both with a plain linear scan of the field list and with
+ * mrp_msg_find.
+ *
+ * Additionally we measure the cost of handling a freshly decoded message,
+ * ie. decoding it and looking up each of its fields once, which for
+ * mrp_msg_find includes building the lookup index.
+ */
+
+#define DEFAULT_ROUNDS 1000000
+#define MIN_DECODES    100
+
+typedef mrp_msg_field_t *(*find_fn_t)(mrp_msg_t *msg, uint16_t tag);
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static mrp_msg_field_t *find_linear(mrp_msg_t *msg, uint16_t tag)
+{
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f = mrp_list_entry(p, typeof(*f), hook);
+        if (f->tag == tag)
+            return f;
+    }
+
+    return NULL;
+}
+
+
+static uint16_t *shuffled_tags(int nfield, unsigned int *seed)
+{
+    uint16_t *tags, tmp;
+    int       i, j;
+
+    if ((tags = mrp_allocz(nfield * sizeof(tags[0]))) == NULL) {
+        fprintf(stderr, "failed to allocate tags\n");
+        exit(1);
+    }
+
+    for (i = 0; i < nfield; i++)
+        tags[i] = i + 1;
+
+    for (i = nfield - 1; i > 0; i--) {
+        j       = rand_r(seed) % (i + 1);
+        tmp     = tags[i];
+        tags[i] = tags[j];
+        tags[j] = tmp;
+    }
+
+    return tags;
+}
+
+
+static mrp_msg_t *create_msg(uint16_t *tags, int nfield)
+{
+    mrp_msg_t *msg;
+    int        i;
+
+    if ((msg = mrp_msg_create_empty()) == NULL)
+        goto fail;
+
+    for (i = 0; i < nfield; i++)
+        if (!mrp_msg_append(msg, tags[i], MRP_MSG_FIELD_UINT32,
+                            (uint32_t)tags[i]))
+            goto fail;
+
+    return msg;
+
+ fail:
+    fprintf(stderr, "failed to create message with %d fields\n", nfield);
+    exit(1);
+}
+
+
+static double bench_lookup(mrp_msg_t *msg, find_fn_t find, uint16_t *order,
+                           int nfield, int rounds)
+{
+    mrp_msg_field_t *f;
+    uint64_t         start, end;
+    int              i;
+
+    start = now_nsecs();
+
+    for (i = 0; i < rounds; i++) {
+        f = find(msg, order[i % nfield]);
+
+        if (f == NULL || f->u32 != order[i % nfield]) {
+            fprintf(stderr, "lookup of tag %u failed\n", order[i % nfield]);
+            exit(1);
+        }
+    }
+
+    end = now_nsecs();
+
+    return 1.0 * (end - start) / rounds;
+}
+
+
+static double bench_decode(void *buf, size_t size, find_fn_t find,
+                           uint16_t *order, int nfield, int rounds)
+{
+    mrp_msg_t       *msg;
+    mrp_msg_field_t *f;
+    uint64_t         start, end;
+    int              i, j;
+
+    start = now_nsecs();
+
+    for (i = 0; i < rounds; i++) {
+        if ((msg = mrp_msg_default_decode(buf, size)) == NULL) {
+            fprintf(stderr, "failed to decode message\n");
+            exit(1);
+        }
+
+        for (j = 0; j < nfield; j++) {
+            f = find(msg, order[j]);
+
+            if (f == NULL || f->u32 != order[j]) {
+                fprintf(stderr, "lookup of tag %u failed\n", order[j]);
+                exit(1);
+            }
+        }
+
+        mrp_msg_unref(msg);
+    }
+
+    end = now_nsecs();
+
+    return 1.0 * (end - start) / rounds;
+}
+
+
+static void bench(int nfield, int rounds)
+{
+    unsigned int  seed = nfield;
+    uint16_t     *tags, *order;
+    mrp_msg_t    *msg;
+    void         *encoded, *data;
+    ssize_t       size;
+    double        linear, indexed, dlinear, dindexed;
+    int           ndecode;
+
+    tags  = shuffled_tags(nfield, &seed);
+    order = shuffled_tags(nfield, &seed);
+    msg   = create_msg(tags, nfield);
+
+    linear  = bench_lookup(msg, find_linear , order, nfield, rounds);
+    indexed = bench_lookup(msg, mrp_msg_find, order, nfield, rounds);
+
+    if ((size = mrp_msg_default_encode(msg, &encoded)) <= 0) {
+        fprintf(stderr, "failed to encode message\n");
+        exit(1);
+    }
+
+    /* skip the message tag, like transports do */
+    data     = encoded + sizeof(uint16_t);
+    size    -= sizeof(uint16_t);
+    ndecode  = MRP_MAX(rounds / nfield, MIN_DECODES);
+    dlinear  = bench_decode(data, size, find_linear , order, nfield, ndecode);
+    dindexed = bench_decode(data, size, mrp_msg_find, order, nfield, ndecode);
+
+    printf("%6d %12.1f %12.1f %14.1f %14.1f\n", nfield,
+           linear, indexed, dlinear / 1000.0, dindexed / 1000.0);
+
+    mrp_free(encoded);
+    mrp_msg_unref(msg);
+    mrp_free(tags);
+    mrp_free(order);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int defaults[] = { 5, 50, 500 };
+    int rounds, nfield, i;
+
+    rounds = argc > 1 ? (int)strtol(argv[1], NULL, 10) : DEFAULT_ROUNDS;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: %s [rounds [nfield ...]]\n", argv[0]);
+        exit(1);
+    }
+
+    printf("%6s %12s %12s %14s %14s\n", "", "linear", "mrp_msg_find",
+           "decode+linear", "decode+find");
+    printf("%6s %12s %12s %14s %14s\n", "fields", "ns/lookup", "ns/lookup",
+           "us/msg", "us/msg");
+
+    if (argc > 2) {
+        for (i = 2; i < argc; i++) {
+            nfield = (int)strtol(argv[i], NULL, 10);
+
+            if (nfield <= 0 || nfield > 0xffff) {
+                fprintf(stderr, "invalid number of fields '%s'\n", argv[i]);
+                exit(1);
+            }
+
+            bench(nfield, rounds);
+        }
+    }
+    else
+        for (i = 0; i < (int)MRP_ARRAY_SIZE(defaults); i++)
+            bench(defaults[i], rounds);
+
+    return 0;
+}
@@ -67,22 +67,23 @@ uint16_t get_type(const char **types, const char *name)
 
 void test_default_encode_decode(int argc, char **argv)
 {
-    mrp_msg_t *msg, *decoded;
-    void      *encoded;
-    ssize_t    size;
-    uint16_t   tag, type, prev_tag;
-    uint8_t    u8;
-    int8_t     s8;
-    uint16_t   u16;
-    int16_t    s16;
-    uint32_t   u32;
-    int32_t    s32;
-    uint64_t   u64;
-    int64_t    s64;
-    double     dbl;
-    bool       bln;
-    char      *val, *end;
-    int        i, ok;
+    mrp_msg_t   *msg, *decoded;
+    mrp_arena_t *arena;
+    void        *encoded;
+    ssize_t      size;
+    uint16_t     tag, type, prev_tag;
+    uint8_t      u8;
+    int8_t       s8;
+    uint16_t     u16;
+    int16_t      s16;
+    uint32_t     u32;
+    int32_t      s32;
+    uint64_t     u64;
+    int64_t      s64;
+    double       dbl;
+    bool         bln;
+    char        *val, *end;
+    int          i, ok;
 
     if ((msg = mrp_msg_create_empty()) == NULL) {
         mrp_log_error("Failed to create new message.");
@@ -201,8 +202,309 @@ void test_default_encode_decode(int argc, char **argv)
 
     mrp_msg_dump(decoded, stdout);
 
+    mrp_msg_unref(decoded);
+
+    if ((arena = mrp_arena_create(0)) == NULL) {
+        mrp_log_error("Failed to create arena.");
+        exit(1);
+    }
+
+    decoded = mrp_msg_default_decode_arena(encoded, size, arena);
+    if (decoded == NULL) {
+        mrp_log_error("Failed to decode message into arena.");
+        exit(1);
+    }
+
+    mrp_msg_dump(decoded, stdout);
+
     mrp_msg_unref(msg);
     mrp_msg_unref(decoded);
+    mrp_arena_destroy(arena);
+}
+
+
+void test_array_decode(void)
+{
+    uint32_t         au32[] = { 1, 2, 3, 4, 5 };
+    mrp_msg_t       *msg, *decoded;
+    mrp_msg_field_t *f;
+    mrp_arena_t     *arena;
+    void            *encoded;
+    ssize_t          size;
+    int              i;
+
+    msg = mrp_msg_create(1, MRP_MSG_FIELD_UINT32, 0xdead,
+                         2, MRP_MSG_FIELD_ARRAY_OF(UINT32),
+                         MRP_ARRAY_SIZE(au32), au32,
+                         3, MRP_MSG_FIELD_UINT32, 0xbeef,
+                         MRP_MSG_FIELD_END);
+
+    if (msg == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    if ((size = mrp_msg_default_encode(msg, &encoded)) <= 0 ||
+        (arena = mrp_arena_create(0)) == NULL) {
+        mrp_log_error("Failed to encode message.");
+        exit(1);
+    }
+
+    /* skip the default encoder tag, like the transports do */
+    for (i = 0; i < 2; i++) {
+        if (i == 0)
+            decoded = mrp_msg_default_decode(encoded + sizeof(uint16_t),
+                                             size - sizeof(uint16_t));
+        else
+            decoded = mrp_msg_default_decode_arena(encoded + sizeof(uint16_t),
+                                                   size - sizeof(uint16_t),
+                                                   arena);
+
+        if (decoded == NULL || decoded->nfield != 3) {
+            mrp_log_error("Failed to decode message with an array.");
+            exit(1);
+        }
+
+        f = mrp_msg_find(decoded, 2);
+
+        if (f == NULL || f->size[0] != MRP_ARRAY_SIZE(au32) ||
+            memcmp(f->au32, au32, sizeof(au32))) {
+            mrp_log_error("Decoded array does not match.");
+            exit(1);
+        }
+
+        /* the field following the array must survive decoding */
+        if ((f = mrp_msg_find(decoded, 3)) == NULL || f->u32 != 0xbeef) {
+            mrp_log_error("Field after array lost in decoding.");
+            exit(1);
+        }
+
+        mrp_msg_unref(decoded);
+    }
+
+    mrp_arena_destroy(arena);
+    mrp_free(encoded);
+    mrp_msg_unref(msg);
+
+    mrp_log_info("ok, fields after arrays decode correctly...");
+}
+
+
+void test_view_decode(void)
+{
+    char              *astr[] = { "foo", "", "foobar" };
+    bool               abln[] = { true, false, true, true };
+    uint8_t            au8[]  = { 1, 2, 3, 4, 5 };
+    uint16_t           au16[] = { 0x1234, 0xfedc };
+    int32_t            as32[] = { -1, 0x12345678, -0x12345678 };
+    uint64_t           au64[] = { 0x0123456789abcdefULL };
+    double             adbl[] = { 3.141, -2.718 };
+    uint32_t           au32[] = { 0 };
+    char               blob[] = "a blob of data";
+    mrp_msg_t         *msg, *view;
+    mrp_msg_field_t   *f;
+    mrp_msg_buffer_t  *buf;
+    void              *encoded, *data;
+    ssize_t            size;
+    uint32_t           i;
+
+#define ARR(t) MRP_MSG_FIELD_ARRAY_OF(t)
+    msg = mrp_msg_create(1, MRP_MSG_FIELD_STRING, "a string",
+                         2, MRP_MSG_FIELD_UINT32, 0xdeadbeef,
+                         3, MRP_MSG_FIELD_BLOB  , sizeof(blob), blob,
+                         4, ARR(STRING)         , MRP_ARRAY_SIZE(astr), astr,
+                         5, ARR(BOOL)           , MRP_ARRAY_SIZE(abln), abln,
+                         6, ARR(UINT8)          , MRP_ARRAY_SIZE(au8) , au8,
+                         7, ARR(UINT16)         , MRP_ARRAY_SIZE(au16), au16,
+                         8, ARR(SINT32)         , MRP_ARRAY_SIZE(as32), as32,
+                         9, ARR(UINT64)         , MRP_ARRAY_SIZE(au64), au64,
+                         10, ARR(DOUBLE)        , MRP_ARRAY_SIZE(adbl), adbl,
+                         11, ARR(UINT32)        , 0, au32,
+                         12, MRP_MSG_FIELD_INT16, -12,
+                         MRP_MSG_FIELD_END);
+#undef ARR
+
+    if (msg == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    if ((size = mrp_msg_default_encode(msg, &encoded)) <= 0) {
+        mrp_log_error("Failed to encode message.");
+        exit(1);
+    }
+
+    /* skip the message tag, like transports do */
+    data  = encoded + sizeof(uint16_t);
+    size -= sizeof(uint16_t);
+
+    /* decoding a truncated message must fail */
+    buf  = mrp_msg_buffer_create(encoded);
+    view = mrp_msg_default_decode_view(buf, data, size - 1);
+
+    if (view != NULL) {
+        mrp_log_error("Decoding truncated message in view mode succeeded.");
+        exit(1);
+    }
+
+    view = mrp_msg_default_decode_view(buf, data, size);
+
+    if (view == NULL) {
+        mrp_log_error("Failed to decode message in view mode.");
+        exit(1);
+    }
+
+    /* the message keeps the buffer alive */
+    if (mrp_msg_buffer_reclaim(buf)) {
+        mrp_log_error("Shared buffer reclaimed while still in use.");
+        exit(1);
+    }
+
+#define CHECK(cond) do {                                                  \
+        if (!(cond)) {                                                    \
+            mrp_log_error("View check '%s' failed.", #cond);              \
+            exit(1);                                                      \
+        }                                                                 \
+    } while (0)
+
+#define CHECK_ARRAY(tag, fld, arr) do {                                   \
+        CHECK((f = mrp_msg_find(view, tag)) != NULL);                     \
+        CHECK(f->size[0] == MRP_ARRAY_SIZE(arr));                         \
+        CHECK(!(f->flags & MRP_MSG_FIELD_ENCODED));                       \
+        for (i = 0; i < f->size[0]; i++)                                  \
+            CHECK(f->fld[i] == arr[i]);                                   \
+    } while (0)
+
+    CHECK((f = mrp_msg_find(view, 1)) != NULL);
+    CHECK(!strcmp(f->str, "a string"));
+    CHECK(f->str > (char *)data && f->str < (char *)data + size);
+
+    CHECK((f = mrp_msg_find(view, 2)) != NULL && f->u32 == 0xdeadbeef);
+
+    CHECK((f = mrp_msg_find(view, 3)) != NULL);
+    CHECK(f->size[0] == sizeof(blob) && !memcmp(f->blb, blob, sizeof(blob)));
+    CHECK(f->blb > data && f->blb < data + size);
+
+    CHECK((f = mrp_msg_find(view, 4)) != NULL);
+    CHECK(f->size[0] == MRP_ARRAY_SIZE(astr));
+    for (i = 0; i < f->size[0]; i++)
+        CHECK(!strcmp(f->astr[i], astr[i]));
+
+    CHECK_ARRAY(5, abln, abln);
+    CHECK_ARRAY(6, au8 , au8 );
+    CHECK((void *)f->au8 > data && (void *)f->au8 < data + size);
+    CHECK_ARRAY(7, au16, au16);
+    CHECK_ARRAY(8, as32, as32);
+    CHECK_ARRAY(9, au64, au64);
+    CHECK_ARRAY(10, adbl, adbl);
+
+    CHECK((f = mrp_msg_find(view, 11)) != NULL && f->size[0] == 0);
+    CHECK((f = mrp_msg_find(view, 12)) != NULL && f->s16 == -12);
+
+    /* fields appended to a view are regular ones */
+    CHECK(mrp_msg_append(view, 13, MRP_MSG_FIELD_STRING, "appended"));
+    CHECK((f = mrp_msg_find(view, 13)) != NULL && f->flags == 0);
+
+#undef CHECK_ARRAY
+#undef CHECK
+
+    mrp_msg_dump(view, stdout);
+
+    /* the last reference to the view releases the buffer */
+    mrp_msg_unref(view);
+    mrp_msg_unref(msg);
+
+    mrp_log_info("ok, view and original match...");
+}
+
+
+static mrp_msg_field_t *scan_fields(mrp_msg_t *msg, uint16_t tag)
+{
+    mrp_msg_field_t *f;
+    mrp_list_hook_t *p, *n;
+
+    mrp_list_foreach(&msg->fields, p, n) {
+        f = mrp_list_entry(p, typeof(*f), hook);
+        if (f->tag == tag)
+            return f;
+    }
+
+    return NULL;
+}
+
+
+static void check_find(mrp_msg_t *msg, int maxtag)
+{
+    int tag;
+
+    for (tag = 0; tag <= maxtag; tag++) {
+        if (mrp_msg_find(msg, tag) != scan_fields(msg, tag)) {
+            mrp_log_error("Indexed lookup of tag %d failed.", tag);
+            exit(1);
+        }
+    }
+}
+
+
+void test_find_index(void)
+{
+    mrp_msg_t   *msg, *decoded;
+    mrp_arena_t *arena;
+    void        *encoded;
+    ssize_t      size;
+    unsigned int seed;
+    uint16_t     tag;
+    int          i;
+
+    if ((msg = mrp_msg_create_empty()) == NULL) {
+        mrp_log_error("Failed to create message.");
+        exit(1);
+    }
+
+    /* random tags, with plenty of duplicates */
+    seed = 1;
+    for (i = 0; i < 4 * MSG_INDEX_MIN; i++) {
+        tag = rand_r(&seed) % 64;
+
+        if (!mrp_msg_append(msg, tag, MRP_MSG_FIELD_UINT32, i)) {
+            mrp_log_error("Failed to append field to message.");
+            exit(1);
+        }
+
+        check_find(msg, 64);
+    }
+
+    /* prepending a duplicate must shadow the existing field */
+    if (!mrp_msg_prepend(msg, 1, MRP_MSG_FIELD_UINT32, 0xffff) ||
+        mrp_msg_find(msg, 1)->u32 != 0xffff) {
+        mrp_log_error("Lookup of prepended field failed.");
+        exit(1);
+    }
+
+    check_find(msg, 64);
+
+    if ((size = mrp_msg_default_encode(msg, &encoded)) <= 0 ||
+        (arena = mrp_arena_create(0)) == NULL) {
+        mrp_log_error("Failed to encode message.");
+        exit(1);
+    }
+
+    decoded = mrp_msg_default_decode_arena(encoded + sizeof(uint16_t),
+                                           size - sizeof(uint16_t), arena);
+
+    if (decoded == NULL || decoded->nfield != msg->nfield) {
+        mrp_log_error("Failed to decode message into arena.");
+        exit(1);
+    }
+
+    check_find(decoded, 64);
+
+    mrp_msg_unref(decoded);
+    mrp_arena_destroy(arena);
+    mrp_free(encoded);
+    mrp_msg_unref(msg);
+
+    mrp_log_info("ok, indexed and linear lookups match...");
 }
 
 
@@ -476,6 +778,9 @@ int main(int argc, char *argv[])
     mrp_log_set_target(MRP_LOG_TO_STDOUT);
 
     test_default_encode_decode(argc, argv);
+    test_array_decode();
+    test_view_decode();
+    test_find_index();
     test_custom_encode_decode();
 
     return 0;
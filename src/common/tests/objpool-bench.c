@@ -0,0 +1,367 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+
+/*
+ * Object pool contention benchmark.
+ *
+ * We run N threads allocating and freeing objects from a single shared
+ * pool and measure the aggregate throughput. We compare a thread-safe
+ * pool (MRP_OBJPOOL_FLAG_THREADSAFE, with per-thread magazines) against
+ * an ordinary pool protected by a single mutex. We run two workloads:
+ *
+ *   - local: every thread frees the objects it has allocated,
+ *   - remote: every thread passes the objects it has allocated to the
+ *     next thread, which frees them.
+ */
+
+#define DEFAULT_ROUNDS 200000
+#define BATCH          64
+#define RING_SIZE      1024
+#define NSECS_PER_SEC  1000000000ULL
+
+typedef struct {
+    void         *obj[RING_SIZE];                /* objects in transit */
+    unsigned int  head;                          /* producer index */
+    unsigned int  tail;                          /* consumer index */
+} ring_t;
+
+typedef struct {
+    const char      *name;                       /* pool type name */
+    int              flags;                      /* pool flags */
+} pooltype_t;
+
+typedef struct {
+    mrp_objpool_t   *pool;                       /* pool to use */
+    int              mt;                         /* thread-safe pool */
+    pthread_mutex_t  lock;                       /* lock, if not */
+    int              remote;                     /* remote frees */
+    int              nthread;                    /* number of threads */
+    ring_t          *rings;                      /* handover rings */
+} bench_t;
+
+typedef struct {
+    bench_t         *b;                          /* benchmark */
+    int              id;                         /* thread index */
+} worker_t;
+
+typedef struct {
+    int              rounds;                     /* allocations per thread */
+    int             *threads;                    /* thread counts to use */
+    int              nthread;                    /* number of counts */
+} bench_config_t;
+
+static pooltype_t pooltypes[] = {
+    { "locked"  , 0                           },
+    { "magazine", MRP_OBJPOOL_FLAG_THREADSAFE },
+};
+
+static bench_config_t cfg;
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * NSECS_PER_SEC + ts.tv_nsec;
+}
+
+
+static void *obj_alloc(bench_t *b)
+{
+    void *obj;
+
+    if (b->mt)
+        return mrp_objpool_alloc(b->pool);
+
+    pthread_mutex_lock(&b->lock);
+    obj = mrp_objpool_alloc(b->pool);
+    pthread_mutex_unlock(&b->lock);
+
+    return obj;
+}
+
+
+static void obj_free(bench_t *b, void *obj)
+{
+    if (b->mt) {
+        mrp_objpool_free(obj);
+        return;
+    }
+
+    pthread_mutex_lock(&b->lock);
+    mrp_objpool_free(obj);
+    pthread_mutex_unlock(&b->lock);
+}
+
+
+static int ring_push(ring_t *r, void *obj)
+{
+    unsigned int head = r->head;
+    unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+    if (head - tail >= RING_SIZE)
+        return FALSE;
+
+    r->obj[head % RING_SIZE] = obj;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    return TRUE;
+}
+
+
+static void *ring_pop(ring_t *r)
+{
+    unsigned int tail = r->tail;
+    unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    void        *obj;
+
+    if (tail == head)
+        return NULL;
+
+    obj = r->obj[tail % RING_SIZE];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return obj;
+}
+
+
+static void *worker(void *data)
+{
+    worker_t *w = data;
+    bench_t  *b = w->b;
+    ring_t   *out, *in;
+    void     *objs[BATCH], *obj;
+    int       i, n;
+
+    out = b->rings + (w->id + 1) % b->nthread;
+    in  = b->rings + w->id;
+
+    for (n = 0; n < cfg.rounds; n += BATCH) {
+        for (i = 0; i < BATCH; i++) {
+            if ((objs[i] = obj_alloc(b)) == NULL) {
+                fprintf(stderr, "failed to allocate object\n");
+                exit(1);
+            }
+            *(int *)objs[i] = w->id;
+        }
+
+        for (i = 0; i < BATCH; i++) {
+            if (!b->remote || !ring_push(out, objs[i]))
+                obj_free(b, objs[i]);
+        }
+
+        if (b->remote)
+            while ((obj = ring_pop(in)) != NULL)
+                obj_free(b, obj);
+    }
+
+    return NULL;
+}
+
+
+static int bench_run(pooltype_t *type, int remote, int nthread)
+{
+    mrp_objpool_config_t  pc;
+    bench_t               b;
+    worker_t             *w;
+    pthread_t            *tids;
+    uint64_t              start, end;
+    double                mean, ops;
+    void                 *obj;
+    int                   i;
+
+    mrp_clear(&b);
+    mrp_clear(&pc);
+
+    pc.name    = "bench";
+    pc.objsize = 64;
+    pc.flags   = type->flags;
+
+    b.mt      = (type->flags & MRP_OBJPOOL_FLAG_THREADSAFE) != 0;
+    b.remote  = remote;
+    b.nthread = nthread;
+    b.pool    = mrp_objpool_create(&pc);
+    b.rings   = mrp_allocz_array(ring_t, nthread);
+    w         = mrp_allocz_array(worker_t, nthread);
+    tids      = mrp_allocz_array(pthread_t, nthread);
+
+    if (b.pool == NULL || b.rings == NULL || w == NULL || tids == NULL)
+        return FALSE;
+
+    pthread_mutex_init(&b.lock, NULL);
+
+    start = now_nsecs();
+
+    for (i = 0; i < nthread; i++) {
+        w[i].b  = &b;
+        w[i].id = i;
+
+        if (pthread_create(tids + i, NULL, worker, w + i) != 0)
+            return FALSE;
+    }
+
+    for (i = 0; i < nthread; i++)
+        pthread_join(tids[i], NULL);
+
+    end = now_nsecs();
+
+    for (i = 0; i < nthread; i++)
+        while ((obj = ring_pop(b.rings + i)) != NULL)
+            obj_free(&b, obj);
+
+    mean = (double)(end - start) / cfg.rounds;
+    ops  = 1e9 * nthread * cfg.rounds / (end - start);
+
+    printf("%-10s %-8s %8d %10d %14.1f %12.2f\n", type->name,
+           remote ? "remote" : "local", nthread, cfg.rounds, mean, ops / 1e6);
+    fflush(stdout);
+
+    mrp_objpool_destroy(b.pool);
+    pthread_mutex_destroy(&b.lock);
+    mrp_free(b.rings);
+    mrp_free(w);
+    mrp_free(tids);
+
+    return TRUE;
+}
+
+
+/*
+ * command line processing
+ */
+
+static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (fmt && *fmt) {
+        va_start(ap, fmt);
+        vprintf(fmt, ap);
+        va_end(ap);
+        printf("\n");
+    }
+
+    printf("usage: %s [options] [thread-count ...]\n\n"
+           "The possible options are:\n"
+           "  -r, --rounds=N                 allocations per thread\n"
+           "  -h, --help                     show help on usage\n",
+           argv0);
+
+    if (exit_code < 0)
+        return;
+    else
+        exit(exit_code);
+}
+
+
+static void parse_cmdline(int argc, char **argv)
+{
+#   define OPTIONS "r:h"
+    struct option options[] = {
+        { "rounds", required_argument, NULL, 'r' },
+        { "help"  , no_argument      , NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    static int  default_threads[] = { 1, 2, 4, 8, 16 };
+    char       *end;
+    int         opt, i;
+
+    mrp_clear(&cfg);
+    cfg.rounds = DEFAULT_ROUNDS;
+
+    while ((opt = getopt_long(argc, argv, OPTIONS, options, NULL)) != -1) {
+        switch (opt) {
+        case 'r':
+            cfg.rounds = (int)strtoul(optarg, &end, 10);
+            if ((end && *end) || cfg.rounds <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid number of rounds '%s'.", optarg);
+            break;
+
+        case 'h':
+            print_usage(argv[0], -1, "");
+            exit(0);
+            break;
+
+        default:
+            print_usage(argv[0], EINVAL, "invalid option '%c'", opt);
+        }
+    }
+
+    if (optind < argc) {
+        cfg.nthread = argc - optind;
+        cfg.threads = mrp_allocz_array(int, cfg.nthread);
+
+        for (i = 0; i < cfg.nthread; i++) {
+            cfg.threads[i] = (int)strtoul(argv[optind + i], &end, 10);
+            if ((end && *end) || cfg.threads[i] <= 0)
+                print_usage(argv[0], EINVAL,
+                            "invalid thread count '%s'.", argv[optind + i]);
+        }
+    }
+    else {
+        cfg.threads = default_threads;
+        cfg.nthread = MRP_ARRAY_SIZE(default_threads);
+    }
+}
+
+
+int main(int argc, char *argv[])
+{
+    size_t t;
+    int    i, remote;
+
+    parse_cmdline(argc, argv);
+
+    printf("%-10s %-8s %8s %10s %14s %12s\n", "pool", "frees", "threads",
+           "rounds", "ns/op/thread", "Mops/s");
+
+    for (remote = 0; remote < 2; remote++)
+        for (t = 0; t < MRP_ARRAY_SIZE(pooltypes); t++)
+            for (i = 0; i < cfg.nthread; i++)
+                if (!bench_run(pooltypes + t, remote, cfg.threads[i]))
+                    exit(1);
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+
+/*
+ * A simple timer benchmark.
+ *
+ * For each given number of simultaneous timers we measure the average
+ * cost of adding a timer, rearming (modifying) an armed timer, dispatching
+ * an expired timer and deleting a timer.
+ *
+ * Additionally we run a set of periodic timers for a while with various
+ * amounts of timer slack and measure how many times the mainloop needs
+ * to wake up per second to serve them.
+ *
+ * Finally we measure the cost of creating and deleting short-lived timers
+ * at a high rate, and show the usage of the mainloop object pools.
+ */
+
+#define DEFAULT_ROUNDS 100000
+#define WAKEUP_TIMERS  50
+#define WAKEUP_SECS    1
+#define CHURN_TIMERS   64
+#define CHURN_ROUNDS   20000
+
+typedef struct {
+    mrp_mainloop_t  *ml;
+    mrp_timer_t    **timers;
+    int              ntimer;
+    int              nfired;
+} bench_t;
+
+
+static uint64_t now_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static void idle_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(t);
+    MRP_UNUSED(user_data);
+}
+
+
+static void expire_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(ml);
+
+    mrp_del_timer(t);
+    b->nfired++;
+}
+
+
+static double per_op(uint64_t start, uint64_t end, int n)
+{
+    return n ? (double)(end - start) / n : 0.0;
+}
+
+
+static int run_bench(int ntimer, int nround)
+{
+    bench_t   b;
+    uint64_t  start, end;
+    double    add, mod, del, exp;
+    int       i, idx;
+
+    mrp_clear(&b);
+
+    b.ml     = mrp_mainloop_create();
+    b.timers = mrp_allocz_array(mrp_timer_t *, ntimer);
+    b.ntimer = ntimer;
+
+    if (b.ml == NULL || b.timers == NULL) {
+        printf("failed to set up benchmark for %d timers\n", ntimer);
+        return FALSE;
+    }
+
+    srand(ntimer);
+
+    /* add timers with random intervals so that none of them expires */
+    start = now_nsecs();
+    for (i = 0; i < ntimer; i++) {
+        b.timers[i] = mrp_add_timer(b.ml, 60000 + rand() % 60000,
+                                    idle_cb, &b);
+        if (b.timers[i] == NULL) {
+            printf("failed to add timer #%d\n", i);
+            return FALSE;
+        }
+    }
+    end = now_nsecs();
+    add = per_op(start, end, ntimer);
+
+    /* rearm randomly chosen timers with a new random interval */
+    start = now_nsecs();
+    for (i = 0; i < nround; i++) {
+        idx = rand() % ntimer;
+        mrp_mod_timer(b.timers[idx], 60000 + rand() % 60000);
+    }
+    end = now_nsecs();
+    mod = per_op(start, end, nround);
+
+    /* delete all timers */
+    start = now_nsecs();
+    for (i = 0; i < ntimer; i++)
+        mrp_del_timer(b.timers[i]);
+    end = now_nsecs();
+    del = per_op(start, end, ntimer);
+
+    /* add already expired one-shot timers and dispatch them */
+    for (i = 0; i < ntimer; i++)
+        b.timers[i] = mrp_add_timer(b.ml, 0, expire_cb, &b);
+
+    start = now_nsecs();
+    while (b.nfired < ntimer)
+        mrp_mainloop_iterate(b.ml);
+    end = now_nsecs();
+    exp = per_op(start, end, ntimer);
+
+    printf("%8d timers: add %8.1f ns, rearm %8.1f ns, expire %8.1f ns, "
+           "delete %8.1f ns\n", ntimer, add, mod, exp, del);
+
+    mrp_free(b.timers);
+    mrp_mainloop_destroy(b.ml);
+
+    return TRUE;
+}
+
+
+static void count_cb(mrp_mainloop_t *ml, mrp_timer_t *t, void *user_data)
+{
+    bench_t *b = (bench_t *)user_data;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(t);
+
+    b->nfired++;
+}
+
+
+static int run_wakeups(unsigned int slack)
+{
+    bench_t   b;
+    uint64_t  start, end;
+    int       i, nwakeup;
+
+    mrp_clear(&b);
+
+    b.ml     = mrp_mainloop_create();
+    b.timers = mrp_allocz_array(mrp_timer_t *, WAKEUP_TIMERS);
+    b.ntimer = WAKEUP_TIMERS;
+
+    if (b.ml == NULL || b.timers == NULL) {
+        printf("failed to set up wakeup benchmark\n");
+        return FALSE;
+    }
+
+    srand(WAKEUP_TIMERS);
+
+    for (i = 0; i < b.ntimer; i++) {
+        b.timers[i] = mrp_add_timer(b.ml, 50 + rand() % 200, count_cb, &b);
+
+        if (b.timers[i] == NULL) {
+            printf("failed to add timer #%d\n", i);
+            return FALSE;
+        }
+
+        mrp_set_timer_slack(b.timers[i], slack);
+    }
+
+    nwakeup = 0;
+    start   = now_nsecs();
+    end     = start + WAKEUP_SECS * 1000000000ULL;
+
+    while (now_nsecs() < end) {
+        mrp_mainloop_iterate(b.ml);
+        nwakeup++;
+    }
+
+    end = now_nsecs();
+
+    printf("%8d timers, slack %3u ms: %8.1f wakeups/s, %8.1f callbacks/s\n",
+           b.ntimer, slack, 1e9 * nwakeup / (end - start),
+           1e9 * b.nfired / (end - start));
+
+    mrp_free(b.timers);
+    mrp_mainloop_destroy(b.ml);
+
+    return TRUE;
+}
+
+
+static void busy_cb(mrp_mainloop_t *ml, mrp_deferred_t *d, void *user_data)
+{
+    MRP_UNUSED(ml);
+    MRP_UNUSED(d);
+    MRP_UNUSED(user_data);
+}
+
+
+static int run_churn(int nround)
+{
+    bench_t         b;
+    mrp_deferred_t *d;
+    uint64_t        start, end;
+    int             i, j;
+
+    mrp_clear(&b);
+
+    b.ml     = mrp_mainloop_create();
+    b.timers = mrp_allocz_array(mrp_timer_t *, CHURN_TIMERS);
+    b.ntimer = CHURN_TIMERS;
+
+    if (b.ml == NULL || b.timers == NULL) {
+        printf("failed to set up timer churn benchmark\n");
+        return FALSE;
+    }
+
+    /* keep the mainloop from blocking once all timers are gone */
+    if ((d = mrp_add_deferred(b.ml, busy_cb, &b)) == NULL) {
+        printf("failed to add deferred callback\n");
+        return FALSE;
+    }
+
+    /* add and delete a batch of timers once per mainloop iteration */
+    start = now_nsecs();
+    for (i = 0; i < nround; i++) {
+        for (j = 0; j < b.ntimer; j++)
+            b.timers[j] = mrp_add_timer(b.ml, 1000 + j, idle_cb, &b);
+        for (j = 0; j < b.ntimer; j++)
+            mrp_del_timer(b.timers[j]);
+
+        mrp_mainloop_iterate(b.ml);
+    }
+    end = now_nsecs();
+
+    printf("%8d timers churned: %8.1f ns per add/delete\n",
+           nround * b.ntimer, per_op(start, end, nround * b.ntimer));
+
+    mrp_mainloop_dump_pools(b.ml, stdout);
+
+    mrp_del_deferred(d);
+    mrp_free(b.timers);
+    mrp_mainloop_destroy(b.ml);
+
+    return TRUE;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int          sizes[] = { 10, 1000, 100000 };
+    unsigned int slacks[] = { 0, 5, 20, 50 };
+    int          i, n;
+
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            n = (int)strtol(argv[i], NULL, 10);
+
+            if (n <= 0) {
+                printf("usage: %s [number-of-timers ...]\n", argv[0]);
+                exit(1);
+            }
+
+            if (!run_bench(n, DEFAULT_ROUNDS))
+                exit(1);
+        }
+    }
+    else {
+        for (i = 0; i < (int)MRP_ARRAY_SIZE(sizes); i++)
+            if (!run_bench(sizes[i], DEFAULT_ROUNDS))
+                exit(1);
+    }
+
+    for (i = 0; i < (int)MRP_ARRAY_SIZE(slacks); i++)
+        if (!run_wakeups(slacks[i]))
+            exit(1);
+
+    if (!run_churn(CHURN_ROUNDS))
+        exit(1);
+
+    return 0;
+}
@@ -31,6 +31,7 @@
 #include <string.h>
 #include <errno.h>
 #include <netdb.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -138,6 +139,12 @@ typedef struct {
     int              log_mask;
     const char      *log_target;
     uint32_t         seqno;
+    int              bench;
+    int              uring;
+    int              budget;
+    int              zerocopy;
+    mrp_transport_t *bt;
+    mrp_msg_t       *last;
 } context_t;
 
 
@@ -369,7 +376,8 @@ void server_init(context_t *c)
     }
 
     flags = MRP_TRANSPORT_REUSEADDR |
-        (c->custom ? MRP_TRANSPORT_MODE_CUSTOM : 0);
+        (c->custom ? MRP_TRANSPORT_MODE_CUSTOM : 0) |
+        (c->zerocopy ? MRP_TRANSPORT_ZEROCOPY : 0);
     c->lt = mrp_transport_create(c->ml, c->atype, &evt, c, flags);
 
     if (c->lt == NULL) {
@@ -516,7 +524,8 @@ void client_init(context_t *c)
         evt.recvmsgfrom = recvfrom_msg;
     }
 
-    flags = c->custom ? MRP_TRANSPORT_MODE_CUSTOM : 0;
+    flags = (c->custom ? MRP_TRANSPORT_MODE_CUSTOM : 0) |
+        (c->zerocopy ? MRP_TRANSPORT_ZEROCOPY : 0);
     c->t  = mrp_transport_create(c->ml, c->atype, &evt, c, flags);
 
     if (c->t == NULL) {
@@ -558,6 +567,259 @@ void client_init(context_t *c)
 }
 
 
+/*
+ * in-process ping-pong benchmark
+ */
+
+static void count_syscalls(context_t *c, uint64_t *nread, uint64_t *nwrite)
+{
+    mrp_transport_t *t[] = { c->t, c->lt, c->bt };
+    size_t           i;
+
+    *nread = *nwrite = 0;
+
+    for (i = 0; i < MRP_ARRAY_SIZE(t); i++) {
+        if (t[i] != NULL) {
+            *nread  += t[i]->nread;
+            *nwrite += t[i]->nwrite;
+        }
+    }
+}
+
+
+static double time_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+
+static void bench_send(context_t *c, mrp_transport_t *t)
+{
+    mrp_msg_t *msg;
+
+    msg = mrp_msg_create(TAG_SEQ, MRP_MSG_FIELD_UINT32, c->seqno,
+                         TAG_MSG, MRP_MSG_FIELD_STRING, "ping",
+                         TAG_END);
+
+    if (msg == NULL || !mrp_transport_send(t, msg)) {
+        mrp_log_error("Failed to send benchmark message #%u.", c->seqno);
+        exit(1);
+    }
+
+    mrp_msg_unref(msg);
+}
+
+
+static void bench_echo(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (!mrp_transport_send(t, msg)) {
+        mrp_log_error("Failed to echo benchmark message.");
+        exit(1);
+    }
+}
+
+
+static void bench_echoto(mrp_transport_t *t, mrp_msg_t *msg,
+                         mrp_sockaddr_t *addr, socklen_t addrlen,
+                         void *user_data)
+{
+    MRP_UNUSED(user_data);
+
+    if (!mrp_transport_sendto(t, msg, addr, addrlen)) {
+        mrp_log_error("Failed to echo benchmark message.");
+        exit(1);
+    }
+}
+
+
+static void bench_reply(mrp_transport_t *t, mrp_msg_t *msg, void *user_data)
+{
+    context_t       *c = (context_t *)user_data;
+    mrp_msg_field_t *f;
+
+    /* hang on to the previous reply to check it outlives the input buffer */
+    if (c->zerocopy) {
+        if (c->last != NULL) {
+            f = mrp_msg_find(c->last, TAG_SEQ);
+
+            if (f == NULL || f->u32 != c->seqno - 1 ||
+                (f = mrp_msg_find(c->last, TAG_MSG)) == NULL ||
+                strcmp(f->str, "ping")) {
+                mrp_log_error("Corrupted benchmark reply #%u.", c->seqno - 1);
+                exit(1);
+            }
+
+            mrp_msg_unref(c->last);
+        }
+
+        c->last = mrp_msg_ref(msg);
+    }
+
+    if (++c->seqno < (uint32_t)c->bench)
+        bench_send(c, t);
+    else
+        mrp_mainloop_quit(c->ml, 0);
+}
+
+
+static void bench_replyfrom(mrp_transport_t *t, mrp_msg_t *msg,
+                            mrp_sockaddr_t *addr, socklen_t addrlen,
+                            void *user_data)
+{
+    MRP_UNUSED(addr);
+    MRP_UNUSED(addrlen);
+
+    bench_reply(t, msg, user_data);
+}
+
+
+static void bench_closed(mrp_transport_t *t, int error, void *user_data)
+{
+    MRP_UNUSED(t);
+    MRP_UNUSED(user_data);
+
+    if (error) {
+        mrp_log_error("Benchmark connection closed with error %d (%s).",
+                      error, strerror(error));
+        exit(1);
+    }
+}
+
+
+static void bench_connection(mrp_transport_t *lt, void *user_data)
+{
+    context_t *c = (context_t *)user_data;
+    int        flags;
+
+    flags = MRP_TRANSPORT_REUSEADDR | MRP_TRANSPORT_NONBLOCK;
+    c->bt = mrp_transport_accept(lt, c, flags);
+
+    if (c->bt == NULL) {
+        mrp_log_error("Failed to accept benchmark connection.");
+        exit(1);
+    }
+}
+
+
+void run_bench(context_t *c)
+{
+    static mrp_transport_evt_t sevt = {
+        { .recvmsg     = bench_echo      },
+        { .recvmsgfrom = bench_echoto    },
+        .closed        = bench_closed,
+        .connection    = bench_connection,
+    };
+    static mrp_transport_evt_t cevt = {
+        { .recvmsg     = bench_reply     },
+        { .recvmsgfrom = bench_replyfrom },
+        .closed        = bench_closed,
+        .connection    = NULL,
+    };
+
+    mrp_io_stats_t io, endio;
+    uint64_t       nread, nwrite, endr, endw, nsys;
+    double         start, end;
+    int            niter, flags;
+
+    if (c->uring && !mrp_mainloop_use_uring(c->ml, TRUE)) {
+        mrp_log_error("Failed to enable io_uring.");
+        exit(1);
+    }
+
+    if (c->budget > 0) {
+        mrp_mainloop_set_dispatch_budget(c->ml, c->budget, 0);
+        mrp_mainloop_set_io_budget(c->ml, c->budget);
+    }
+
+    flags = c->zerocopy ? MRP_TRANSPORT_ZEROCOPY : 0;
+    c->lt = mrp_transport_create(c->ml, c->atype, &sevt, c,
+                                 MRP_TRANSPORT_REUSEADDR | flags);
+
+    if (c->lt == NULL || !mrp_transport_bind(c->lt, &c->addr, c->alen) ||
+        (c->stream && !mrp_transport_listen(c->lt, 0))) {
+        mrp_log_error("Failed to set up benchmark server at %s.", c->addrstr);
+        exit(1);
+    }
+
+    c->t = mrp_transport_create(c->ml, c->atype, &cevt, c, flags);
+
+    if (c->t == NULL) {
+        mrp_log_error("Failed to create benchmark client transport.");
+        exit(1);
+    }
+
+    if (!strcmp(c->atype, "unxd")) {
+        char           addrstr[] = "unxd:@transport-bench-client";
+        mrp_sockaddr_t addr;
+        socklen_t      alen;
+
+        alen = mrp_transport_resolve(NULL, addrstr, &addr, sizeof(addr), NULL);
+
+        if (alen <= 0 || !mrp_transport_bind(c->t, &addr, alen)) {
+            mrp_log_error("Failed to bind to transport address '%s'.", addrstr);
+            exit(1);
+        }
+    }
+
+    if (!mrp_transport_connect(c->t, &c->addr, c->alen)) {
+        mrp_log_error("Failed to connect to %s.", c->addrstr);
+        exit(1);
+    }
+
+    count_syscalls(c, &nread, &nwrite);
+    mrp_mainloop_io_stats(c->ml, &io);
+    start = time_now();
+    niter = 0;
+
+    c->seqno = 0;
+    bench_send(c, c->t);
+
+    while (mrp_mainloop_iterate(c->ml))
+        niter++;
+
+    end = time_now();
+    count_syscalls(c, &endr, &endw);
+    mrp_mainloop_io_stats(c->ml, &endio);
+
+    endr            -= nread;
+    endw            -= nwrite;
+    endio.npoll     -= io.npoll;
+    endio.nenter    -= io.nenter;
+    endio.nreq      -= io.nreq;
+    endio.nemulated -= io.nemulated;
+
+    nsys = endio.npoll + endio.nenter + endio.nemulated + endr + endw;
+
+    printf("%s, %s: %u messages in %.3f s, %.0f msgs/s\n", c->addrstr,
+           mrp_io_req_native(c->ml) ? "io_uring" : "epoll",
+           c->seqno, end - start, c->seqno / (end - start));
+    printf("    %d mainloop iterations (one poll each), %.2f per message\n",
+           niter, 1.0 * niter / c->seqno);
+    printf("    %llu epoll_wait, %llu io_uring_enter, %llu I/O requests "
+           "(%llu emulated syscalls)\n",
+           (unsigned long long)endio.npoll, (unsigned long long)endio.nenter,
+           (unsigned long long)endio.nreq,
+           (unsigned long long)endio.nemulated);
+    printf("    %llu transport read and %llu write syscalls\n",
+           (unsigned long long)endr, (unsigned long long)endw);
+    printf("    %llu syscalls in total, %.2f per message\n",
+           (unsigned long long)nsys, 1.0 * nsys / c->seqno);
+
+    mrp_msg_unref(c->last);
+    c->last = NULL;
+
+    mrp_transport_destroy(c->t);
+    mrp_transport_destroy(c->bt);
+    mrp_transport_destroy(c->lt);
+}
+
+
 static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
 {
     va_list ap;
@@ -577,6 +839,12 @@ static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
            "  -c, --custom                   use custom messages\n"
            "  -m, --message                  use generic messages (default)\n"
            "  -b, --buggy                    use buggy data descriptors\n"
+           "  -B, --bench=N                  ping-pong N messages in-process\n"
+           "  -U, --uring                    use io_uring for the benchmark\n"
+           "  -W, --budget=N                 dispatch at most N events and\n"
+           "                                 reads per benchmark wakeup\n"
+           "  -Z, --zerocopy                 decode received messages in view\n"
+           "                                 mode, without copying field data\n"
            "  -t, --log-target=TARGET        log target to use\n"
            "      TARGET is one of stderr,stdout,syslog, or a logfile path\n"
            "  -l, --log-level=LEVELS         logging level to use\n"
@@ -606,7 +874,7 @@ static void config_set_defaults(context_t *ctx)
 
 int parse_cmdline(context_t *ctx, int argc, char **argv)
 {
-#   define OPTIONS "scmbCa:l:t:vdh"
+#   define OPTIONS "scmbB:UW:ZCa:l:t:vdh"
     struct option options[] = {
         { "server"    , no_argument      , NULL, 's' },
         { "address"   , required_argument, NULL, 'a' },
@@ -614,6 +882,10 @@ int parse_cmdline(context_t *ctx, int argc, char **argv)
         { "connect"   , no_argument      , NULL, 'C' },
         { "message"   , no_argument      , NULL, 'm' },
         { "buggy"     , no_argument      , NULL, 'b' },
+        { "bench"     , required_argument, NULL, 'B' },
+        { "uring"     , no_argument      , NULL, 'U' },
+        { "budget"    , required_argument, NULL, 'W' },
+        { "zerocopy"  , no_argument      , NULL, 'Z' },
         { "log-level" , required_argument, NULL, 'l' },
         { "log-target", required_argument, NULL, 't' },
         { "verbose"   , optional_argument, NULL, 'v' },
@@ -645,6 +917,26 @@ int parse_cmdline(context_t *ctx, int argc, char **argv)
             ctx->buggy = TRUE;
             break;
 
+        case 'B':
+            ctx->bench = (int)strtol(optarg, NULL, 10);
+            if (ctx->bench <= 0)
+                print_usage(argv[0], EINVAL, "invalid count '%s'", optarg);
+            break;
+
+        case 'U':
+            ctx->uring = TRUE;
+            break;
+
+        case 'W':
+            ctx->budget = (int)strtol(optarg, NULL, 10);
+            if (ctx->budget <= 0)
+                print_usage(argv[0], EINVAL, "invalid budget '%s'", optarg);
+            break;
+
+        case 'Z':
+            ctx->zerocopy = TRUE;
+            break;
+
         case 'C':
             ctx->connect = TRUE;
             break;
@@ -727,6 +1019,13 @@ int main(int argc, char *argv[])
 
     c.ml = mrp_mainloop_create();
 
+    if (c.bench) {
+        run_bench(&c);
+        mrp_mainloop_destroy(c.ml);
+
+        return 0;
+    }
+
     if (c.server)
         server_init(&c);
     else
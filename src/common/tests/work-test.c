@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/common/work.h>
+
+#define fatal(fmt, args...) do {                                          \
+        fprintf(stderr, "fatal error: "fmt"\n" , ## args);                \
+        exit(1);                                                          \
+    } while (0)
+
+#define info(fmt, args...) do {                                           \
+        fprintf(stdout, fmt"\n" , ## args);                               \
+    } while (0)
+
+#define NWORK 1000
+
+
+typedef struct {
+    int         id;
+    mrp_work_t *w;
+    int         usecs;
+    int         ran;
+    int         done;
+    int         canceled;
+} test_work_t;
+
+
+static test_work_t works[NWORK];
+static int         ndone;
+
+
+static void work_cb(void *user_data)
+{
+    test_work_t *t = (test_work_t *)user_data;
+
+    if (t->usecs > 0)
+        usleep(t->usecs);
+
+    t->ran++;
+}
+
+
+static void done_cb(mrp_mainloop_t *ml, mrp_work_t *w,
+                    mrp_work_status_t status, void *user_data)
+{
+    test_work_t *t = (test_work_t *)user_data;
+
+    if (w != t->w)
+        fatal("work #%d completed with incorrect handle", t->id);
+
+    if (status == MRP_WORK_CANCELED)
+        t->canceled++;
+    else
+        t->done++;
+
+    t->w = NULL;
+
+    if (++ndone == NWORK)
+        mrp_mainloop_quit(ml, 0);
+}
+
+
+int main(int argc, char *argv[])
+{
+    mrp_mainloop_t       *ml;
+    mrp_workpool_t       *pool;
+    mrp_workpool_stats_t  st;
+    test_work_t          *t;
+    int                   nthread, i, ncancel, nfail;
+
+    if (argc > 1)
+        nthread = (int)strtol(argv[1], NULL, 10);
+    else
+        nthread = 4;
+
+    if ((ml = mrp_mainloop_create()) == NULL)
+        fatal("failed to create mainloop");
+
+    if ((pool = mrp_workpool_create(ml, "test", nthread)) == NULL)
+        fatal("failed to create worker pool");
+
+    for (i = 0, t = works; i < NWORK; i++, t++) {
+        t->id    = i;
+        t->usecs = (i % 10) ? 0 : 1000;
+        t->w     = mrp_workpool_submit(pool, work_cb, done_cb, t);
+
+        if (t->w == NULL)
+            fatal("failed to submit work #%d", i);
+    }
+
+    ncancel = 0;
+    for (i = NWORK - 1, t = works + i; i >= 0; i -= 7, t -= 7)
+        if (mrp_work_cancel(t->w))
+            ncancel++;
+
+    mrp_mainloop_run(ml);
+
+    mrp_workpool_get_stats(pool, &st);
+
+    nfail = 0;
+    for (i = 0, t = works; i < NWORK; i++, t++) {
+        if (t->done + t->canceled != 1 || t->ran != t->done) {
+            info("work #%d: FAIL (ran %d, done %d, canceled %d)", i,
+                 t->ran, t->done, t->canceled);
+            nfail++;
+        }
+    }
+
+    info("%d threads: %llu submitted, %llu completed, %llu canceled "
+         "(%d requested), %llu stolen, max. %d queued", st.nthread,
+         st.submitted, st.completed, st.canceled, ncancel, st.stolen,
+         st.max_queued);
+
+    if (st.submitted != NWORK || st.canceled != (unsigned)ncancel ||
+        st.completed + st.canceled != NWORK || st.queued || st.running)
+        fatal("incorrect worker pool statistics");
+
+    mrp_workpool_destroy(pool);
+    mrp_mainloop_destroy(ml);
+
+    if (nfail)
+        fatal("%d work items failed", nfail);
+
+    return 0;
+}
@@ -569,8 +569,15 @@ static int recv_data(mrp_transport_t *t, void *data, size_t size,
             data += sizeof(tag);
             size -= sizeof(tag);
 
-            if (tag != MRP_MSG_TAG_DEFAULT ||
-                (msg = mrp_msg_default_decode(data, size)) == NULL) {
+            if (tag != MRP_MSG_TAG_DEFAULT)
+                return -EPROTO;
+
+            if (t->rxbuf != NULL)
+                msg = mrp_msg_default_decode_view(t->rxbuf, data, size);
+            else
+                msg = mrp_msg_default_decode(data, size);
+
+            if (msg == NULL) {
                 return -EPROTO;
             }
             else {
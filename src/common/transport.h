@@ -115,17 +115,23 @@ typedef enum {
     MRP_TRANSPORT_REUSEADDR = 0x1,
     MRP_TRANSPORT_NONBLOCK  = 0x2,
     MRP_TRANSPORT_CLOEXEC   = 0x4,
+    MRP_TRANSPORT_ZEROCOPY  = 0x8,       /* decode messages in view mode */
 
     MRP_TRANSPORT_MODE_MSG    = 0x00000000, /* in generic mode */
     MRP_TRANSPORT_MODE_RAW    = 0x10000000, /* in bitpipe mode */
     MRP_TRANSPORT_MODE_CUSTOM = 0x20000000, /* in custom type mode */
     MRP_TRANSPORT_MODE_MASK   = 0x30000000, /* mask for  transport mode */
 
-    MRP_TRANSPORT_INHERIT     = 0x30000000, /* mask of inherited flags */
+    MRP_TRANSPORT_INHERIT     = 0x30000008, /* mask of inherited flags */
 } mrp_transport_flag_t;
 
 #define MRP_TRANSPORT_MODE(t) ((t)->flags & MRP_TRANSPORT_MODE_MASK)
 
+/** Macro to check if a transport passes on received messages as views. */
+#define MRP_TRANSPORT_ZEROCOPY_MSG(t)                                     \
+    (((t)->flags & (MRP_TRANSPORT_MODE_MASK | MRP_TRANSPORT_ZEROCOPY)) == \
+     (MRP_TRANSPORT_MODE_MSG | MRP_TRANSPORT_ZEROCOPY))
+
 /*
  * transport requests
  *
@@ -245,7 +251,10 @@ typedef struct {
                                         size_t size,                      \
                                         mrp_sockaddr_t *addr,             \
                                         socklen_t addrlen);               \
+    mrp_msg_buffer_t        *rxbuf;                                       \
     void                    *user_data;                                   \
+    uint64_t                 nread;                                       \
+    uint64_t                 nwrite;                                      \
     int                      flags;                                       \
     int                      busy;                                        \
     int                      connected : 1;                               \
@@ -197,15 +197,68 @@ int mrp_string_comp(const void *key1, const void *key2)
 }
 
 
-uint32_t mrp_string_hash(const void *key)
+/*
+ * hashing
+ *
+ * We use MurmurHash64A, which consumes the input a 64-bit word at a time
+ * and mixes every bit of the input into every bit of the result. Unlike
+ * the shift-xor hash we used to have, it does not collide on keys which
+ * differ only far from their end, nor does it drop all but the last 32
+ * characters of long keys (such as D-Bus paths or debug rules).
+ */
+
+uint32_t mrp_hash_data(const void *data, size_t size, uint32_t seed)
 {
-    uint32_t    h;
-    const char *p;
+    const uint64_t  m = 0xc6a4a7935bd1e995ULL;
+    const int       r = 47;
+    const uint8_t  *p = data;
+    const uint8_t  *e = p + (size & ~(size_t)7);
+    uint64_t        h = seed ^ (size * m);
+    uint64_t        k;
+
+    for ( ; p < e; p += sizeof(k)) {
+        memcpy(&k, p, sizeof(k));
+
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+
+        h ^= k;
+        h *= m;
+    }
 
-    for (h = 0, p = key; *p; p++) {
-        h <<= 1;
-        h  ^= *p;
+    switch (size & 7) {
+    case 7: h ^= (uint64_t)p[6] << 48;          /* fall through */
+    case 6: h ^= (uint64_t)p[5] << 40;          /* fall through */
+    case 5: h ^= (uint64_t)p[4] << 32;          /* fall through */
+    case 4: h ^= (uint64_t)p[3] << 24;          /* fall through */
+    case 3: h ^= (uint64_t)p[2] << 16;          /* fall through */
+    case 2: h ^= (uint64_t)p[1] << 8;           /* fall through */
+    case 1: h ^= (uint64_t)p[0];
+        h *= m;
     }
 
-    return h;
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+
+uint32_t mrp_string_hash(const void *key)
+{
+    return mrp_hash_data(key, strlen(key), MRP_HASH_SEED);
+}
+
+
+uint32_t mrp_string_hash_len(const char *str, size_t len)
+{
+    return mrp_hash_data(str, strnlen(str, len), MRP_HASH_SEED);
+}
+
+
+uint32_t mrp_string_hash_seed(const void *key, uint32_t seed)
+{
+    return mrp_hash_data(key, strlen(key), seed);
 }
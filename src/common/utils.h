@@ -30,11 +30,23 @@
 #ifndef __MURPHY_UTILS_H__
 #define __MURPHY_UTILS_H__
 
+#include <stddef.h>
 #include <stdint.h>
 
+#define MRP_HASH_SEED 0x9e3779b9             /* default hash seed */
+
 int mrp_daemonize(const char *dir, const char *new_out, const char *new_err);
 
+/** Hash @size bytes of @data, using @seed to perturb the hash. */
+uint32_t mrp_hash_data(const void *data, size_t size, uint32_t seed);
+
 int mrp_string_comp(const void *key1, const void *key2);
 uint32_t mrp_string_hash(const void *key);
 
+/** Hash the first @len bytes of string @str. */
+uint32_t mrp_string_hash_len(const char *str, size_t len);
+
+/** Hash string @key, using @seed to perturb the hash. */
+uint32_t mrp_string_hash_seed(const void *key, uint32_t seed);
+
 #endif /* __MURPHY_UTILS_H__ */
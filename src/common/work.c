@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE                      /* we want pthread_setname_np */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mm.h>
+#include <murphy/common/log.h>
+#include <murphy/common/list.h>
+#include <murphy/common/mainloop.h>
+#include <murphy/common/work.h>
+
+#define MAX_WORKERS 64                   /* max. threads per pool */
+
+/*
+ * work item states
+ */
+
+typedef enum {
+    WORK_QUEUED = 0,                     /* waiting in a worker queue */
+    WORK_RUNNING,                        /* being run by a worker */
+    WORK_DONE,                           /* waiting for completion */
+} work_state_t;
+
+
+typedef struct worker_s worker_t;
+
+struct mrp_work_s {
+    mrp_list_hook_t     hook;            /* to worker queue or done list */
+    mrp_workpool_t     *pool;            /* pool we were submitted to */
+    worker_t           *worker;          /* worker we are queued for */
+    work_state_t        state;           /* state, under worker->lock */
+    mrp_work_status_t   status;          /* completion status */
+    mrp_work_cb_t       work;            /* work callback */
+    mrp_work_done_cb_t  done;            /* completion callback */
+    void               *user_data;       /* opaque user data */
+};
+
+
+struct worker_s {
+    mrp_workpool_t     *pool;            /* pool we belong to */
+    int                 id;              /* worker id within the pool */
+    pthread_t           tid;             /* worker thread */
+    pthread_mutex_t     lock;            /* protects queue */
+    mrp_list_hook_t     queue;           /* queued work items */
+    unsigned int        started : 1;     /* whether thread was started */
+};
+
+
+struct mrp_workpool_s {
+    char               *name;            /* pool name */
+    mrp_mainloop_t     *ml;              /* mainloop for completions */
+    worker_t           *workers;         /* worker threads */
+    int                 nworker;         /* number of workers */
+    int                 next;            /* next worker to queue to */
+    int                 efd;             /* eventfd for completions */
+    mrp_io_watch_t     *w;               /* I/O watch for efd */
+    pthread_mutex_t     lock;            /* protects the fields below */
+    pthread_cond_t      cond;            /* idle workers wait here */
+    int                 stop;            /* whether we're shutting down */
+    mrp_list_hook_t     done;            /* completed work items */
+    mrp_workpool_stats_t stats;          /* usage statistics */
+};
+
+
+static void complete_work(mrp_work_t *w, mrp_work_status_t status)
+{
+    mrp_workpool_t *pool = w->pool;
+    uint64_t        one  = 1;
+    int             kick;
+
+    pthread_mutex_lock(&w->worker->lock);
+    w->state = WORK_DONE;
+    pthread_mutex_unlock(&w->worker->lock);
+
+    pthread_mutex_lock(&pool->lock);
+
+    w->status = status;
+
+    if (status == MRP_WORK_COMPLETED) {
+        pool->stats.running--;
+        pool->stats.completed++;
+    }
+    else {
+        pool->stats.queued--;
+        pool->stats.canceled++;
+    }
+
+    kick = mrp_list_empty(&pool->done);
+    mrp_list_append(&pool->done, &w->hook);
+
+    if (kick && write(pool->efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        mrp_log_error("Failed to kick worker pool '%s' (%d: %s).",
+                      pool->name, errno, strerror(errno));
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+static mrp_work_t *dequeue_work(worker_t *wrk, int steal)
+{
+    mrp_work_t *w;
+
+    pthread_mutex_lock(&wrk->lock);
+
+    if (!mrp_list_empty(&wrk->queue)) {
+        if (!steal)
+            w = mrp_list_entry(wrk->queue.next, typeof(*w), hook);
+        else
+            w = mrp_list_entry(wrk->queue.prev, typeof(*w), hook);
+
+        mrp_list_delete(&w->hook);
+        w->state = WORK_RUNNING;
+    }
+    else
+        w = NULL;
+
+    pthread_mutex_unlock(&wrk->lock);
+
+    return w;
+}
+
+
+static mrp_work_t *next_work(worker_t *wrk)
+{
+    mrp_workpool_t *pool = wrk->pool;
+    mrp_work_t     *w;
+    int             i, id;
+
+    /*
+     * Notes:
+     *
+     *     Every worker has its own queue which we fill round-robin from
+     *     the mainloop thread. Workers take items from the head of their
+     *     own queue and, once it runs dry, steal from the tail of the
+     *     queues of other workers. This keeps a single long-running item
+     *     from holding up work queued behind it.
+     */
+
+    if ((w = dequeue_work(wrk, FALSE)) != NULL)
+        return w;
+
+    for (i = 1; i < pool->nworker; i++) {
+        id = (wrk->id + i) % pool->nworker;
+
+        if ((w = dequeue_work(pool->workers + id, TRUE)) != NULL) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.stolen++;
+            pthread_mutex_unlock(&pool->lock);
+            return w;
+        }
+    }
+
+    return NULL;
+}
+
+
+static void *worker_thread(void *data)
+{
+    worker_t       *wrk  = (worker_t *)data;
+    mrp_workpool_t *pool = wrk->pool;
+    mrp_work_t     *w;
+
+    for (;;) {
+        if ((w = next_work(wrk)) != NULL) {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.queued--;
+            pool->stats.running++;
+            pthread_mutex_unlock(&pool->lock);
+
+            w->work(w->user_data);
+            complete_work(w, MRP_WORK_COMPLETED);
+
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+
+        while (pool->stats.queued <= 0 && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+
+static void dispatch_done(mrp_workpool_t *pool)
+{
+    mrp_list_hook_t  done, *p, *n;
+    mrp_work_t      *w;
+
+    mrp_list_init(&done);
+
+    pthread_mutex_lock(&pool->lock);
+    mrp_list_move(&done, &pool->done);
+    pthread_mutex_unlock(&pool->lock);
+
+    mrp_list_foreach(&done, p, n) {
+        w = mrp_list_entry(p, typeof(*w), hook);
+        mrp_list_delete(&w->hook);
+
+        if (w->done != NULL)
+            w->done(pool->ml, w, w->status, w->user_data);
+
+        mrp_free(w);
+    }
+}
+
+
+static void done_cb(mrp_mainloop_t *ml, mrp_io_watch_t *iow, int fd,
+                    mrp_io_event_t events, void *user_data)
+{
+    mrp_workpool_t *pool = (mrp_workpool_t *)user_data;
+    uint64_t        cnt;
+
+    MRP_UNUSED(ml);
+    MRP_UNUSED(iow);
+    MRP_UNUSED(events);
+
+    if (read(fd, &cnt, sizeof(cnt)) < 0 && errno != EAGAIN)
+        mrp_log_error("Failed to read worker pool '%s' fd (%d: %s).",
+                      pool->name, errno, strerror(errno));
+
+    dispatch_done(pool);
+}
+
+
+static int start_workers(mrp_workpool_t *pool)
+{
+    worker_t *wrk;
+    sigset_t  all, old;
+    char      name[16];
+    int       i, success;
+
+    /*
+     * Notes: Signals are delivered to us through a signalfd in the
+     *        mainloop. Make sure none of the workers ever gets any of
+     *        them by blocking all signals in the worker threads.
+     */
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    success = TRUE;
+    for (i = 0, wrk = pool->workers; i < pool->nworker; i++, wrk++) {
+        if (pthread_create(&wrk->tid, NULL, worker_thread, wrk) != 0) {
+            success = FALSE;
+            break;
+        }
+
+        wrk->started = TRUE;
+
+        snprintf(name, sizeof(name), "%s-%d", pool->name, i);
+        pthread_setname_np(wrk->tid, name);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    return success;
+}
+
+
+static void stop_workers(mrp_workpool_t *pool)
+{
+    worker_t   *wrk;
+    mrp_work_t *w;
+    int         i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0, wrk = pool->workers; i < pool->nworker; i++, wrk++) {
+        while ((w = dequeue_work(wrk, FALSE)) != NULL)
+            complete_work(w, MRP_WORK_CANCELED);
+
+        if (wrk->started)
+            pthread_join(wrk->tid, NULL);
+
+        pthread_mutex_destroy(&wrk->lock);
+    }
+}
+
+
+mrp_workpool_t *mrp_workpool_create(mrp_mainloop_t *ml, const char *name,
+                                    int nthread)
+{
+    mrp_workpool_t *pool;
+    int             i;
+
+    if (nthread <= 0)
+        nthread = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (nthread <= 0)
+        nthread = 1;
+
+    if (nthread > MAX_WORKERS)
+        nthread = MAX_WORKERS;
+
+    if ((pool = mrp_allocz(sizeof(*pool))) == NULL)
+        return NULL;
+
+    pool->ml      = ml;
+    pool->name    = mrp_strdup(name ? name : "worker");
+    pool->efd     = -1;
+    pool->workers = mrp_allocz_array(worker_t, nthread);
+    mrp_list_init(&pool->done);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if (pool->name == NULL || pool->workers == NULL)
+        goto fail;
+
+    pool->nworker       = nthread;
+    pool->stats.nthread = nthread;
+
+    for (i = 0; i < nthread; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id   = i;
+        mrp_list_init(&pool->workers[i].queue);
+        pthread_mutex_init(&pool->workers[i].lock, NULL);
+    }
+
+    pool->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (pool->efd < 0)
+        goto fail;
+
+    pool->w = mrp_add_io_watch(ml, pool->efd, MRP_IO_EVENT_IN, done_cb, pool);
+
+    if (pool->w == NULL)
+        goto fail;
+
+    if (start_workers(pool))
+        return pool;
+
+ fail:
+    mrp_log_error("Failed to create worker pool '%s'.", name ? name : "");
+    mrp_workpool_destroy(pool);
+
+    return NULL;
+}
+
+
+void mrp_workpool_destroy(mrp_workpool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    if (pool->workers != NULL)
+        stop_workers(pool);
+
+    if (pool->efd >= 0)
+        dispatch_done(pool);
+
+    mrp_del_io_watch(pool->w);
+
+    if (pool->efd >= 0)
+        close(pool->efd);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+
+    mrp_free(pool->workers);
+    mrp_free(pool->name);
+    mrp_free(pool);
+}
+
+
+mrp_work_t *mrp_workpool_submit(mrp_workpool_t *pool, mrp_work_cb_t work,
+                                mrp_work_done_cb_t done, void *user_data)
+{
+    mrp_work_t *w;
+    worker_t   *wrk;
+
+    if (pool == NULL || work == NULL)
+        return NULL;
+
+    if ((w = mrp_allocz(sizeof(*w))) == NULL)
+        return NULL;
+
+    mrp_list_init(&w->hook);
+    w->pool      = pool;
+    w->work      = work;
+    w->done      = done;
+    w->user_data = user_data;
+    w->state     = WORK_QUEUED;
+
+    wrk        = pool->workers + pool->next;
+    pool->next = (pool->next + 1) % pool->nworker;
+    w->worker  = wrk;
+
+    pthread_mutex_lock(&wrk->lock);
+    mrp_list_append(&wrk->queue, &w->hook);
+    pthread_mutex_unlock(&wrk->lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.submitted++;
+    pool->stats.queued++;
+    if (pool->stats.queued > pool->stats.max_queued)
+        pool->stats.max_queued = pool->stats.queued;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    return w;
+}
+
+
+mrp_work_t *mrp_work_submit(mrp_mainloop_t *ml, mrp_work_cb_t work,
+                            mrp_work_done_cb_t done, void *user_data)
+{
+    return mrp_workpool_submit(mrp_mainloop_get_workpool(ml),
+                               work, done, user_data);
+}
+
+
+int mrp_work_cancel(mrp_work_t *w)
+{
+    worker_t *wrk;
+    int       canceled;
+
+    if (w == NULL)
+        return FALSE;
+
+    wrk = w->worker;
+
+    pthread_mutex_lock(&wrk->lock);
+
+    if (w->state == WORK_QUEUED) {
+        mrp_list_delete(&w->hook);
+        w->state = WORK_DONE;
+        canceled = TRUE;
+    }
+    else
+        canceled = FALSE;
+
+    pthread_mutex_unlock(&wrk->lock);
+
+    if (canceled)
+        complete_work(w, MRP_WORK_CANCELED);
+
+    return canceled;
+}
+
+
+void mrp_workpool_get_stats(mrp_workpool_t *pool, mrp_workpool_stats_t *st)
+{
+    pthread_mutex_lock(&pool->lock);
+    *st = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012, Intel Corporation
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *  * Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *  * Neither the name of Intel Corporation nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MURPHY_WORK_H__
+#define __MURPHY_WORK_H__
+
+#include <murphy/common/macros.h>
+#include <murphy/common/mainloop.h>
+
+MRP_CDECL_BEGIN
+
+/*
+ * worker thread pools
+ *
+ * A worker pool runs work callbacks in a set of worker threads and
+ * delivers the corresponding completion callbacks back in the thread
+ * of the mainloop the pool was created for. Work callbacks must not
+ * touch the mainloop or anything else that is not thread-safe. A work
+ * item handle stays valid until its completion callback has returned.
+ */
+
+typedef struct mrp_workpool_s mrp_workpool_t;
+typedef struct mrp_work_s     mrp_work_t;
+
+/** Completion status of a work item. */
+typedef enum {
+    MRP_WORK_COMPLETED = 0,              /* work callback was run */
+    MRP_WORK_CANCELED,                   /* work was canceled before run */
+} mrp_work_status_t;
+
+/** Work callback, called in a worker thread. */
+typedef void (*mrp_work_cb_t)(void *user_data);
+
+/** Completion callback, called in the mainloop thread. */
+typedef void (*mrp_work_done_cb_t)(mrp_mainloop_t *ml, mrp_work_t *w,
+                                   mrp_work_status_t status, void *user_data);
+
+/** Worker pool statistics. */
+typedef struct {
+    int                nthread;          /* number of worker threads */
+    int                queued;           /* work items waiting to run */
+    int                running;          /* work items being run */
+    int                max_queued;       /* max. number of waiting items */
+    unsigned long long submitted;        /* total submitted items */
+    unsigned long long completed;        /* total completed items */
+    unsigned long long canceled;         /* total canceled items */
+    unsigned long long stolen;           /* items stolen by idle workers */
+} mrp_workpool_stats_t;
+
+/** Create a pool of nthread (0 = number of CPUs) worker threads. */
+mrp_workpool_t *mrp_workpool_create(mrp_mainloop_t *ml, const char *name,
+                                    int nthread);
+
+/** Destroy a pool, canceling pending work and waiting for running work. */
+void mrp_workpool_destroy(mrp_workpool_t *pool);
+
+/** Get the default worker pool of a mainloop, creating it if necessary. */
+mrp_workpool_t *mrp_mainloop_get_workpool(mrp_mainloop_t *ml);
+
+/** Submit work to the given pool. */
+mrp_work_t *mrp_workpool_submit(mrp_workpool_t *pool, mrp_work_cb_t work,
+                                mrp_work_done_cb_t done, void *user_data);
+
+/** Submit work to the default worker pool of the given mainloop. */
+mrp_work_t *mrp_work_submit(mrp_mainloop_t *ml, mrp_work_cb_t work,
+                            mrp_work_done_cb_t done, void *user_data);
+
+/** Cancel work that has not started running yet. */
+int mrp_work_cancel(mrp_work_t *w);
+
+/** Get statistics about the given pool. */
+void mrp_workpool_get_stats(mrp_workpool_t *pool, mrp_workpool_stats_t *st);
+
+MRP_CDECL_END
+
+#endif /* __MURPHY_WORK_H__ */
@@ -537,3 +537,232 @@ MRP_CORE_CONSOLE_GROUP(debug_group, "debug", DEBUG_GROUP_DESCRIPTION, NULL, {
                           LIST_SYNTAX, LIST_SUMMARY, LIST_DESCRIPTION)
 });
 
+
+
+/*
+ * mainloop profiling and statistics commands
+ */
+
+static void profile_enable(mrp_console_t *c, void *user_data,
+                           int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    if (mrp_mainloop_profiling(c->ctx->ml, TRUE))
+        mrp_console_printf(c, "Mainloop profiling is now enabled.\n");
+    else
+        mrp_console_printf(c, "Failed to enable mainloop profiling.\n");
+}
+
+
+static void profile_disable(mrp_console_t *c, void *user_data,
+                            int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_mainloop_profiling(c->ctx->ml, FALSE);
+
+    mrp_console_printf(c, "Mainloop profiling is now disabled.\n");
+}
+
+
+static void profile_reset(mrp_console_t *c, void *user_data,
+                          int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_mainloop_reset_profile(c->ctx->ml);
+
+    mrp_console_printf(c, "Mainloop profiling data has been reset.\n");
+}
+
+
+static void profile_show(mrp_console_t *c, void *user_data,
+                         int argc, char **argv)
+{
+    int max;
+
+    MRP_UNUSED(user_data);
+
+    if (argc > 2)
+        max = (int)strtol(argv[2], NULL, 10);
+    else
+        max = 10;
+
+    mrp_mainloop_dump_profile(c->ctx->ml, c->stdout, max);
+}
+
+
+static void pools_show(mrp_console_t *c, void *user_data,
+                       int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_mainloop_dump_pools(c->ctx->ml, c->stdout);
+}
+
+
+#define PROFILE_GROUP_DESCRIPTION                                         \
+    "Mainloop profiling commands control the collection of per-callback\n"\
+    "latency statistics. When enabled, the mainloop measures the time\n"  \
+    "spent in each I/O watch, timer, deferred and subloop callback, and\n"\
+    "keeps call counts and latency histograms per callback address. The\n"\
+    "duration of loop iterations and the time spent waiting in poll are\n"\
+    "also collected. Callback addresses are resolved to symbols when\n"   \
+    "the statistics are shown. The usage of the object pools the\n"      \
+    "mainloop allocates its watches, timers, etc. from can also be\n"    \
+    "shown.\n"
+
+#define PROFILE_ENABLE_SYNTAX       "enable"
+#define PROFILE_ENABLE_SUMMARY      "enable mainloop profiling"
+#define PROFILE_ENABLE_DESCRIPTION                                        \
+    "Start collecting per-callback latency statistics.\n"
+
+#define PROFILE_DISABLE_SYNTAX      "disable"
+#define PROFILE_DISABLE_SUMMARY     "disable mainloop profiling"
+#define PROFILE_DISABLE_DESCRIPTION                                       \
+    "Stop collecting statistics and discard all collected data.\n"
+
+#define PROFILE_RESET_SYNTAX        "reset"
+#define PROFILE_RESET_SUMMARY       "reset mainloop profiling data"
+#define PROFILE_RESET_DESCRIPTION                                         \
+    "Discard all statistics collected so far, keep profiling enabled.\n"
+
+#define PROFILE_SHOW_SYNTAX         "show [max]"
+#define PROFILE_SHOW_SUMMARY        "show mainloop profiling data"
+#define PROFILE_SHOW_DESCRIPTION                                          \
+    "Show loop iteration and poll wait times, and the statistics of the\n"\
+    "top max (default 10, 0 for all) callbacks by total time spent.\n"
+
+#define POOLS_SYNTAX                "pools"
+#define POOLS_SUMMARY               "show mainloop object pool usage"
+#define POOLS_DESCRIPTION                                                 \
+    "Show the number of objects in use, the maximum number of objects\n"  \
+    "used, and the allocation counts for each mainloop object pool.\n"
+
+MRP_CORE_CONSOLE_GROUP(profile_group, "mainloop", PROFILE_GROUP_DESCRIPTION,
+                       NULL, {
+        MRP_TOKENIZED_CMD("enable", profile_enable, FALSE,
+                          PROFILE_ENABLE_SYNTAX, PROFILE_ENABLE_SUMMARY,
+                          PROFILE_ENABLE_DESCRIPTION),
+        MRP_TOKENIZED_CMD("disable", profile_disable, FALSE,
+                          PROFILE_DISABLE_SYNTAX, PROFILE_DISABLE_SUMMARY,
+                          PROFILE_DISABLE_DESCRIPTION),
+        MRP_TOKENIZED_CMD("reset", profile_reset, FALSE,
+                          PROFILE_RESET_SYNTAX, PROFILE_RESET_SUMMARY,
+                          PROFILE_RESET_DESCRIPTION),
+        MRP_TOKENIZED_CMD("show", profile_show, FALSE,
+                          PROFILE_SHOW_SYNTAX, PROFILE_SHOW_SUMMARY,
+                          PROFILE_SHOW_DESCRIPTION),
+        MRP_TOKENIZED_CMD("pools", pools_show, FALSE,
+                          POOLS_SYNTAX, POOLS_SUMMARY, POOLS_DESCRIPTION)
+});
+
+
+
+/*
+ * memory allocation sampling commands
+ */
+
+static void memory_sample(mrp_console_t *c, void *user_data,
+                          int argc, char **argv)
+{
+    unsigned long  rate;
+    char          *end;
+
+    MRP_UNUSED(user_data);
+
+    if (argc != 3) {
+        mrp_console_printf(c, "Usage: memory sample <rate>\n");
+        return;
+    }
+
+    rate = strtoul(argv[2], &end, 0);
+
+    if (*end != '\0') {
+        mrp_console_printf(c, "Invalid sampling rate '%s'.\n", argv[2]);
+        return;
+    }
+
+    mrp_mm_sample(rate);
+
+    if (rate)
+        mrp_console_printf(c, "Sampling one allocation per ~%lu bytes.\n",
+                           rate);
+    else
+        mrp_console_printf(c, "Allocation sampling is now disabled.\n");
+}
+
+
+static void memory_show(mrp_console_t *c, void *user_data,
+                        int argc, char **argv)
+{
+    int max;
+
+    MRP_UNUSED(user_data);
+
+    if (argc > 2)
+        max = (int)strtol(argv[2], NULL, 10);
+    else
+        max = 10;
+
+    mrp_mm_dump_samples(c->stdout, max);
+}
+
+
+static void memory_check(mrp_console_t *c, void *user_data,
+                         int argc, char **argv)
+{
+    MRP_UNUSED(user_data);
+    MRP_UNUSED(argc);
+    MRP_UNUSED(argv);
+
+    mrp_mm_check(c->stdout);
+}
+
+
+#define MEMORY_GROUP_DESCRIPTION                                          \
+    "Memory commands control the sampling allocation profiler. When\n"    \
+    "enabled, about one allocation per every rate bytes allocated is\n"   \
+    "recorded together with its call site and backtrace, until it is\n"   \
+    "freed. The live sampled memory can then be shown per call site,\n"   \
+    "as an estimate of how much memory each site is holding on to.\n"
+
+#define MEMORY_SAMPLE_SYNTAX        "sample <rate>"
+#define MEMORY_SAMPLE_SUMMARY       "set the allocation sampling rate"
+#define MEMORY_SAMPLE_DESCRIPTION                                         \
+    "Sample about one allocation per rate bytes allocated. A rate of 0\n" \
+    "disables sampling. Any previously collected samples are dropped.\n"
+
+#define MEMORY_SHOW_SYNTAX          "show [max]"
+#define MEMORY_SHOW_SUMMARY         "show sampled live memory"
+#define MEMORY_SHOW_DESCRIPTION                                           \
+    "Show the estimated live memory of the top max (default 10, 0 for\n"  \
+    "all) call sites, with their backtraces.\n"
+
+#define MEMORY_CHECK_SYNTAX         "check"
+#define MEMORY_CHECK_SUMMARY        "check memory allocator state"
+#define MEMORY_CHECK_DESCRIPTION                                          \
+    "Show the state of the active memory allocator, along with the\n"     \
+    "sampled live memory, if sampling is enabled.\n"
+
+MRP_CORE_CONSOLE_GROUP(memory_group, "memory", MEMORY_GROUP_DESCRIPTION,
+                       NULL, {
+        MRP_TOKENIZED_CMD("sample", memory_sample, FALSE,
+                          MEMORY_SAMPLE_SYNTAX, MEMORY_SAMPLE_SUMMARY,
+                          MEMORY_SAMPLE_DESCRIPTION),
+        MRP_TOKENIZED_CMD("show", memory_show, FALSE,
+                          MEMORY_SHOW_SYNTAX, MEMORY_SHOW_SUMMARY,
+                          MEMORY_SHOW_DESCRIPTION),
+        MRP_TOKENIZED_CMD("check", memory_check, FALSE,
+                          MEMORY_CHECK_SYNTAX, MEMORY_CHECK_SUMMARY,
+                          MEMORY_CHECK_DESCRIPTION)
+});
@@ -44,6 +44,7 @@ typedef struct {
     const char *config_dir;                /* plugin configuration directory */
     const char *plugin_dir;                /* plugin directory */
     bool        foreground;                /* whether to stay in foreground*/
+    unsigned    watchdog;                  /* stall watchdog budget (ms) */
 
     /* actual runtime context data */
     mrp_mainloop_t  *ml;                   /* mainloop */
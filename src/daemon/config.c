@@ -73,6 +73,9 @@ static void print_usage(const char *argv0, int exit_code, const char *fmt, ...)
            "      LEVELS is a comma separated list of info, error and warning\n"
            "  -v, --verbose                  increase logging verbosity\n"
            "  -f, --foreground               don't daemonize\n"
+           "  -w, --watchdog=MSECS           report stalled mainloop callbacks\n"
+           "      Callbacks running longer than MSECS are logged together\n"
+           "      with a backtrace of the mainloop.\n"
 #if 0
            "  -a, --plugin=name:key=value    set plugin config variable\n"
            "      E.g -a foo:bar=xyzzy sets the value of configuration key\n"
@@ -186,7 +189,7 @@ static void config_set_defaults(mrp_context_t *ctx)
 
 int mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv)
 {
-    #define OPTIONS "C:D:l:t:fP:a:vdhq"
+    #define OPTIONS "C:D:l:t:fw:P:a:vdhq"
     struct option options[] = {
         { "config-file"  , required_argument, NULL, 'C' },
         { "config-dir"   , required_argument, NULL, 'D' },
@@ -196,6 +199,7 @@ int mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv)
         { "verbose"      , optional_argument, NULL, 'v' },
         { "debug"        , no_argument      , NULL, 'd' },
         { "foreground"   , no_argument      , NULL, 'f' },
+        { "watchdog"     , required_argument, NULL, 'w' },
 #if 0
         { "plugin"       , required_argument, NULL, 'a' },
 #endif
@@ -204,7 +208,8 @@ int mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv)
         { NULL, 0, NULL, 0 }
     };
 
-    int  opt, debug;
+    int   opt, debug;
+    char *end;
 #if 0
     char arg[256], *plugin, *key, *value;
 #endif
@@ -251,6 +256,13 @@ int mrp_parse_cmdline(mrp_context_t *ctx, int argc, char **argv)
             ctx->foreground = TRUE;
             break;
 
+        case 'w':
+            ctx->watchdog = (unsigned)strtoul(optarg, &end, 10);
+            if (*end || !*optarg)
+                print_usage(argv[0], EINVAL, "invalid watchdog budget '%s'",
+                            optarg);
+            break;
+
 #if 0
         case 'a':
             strncpy(arg, optarg, sizeof(arg) - 1);
@@ -101,6 +101,10 @@ int main(int argc, char *argv[])
                 exit(1);
         }
 
+        /* start the watchdog thread only after we have forked */
+        if (ctx->watchdog)
+            mrp_mainloop_watchdog(ctx->ml, ctx->watchdog);
+
         mrp_mainloop_run(ctx->ml);
 
         mrp_log_info("Exiting...");